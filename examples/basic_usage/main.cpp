@@ -218,7 +218,7 @@ void setup() {
     auto info = storage.getInfo("temp/target");
     if (info) {
         Serial.printf("Parameter '%s': %s\n", 
-                     info->name.c_str(), info->description.c_str());
+                     info->name, info->description ? info->description : "");
     }
     
     // List all PID parameters
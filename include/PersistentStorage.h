@@ -5,52 +5,221 @@
 #include <Preferences.h>
 #include <ArduinoJson.h>
 #include <functional>
-#include <map>
+#include <deque>
 #include <vector>
 #include <string>
+#include <type_traits>
 #include <freertos/FreeRTOS.h>
 #include <freertos/queue.h>
+#include <freertos/semphr.h>
+#include <freertos/task.h>
+#include <atomic>
 
 // Include the logging configuration
 #include "PersistentStorageLogging.h"
+#include "PersistentStorageStats.h"
+#include "PersistentStorageLock.h"
+#include "PersistentStorageValue.h"
+#include "PersistentStorageDelegate.h"
+#include "PersistentStorageArena.h"
 
 // Forward declaration for MQTT integration
 class MQTTManager;
 
+// Compile-time schema entry, see PersistentStorageSchema.h
+struct SchemaEntry;
+
+// Stored-data migration step, see PersistentStorageMigration.h
+struct Migration;
+
+// Field list of a struct parameter, see PersistentStorageStruct.h
+struct StructLayout;
+struct StructField;
+
+// Flush bookkeeping of a counter parameter, see below
+struct CounterState;
+
+/**
+ * @brief Bounds of an int64 or double parameter
+ *
+ * Held by the registry outside ParameterInfo, so that the constraints
+ * union stays 8 bytes.
+ */
+struct WideRange {
+    union {
+        struct { int64_t min, max; } int64Range;
+        struct { double min, max; } doubleRange;
+    };
+};
+
 /**
  * @brief Parameter metadata for registration
  */
 struct ParameterInfo {
-    enum Type {
+    enum Type : uint8_t {
         TYPE_BOOL,
         TYPE_INT,
         TYPE_FLOAT,
         TYPE_STRING,
-        TYPE_BLOB
+        TYPE_BLOB,
+        TYPE_COUNTER,           // uint64_t, monotonic, saved in batches
+        TYPE_ARRAY,             // Fixed number of bool/int/float elements, stored in chunks
+        TYPE_STRUCT,            // Fields of a struct in one blob, addressed as "<name>.<field>"
+        TYPE_INT64,             // int64_t, NVS i64
+        TYPE_UINT32,            // uint32_t, NVS u32
+        TYPE_DOUBLE,            // double, 8-byte blob
+        TYPE_ENUM               // uint8_t index into a name table, NVS u8; names in JSON/MQTT
     };
     
-    enum Access {
+    enum Access : uint8_t {
         ACCESS_READ_ONLY,
         ACCESS_READ_WRITE
     };
     
-    std::string name;           // Parameter name (e.g., "heating/targetTemp")
-    std::string description;    // Human-readable description
-    Type type;                  // Data type
-    Access access;              // Access level
+    enum Persistence : uint8_t {
+        PERSIST_NVS,            // Loaded from and saved to NVS
+        PERSIST_NONE            // RAM only (runtime values, status)
+    };
+    
+    enum Compression : uint8_t {
+        COMPRESS_NONE,
+        COMPRESS_LZ             // LZSS, see PersistentStorageCompression.h
+    };
+    
+    // Allocation-free callbacks: function pointers or lambdas capturing one pointer
+    typedef InlineDelegate<void(const std::string&, const void*)> ChangeCallback;
+    typedef InlineDelegate<bool(const void*)> Validator;
+    
     void* dataPtr;              // Pointer to actual data
-    size_t size;                // Size for blob types
+    const char* name;           // Parameter name (e.g., "heating/targetTemp"), interned by the registry
+    const char* description;    // Human-readable description, must outlive the registry (string literal)
+    
+    // Callbacks
+    ChangeCallback onChange;
+    Validator validator;
     
     // Constraints
     union {
-        struct { int32_t min, max; } intRange;
-        struct { float min, max; } floatRange;
+        struct { int32_t min, max; } intRange;      // Also per element of int arrays
+        struct { float min, max; } floatRange;      // Also per element of float arrays
         struct { size_t maxLen; } stringMax;
+        struct { CounterState* state; } counter;
+        struct { const StructLayout* layout; } structure;
+        struct { uint32_t min, max; } uintRange;
+        struct { const WideRange* range; } wide;    // int64 and double bounds
+        struct { const char* const* names; uint16_t count; } enumeration;
     } constraints;
     
-    // Callbacks
-    std::function<void(const std::string&, const void*)> onChange;
-    std::function<bool(const void*)> validator;
+    size_t size;                // Size for blob, array and struct types
+    uint32_t sequence = 0;      // Seqlock counter for string/blob/array/struct values (odd while written)
+    Type type;                  // Data type
+    Type elementType = TYPE_INT;    // TYPE_ARRAY: type of the elements
+    Access access;              // Access level
+    Persistence persistence = PERSIST_NVS;
+    Compression compression = COMPRESS_NONE;    // Strings and blobs, applied when saved
+    mutable bool storedAsBlob = false;          // TYPE_STRING: NVS holds it compressed, as last loaded or saved
+};
+
+/**
+ * @brief Registry RAM usage broken down by field, in bytes
+ *
+ * Description texts are not counted: they stay in flash and only their
+ * pointers occupy RAM.
+ */
+struct MemoryFootprint {
+    size_t parameters;      // Registered parameters
+    size_t names;           // Name arena blocks and name pointers
+    size_t descriptions;    // Description pointers
+    size_t callbacks;       // onChange and validator delegates
+    size_t constraints;     // Range / length constraints
+    size_t values;          // Data pointer, size, sequence, type and access (with padding)
+    size_t index;           // Sorted lookup index, unused slot chunk space and chunk map
+    size_t total;
+};
+
+/**
+ * @brief Outcome of a loadAll() pass
+ *
+ * missing, unregistered, mismatched and converted are only filled by
+ * LoadStrategy::ITERATE, which knows the stored type of every key; the
+ * per-key strategy cannot tell a stored value from a default.
+ */
+struct LoadReport {
+    size_t registered = 0;                  // Persistent parameters considered
+    size_t loaded = 0;                      // Parameters read from NVS
+    std::vector<std::string> missing;       // Registered names without a stored value
+    std::vector<std::string> unregistered;  // Stored NVS keys without a parameter
+    std::vector<std::string> mismatched;    // Stored with an unusable type or size, default kept
+    size_t converted = 0;                   // Stored with another type and converted
+    int64_t durationUs = 0;
+};
+
+/**
+ * @brief Outcome of the migrations run by begin()
+ */
+struct MigrationReport {
+    uint32_t fromVersion = 0;   // Stored schema version before begin()
+    uint32_t toVersion = 0;     // Stored schema version after begin()
+    size_t applied = 0;         // Steps that changed stored data
+    size_t skipped = 0;         // Steps with nothing (left) to do
+    size_t failed = 0;          // Steps whose value was dropped or kept unconverted
+};
+
+/**
+ * @brief Outcome of a gcOrphans() round
+ */
+struct GcReport {
+    size_t scanned = 0;     // Entries in the namespace
+    size_t removed = 0;     // Orphaned keys erased
+    size_t pending = 0;     // Orphans left for a later round
+};
+
+/**
+ * @brief When a counter's unsaved increments are written to NVS
+ *
+ * A counter is saved once it is flushThreshold above the stored value, or
+ * flushIntervalMs after its first unsaved increment (by the service task
+ * or flushCounters()), and by saveAll()/end(). A restart loses less than
+ * flushThreshold counts.
+ */
+struct CounterConfig {
+    uint64_t flushThreshold = 100;
+    uint32_t flushIntervalMs = 60000;
+};
+
+/**
+ * @brief Flush bookkeeping of one counter, guarded by the counter mutex
+ */
+struct CounterState {
+    ParameterInfo* param = nullptr;
+    CounterConfig config;
+    uint64_t flushed = 0;           // Value last written to NVS
+    uint32_t dirtySinceMs = 0;      // millis() of the first unsaved increment
+    bool dirty = false;
+};
+
+/**
+ * @brief Configuration of the optional storage service task
+ */
+struct StorageTaskConfig {
+    uint32_t stackSize = 4096;          // Task stack in bytes
+    UBaseType_t priority = 2;           // FreeRTOS priority
+    BaseType_t core = tskNO_AFFINITY;   // Core to pin to, or tskNO_AFFINITY
+    uint32_t budgetUs = 5000;           // processCommandQueue() budget per round
+    uint32_t flushDelayMs = 2000;       // Delay before saveDeferred() values are written
+    uint32_t idleTimeoutMs = 10000;     // Longest sleep when there is nothing to do
+    uint32_t gcIntervalMs = 0;          // Period of background gcOrphans(), 0 = off
+    size_t gcBatch = 4;                 // Orphaned keys erased per idle round
+};
+
+/**
+ * @brief Configuration of the change notification dispatcher task
+ */
+struct DispatcherConfig {
+    uint32_t stackSize = 4096;          // Task stack in bytes
+    UBaseType_t priority = 1;           // FreeRTOS priority
+    BaseType_t core = tskNO_AFFINITY;   // Core to pin to, or tskNO_AFFINITY
+    size_t queueLength = 16;            // Change events that can be pending
 };
 
 /**
@@ -69,7 +238,18 @@ public:
         ERROR_VALIDATION_FAILED,
         ERROR_NVS_FAIL,
         ERROR_INVALID_NAME,
-        ERROR_TOO_LARGE
+        ERROR_TOO_LARGE,
+        ERROR_REENTRANT         // Registry changed from a callback running under its lock
+    };
+    
+    enum class LoadStrategy : uint8_t {
+        PER_KEY,        // One NVS lookup per registered parameter
+        ITERATE         // One pass over the stored entries
+    };
+    
+    enum class SaveMode : uint8_t {
+        PER_KEY,        // One NVS item per parameter
+        SNAPSHOT        // All parameters in one CRC-checked image, A/B slots
     };
     
     /**
@@ -88,6 +268,21 @@ public:
      */
     bool begin();
     
+    /**
+     * @brief Declare the schema version and the migrations leading to it
+     *
+     * Call before begin(). begin() compares the version stored in NVS with
+     * this one and runs the steps of every newer version in order, with
+     * one commit per version; later boots only read the stored version.
+     * The table must stay valid until begin() returns.
+     */
+    void setSchema(uint32_t version, const Migration* migrations = nullptr, size_t count = 0);
+    
+    /**
+     * @brief What the migration pass of begin() did
+     */
+    const MigrationReport& getMigrationReport() const { return migrationReport_; }
+    
     /**
      * @brief End storage system and free resources
      */
@@ -97,9 +292,12 @@ public:
     
     /**
      * @brief Register a boolean parameter
+     *
+     * The description is stored by pointer - pass a string literal. Build
+     * with -DPSTORAGE_NO_DESCRIPTIONS to drop descriptions entirely.
      */
     Result registerBool(const std::string& name, bool* dataPtr, 
-                       const std::string& description = "",
+                       const char* description = "",
                        ParameterInfo::Access access = ParameterInfo::ACCESS_READ_WRITE);
     
     /**
@@ -107,7 +305,7 @@ public:
      */
     Result registerInt(const std::string& name, int32_t* dataPtr,
                       int32_t minVal, int32_t maxVal,
-                      const std::string& description = "",
+                      const char* description = "",
                       ParameterInfo::Access access = ParameterInfo::ACCESS_READ_WRITE);
     
     /**
@@ -115,34 +313,230 @@ public:
      */
     Result registerFloat(const std::string& name, float* dataPtr,
                         float minVal, float maxVal,
-                        const std::string& description = "",
+                        const char* description = "",
                         ParameterInfo::Access access = ParameterInfo::ACCESS_READ_WRITE);
     
+    /**
+     * @brief Register a 64-bit integer parameter (energy totals) with range
+     */
+    Result registerInt64(const std::string& name, int64_t* dataPtr,
+                        int64_t minVal, int64_t maxVal,
+                        const char* description = "",
+                        ParameterInfo::Access access = ParameterInfo::ACCESS_READ_WRITE);
+    
+    /**
+     * @brief Register an unsigned 32-bit parameter (timestamps, counts) with range
+     */
+    Result registerUInt32(const std::string& name, uint32_t* dataPtr,
+                         uint32_t minVal, uint32_t maxVal,
+                         const char* description = "",
+                         ParameterInfo::Access access = ParameterInfo::ACCESS_READ_WRITE);
+    
+    /**
+     * @brief Register a double parameter with range
+     */
+    Result registerDouble(const std::string& name, double* dataPtr,
+                         double minVal, double maxVal,
+                         const char* description = "",
+                         ParameterInfo::Access access = ParameterInfo::ACCESS_READ_WRITE);
+    
+    /**
+     * @brief Register an enum stored as a one-byte index into a name table
+     *
+     * JSON and MQTT use the names ("eco"); MQTT set also takes the index.
+     * The value must lie below count (at most 256). The table is stored
+     * by pointer and must outlive the registry (string literals).
+     */
+    Result registerEnum(const std::string& name, uint8_t* dataPtr,
+                       const char* const* names, size_t count,
+                       const char* description = "",
+                       ParameterInfo::Access access = ParameterInfo::ACCESS_READ_WRITE);
+    
+    /**
+     * @brief Register an enum with a one-byte underlying type, e.g.
+     * enum class Mode : uint8_t { OFF, ECO, COMFORT } with {"off", "eco", "comfort"}
+     */
+    template<typename E, size_t N>
+    Result registerEnum(const std::string& name, E* dataPtr, const char* const (&names)[N],
+                        const char* description = "",
+                        ParameterInfo::Access access = ParameterInfo::ACCESS_READ_WRITE) {
+        static_assert(std::is_enum<E>::value && sizeof(E) == sizeof(uint8_t),
+                      "Enum parameters need a uint8_t underlying type");
+        return registerEnum(name, reinterpret_cast<uint8_t*>(dataPtr), names, N, description, access);
+    }
+    
     /**
      * @brief Register a string parameter
      */
     Result registerString(const std::string& name, char* dataPtr, size_t maxLen,
-                         const std::string& description = "",
+                         const char* description = "",
                          ParameterInfo::Access access = ParameterInfo::ACCESS_READ_WRITE);
     
     /**
      * @brief Register a binary blob parameter
      */
     Result registerBlob(const std::string& name, void* dataPtr, size_t size,
-                       const std::string& description = "",
+                       const char* description = "",
                        ParameterInfo::Access access = ParameterInfo::ACCESS_READ_WRITE);
     
+    /**
+     * @brief Register a 64-bit monotonic counter (runtime, ignitions, energy)
+     *
+     * Increment with add(); increments accumulate in RAM and are saved per
+     * CounterConfig. MQTT set only accepts values not below the current one.
+     */
+    Result registerCounter(const std::string& name, uint64_t* dataPtr,
+                          const CounterConfig& config = CounterConfig(),
+                          const char* description = "",
+                          ParameterInfo::Access access = ParameterInfo::ACCESS_READ_WRITE);
+    
+    /**
+     * @brief Register a fixed-size int array (heating curve, schedule, table)
+     *
+     * Every element must lie within [minVal, maxVal]. The array is stored
+     * in 64-byte chunks, so setElementJson() and MQTT set/<name>/<index>
+     * rewrite only the chunk holding the element. At most 4096 elements.
+     */
+    Result registerIntArray(const std::string& name, int32_t* dataPtr, size_t count,
+                           int32_t minVal, int32_t maxVal,
+                           const char* description = "",
+                           ParameterInfo::Access access = ParameterInfo::ACCESS_READ_WRITE);
+    
+    /**
+     * @brief Register a fixed-size float array, see registerIntArray()
+     */
+    Result registerFloatArray(const std::string& name, float* dataPtr, size_t count,
+                             float minVal, float maxVal,
+                             const char* description = "",
+                             ParameterInfo::Access access = ParameterInfo::ACCESS_READ_WRITE);
+    
+    /**
+     * @brief Register a fixed-size bool array, see registerIntArray()
+     */
+    Result registerBoolArray(const std::string& name, bool* dataPtr, size_t count,
+                            const char* description = "",
+                            ParameterInfo::Access access = ParameterInfo::ACCESS_READ_WRITE);
+    
+    /**
+     * @brief Register a struct as one parameter stored in a single blob
+     *
+     * Use the registerStruct() template of PersistentStorageStruct.h with a
+     * PSTORAGE_STRUCT_LAYOUT(). Fields are read and written as
+     * "<name>.<field>" through getJson()/setJson() and MQTT; a field update
+     * patches RAM and saves the blob once. The layout must outlive the registry.
+     * Returns ERROR_TOO_LARGE for a field above 255 bytes, a string field
+     * below 2 bytes or a field outside the struct.
+     */
+    Result registerStruct(const std::string& name, void* dataPtr, const StructLayout& layout,
+                         const char* description = "",
+                         ParameterInfo::Access access = ParameterInfo::ACCESS_READ_WRITE);
+    
+    /**
+     * @brief Register a compile-time schema table (see PSTORAGE_SCHEMA())
+     *
+     * The table was validated by the compiler, so names are neither checked
+     * nor copied: the entries point at flash. Fields are located at
+     * base + offset. Takes the registry lock once for the whole table.
+     */
+    Result registerSchema(const SchemaEntry* entries, size_t count, void* base);
+    
+    /**
+     * @brief Start a bulk registration
+     *
+     * Until the matching endRegistration(), registerX() calls neither load
+     * from NVS nor insert into the sorted index. Parameters of the batch can
+     * be looked up by name (getInfo(), setOnChange()) but are not listed,
+     * published or saved before the batch ends. Calls nest.
+     */
+    void beginRegistration();
+    
+    /**
+     * @brief Finish a bulk registration
+     *
+     * Merges the batch into the index in one step and loads its parameters
+     * in a single pass (if begin() was called).
+     * @return Result of the load pass
+     */
+    Result endRegistration();
+    
     /**
      * @brief Set change callback for a parameter
+     *
+     * Accepts a function pointer or a lambda capturing at most one pointer
+     * (e.g. [this]); larger captures fail to compile. Returns
+     * ERROR_REENTRANT when called from an onChange or validator callback,
+     * as do registerX() and the other registry changes.
      */
-    Result setOnChange(const std::string& name, 
-                      std::function<void(const std::string&, const void*)> callback);
+    Result setOnChange(const std::string& name, ParameterInfo::ChangeCallback callback);
     
     /**
      * @brief Set validator callback for a parameter
+     *
+     * Same capture limits as setOnChange().
+     */
+    Result setValidator(const std::string& name, ParameterInfo::Validator validator);
+    
+    /**
+     * @brief Compress a string or blob parameter in NVS
+     *
+     * Applies from the next save, and only where the compressed value takes
+     * fewer 32-byte NVS entries. Stored values carry a header, so compressed
+     * and plain ones load whatever the setting; turning compression off
+     * rewrites a compressed string as a plain one when it is loaded.
+     * Snapshot images (SaveMode::SNAPSHOT) keep values uncompressed.
+     *
+     * @return ERROR_TYPE_MISMATCH if the parameter is neither a string nor a blob
+     */
+    Result setCompression(const std::string& name, ParameterInfo::Compression codec);
+    
+    // Change subscriptions
+    
+    /**
+     * @brief Handler for a batch of changed parameter names
+     */
+    typedef std::function<void(const std::vector<std::string>& names)> ChangeHandler;
+    
+    /**
+     * @brief Subscribe to changes of one parameter or a group
+     *
+     * Handlers run on the dispatcher task when it is started (see
+     * startDispatcher()), otherwise synchronously on the changing task.
+     * Each handler is called once per batch with the matching names.
+     *
+     * @param pattern Parameter name, a prefix followed by '*' to match a group, or "*"
+     * @return Subscription id for unsubscribe(), 0 on failure
      */
-    Result setValidator(const std::string& name,
-                       std::function<bool(const void*)> validator);
+    uint32_t subscribe(const std::string& pattern, ChangeHandler handler);
+    
+    /**
+     * @brief Remove a subscription
+     */
+    bool unsubscribe(uint32_t id);
+    
+    /**
+     * @brief Group the changes until endChangeBatch() into one notification
+     *
+     * Batches nest; changes from other tasks meanwhile join the batch.
+     */
+    void beginChangeBatch();
+    void endChangeBatch();
+    
+    /**
+     * @brief Start the task that delivers change notifications
+     *
+     * Changes are queued without blocking; events that do not fit into the
+     * queue are dropped and counted in StorageStats::notificationsDropped.
+     */
+    bool startDispatcher(const DispatcherConfig& config = DispatcherConfig());
+    
+    /**
+     * @brief Stop the dispatcher task after delivering queued changes
+     *
+     * Changes made meanwhile on other tasks are delivered synchronously.
+     */
+    void stopDispatcher();
+    
+    bool isDispatcherRunning() const { return dispatcherTask_ != nullptr; }
     
     // Storage operations
     
@@ -166,7 +560,29 @@ public:
      * @param autoSaveDefaults If true and no parameters found in NVS (first boot),
      *                         automatically save default values to initialize NVS
      */
-    Result loadAll(bool autoSaveDefaults = false);
+    Result loadAll(bool autoSaveDefaults = false, LoadReport* report = nullptr);
+    
+    /**
+     * @brief Select how loadAll() and endRegistration() read NVS
+     *
+     * ITERATE (default) walks the namespace once with the NVS entry iterator
+     * and only reads keys that exist; PER_KEY looks up every parameter.
+     */
+    void setLoadStrategy(LoadStrategy strategy) { loadStrategy_ = strategy; }
+    
+    /**
+     * @brief Select how values are written to NVS; call before begin()
+     *
+     * SNAPSHOT writes every persistent parameter as one image with a
+     * sequence number and CRC into the inactive of two slots, then flips
+     * the active slot. A power cut at any point leaves the previous image
+     * intact, so a set of related values is never half updated. loadAll()
+     * uses the active slot and falls back to the other one if it is
+     * corrupt; without a valid image it loads per-key values and writes
+     * them as the first snapshot. Every save rewrites the whole image, so
+     * combine it with saveDeferred() for frequently changing values.
+     */
+    void setSaveMode(SaveMode mode) { saveMode_ = mode; }
     
     /**
      * @brief Reset a parameter to default value
@@ -175,6 +591,11 @@ public:
     
     /**
      * @brief Reset all parameters to defaults
+     *
+     * Removes the stored values of the registered parameters (in SNAPSHOT
+     * mode, writes an image without them). Streamed blobs, the schema
+     * version and keys of unregistered parameters are kept; use
+     * eraseNamespace() to wipe everything.
      */
     Result resetAll();
 
@@ -189,25 +610,162 @@ public:
      */
     bool eraseNamespace();
     
+    /**
+     * @brief Erase stored keys that no registered parameter maps to
+     *
+     * Reclaims entries left behind by renamed or removed parameters. Only
+     * call it once every parameter is registered: a key counts as orphaned
+     * if no parameter owns it right now. maxRemovals bounds one round
+     * (0 = all) so collection can proceed incrementally; keys starting with
+     * '.' are reserved for the library and kept.
+     * @return ERROR_ACCESS_DENIED during a bulk registration
+     */
+    Result gcOrphans(GcReport* report = nullptr, size_t maxRemovals = 0);
+    
     // Value access methods
     
     /**
      * @brief Get parameter value as JSON
+     *
+     * Struct fields are addressed as "<name>.<field>".
      */
     Result getJson(const std::string& name, JsonDocument& doc);
     
+    /**
+     * @brief Get a slice of an array or blob parameter as JSON
+     *
+     * Like getJson() with "offset" and only the elements [offset,
+     * offset + count) in "value"; count is clipped to the array. Blob
+     * slices are bytes, base64-encoded into "value".
+     * @return ERROR_TYPE_MISMATCH if the parameter is neither
+     */
+    Result getJson(const std::string& name, JsonDocument& doc, size_t offset, size_t count);
+    
     /**
      * @brief Set parameter value from JSON
+     *
+     * Arrays take a JSON array with exactly one value per element, structs
+     * an object with the fields to change; "<name>.<field>" sets one field.
+     * Blobs take the whole blob as a base64 string.
      */
     Result setJson(const std::string& name, const JsonDocument& doc);
     
+    /**
+     * @brief Set one array element from doc["value"] and save its chunk
+     *
+     * The validator, if any, sees the whole array with the new element.
+     * @return ERROR_NOT_FOUND if index is out of range
+     */
+    Result setElementJson(const std::string& name, size_t index, const JsonDocument& doc);
+    
+    /**
+     * @brief Copy a parameter value without tearing
+     *
+     * Safe against concurrent setJson()/write()/load() from other tasks.
+     * Strings are NUL-terminated and need size > length.
+     *
+     * @param out Destination buffer
+     * @param size Size of the destination buffer
+     * @param length Optional, receives the value length (string length for strings)
+     * @return ERROR_TOO_LARGE if the value did not fit into out
+     */
+    Result readConsistent(const std::string& name, void* out, size_t size,
+                          size_t* length = nullptr) const;
+    
+    /**
+     * @brief Lock-free variant for hot paths, using a pointer from getInfo()
+     * @return Value length; the copy is complete if it is <= size (< size for strings)
+     */
+    static size_t readConsistent(const ParameterInfo& param, void* out, size_t size);
+    
+    /**
+     * @brief Validate and store a new value without exposing partial writes
+     *
+     * Applies range/length checks and the validator, then notifies onChange.
+     * Read-only parameters can be written locally. Does not save to NVS -
+     * call save() or saveDeferred() afterwards.
+     *
+     * @param value New value (for strings the characters, without terminator)
+     * @param size sizeof the scalar, string length, or exact blob size
+     */
+    Result write(const std::string& name, const void* value, size_t size);
+    
+    /**
+     * @brief Copy part of a blob without tearing
+     *
+     * Streams a large blob out in slices instead of copying it whole.
+     * @param copied Optional, receives the bytes copied (clipped to the blob)
+     * @return ERROR_TYPE_MISMATCH if the parameter is not a blob,
+     *         ERROR_VALIDATION_FAILED if offset is beyond the blob
+     */
+    Result readBlob(const std::string& name, size_t offset, void* out, size_t length,
+                    size_t* copied = nullptr) const;
+    
+    /**
+     * @brief Write part of a blob, see write()
+     *
+     * Chunks are staged in a copy of the blob: a chunk at the offset where
+     * the previous one ended continues the transfer, any other offset
+     * starts a new one from the current content. The staged blob is
+     * validated and stored once the end of the blob or a final chunk is
+     * reached, so readers never see a half-written transfer. One transfer
+     * at a time; it holds a buffer of the blob size until it completes.
+     *
+     * @param final Complete the transfer with this chunk
+     * @return ERROR_TOO_LARGE if the chunk runs past the end of the blob
+     */
+    Result writeBlob(const std::string& name, size_t offset, const void* data, size_t length,
+                     bool final = true);
+    
+    /**
+     * @brief Validate and store one array element, see write()
+     *
+     * @param size sizeof the element type
+     * @return ERROR_NOT_FOUND if index is out of range
+     */
+    Result writeElement(const std::string& name, size_t index, const void* value, size_t size);
+    
+    /**
+     * @brief Increment a counter
+     *
+     * Saves to NVS only when the counter's flush threshold is reached;
+     * otherwise the service task or flushCounters() saves it later.
+     */
+    Result add(const std::string& name, uint64_t delta = 1);
+    
+    /**
+     * @brief Save counters with unsaved increments
+     * @param all Save every dirty counter, not only those past their interval
+     * @return Number of counters saved
+     */
+    size_t flushCounters(bool all = false);
+    
     /**
      * @brief Get all parameters as JSON
      */
     void getAllJson(JsonDocument& doc);
     
+    /**
+     * @brief Get one page of parameter names as JSON
+     *
+     * Produces {"items": [...], "count": n, "next": "<cursor>"}. "next" is
+     * only present when more names match; pass it back as cursor to get
+     * the following page. Memory use is bounded by limit, not by the
+     * number of registered parameters.
+     *
+     * @param prefix Only names starting with this prefix ("" = all)
+     * @param cursor Continuation cursor from the previous page ("" = first page)
+     * @param limit Maximum names per page
+     * @param withMeta Emit {"name","type","access"} objects instead of plain names
+     */
+    void getAllJson(JsonDocument& doc, const std::string& prefix,
+                    const std::string& cursor, size_t limit, bool withMeta = false);
+    
     /**
      * @brief Get parameter info
+     *
+     * Entries are never removed, so the pointer stays valid; registering
+     * the same name again replaces its contents.
      */
     const ParameterInfo* getInfo(const std::string& name) const;
     
@@ -221,6 +779,138 @@ public:
      */
     std::vector<std::string> listByPrefix(const std::string& prefix) const;
     
+    /**
+     * @brief List one page of names by prefix
+     * @return Cursor for the next page, empty when no more names match
+     */
+    std::string listPage(const std::string& prefix, const std::string& cursor,
+                         size_t limit, std::vector<std::string>& names) const;
+    
+    // Streamed blobs
+    
+    static constexpr size_t STREAM_CHUNK_SIZE = 1024;                   // Bytes per NVS chunk
+    static constexpr size_t STREAM_MAX_SIZE = 256 * STREAM_CHUNK_SIZE;
+    
+    /**
+     * @brief Incremental writer of a streamed blob, see openBlobWriter()
+     *
+     * Data is collected in a window of one chunk and each full chunk is
+     * written to NVS, so the blob never has to be in RAM. The previous
+     * content stays readable until commit(). Destroying an uncommitted
+     * writer aborts it.
+     */
+    class BlobWriter {
+    public:
+        BlobWriter() = default;
+        BlobWriter(BlobWriter&& other) noexcept { *this = std::move(other); }
+        BlobWriter& operator=(BlobWriter&& other) noexcept;
+        BlobWriter(const BlobWriter&) = delete;
+        BlobWriter& operator=(const BlobWriter&) = delete;
+        ~BlobWriter() { abort(); }
+        
+        /**
+         * @brief Append data
+         * @return ERROR_TOO_LARGE past the size given to openBlobWriter()
+         *         (nothing is appended), ERROR_NVS_FAIL if a chunk could not
+         *         be written (the writer is aborted)
+         */
+        Result write(const void* data, size_t length);
+        
+        /**
+         * @brief Write the last chunk and the manifest, then erase the old chunks
+         * @return ERROR_VALIDATION_FAILED while fewer bytes than announced are
+         *         written (the writer stays open)
+         */
+        Result commit();
+        
+        /**
+         * @brief Drop the write; the previous content stays
+         */
+        void abort();
+        
+        bool isOpen() const { return storage_ != nullptr; }
+        size_t written() const { return written_; }
+        
+    private:
+        friend class PersistentStorage;
+        PersistentStorage* storage_ = nullptr;
+        uint32_t hash_ = 0;             // Name hash, part of the NVS keys
+        uint32_t size_ = 0;
+        uint32_t written_ = 0;
+        uint32_t crc_ = 0;              // Running CRC-32 of the written bytes
+        uint16_t chunks_ = 0;           // Chunks written to NVS
+        uint8_t generation_ = 0;        // Chunk set being written (the other one is live)
+        std::vector<uint8_t> window_;
+    };
+    
+    /**
+     * @brief Incremental reader of a streamed blob, see openBlobReader()
+     *
+     * Reads one chunk at a time into its window. A sequential read from
+     * the start checks the CRC when it reaches the end. Committing a new
+     * version invalidates open readers: their next chunk fails to load.
+     */
+    class BlobReader {
+    public:
+        /**
+         * @brief Copy up to length bytes from the current position
+         * @param got Optional, receives the bytes copied (0 at the end)
+         * @return ERROR_VALIDATION_FAILED if a sequential read ends on a CRC
+         *         mismatch, ERROR_NVS_FAIL if a chunk is missing or damaged
+         */
+        Result read(void* out, size_t length, size_t* got = nullptr);
+        
+        /**
+         * @brief Move the read position; only a read from 0 checks the CRC
+         */
+        Result seek(size_t offset);
+        
+        bool isOpen() const { return storage_ != nullptr; }
+        size_t size() const { return size_; }
+        size_t position() const { return position_; }
+        
+    private:
+        friend class PersistentStorage;
+        PersistentStorage* storage_ = nullptr;
+        uint32_t hash_ = 0;
+        uint32_t size_ = 0;
+        uint32_t crc_ = 0;              // From the manifest
+        uint32_t position_ = 0;
+        uint32_t runningCrc_ = 0;       // Of bytes [0, position_) while checked
+        bool checking_ = false;         // Read sequentially from 0 so far
+        uint8_t generation_ = 0;
+        int32_t windowChunk_ = -1;      // Chunk held in window_
+        std::vector<uint8_t> window_;
+    };
+    
+    /**
+     * @brief Start writing a streamed blob of exactly size bytes
+     *
+     * Streamed blobs are kept out of the registry for data too large for
+     * RAM (schedules, lookup tables). They are stored as chunks of
+     * STREAM_CHUNK_SIZE bytes and a manifest with the size and CRC-32.
+     * New chunks go to a second chunk set and the manifest is switched
+     * over by commit(), so a power cut at any point leaves the old or the
+     * new version. Their keys start with '.' and are left alone by
+     * gcOrphans(); remove them with removeBlobStream().
+     *
+     * @return ERROR_TOO_LARGE above STREAM_MAX_SIZE, ERROR_ACCESS_DENIED
+     *         if another writer of the same name is open
+     */
+    Result openBlobWriter(const std::string& name, size_t size, BlobWriter& writer);
+    
+    /**
+     * @brief Open the committed version of a streamed blob
+     * @return ERROR_NOT_FOUND if none was committed
+     */
+    Result openBlobReader(const std::string& name, BlobReader& reader);
+    
+    /**
+     * @brief Erase a streamed blob
+     * @return ERROR_ACCESS_DENIED while a writer of it is open
+     */
+    Result removeBlobStream(const std::string& name);
+    
     // MQTT integration
     
     /**
@@ -251,20 +941,90 @@ public:
     
     /**
      * @brief Publish all parameters via MQTT grouped by category
+     *
+     * Waits GROUP_PUBLISH_DELAY_MS between groups. A get/all handled by
+     * processCommandQueue(budgetUs) publishes the groups without waiting.
      */
     void publishAllGrouped();
-    void publishGroupedCategory(const std::string& category);
+    
+    /**
+     * @brief Publish one group to {prefix}/status/<category>
+     * @return true if the group had parameters to publish
+     */
+    bool publishGroupedCategory(const std::string& category);
+    
+    /**
+     * @brief Set the largest MQTT packet the client/broker accepts
+     *
+     * JSON payloads that do not fit (together with their topic) are split
+     * into raw slices published on "<topic>/part/<i>/<n>" (1-based); the
+     * concatenation of all slices is the complete document.
+     * Call while nothing is being published.
+     */
+    void setMaxPacketSize(size_t bytes);
+    size_t getMaxPacketSize() const { return maxPacketSize_; }
     
     /**
      * @brief Process queued commands (call from task loop)
      */
     void processCommandQueue();
     
+    /**
+     * @brief Process queued commands within a time budget
+     *
+     * Alternates between queued commands and async publish steps until both
+     * are drained or the budget is spent. Never sleeps; at least one step
+     * is taken even with a zero budget.
+     *
+     * @param budgetUs Time budget in microseconds
+     * @return Number of commands still queued
+     */
+    size_t processCommandQueue(uint32_t budgetUs);
+    
     /**
      * @brief Continue async publishing if in progress
      */
     void continueAsyncPublish();
     
+    // Service task
+    
+    /**
+     * @brief Start a built-in task that owns command processing, publishing
+     *        and deferred flushes
+     *
+     * The task sleeps on a task notification and is woken as soon as a
+     * command is queued, a publish is started or a deferred save is due.
+     * Do not call processCommandQueue()/continueAsyncPublish() yourself
+     * while it runs.
+     *
+     * @return true if the task is running
+     */
+    bool startServiceTask(const StorageTaskConfig& config = StorageTaskConfig());
+    
+    /**
+     * @brief Stop the service task (waits for the current round to finish)
+     */
+    void stopServiceTask();
+    
+    /**
+     * @brief Check if the service task is running
+     */
+    bool isServiceTaskRunning() const { return serviceTask_ != nullptr; }
+    
+    /**
+     * @brief Mark a parameter for saving after the flush delay
+     *
+     * Several changes within the delay cost a single NVS write. Pending
+     * saves are written by the service task, by flushDeferred() or by end().
+     */
+    Result saveDeferred(const std::string& name);
+    
+    /**
+     * @brief Write all pending deferred saves now
+     * @return Number of parameters saved
+     */
+    size_t flushDeferred();
+    
     // Utility methods
     
     /**
@@ -272,6 +1032,16 @@ public:
      */
     static const char* resultToString(Result result);
     
+    /**
+     * @brief Get JSON type name ("bool", "int", ...) for a parameter type
+     */
+    static const char* typeToString(ParameterInfo::Type type);
+    
+    /**
+     * @brief Check if an async publish (publishAll) is in progress
+     */
+    bool isPublishing() const { return isPublishing_; }
+    
     /**
      * @brief Check if storage is initialized
      */
@@ -282,32 +1052,106 @@ public:
      */
     size_t getParameterCount() const { return parameters_.size(); }
     
+    /**
+     * @brief Get the registry's RAM usage broken down by field
+     */
+    MemoryFootprint getMemoryFootprint() const;
+    
     /**
      * @brief Get NVS statistics
      */
     void getNvsStats(size_t& usedEntries, size_t& freeEntries, size_t& totalEntries);
+    
+    /**
+     * @brief Get a snapshot of the runtime counters
+     *
+     * All zero when built with PSTORAGE_DISABLE_STATS.
+     */
+    StorageStats getStats() const;
+    
+    /**
+     * @brief Reset all runtime counters (queue high-water mark included)
+     */
+    void resetStats();
+    
+    /**
+     * @brief Publish runtime counters to {prefix}/status/stats
+     */
+    void publishStats();
 
 private:
     // Command queue for async processing
     struct ParameterCommand {
-        enum Type { GET, SET, LIST, SAVE, GET_ALL };
+        enum Type { GET, SET, LIST, SAVE, GET_ALL, STATS, LIST_PAGE, BLOB_COMMIT };
         Type type;
         char paramName[48];  // Reduced from 64
         char payload[64];    // Reduced from 128 to save stack
+        uint16_t limit;      // LIST_PAGE: names per page; GET: array/blob slice length, 0 = all
+        uint16_t offset;     // GET: first element (byte) of the array (blob) slice
+        bool withMeta;       // LIST_PAGE: include type/access
     };
     
     // Constants
     static constexpr size_t COMMAND_QUEUE_SIZE = 5;  // Reduced from 10
     static constexpr size_t PARAMS_PER_CHUNK = 5;
+    static constexpr uint32_t GROUP_PUBLISH_DELAY_MS = 50;
+    static constexpr size_t DEFAULT_MAX_PACKET_SIZE = 1024;  // esp-mqtt default buffer
+    static constexpr size_t MIN_PACKET_SIZE = 128;
+    static constexpr size_t MQTT_PACKET_OVERHEAD = 7;   // Fixed header + topic length
+    static constexpr size_t OUTPUT_BUFFER_COUNT = 2;
+    static constexpr size_t LIST_PAGE_DEFAULT = 32;
+    static constexpr size_t LIST_PAGE_MAX = 100;
+    static constexpr uint32_t BATCH_TIMEOUT_MS = 50;    // Give up waiting for a dropped batch end
     
     // NVS namespace and preferences
     Preferences preferences_;
     std::string namespaceName_;
     std::string mqttPrefix_;
     bool initialized_;
+    LoadStrategy loadStrategy_;
+    SaveMode saveMode_;
+    
+    // Snapshot slots (SaveMode::SNAPSHOT), guarded by snapshotMutex_
+    SemaphoreHandle_t snapshotMutex_;
+    int8_t snapshotSlot_;                   // Active slot, -1 if there is no valid image
+    uint32_t snapshotSequence_;             // Sequence of the newest image seen
+    
+    // Blob transfer in progress (writeBlob(), chunked MQTT set), guarded by blobMutex_
+    struct BlobUpload {
+        ParameterInfo* param = nullptr;
+        std::vector<uint8_t> data;      // Staged copy of the whole blob
+        size_t next = 0;                // Offset following the last chunk
+        bool complete = false;          // Waiting for commitBlob()
+    };
+    SemaphoreHandle_t blobMutex_;
+    BlobUpload blobUpload_;
+    std::vector<uint32_t> streamWriters_;   // Name hashes of the open BlobWriters
+    
+    // Counter flush state (stable addresses, referenced by ParameterInfo)
+    SemaphoreHandle_t counterMutex_;
+    std::deque<CounterState> counters_;
+    
+    // Bounds of int64 and double parameters (stable addresses, guarded by registryLock_)
+    std::deque<WideRange> wideRanges_;
     
-    // Parameter registry
-    std::map<std::string, ParameterInfo> parameters_;
+    // Schema version and migrations applied by begin()
+    uint32_t schemaVersion_;
+    const Migration* migrations_;
+    size_t migrationCount_;
+    MigrationReport migrationReport_;
+    
+    // Parameter registry, guarded by registryLock_. Entries live in stable
+    // slots (getInfo() pointers stay valid); parameters_ is the index sorted by name
+    std::deque<ParameterInfo> slots_;
+    std::vector<ParameterInfo*> parameters_;
+    NameArena names_;
+    mutable RegistryLock registryLock_;
+    
+    // Bulk registration (beginRegistration()/endRegistration()): new entries
+    // wait unsorted in registrationBatch_ and loads are collected in pendingLoads_
+    uint32_t registrationDepth_;
+    std::vector<ParameterInfo*> registrationBatch_;
+    std::vector<ParameterInfo*> pendingLoads_;
     
     // MQTT manager reference
     MQTTManager* mqttManager_;
@@ -324,19 +1168,149 @@ private:
     // Thread safety
     SemaphoreHandle_t publishMutex_;
     
+    // Service task state
+    TaskHandle_t serviceTask_;
+    SemaphoreHandle_t serviceExited_;
+    volatile bool serviceRunning_;
+    StorageTaskConfig serviceConfig_;
+    uint32_t nextGcMs_;                     // millis() of the next background gcOrphans() round
+    
+    // Deferred saves, written once flushDeadlineMs_ has passed
+    SemaphoreHandle_t deferredMutex_;
+    std::vector<std::string> deferredSaves_;
+    uint32_t flushDeadlineMs_;
+    
+    // Change subscriptions and dispatcher, guarded by notifyMutex_
+    struct ChangeEvent {
+        char name[65];      // Empty: wake-up only
+        uint32_t batch;     // Events of one batch share the id
+        bool last;          // Final event of its batch
+    };
+    
+    struct Subscription {
+        uint32_t id;
+        std::string pattern;
+        ChangeHandler handler;
+    };
+    
+    SemaphoreHandle_t notifyMutex_;
+    std::vector<Subscription> subscriptions_;
+    uint32_t nextSubscriptionId_;
+    uint32_t nextBatchId_;
+    uint32_t batchDepth_;
+    std::vector<std::string> batchNames_;
+    QueueHandle_t changeQueue_;
+    TaskHandle_t dispatcherTask_;
+    SemaphoreHandle_t dispatcherExited_;
+    volatile bool dispatcherRunning_;
+    
+    // Argument-less commands currently waiting in the queue (bit per type)
+    std::atomic<uint32_t> pendingCommands_;
+    
+    // JSON output buffer pool, buffers of maxPacketSize_ allocated on first use
+    size_t maxPacketSize_;
+    char* outputBuffers_[OUTPUT_BUFFER_COUNT];
+    std::atomic<uint32_t> outputBuffersBusy_;
+    
+#ifndef PSTORAGE_DISABLE_STATS
+    // Runtime counters
+    mutable portMUX_TYPE statsMux_;
+    StorageStats stats_;
+    
+    void statsAdd(uint32_t StorageStats::* field, uint32_t n);
+    void statsRecordLatency(StorageStats::Operation op, int64_t us);
+#endif
+    
     // Helper methods
+    Result insertParameter(const std::string& name, ParameterInfo& info);
+    Result insertLocked(const char* name, ParameterInfo& info, bool internName);
+    Result commitRegistrationLocked();
+    Result loadParameters(const std::vector<ParameterInfo*>& params, LoadReport& result, bool detailed);
+    bool loadByIteration(const std::vector<ParameterInfo*>& params, LoadReport& report,
+                         bool detailed, Result& lastResult);
+    ParameterInfo* findParameter(const std::string& name) const;
+    std::vector<ParameterInfo*>::const_iterator lowerBound(const std::string& name) const;
     bool validateParameterName(const std::string& name) const;
     std::string sanitizeNvsKey(const std::string& name) const;
-    Result loadParameter(ParameterInfo& param);
+    static void nvsKeyFor(const char* name, char* key);
+    Result runMigrations();
+    Result loadParameter(ParameterInfo& param, bool stored = false);
+    Result convertStored(ParameterInfo& param, uint8_t storedType);
     Result saveParameter(const ParameterInfo& param);
+    Result persistParameter(const ParameterInfo& param);
+    size_t saveCompressed(const ParameterInfo& param, const char* key);
+    Result loadCompressed(ParameterInfo& param, const char* key);
+    Result registerArray(const std::string& name, ParameterInfo& info, size_t count);
+    const WideRange* addWideRange(const std::string& name, const WideRange& range);
+    Result stageBlob(ParameterInfo& param, size_t offset, const char* data, size_t length,
+                     bool base64, bool final, bool& complete);
+    Result commitBlob(ParameterInfo& param, bool persist);
+    bool handleBlobSet(const std::string& name, const std::string& query, const std::string& payload);
+    void publishBlob(const ParameterInfo& param, size_t offset, size_t count);
+    Result writeStreamChunk(BlobWriter& writer);
+    Result commitStream(BlobWriter& writer);
+    void closeStream(BlobWriter& writer);
+    Result loadStreamChunk(BlobReader& reader, size_t chunk);
+    Result loadArrayChunk(ParameterInfo& param, size_t chunk, bool stored);
+    Result saveArrayChunk(const ParameterInfo& param, size_t chunk);
+    Result storeElement(ParameterInfo& param, size_t index, const void* value, size_t size);
+    ParameterInfo* findElement(const std::string& path, size_t& index) const;
+    ParameterInfo* findField(const std::string& path, const StructField*& field) const;
+    Result decodeStruct(ParameterInfo& param, const uint8_t* data, size_t length, bool& upgraded);
+    void markCounterFlushed(const ParameterInfo& param, uint64_t value);
+    void detachCounter(CounterState& state);
+    Result saveSnapshot(const ParameterInfo* exclude = nullptr, bool empty = false);
+    void removeStored(const ParameterInfo& param);
+    bool loadSnapshot(const std::vector<ParameterInfo*>& params, LoadReport& report,
+                      bool detailed, Result& lastResult);
+    bool readSnapshot(uint8_t slot, std::vector<uint8_t>& image, uint32_t& sequence);
     void notifyChange(const std::string& name, const void* newValue);
     
+    // Change dispatch helpers
+    static bool patternMatches(const std::string& pattern, const std::string& name);
+    void dispatchChanges(const std::vector<std::string>& names);
+    void deliverChanges(const std::vector<std::string>& names);
+    static void dispatcherTaskEntry(void* arg);
+    void dispatcherLoop();
+    
     // JSON conversion helpers
-    void parameterToJson(const ParameterInfo& param, JsonDocument& doc);
+    void parameterToJson(const ParameterInfo& param, JsonDocument& doc,
+                         size_t offset = 0, size_t count = SIZE_MAX);
     Result jsonToParameter(ParameterInfo& param, const JsonDocument& doc);
+    void fieldToJson(const ParameterInfo& param, const StructField& field, JsonDocument& doc);
+    Result jsonToField(ParameterInfo& param, const StructField& field, const JsonDocument& doc);
+    
+    // Value access helpers
+    Result validateValue(const ParameterInfo& param, const void* value, size_t size) const;
+    static void storeValue(ParameterInfo& param, const void* value, size_t size);
     
-    // Async publishing helper
+    // Async publishing helpers
+    void publishParameter(const ParameterInfo& param, size_t offset = 0, size_t count = SIZE_MAX);
     void publishAllAsync();
+    bool claimNextPublishIndex(size_t& index);
+    void publishParameterAt(size_t index);
+    
+    // Grouped publishing, optionally pausing between groups
+    void publishAllGrouped(uint32_t groupDelayMs);
+    
+    // Command execution; paced allows the legacy delays between publishes
+    void executeCommand(const ParameterCommand& cmd, bool paced);
+    
+    // Service task helpers
+    static void serviceTaskEntry(void* arg);
+    void serviceLoop();
+    void wakeServiceTask();
+    uint32_t msUntilDeferredFlush();
+    size_t flushDueCounters(bool all, uint32_t* waitMs);
+    
+    // MQTT output helpers
+    class MultipartWriter;
+    bool publishMessage(const char* topic, const char* payload);
+    bool publishJson(const char* topic, const JsonDocument& doc);
+    size_t payloadLimit(size_t topicLen) const;
+    char* acquireOutputBuffer(size_t size, int& slot);
+    void releaseOutputBuffer(char* buffer, int slot);
+    void statsToJson(const StorageStats& stats, JsonDocument& doc) const;
 };
 
 #endif // PERSISTENT_STORAGE_H
\ No newline at end of file
@@ -0,0 +1,69 @@
+#ifndef PERSISTENT_STORAGE_ARENA_H
+#define PERSISTENT_STORAGE_ARENA_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+/**
+ * @brief Append-only storage for parameter names
+ *
+ * Names are packed back to back into a few heap blocks instead of one
+ * std::string allocation each. Interned pointers stay valid until the
+ * arena is destroyed.
+ */
+class NameArena {
+public:
+    static constexpr size_t BLOCK_SIZE = 512;
+
+    NameArena() : cursor_(nullptr), blockFree_(0), used_(0), allocated_(0) {}
+
+    ~NameArena() {
+        for (char* block : blocks_) {
+            free(block);
+        }
+    }
+
+    NameArena(const NameArena&) = delete;
+    NameArena& operator=(const NameArena&) = delete;
+
+    /**
+     * @brief Copy a string into the arena
+     * @return Terminated copy, nullptr if out of memory
+     */
+    const char* intern(const char* str, size_t len) {
+        if (len + 1 > blockFree_) {
+            size_t blockSize = len + 1 > BLOCK_SIZE ? len + 1 : BLOCK_SIZE;
+            char* block = (char*)malloc(blockSize);
+            if (!block) {
+                return nullptr;
+            }
+            blocks_.push_back(block);
+            cursor_ = block;
+            blockFree_ = blockSize;
+            allocated_ += blockSize;
+        }
+
+        char* dst = cursor_;
+        memcpy(dst, str, len);
+        dst[len] = '\0';
+        cursor_ += len + 1;
+        blockFree_ -= len + 1;
+        used_ += len + 1;
+        return dst;
+    }
+
+    size_t bytesUsed() const { return used_; }
+    size_t bytesAllocated() const { return allocated_ + blocks_.capacity() * sizeof(char*); }
+
+private:
+    std::vector<char*> blocks_;
+    char* cursor_;          // Next free byte in the last block
+    size_t blockFree_;      // Bytes left in the last block
+    size_t used_;           // Bytes holding names (terminators included)
+    size_t allocated_;      // Bytes allocated for blocks
+};
+
+#endif // PERSISTENT_STORAGE_ARENA_H
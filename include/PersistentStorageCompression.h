@@ -0,0 +1,133 @@
+#ifndef PERSISTENT_STORAGE_COMPRESSION_H
+#define PERSISTENT_STORAGE_COMPRESSION_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+/**
+ * @brief LZSS codec for compressed string and blob values
+ *
+ * A flag byte precedes each group of up to eight items (bit set = match,
+ * LSB first). A literal is one byte; a match is two, holding a 12-bit
+ * distance (1-4096) and a 4-bit length (3-18) back into the output, so
+ * runs of a repeated byte cost two bytes per 18. The compressor remembers
+ * the last position of each 3-byte hash in a 256-entry table (512 bytes
+ * of stack) and tries that one candidate; the decompressor needs no memory
+ * beyond its output. Free of platform dependencies, so host tools (see
+ * tools/compression_bench) run the same code.
+ */
+struct LzCodec {
+    static constexpr size_t MIN_MATCH = 3;
+    static constexpr size_t MAX_MATCH = MIN_MATCH + 15;
+    static constexpr size_t WINDOW = 4096;
+    static constexpr size_t MAX_INPUT = 65534;     // Positions are kept in 16 bits
+    static constexpr unsigned HASH_BITS = 8;
+
+    /**
+     * @brief Compress length bytes into at most capacity bytes
+     * @return Compressed size, 0 if it would exceed capacity or length is above MAX_INPUT
+     */
+    static size_t compress(const uint8_t* in, size_t length, uint8_t* out, size_t capacity) {
+        if (length > MAX_INPUT) {
+            return 0;
+        }
+        uint16_t last[1 << HASH_BITS];      // Position + 1 of the last occurrence, 0 = none
+        memset(last, 0, sizeof(last));
+
+        size_t pos = 0;
+        size_t outPos = 0;
+        size_t flagPos = 0;
+        unsigned item = 8;
+        while (pos < length) {
+            if (item == 8) {
+                if (outPos >= capacity) {
+                    return 0;
+                }
+                flagPos = outPos++;
+                out[flagPos] = 0;
+                item = 0;
+            }
+
+            size_t matchLength = 0;
+            size_t distance = 0;
+            if (pos + MIN_MATCH <= length) {
+                uint32_t h = hash(in + pos);
+                size_t candidate = last[h];
+                last[h] = (uint16_t)(pos + 1);
+                if (candidate > 0 && pos - (candidate - 1) <= WINDOW) {
+                    size_t from = candidate - 1;
+                    size_t longest = (length - pos < MAX_MATCH) ? length - pos : MAX_MATCH;
+                    while (matchLength < longest && in[from + matchLength] == in[pos + matchLength]) {
+                        matchLength++;
+                    }
+                    distance = pos - from;
+                }
+            }
+
+            if (matchLength >= MIN_MATCH) {
+                if (outPos + 2 > capacity) {
+                    return 0;
+                }
+                out[flagPos] |= (uint8_t)(1 << item);
+                out[outPos++] = (uint8_t)((distance - 1) >> 4);
+                out[outPos++] = (uint8_t)(((distance - 1) & 0x0F) << 4 | (matchLength - MIN_MATCH));
+                // Index the covered positions too, so that later matches find them
+                for (size_t i = 1; i < matchLength && pos + i + MIN_MATCH <= length; i++) {
+                    last[hash(in + pos + i)] = (uint16_t)(pos + i + 1);
+                }
+                pos += matchLength;
+            } else {
+                if (outPos >= capacity) {
+                    return 0;
+                }
+                out[outPos++] = in[pos++];
+            }
+            item++;
+        }
+        return outPos;
+    }
+
+    /**
+     * @brief Decompress into exactly length bytes
+     * @return false if the data is malformed or does not decode to length bytes
+     */
+    static bool decompress(const uint8_t* in, size_t inLength, uint8_t* out, size_t length) {
+        size_t inPos = 0;
+        size_t outPos = 0;
+        while (inPos < inLength) {
+            uint8_t flags = in[inPos++];
+            for (unsigned item = 0; item < 8 && inPos < inLength; item++) {
+                if (flags & (1 << item)) {
+                    if (inPos + 2 > inLength) {
+                        return false;
+                    }
+                    size_t distance = ((size_t)in[inPos] << 4 | in[inPos + 1] >> 4) + 1;
+                    size_t n = (in[inPos + 1] & 0x0F) + MIN_MATCH;
+                    inPos += 2;
+                    if (distance > outPos || n > length - outPos) {
+                        return false;
+                    }
+                    // Byte by byte: an overlapping match repeats a run
+                    for (size_t i = 0; i < n; i++, outPos++) {
+                        out[outPos] = out[outPos - distance];
+                    }
+                } else {
+                    if (outPos >= length) {
+                        return false;
+                    }
+                    out[outPos++] = in[inPos++];
+                }
+            }
+        }
+        return outPos == length;
+    }
+
+private:
+    static uint32_t hash(const uint8_t* p) {
+        uint32_t v = (uint32_t)p[0] << 16 | (uint32_t)p[1] << 8 | p[2];
+        return (v * 2654435761u) >> (32 - HASH_BITS);
+    }
+};
+
+#endif // PERSISTENT_STORAGE_COMPRESSION_H
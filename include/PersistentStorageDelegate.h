@@ -0,0 +1,62 @@
+#ifndef PERSISTENT_STORAGE_DELEGATE_H
+#define PERSISTENT_STORAGE_DELEGATE_H
+
+#include <stddef.h>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+/**
+ * @brief Allocation-free callable with inline storage
+ *
+ * Holds a function pointer or a lambda whose captures fit into Capacity
+ * bytes (by default one pointer: [this], [&obj], [ptr]) and are trivially
+ * copyable. Never allocates, copies with a plain memcpy and costs one
+ * pointer plus Capacity - half of a std::function.
+ *
+ * Callables that do not fit are rejected at compile time; capture a
+ * pointer to a context struct instead.
+ */
+template<typename Signature, size_t Capacity = sizeof(void*)>
+class InlineDelegate;
+
+template<typename R, typename... Args, size_t Capacity>
+class InlineDelegate<R(Args...), Capacity> {
+public:
+    InlineDelegate() : storage_(), invoker_(nullptr) {}
+    InlineDelegate(std::nullptr_t) : storage_(), invoker_(nullptr) {}
+
+    template<typename F,
+             typename = typename std::enable_if<
+                 !std::is_same<typename std::decay<F>::type, InlineDelegate>::value>::type>
+    InlineDelegate(F callable) : storage_(), invoker_(&invoke<F>) {
+        static_assert(sizeof(F) <= Capacity,
+                      "Callable too large for InlineDelegate - capture a single pointer");
+        static_assert(alignof(F) <= alignof(Storage),
+                      "Callable alignment not supported by InlineDelegate");
+        static_assert(std::is_trivially_copyable<F>::value &&
+                      std::is_trivially_destructible<F>::value,
+                      "InlineDelegate captures must be trivially copyable (pointers, references, scalars)");
+        new (&storage_) F(callable);
+    }
+
+    R operator()(Args... args) const {
+        return invoker_(&storage_, std::forward<Args>(args)...);
+    }
+
+    explicit operator bool() const { return invoker_ != nullptr; }
+
+private:
+    typedef typename std::aligned_storage<Capacity, alignof(void*)>::type Storage;
+
+    template<typename F>
+    static R invoke(const void* storage, Args... args) {
+        F& callable = *const_cast<F*>(static_cast<const F*>(storage));
+        return callable(std::forward<Args>(args)...);
+    }
+
+    Storage storage_;
+    R (*invoker_)(const void*, Args...);
+};
+
+#endif // PERSISTENT_STORAGE_DELEGATE_H
@@ -0,0 +1,202 @@
+#ifndef PERSISTENT_STORAGE_LOCK_H
+#define PERSISTENT_STORAGE_LOCK_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include <freertos/task.h>
+
+/**
+ * @brief Writer-preferring reader-writer lock for the parameter registry
+ *
+ * Any number of tasks may hold the lock shared at the same time; readers
+ * only touch a short bookkeeping mutex and never wait for each other. A
+ * writer closes a turnstile so that no new readers enter, waits for the
+ * current ones to leave, and then excludes everyone.
+ *
+ * Shared locks nest (readers are tracked per task, so a nested lock never
+ * queues behind a waiting writer), and the writing task may take shared
+ * locks while it holds the exclusive one. Upgrading - taking the exclusive
+ * lock while holding a shared one, e.g. registering a parameter from an
+ * onChange callback - would deadlock, so lock() refuses it and returns
+ * false, as it does for a nested exclusive lock.
+ */
+class RegistryLock {
+public:
+    static constexpr size_t MAX_READER_TASKS = 8;
+
+    RegistryLock()
+        : countMutex_(xSemaphoreCreateMutex())
+        , turnstile_(xSemaphoreCreateMutex())
+        , writeGate_(xSemaphoreCreateBinary())
+        , readers_(0)
+        , writer_(nullptr)
+        , writerReads_(0)
+        , holders_() {
+        if (writeGate_) {
+            xSemaphoreGive(writeGate_);
+        }
+    }
+
+    ~RegistryLock() {
+        if (countMutex_) {
+            vSemaphoreDelete(countMutex_);
+        }
+        if (turnstile_) {
+            vSemaphoreDelete(turnstile_);
+        }
+        if (writeGate_) {
+            vSemaphoreDelete(writeGate_);
+        }
+    }
+
+    RegistryLock(const RegistryLock&) = delete;
+    RegistryLock& operator=(const RegistryLock&) = delete;
+
+    void lockShared() {
+        TaskHandle_t self = xTaskGetCurrentTaskHandle();
+        if (writer_.load(std::memory_order_relaxed) == self) {
+            writerReads_++;
+            return;
+        }
+
+        for (;;) {
+            xSemaphoreTake(countMutex_, portMAX_DELAY);
+            Holder* holder = findHolder(self);
+            if (holder) {
+                holder->depth++;
+                xSemaphoreGive(countMutex_);
+                return;
+            }
+            xSemaphoreGive(countMutex_);
+
+            // Outermost lock: queue behind any waiting writer
+            xSemaphoreTake(turnstile_, portMAX_DELAY);
+            xSemaphoreGive(turnstile_);
+
+            xSemaphoreTake(countMutex_, portMAX_DELAY);
+            holder = findHolder(nullptr);
+            if (holder) {
+                holder->task = self;
+                holder->depth = 1;
+                // The first reader closes the gate for writers, the last one reopens it
+                if (readers_++ == 0) {
+                    xSemaphoreTake(writeGate_, portMAX_DELAY);
+                }
+                xSemaphoreGive(countMutex_);
+                return;
+            }
+            xSemaphoreGive(countMutex_);
+
+            // More concurrent reader tasks than slots - wait for one to leave
+            vTaskDelay(1);
+        }
+    }
+
+    void unlockShared() {
+        TaskHandle_t self = xTaskGetCurrentTaskHandle();
+        if (writer_.load(std::memory_order_relaxed) == self) {
+            writerReads_--;
+            return;
+        }
+
+        xSemaphoreTake(countMutex_, portMAX_DELAY);
+        Holder* holder = findHolder(self);
+        if (holder && --holder->depth == 0) {
+            holder->task = nullptr;
+            if (--readers_ == 0) {
+                xSemaphoreGive(writeGate_);
+            }
+        }
+        xSemaphoreGive(countMutex_);
+    }
+
+    /**
+     * @brief Take the exclusive lock
+     * @return false, without locking, if the calling task already holds the lock
+     */
+    bool lock() {
+        TaskHandle_t self = xTaskGetCurrentTaskHandle();
+        if (writer_.load(std::memory_order_relaxed) == self) {
+            return false;
+        }
+
+        // Only this task adds or removes its own holder slot
+        xSemaphoreTake(countMutex_, portMAX_DELAY);
+        bool reading = findHolder(self) != nullptr;
+        xSemaphoreGive(countMutex_);
+        if (reading) {
+            return false;
+        }
+
+        xSemaphoreTake(turnstile_, portMAX_DELAY);
+        xSemaphoreTake(writeGate_, portMAX_DELAY);
+        writer_.store(self, std::memory_order_relaxed);
+        return true;
+    }
+
+    void unlock() {
+        writer_.store(nullptr, std::memory_order_relaxed);
+        xSemaphoreGive(writeGate_);
+        xSemaphoreGive(turnstile_);
+    }
+
+    /**
+     * @brief Scoped shared (read) lock
+     */
+    class ReadGuard {
+    public:
+        explicit ReadGuard(RegistryLock& lock) : lock_(lock) { lock_.lockShared(); }
+        ~ReadGuard() { lock_.unlockShared(); }
+        ReadGuard(const ReadGuard&) = delete;
+        ReadGuard& operator=(const ReadGuard&) = delete;
+    private:
+        RegistryLock& lock_;
+    };
+
+    /**
+     * @brief Scoped exclusive (write) lock; check owns() before touching the registry
+     */
+    class WriteGuard {
+    public:
+        explicit WriteGuard(RegistryLock& lock) : lock_(lock), owns_(lock_.lock()) {}
+        ~WriteGuard() {
+            if (owns_) {
+                lock_.unlock();
+            }
+        }
+        bool owns() const { return owns_; }
+        WriteGuard(const WriteGuard&) = delete;
+        WriteGuard& operator=(const WriteGuard&) = delete;
+    private:
+        RegistryLock& lock_;
+        bool owns_;
+    };
+
+private:
+    struct Holder {
+        TaskHandle_t task;              // Reading task, nullptr = free slot
+        uint32_t depth;                 // Nesting depth of its shared locks
+    };
+
+    Holder* findHolder(TaskHandle_t task) {
+        for (auto& holder : holders_) {
+            if (holder.task == task) {
+                return &holder;
+            }
+        }
+        return nullptr;
+    }
+
+    SemaphoreHandle_t countMutex_;      // Protects readers_ and holders_
+    SemaphoreHandle_t turnstile_;       // Held by a writer to stop new readers
+    SemaphoreHandle_t writeGate_;       // Binary semaphore, taken while readers or a writer are active
+    uint32_t readers_;
+    std::atomic<TaskHandle_t> writer_;  // Task holding the exclusive lock
+    uint32_t writerReads_;              // Shared locks nested inside the exclusive one
+    Holder holders_[MAX_READER_TASKS];
+};
+
+#endif // PERSISTENT_STORAGE_LOCK_H
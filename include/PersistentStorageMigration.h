@@ -0,0 +1,83 @@
+#ifndef PERSISTENT_STORAGE_MIGRATION_H
+#define PERSISTENT_STORAGE_MIGRATION_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "PersistentStorage.h"
+
+/**
+ * @brief One step of a stored-data migration
+ *
+ * Steps are declared in a table passed to PersistentStorage::setSchema()
+ * and run once at begin() when the stored schema version is older than
+ * the firmware's. Each step belongs to the version it upgrades to.
+ *
+ * Steps are idempotent where the stored data allows it (a rename whose old
+ * key is gone or a retype whose key already has the new type is skipped),
+ * so a power cut during a migration simply repeats the unfinished version.
+ * A retype writes the converted value under a temporary key before it
+ * erases the old one, and the next begin() completes it. A failed write
+ * keeps the stored value and leaves the version for the next begin().
+ * Blob upgrades receive the stored length and should use it to recognize
+ * data that is already in the new layout.
+ */
+struct Migration {
+    enum Kind : uint8_t {
+        RENAME,         // Move the value to a new parameter name
+        RETYPE,         // Convert between scalar types and string (see README)
+        UPGRADE_BLOB    // Rewrite a blob through a callback
+    };
+
+    // Converts oldLength bytes into at most capacity bytes at out.
+    // Returns the new length, 0 to drop the value (the default is used).
+    typedef InlineDelegate<size_t(const uint8_t* data, size_t oldLength,
+                                  uint8_t* out, size_t capacity)> BlobUpgrade;
+
+    uint32_t version;               // Schema version this step upgrades to
+    Kind kind;
+    ParameterInfo::Type fromType;   // RETYPE: stored type
+    ParameterInfo::Type toType;     // RETYPE: new type
+    const char* name;               // Parameter name (old name for RENAME)
+    const char* newName;            // RENAME: new parameter name
+    size_t newSize;                 // UPGRADE_BLOB: size of the new layout
+    BlobUpgrade upgrade;            // UPGRADE_BLOB: layout conversion
+
+    static Migration rename(uint32_t version, const char* from, const char* to) {
+        Migration m = base(version, RENAME, from);
+        m.newName = to;
+        return m;
+    }
+
+    static Migration retype(uint32_t version, const char* name,
+                            ParameterInfo::Type from, ParameterInfo::Type to) {
+        Migration m = base(version, RETYPE, name);
+        m.fromType = from;
+        m.toType = to;
+        return m;
+    }
+
+    static Migration upgradeBlob(uint32_t version, const char* name, size_t newSize,
+                                 BlobUpgrade upgrade) {
+        Migration m = base(version, UPGRADE_BLOB, name);
+        m.fromType = ParameterInfo::TYPE_BLOB;
+        m.toType = ParameterInfo::TYPE_BLOB;
+        m.newSize = newSize;
+        m.upgrade = upgrade;
+        return m;
+    }
+
+private:
+    static Migration base(uint32_t version, Kind kind, const char* name) {
+        Migration m;
+        m.version = version;
+        m.kind = kind;
+        m.fromType = ParameterInfo::TYPE_BOOL;
+        m.toType = ParameterInfo::TYPE_BOOL;
+        m.name = name;
+        m.newName = nullptr;
+        m.newSize = 0;
+        return m;
+    }
+};
+
+#endif // PERSISTENT_STORAGE_MIGRATION_H
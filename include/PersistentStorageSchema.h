@@ -0,0 +1,256 @@
+#ifndef PERSISTENT_STORAGE_SCHEMA_H
+#define PERSISTENT_STORAGE_SCHEMA_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "PersistentStorage.h"
+
+/**
+ * @brief One parameter of a compile-time schema
+ *
+ * Generated by PSTORAGE_SCHEMA(); all fields are constant data in flash.
+ */
+struct SchemaEntry {
+    enum Class : uint8_t {
+        PERSISTENT,     // Saved to NVS, writable via MQTT
+        RUNTIME,        // RAM only, writable via MQTT
+        STATUS          // RAM only, read-only via MQTT
+    };
+
+    const char* name;
+    const char* description;
+    ParameterInfo::Type type;
+    Class cls;
+    size_t offset;              // Field offset in the settings struct
+    size_t size;                // Field size (string buffer size)
+    double defaultValue;        // Numeric default (bool: 0/1)
+    const char* defaultString;  // String default, nullptr for other types
+    double min, max;            // Range; max = max characters for strings
+};
+
+/**
+ * @brief Hash used for parameter names longer than an NVS key (15 chars)
+ *
+ * Shared by the runtime key mapping and the compile-time collision check.
+ */
+constexpr uint32_t nvsKeyHash(const char* name, uint32_t hash = 0) {
+    return *name ? nvsKeyHash(name + 1, hash * 31 + (uint32_t)*name) : hash;
+}
+
+#if __cplusplus >= 201703L
+
+/**
+ * @brief Compile-time checks on a schema table
+ */
+namespace pstorage_schema {
+
+constexpr size_t NVS_KEY_MAX = 15;
+
+struct NvsKey {
+    char str[NVS_KEY_MAX + 1];
+};
+
+constexpr size_t length(const char* str) {
+    size_t len = 0;
+    while (str[len]) {
+        len++;
+    }
+    return len;
+}
+
+constexpr bool equal(const char* a, const char* b) {
+    while (*a && *a == *b) {
+        a++;
+        b++;
+    }
+    return *a == *b;
+}
+
+// Same mapping as PersistentStorage::sanitizeNvsKey()
+constexpr NvsKey nvsKey(const char* name) {
+    NvsKey key = {};
+    size_t len = length(name);
+    if (len <= NVS_KEY_MAX) {
+        for (size_t i = 0; i < len; i++) {
+            key.str[i] = name[i];
+        }
+        return key;
+    }
+
+    uint32_t hash = nvsKeyHash(name);
+    char digits[10] = {};
+    size_t count = 0;
+    do {
+        digits[count++] = (char)('0' + hash % 10);
+        hash /= 10;
+    } while (hash);
+
+    key.str[0] = 'p';
+    for (size_t i = 0; i < count; i++) {
+        key.str[1 + i] = digits[count - 1 - i];
+    }
+    return key;
+}
+
+constexpr bool validName(const char* name) {
+    size_t len = length(name);
+    if (len == 0 || len > 64) {
+        return false;
+    }
+    for (size_t i = 0; i < len; i++) {
+        char c = name[i];
+        bool ok = (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+                  (c >= '0' && c <= '9') || c == '_' || c == '/';
+        if (!ok) {
+            return false;
+        }
+    }
+    return true;
+}
+
+template<size_t N>
+constexpr bool namesValid(const SchemaEntry (&entries)[N]) {
+    for (size_t i = 0; i < N; i++) {
+        if (!validName(entries[i].name)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+template<size_t N>
+constexpr bool namesUnique(const SchemaEntry (&entries)[N]) {
+    for (size_t i = 0; i < N; i++) {
+        for (size_t j = i + 1; j < N; j++) {
+            if (equal(entries[i].name, entries[j].name)) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+template<size_t N>
+constexpr bool keysUnique(const SchemaEntry (&entries)[N]) {
+    for (size_t i = 0; i < N; i++) {
+        for (size_t j = i + 1; j < N; j++) {
+            if (equal(nvsKey(entries[i].name).str, nvsKey(entries[j].name).str)) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+template<size_t N>
+constexpr bool defaultsInRange(const SchemaEntry (&entries)[N]) {
+    for (size_t i = 0; i < N; i++) {
+        const SchemaEntry& e = entries[i];
+        switch (e.type) {
+            case ParameterInfo::TYPE_INT:
+            case ParameterInfo::TYPE_FLOAT:
+                if (e.min > e.max || e.defaultValue < e.min || e.defaultValue > e.max) {
+                    return false;
+                }
+                break;
+            case ParameterInfo::TYPE_STRING:
+                if (length(e.defaultString) > (size_t)e.max) {
+                    return false;
+                }
+                break;
+            default:
+                break;
+        }
+    }
+    return true;
+}
+
+} // namespace pstorage_schema
+
+/**
+ * @brief Maps a settings struct to its schema table
+ */
+template<typename Settings>
+struct SchemaOf;
+
+/**
+ * @brief Register every field of a schema-generated settings struct
+ */
+template<typename Settings>
+PersistentStorage::Result registerSchema(PersistentStorage& storage, Settings& settings) {
+    return storage.registerSchema(SchemaOf<Settings>::entries, SchemaOf<Settings>::count, &settings);
+}
+
+/**
+ * @brief Parameter name of a schema field, e.g. schemaName<HeatingSettings>(HeatingSettings::Param::targetTemp)
+ */
+template<typename Settings>
+constexpr const char* schemaName(size_t id) {
+    return SchemaOf<Settings>::entries[id].name;
+}
+
+// Per-type pieces used by the X-macro expansions below
+#define PSTOR_SCHEMA_FIELD_BOOL(field, dflt, hi)    bool field = dflt;
+#define PSTOR_SCHEMA_FIELD_INT(field, dflt, hi)     int32_t field = dflt;
+#define PSTOR_SCHEMA_FIELD_FLOAT(field, dflt, hi)   float field = dflt;
+#define PSTOR_SCHEMA_FIELD_STRING(field, dflt, hi)  char field[(size_t)(hi) + 1] = dflt;
+
+#define PSTOR_SCHEMA_NUM_BOOL(dflt)     ((dflt) ? 1.0 : 0.0)
+#define PSTOR_SCHEMA_NUM_INT(dflt)      ((double)(dflt))
+#define PSTOR_SCHEMA_NUM_FLOAT(dflt)    ((double)(dflt))
+#define PSTOR_SCHEMA_NUM_STRING(dflt)   0.0
+
+#define PSTOR_SCHEMA_STR_BOOL(dflt)     nullptr
+#define PSTOR_SCHEMA_STR_INT(dflt)      nullptr
+#define PSTOR_SCHEMA_STR_FLOAT(dflt)    nullptr
+#define PSTOR_SCHEMA_STR_STRING(dflt)   dflt
+
+#define PSTOR_SCHEMA_FIELD(type, field, name, dflt, lo, hi, cls, desc) \
+    PSTOR_SCHEMA_FIELD_##type(field, dflt, hi)
+
+#define PSTOR_SCHEMA_ID(type, field, name, dflt, lo, hi, cls, desc) field,
+
+#define PSTOR_SCHEMA_ENTRY(type, field, name, dflt, lo, hi, cls, desc) \
+    { name, desc, ParameterInfo::TYPE_##type, SchemaEntry::cls, \
+      offsetof(Type, field), sizeof(Type::field), \
+      PSTOR_SCHEMA_NUM_##type(dflt), PSTOR_SCHEMA_STR_##type(dflt), \
+      (double)(lo), (double)(hi) },
+
+/**
+ * @brief Declare a settings struct and its parameter schema in one place
+ *
+ * LIST is an X-macro taking X(type, field, name, default, min, max, class,
+ * description) per parameter, with type BOOL, INT, FLOAT or STRING (max =
+ * maximum characters) and class PERSISTENT, RUNTIME or STATUS:
+ *
+ *   #define HEATING_SCHEMA(X) \
+ *       X(FLOAT, targetTemp, "heating/targetTemp", 21.5f, 5, 30, PERSISTENT, "Target") \
+ *       X(BOOL,  enabled,    "heating/enabled",    true,  0, 1,  PERSISTENT, "Enabled")
+ *   PSTORAGE_SCHEMA(HeatingSettings, HEATING_SCHEMA);
+ *
+ * Generates the struct with defaults, HeatingSettings::Param ids and a
+ * constexpr schema table. Invalid or duplicate names, NVS key collisions
+ * and defaults outside their range fail to compile.
+ */
+#define PSTORAGE_SCHEMA(Name, LIST) \
+    struct Name { \
+        LIST(PSTOR_SCHEMA_FIELD) \
+        struct Param { enum : uint16_t { LIST(PSTOR_SCHEMA_ID) COUNT }; }; \
+    }; \
+    namespace Name##_schema { \
+        using Type = Name; \
+        inline constexpr SchemaEntry entries[] = { LIST(PSTOR_SCHEMA_ENTRY) }; \
+        static_assert(pstorage_schema::namesValid(entries), \
+                      #Name ": invalid parameter name (use a-z, A-Z, 0-9, _ and /, max 64 chars)"); \
+        static_assert(pstorage_schema::namesUnique(entries), #Name ": duplicate parameter name"); \
+        static_assert(pstorage_schema::keysUnique(entries), #Name ": NVS key collision between parameters"); \
+        static_assert(pstorage_schema::defaultsInRange(entries), #Name ": default outside its range"); \
+    } \
+    template<> struct SchemaOf<Name> { \
+        static constexpr const SchemaEntry* entries = Name##_schema::entries; \
+        static constexpr size_t count = sizeof(Name##_schema::entries) / sizeof(SchemaEntry); \
+    }
+
+#endif // __cplusplus >= 201703L
+
+#endif // PERSISTENT_STORAGE_SCHEMA_H
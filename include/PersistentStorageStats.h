@@ -0,0 +1,101 @@
+#ifndef PERSISTENT_STORAGE_STATS_H
+#define PERSISTENT_STORAGE_STATS_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * @brief Latency histogram with power-of-four microsecond buckets
+ *
+ * Bucket upper bounds: 64us, 256us, 1ms, 4ms, 16ms, 65ms, 262ms, unbounded.
+ */
+struct LatencyHistogram {
+    static constexpr size_t BUCKET_COUNT = 8;
+
+    uint32_t count;                     // Number of samples
+    uint32_t maxUs;                     // Slowest sample
+    uint64_t totalUs;                   // Sum of all samples (for averages)
+    uint32_t buckets[BUCKET_COUNT];     // Sample counts per bucket
+
+    /**
+     * @brief Map a duration to its bucket index
+     */
+    static size_t bucketFor(uint32_t us) {
+        if (us < 64) {
+            return 0;
+        }
+        size_t bits = 32 - __builtin_clz(us);   // 64 -> 7 bits
+        size_t bucket = (bits - 7) / 2 + 1;
+        return bucket < BUCKET_COUNT ? bucket : BUCKET_COUNT - 1;
+    }
+
+    /**
+     * @brief Upper bound of a bucket in microseconds (0 = unbounded)
+     */
+    static uint32_t bucketLimitUs(size_t bucket) {
+        return bucket + 1 < BUCKET_COUNT ? (64UL << (bucket * 2)) : 0;
+    }
+};
+
+/**
+ * @brief Runtime counters collected by PersistentStorage
+ *
+ * Collection can be removed at compile time with -DPSTORAGE_DISABLE_STATS,
+ * in which case getStats() returns an all-zero snapshot.
+ */
+struct StorageStats {
+    enum Operation {
+        OP_LOAD,
+        OP_SAVE,
+        OP_SET_JSON,
+        OP_PUBLISH,
+        OP_COUNT
+    };
+
+    LatencyHistogram latency[OP_COUNT];  // Per-operation counts and latencies
+
+    // NVS
+    uint32_t nvsBytesWritten;           // Payload bytes handed to NVS
+    uint32_t nvsCommits;                // Successful NVS writes (Preferences commits each put)
+
+    // Command queue
+    uint32_t queueDepth;                // Commands waiting at snapshot time
+    uint32_t queueHighWater;            // Deepest queue seen
+    uint32_t commandsDropped;           // Commands lost because the queue was full
+    uint32_t commandsCoalesced;         // Commands merged into an identical pending one
+
+    // MQTT output
+    uint32_t publishFailures;           // Publishes rejected by callback or manager
+    uint32_t multipartMessages;         // Payloads split into numbered parts
+    uint32_t jsonTruncations;           // Payloads that could not be delivered intact
+
+    // Change notifications
+    uint32_t notificationsQueued;       // Change events handed to the dispatcher
+    uint32_t notificationsDropped;      // Change events lost because the queue was full
+
+    static const char* operationName(Operation op) {
+        switch (op) {
+            case OP_LOAD: return "load";
+            case OP_SAVE: return "save";
+            case OP_SET_JSON: return "setJson";
+            case OP_PUBLISH: return "publish";
+            default: return "unknown";
+        }
+    }
+};
+
+// Collection macros - expand to nothing when stats are disabled
+#ifdef PSTORAGE_DISABLE_STATS
+    #define PSTOR_STATS_TIMER(var)          ((void)0)
+    #define PSTOR_STATS_LATENCY(op, var)    ((void)0)
+    #define PSTOR_STATS_INC(field)          ((void)0)
+    #define PSTOR_STATS_ADD(field, n)       ((void)0)
+#else
+    #include <esp_timer.h>
+    #define PSTOR_STATS_TIMER(var)          const int64_t var = esp_timer_get_time()
+    #define PSTOR_STATS_LATENCY(op, var)    statsRecordLatency(StorageStats::op, esp_timer_get_time() - (var))
+    #define PSTOR_STATS_INC(field)          statsAdd(&StorageStats::field, 1)
+    #define PSTOR_STATS_ADD(field, n)       statsAdd(&StorageStats::field, (n))
+#endif
+
+#endif // PERSISTENT_STORAGE_STATS_H
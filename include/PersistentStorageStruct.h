@@ -0,0 +1,147 @@
+#ifndef PERSISTENT_STORAGE_STRUCT_H
+#define PERSISTENT_STORAGE_STRUCT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "PersistentStorage.h"
+#include "PersistentStorageSchema.h"
+
+/**
+ * @brief One field of a struct parameter
+ *
+ * Generated by PSTORAGE_STRUCT_LAYOUT(); constant data in flash. The field
+ * is addressed as "<parameter>.<name>" by getJson()/setJson() and MQTT.
+ */
+struct StructField {
+    const char* name;
+    ParameterInfo::Type type;   // TYPE_BOOL, TYPE_INT, TYPE_FLOAT or TYPE_STRING
+    size_t offset;              // Offset in the struct
+    size_t size;                // Field size (string buffer size)
+    double min, max;            // Range of int and float fields
+};
+
+/**
+ * @brief Field list of a struct stored as one NVS blob
+ *
+ * The blob holds the layout version and each field tagged with a hash of
+ * its name, so fields can be added, removed or reordered: on load, fields
+ * are matched by name and type, new ones keep their defaults and dropped
+ * ones are ignored. A blob of another version is rewritten in the current
+ * layout.
+ */
+struct StructLayout {
+    const StructField* fields;
+    size_t count;
+    size_t size;                // sizeof the struct
+    uint16_t version;           // Stored with the blob; bump when the field list changes
+};
+
+/**
+ * @brief Tag of a field in the stored blob
+ */
+constexpr uint16_t structFieldTag(const char* name) {
+    return (uint16_t)(nvsKeyHash(name) ^ (nvsKeyHash(name) >> 16));
+}
+
+#if __cplusplus >= 201703L
+
+/**
+ * @brief Compile-time checks on a struct layout
+ */
+namespace pstorage_struct {
+
+template<typename T>
+struct FieldType {
+    static_assert(sizeof(T) == 0, "Struct fields must be bool, int32_t, float or char[]");
+};
+template<> struct FieldType<bool> { static constexpr ParameterInfo::Type type = ParameterInfo::TYPE_BOOL; };
+template<> struct FieldType<int32_t> { static constexpr ParameterInfo::Type type = ParameterInfo::TYPE_INT; };
+template<> struct FieldType<float> { static constexpr ParameterInfo::Type type = ParameterInfo::TYPE_FLOAT; };
+template<size_t N> struct FieldType<char[N]> { static constexpr ParameterInfo::Type type = ParameterInfo::TYPE_STRING; };
+
+template<size_t N>
+constexpr bool tagsUnique(const StructField (&fields)[N]) {
+    for (size_t i = 0; i < N; i++) {
+        for (size_t j = i + 1; j < N; j++) {
+            if (structFieldTag(fields[i].name) == structFieldTag(fields[j].name)) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+// Stored lengths are one byte
+template<size_t N>
+constexpr bool sizesValid(const StructField (&fields)[N]) {
+    for (size_t i = 0; i < N; i++) {
+        if (fields[i].size > 255 || (fields[i].type == ParameterInfo::TYPE_STRING && fields[i].size < 2)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+template<size_t N>
+constexpr bool rangesValid(const StructField (&fields)[N]) {
+    for (size_t i = 0; i < N; i++) {
+        if ((fields[i].type == ParameterInfo::TYPE_INT || fields[i].type == ParameterInfo::TYPE_FLOAT) &&
+            fields[i].min > fields[i].max) {
+            return false;
+        }
+    }
+    return true;
+}
+
+} // namespace pstorage_struct
+
+/**
+ * @brief Maps a struct to its layout
+ */
+template<typename T>
+struct StructLayoutOf;
+
+/**
+ * @brief Register a struct with a PSTORAGE_STRUCT_LAYOUT() as one parameter
+ */
+template<typename T>
+PersistentStorage::Result registerStruct(PersistentStorage& storage, const std::string& name, T& data,
+                                         const char* description = "",
+                                         ParameterInfo::Access access = ParameterInfo::ACCESS_READ_WRITE) {
+    return storage.registerStruct(name, &data, StructLayoutOf<T>::layout, description, access);
+}
+
+#define PSTOR_STRUCT_FIELD(field, lo, hi) \
+    { #field, pstorage_struct::FieldType<decltype(Type::field)>::type, \
+      offsetof(Type, field), sizeof(Type::field), (double)(lo), (double)(hi) },
+
+/**
+ * @brief Declare the stored fields of an existing struct
+ *
+ * LIST is an X-macro taking X(field, min, max) per field; the type is
+ * taken from the member (bool, int32_t, float or a char array). The range
+ * applies to int and float fields:
+ *
+ *   struct PidConfig { float kp, ki, kd; int32_t windup; bool enabled; };
+ *   #define PID_FIELDS(X) \
+ *       X(kp, 0, 100) X(ki, 0, 10) X(kd, 0, 10) X(windup, 0, 1000) X(enabled, 0, 1)
+ *   PSTORAGE_STRUCT_LAYOUT(PidConfig, 1, PID_FIELDS);
+ *
+ * Members left out of the list are neither stored nor exposed.
+ */
+#define PSTORAGE_STRUCT_LAYOUT(Name, Version, LIST) \
+    namespace Name##_layout { \
+        using Type = Name; \
+        inline constexpr StructField fields[] = { LIST(PSTOR_STRUCT_FIELD) }; \
+        static_assert(pstorage_struct::tagsUnique(fields), #Name ": field name tags collide, rename a field"); \
+        static_assert(pstorage_struct::sizesValid(fields), #Name ": string fields must hold 1 to 254 characters"); \
+        static_assert(pstorage_struct::rangesValid(fields), #Name ": field min above max"); \
+    } \
+    template<> struct StructLayoutOf<Name> { \
+        static constexpr StructLayout layout = { \
+            Name##_layout::fields, sizeof(Name##_layout::fields) / sizeof(StructField), sizeof(Name), Version }; \
+    }
+
+#endif // __cplusplus >= 201703L
+
+#endif // PERSISTENT_STORAGE_STRUCT_H
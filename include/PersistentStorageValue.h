@@ -0,0 +1,88 @@
+#ifndef PERSISTENT_STORAGE_VALUE_H
+#define PERSISTENT_STORAGE_VALUE_H
+
+#include <stdint.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+/**
+ * @brief Tear-free access to parameter values
+ *
+ * Scalars (bool, int32_t, uint32_t, int64_t, float, double, enum indexes
+ * and uint64_t counters) are read and written with single atomic loads
+ * and stores. Strings, blobs, arrays and structs are guarded by a
+ * per-parameter sequence lock: the counter is odd while a writer copies,
+ * and a reader retries its copy if the counter was odd or changed
+ * underneath it. Readers never take a lock; writers of the same parameter
+ * are serialized on the counter.
+ */
+struct ValueAccess {
+    // Spins before a waiting reader/writer sleeps for a tick, so that a
+    // preempted lower priority task can finish its copy
+    static constexpr uint32_t SPINS_BEFORE_SLEEP = 64;
+
+    template<typename T>
+    static T load(const void* ptr) {
+        T value;
+        __atomic_load(static_cast<const T*>(ptr), &value, __ATOMIC_ACQUIRE);
+        return value;
+    }
+
+    template<typename T>
+    static void store(void* ptr, T value) {
+        __atomic_store(static_cast<T*>(ptr), &value, __ATOMIC_RELEASE);
+    }
+
+    // Returns the new value
+    template<typename T>
+    static T add(void* ptr, T delta) {
+        return __atomic_add_fetch(static_cast<T*>(ptr), delta, __ATOMIC_ACQ_REL);
+    }
+
+    /**
+     * @brief Wait for a stable (even) sequence and return it
+     */
+    static uint32_t readBegin(const uint32_t& seq) {
+        for (uint32_t spins = 0;; spins++) {
+            uint32_t start = __atomic_load_n(&seq, __ATOMIC_ACQUIRE);
+            if ((start & 1) == 0) {
+                return start;
+            }
+            backoff(spins);
+        }
+    }
+
+    /**
+     * @brief Check whether the copy taken since readBegin() must be repeated
+     */
+    static bool readRetry(const uint32_t& seq, uint32_t start) {
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        return __atomic_load_n(&seq, __ATOMIC_RELAXED) != start;
+    }
+
+    static void writeBegin(uint32_t& seq) {
+        for (uint32_t spins = 0;; spins++) {
+            uint32_t current = __atomic_load_n(&seq, __ATOMIC_RELAXED);
+            if ((current & 1) == 0 &&
+                __atomic_compare_exchange_n(&seq, &current, current + 1, false,
+                                            __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+                break;
+            }
+            backoff(spins);
+        }
+        __atomic_thread_fence(__ATOMIC_RELEASE);
+    }
+
+    static void writeEnd(uint32_t& seq) {
+        __atomic_fetch_add(&seq, 1, __ATOMIC_RELEASE);
+    }
+
+private:
+    static void backoff(uint32_t spins) {
+        if (spins >= SPINS_BEFORE_SLEEP) {
+            vTaskDelay(1);
+        }
+    }
+};
+
+#endif // PERSISTENT_STORAGE_VALUE_H
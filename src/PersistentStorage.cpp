@@ -1,21 +1,791 @@
 #include "PersistentStorage.h"
+#include "PersistentStorageSchema.h"
+#include "PersistentStorageMigration.h"
+#include "PersistentStorageStruct.h"
+#include "PersistentStorageCompression.h"
 #include <algorithm>
+#include <cmath>
 #include <cstring>
+#include <map>
 #include <MQTTManager.h>
 #include <esp_task_wdt.h>
+#include <esp_timer.h>
+#include <esp_idf_version.h>
 #include <nvs.h>
 
+namespace {
+
+// Temporary NVS key -> parameter index table for one pass over the namespace.
+// A parameter can own several keys (array chunks).
+class NvsKeyIndex {
+public:
+    explicit NvsKeyIndex(size_t count) : table_(tableSize(count), 0) {
+        keys_.reserve(count);
+    }
+    
+    void add(size_t index, const char* key) {
+        keys_.emplace_back();
+        strncpy(keys_.back().str, key, sizeof(keys_.back().str) - 1);
+        keys_.back().index = index;
+        if (keys_.size() * 2 > table_.size()) {
+            rehash(table_.size() * 2);
+        } else {
+            insert(keys_.size() - 1);
+        }
+    }
+    
+    // Call fn(index) for every parameter stored under key (several if their
+    // hashed names collide); returns false if there is none
+    template<typename F>
+    bool forEach(const char* key, F fn) const {
+        bool matched = false;
+        for (size_t slot = nvsKeyHash(key) & mask(); table_[slot]; slot = (slot + 1) & mask()) {
+            const Key& entry = keys_[table_[slot] - 1];
+            if (strcmp(entry.str, key) == 0) {
+                matched = true;
+                fn(entry.index);
+            }
+        }
+        return matched;
+    }
+    
+    bool contains(const char* key) const {
+        return forEach(key, [](size_t) {});
+    }
+    
+private:
+    struct Key {
+        char str[NVS_KEY_NAME_MAX_SIZE] = {};
+        size_t index = 0;
+    };
+    
+    // Open addressing, at most half full
+    static size_t tableSize(size_t count) {
+        size_t size = 16;
+        while (size < count * 2) {
+            size <<= 1;
+        }
+        return size;
+    }
+    
+    size_t mask() const { return table_.size() - 1; }
+    
+    void insert(size_t key) {
+        size_t slot = nvsKeyHash(keys_[key].str) & mask();
+        while (table_[slot]) {
+            slot = (slot + 1) & mask();
+        }
+        table_[slot] = key + 1;
+    }
+    
+    void rehash(size_t size) {
+        table_.assign(size, 0);
+        for (size_t i = 0; i < keys_.size(); i++) {
+            insert(i);
+        }
+    }
+    
+    std::vector<Key> keys_;
+    std::vector<uint32_t> table_;   // Key + 1, 0 = empty slot
+};
+
+// Call fn(entry) for every entry of a namespace in the default partition.
+// Returns false if the namespace cannot be iterated.
+template<typename F>
+bool forEachNvsEntry(const char* namespaceName, F fn) {
+    nvs_entry_info_t entry;
+#if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(5, 0, 0)
+    nvs_iterator_t it = nullptr;
+    esp_err_t err = nvs_entry_find(NVS_DEFAULT_PART_NAME, namespaceName, NVS_TYPE_ANY, &it);
+    if (err != ESP_OK && err != ESP_ERR_NVS_NOT_FOUND) {
+        return false;
+    }
+    while (err == ESP_OK) {
+        nvs_entry_info(it, &entry);
+        fn(entry);
+        err = nvs_entry_next(&it);
+    }
+    nvs_release_iterator(it);
+#else
+    nvs_iterator_t it = nvs_entry_find(NVS_DEFAULT_PART_NAME, namespaceName, NVS_TYPE_ANY);
+    while (it) {
+        nvs_entry_info(it, &entry);
+        fn(entry);
+        it = nvs_entry_next(it);
+    }
+#endif
+    return true;
+}
+
+
+// Stored schema version; keys starting with '.' are reserved for the library
+const char* const SCHEMA_VERSION_KEY = ".schema";
+
+// NVS item type Preferences uses for a parameter type
+nvs_type_t nvsTypeOf(ParameterInfo::Type type) {
+    switch (type) {
+        case ParameterInfo::TYPE_BOOL:    return NVS_TYPE_U8;
+        case ParameterInfo::TYPE_ENUM:    return NVS_TYPE_U8;
+        case ParameterInfo::TYPE_INT:     return NVS_TYPE_I32;
+        case ParameterInfo::TYPE_UINT32:  return NVS_TYPE_U32;
+        case ParameterInfo::TYPE_INT64:   return NVS_TYPE_I64;
+        case ParameterInfo::TYPE_STRING:  return NVS_TYPE_STR;
+        case ParameterInfo::TYPE_COUNTER: return NVS_TYPE_U64;
+        default:                          return NVS_TYPE_BLOB; // Floats and doubles are blobs
+    }
+}
+
+// Read a string or blob item
+bool readNvsBytes(nvs_handle_t handle, const char* key, nvs_type_t type, std::vector<uint8_t>& data) {
+    size_t length = 0;
+    esp_err_t err = (type == NVS_TYPE_STR) ? nvs_get_str(handle, key, nullptr, &length)
+                                           : nvs_get_blob(handle, key, nullptr, &length);
+    if (err != ESP_OK) {
+        return false;
+    }
+    data.resize(length + 1);
+    err = (type == NVS_TYPE_STR) ? nvs_get_str(handle, key, (char*)data.data(), &length)
+                                 : nvs_get_blob(handle, key, data.data(), &length);
+    data.resize(length);
+    return err == ESP_OK;
+}
+
+template<typename T>
+esp_err_t copyNvsScalar(nvs_handle_t handle, const char* from, const char* to,
+                        esp_err_t (*get)(nvs_handle_t, const char*, T*),
+                        esp_err_t (*set)(nvs_handle_t, const char*, T)) {
+    T value;
+    esp_err_t err = get(handle, from, &value);
+    return err != ESP_OK ? err : set(handle, to, value);
+}
+
+// Copy an item of any type to another key
+esp_err_t copyNvsItem(nvs_handle_t handle, const char* from, const char* to, nvs_type_t type) {
+    switch (type) {
+        case NVS_TYPE_U8:  return copyNvsScalar<uint8_t>(handle, from, to, nvs_get_u8, nvs_set_u8);
+        case NVS_TYPE_I8:  return copyNvsScalar<int8_t>(handle, from, to, nvs_get_i8, nvs_set_i8);
+        case NVS_TYPE_U16: return copyNvsScalar<uint16_t>(handle, from, to, nvs_get_u16, nvs_set_u16);
+        case NVS_TYPE_I16: return copyNvsScalar<int16_t>(handle, from, to, nvs_get_i16, nvs_set_i16);
+        case NVS_TYPE_U32: return copyNvsScalar<uint32_t>(handle, from, to, nvs_get_u32, nvs_set_u32);
+        case NVS_TYPE_I32: return copyNvsScalar<int32_t>(handle, from, to, nvs_get_i32, nvs_set_i32);
+        case NVS_TYPE_U64: return copyNvsScalar<uint64_t>(handle, from, to, nvs_get_u64, nvs_set_u64);
+        case NVS_TYPE_I64: return copyNvsScalar<int64_t>(handle, from, to, nvs_get_i64, nvs_set_i64);
+        case NVS_TYPE_STR:
+        case NVS_TYPE_BLOB: {
+            std::vector<uint8_t> data;
+            if (!readNvsBytes(handle, from, type, data)) {
+                return ESP_FAIL;
+            }
+            return (type == NVS_TYPE_STR) ? nvs_set_str(handle, to, (const char*)data.data())
+                                          : nvs_set_blob(handle, to, data.data(), data.size());
+        }
+        default:
+            return ESP_ERR_NOT_SUPPORTED;
+    }
+}
+
+// Read a scalar or string value as number and text
+bool readNvsScalar(nvs_handle_t handle, const char* key, ParameterInfo::Type type,
+                   double& number, std::string& text) {
+    char buf[24];
+    switch (type) {
+        case ParameterInfo::TYPE_ENUM: {
+            // Only the index is stored; the names are not known here
+            uint8_t value;
+            if (nvs_get_u8(handle, key, &value) != ESP_OK) {
+                return false;
+            }
+            number = value;
+            snprintf(buf, sizeof(buf), "%u", value);
+            text = buf;
+            return true;
+        }
+        case ParameterInfo::TYPE_BOOL: {
+            uint8_t value;
+            if (nvs_get_u8(handle, key, &value) != ESP_OK) {
+                return false;
+            }
+            number = value ? 1 : 0;
+            text = value ? "true" : "false";
+            return true;
+        }
+        case ParameterInfo::TYPE_INT: {
+            int32_t value;
+            if (nvs_get_i32(handle, key, &value) != ESP_OK) {
+                return false;
+            }
+            number = value;
+            snprintf(buf, sizeof(buf), "%ld", (long)value);
+            text = buf;
+            return true;
+        }
+        case ParameterInfo::TYPE_FLOAT: {
+            float value;
+            size_t length = sizeof(value);
+            if (nvs_get_blob(handle, key, &value, &length) != ESP_OK || length != sizeof(value)) {
+                return false;
+            }
+            number = value;
+            snprintf(buf, sizeof(buf), "%g", value);
+            text = buf;
+            return true;
+        }
+        case ParameterInfo::TYPE_COUNTER: {
+            uint64_t value;
+            if (nvs_get_u64(handle, key, &value) != ESP_OK) {
+                return false;
+            }
+            number = (double)value;
+            snprintf(buf, sizeof(buf), "%llu", (unsigned long long)value);
+            text = buf;
+            return true;
+        }
+        case ParameterInfo::TYPE_UINT32: {
+            uint32_t value;
+            if (nvs_get_u32(handle, key, &value) != ESP_OK) {
+                return false;
+            }
+            number = value;
+            snprintf(buf, sizeof(buf), "%lu", (unsigned long)value);
+            text = buf;
+            return true;
+        }
+        case ParameterInfo::TYPE_INT64: {
+            int64_t value;
+            if (nvs_get_i64(handle, key, &value) != ESP_OK) {
+                return false;
+            }
+            number = (double)value;
+            snprintf(buf, sizeof(buf), "%lld", (long long)value);
+            text = buf;
+            return true;
+        }
+        case ParameterInfo::TYPE_DOUBLE: {
+            double value;
+            size_t length = sizeof(value);
+            if (nvs_get_blob(handle, key, &value, &length) != ESP_OK || length != sizeof(value)) {
+                return false;
+            }
+            number = value;
+            snprintf(buf, sizeof(buf), "%.17g", value);
+            text = buf;
+            return true;
+        }
+        case ParameterInfo::TYPE_STRING: {
+            std::vector<uint8_t> data;
+            if (!readNvsBytes(handle, key, NVS_TYPE_STR, data)) {
+                return false;
+            }
+            text.assign((const char*)data.data());
+            char* end = nullptr;
+            number = strtod(text.c_str(), &end);
+            if (text == "true") {
+                number = 1;
+            } else if (text == "false") {
+                number = 0;
+            } else if (end == text.c_str() || *end != '\0') {
+                number = NAN;   // Not a number: only convertible to string
+            }
+            return true;
+        }
+        default:
+            return false;
+    }
+}
+
+// Write a converted value; ESP_ERR_NOT_SUPPORTED if it cannot be represented
+esp_err_t writeNvsScalar(nvs_handle_t handle, const char* key, ParameterInfo::Type type,
+                         double number, const std::string& text) {
+    const esp_err_t unrepresentable = ESP_ERR_NOT_SUPPORTED;
+    if (type != ParameterInfo::TYPE_STRING && std::isnan(number)) {
+        return unrepresentable;
+    }
+    switch (type) {
+        case ParameterInfo::TYPE_BOOL:
+            return nvs_set_u8(handle, key, number != 0);
+        case ParameterInfo::TYPE_INT: {
+            double clamped = std::max<double>(INT32_MIN, std::min<double>(INT32_MAX, std::round(number)));
+            return nvs_set_i32(handle, key, (int32_t)clamped);
+        }
+        case ParameterInfo::TYPE_FLOAT: {
+            float value = (float)number;
+            return nvs_set_blob(handle, key, &value, sizeof(value));
+        }
+        case ParameterInfo::TYPE_COUNTER:
+            return number >= 0 ? nvs_set_u64(handle, key, (uint64_t)std::llround(number)) : unrepresentable;
+        case ParameterInfo::TYPE_UINT32:
+            return (number >= 0 && number <= UINT32_MAX)
+                 ? nvs_set_u32(handle, key, (uint32_t)std::llround(number)) : unrepresentable;
+        case ParameterInfo::TYPE_INT64:
+            return std::fabs(number) < 9.2e18 ? nvs_set_i64(handle, key, std::llround(number)) : unrepresentable;
+        case ParameterInfo::TYPE_DOUBLE:
+            return nvs_set_blob(handle, key, &number, sizeof(number));
+        case ParameterInfo::TYPE_ENUM:
+            // Index only: strings become enums when loaded into the registered parameter
+            return (number >= 0 && number <= UINT8_MAX)
+                 ? nvs_set_u8(handle, key, (uint8_t)std::lround(number)) : unrepresentable;
+        case ParameterInfo::TYPE_STRING:
+            return nvs_set_str(handle, key, text.c_str());
+        default:
+            return unrepresentable;
+    }
+}
+
+// Retype in progress: the converted value and the key it belongs to
+const char* const MIGRATION_VALUE_KEY = ".migval";
+const char* const MIGRATION_TARGET_KEY = ".migkey";
+
+// Move a converted value from the temporary key to its own key and remove
+// the temporary. Safe to repeat after a power cut at any point: an item
+// still under the own key (old value not yet erased, or already copied) wins.
+esp_err_t finishRetype(nvs_handle_t handle, std::map<std::string, nvs_type_t>& types) {
+    auto value = types.find(MIGRATION_VALUE_KEY);
+    std::vector<uint8_t> target;
+    if (value != types.end() && readNvsBytes(handle, MIGRATION_TARGET_KEY, NVS_TYPE_STR, target)) {
+        const char* key = (const char*)target.data();
+        if (!types.count(key)) {
+            esp_err_t err = copyNvsItem(handle, MIGRATION_VALUE_KEY, key, value->second);
+            if (err == ESP_OK) {
+                err = nvs_commit(handle);
+            }
+            if (err != ESP_OK) {
+                return err;
+            }
+            types[key] = value->second;
+        }
+    }
+    nvs_erase_key(handle, MIGRATION_VALUE_KEY);
+    nvs_erase_key(handle, MIGRATION_TARGET_KEY);
+    types.erase(MIGRATION_VALUE_KEY);
+    types.erase(MIGRATION_TARGET_KEY);
+    return nvs_commit(handle);
+}
+
+// Snapshot images (SaveMode::SNAPSHOT): two slots and the active slot index.
+// An image is the header, entries of NUL-terminated NVS key, type, 16-bit
+// length and value, and a CRC-32 of everything before it.
+const char* const SNAPSHOT_ACTIVE_KEY = ".snap";
+const char* const SNAPSHOT_SLOT_KEYS[2] = {".snapA", ".snapB"};
+const uint32_t SNAPSHOT_MAGIC = 0x50534E31;    // "PSN1"
+
+struct SnapshotHeader {
+    uint32_t magic;
+    uint32_t sequence;
+    uint16_t count;
+    uint16_t reserved;
+};
+
+// Running CRC-32: start with 0xFFFFFFFF, invert the result
+uint32_t crc32Update(uint32_t crc, const uint8_t* data, size_t length) {
+    for (size_t i = 0; i < length; i++) {
+        crc ^= data[i];
+        for (int bit = 0; bit < 8; bit++) {
+            crc = (crc >> 1) ^ (0xEDB88320 & (0 - (crc & 1)));
+        }
+    }
+    return crc;
+}
+
+uint32_t crc32(const uint8_t* data, size_t length) {
+    return ~crc32Update(0xFFFFFFFF, data, length);
+}
+
+// Compressed strings and blobs are stored as NVS blobs: magic, codec, the
+// 16-bit original length and CRC-32 of the original, then the LZSS data.
+// The CRC tells a compressed value from a plain blob with the same start.
+const uint8_t COMPRESSED_MAGIC[2] = {0xC5, 0x7A};
+const size_t COMPRESSED_HEADER_SIZE = 9;
+const size_t NVS_ENTRY_SIZE = 32;
+
+size_t nvsDataEntries(size_t bytes) {
+    return (bytes + NVS_ENTRY_SIZE - 1) / NVS_ENTRY_SIZE;
+}
+
+// Compressed value with header into packed, if it fits into fewer than
+// maxEntries NVS data entries
+bool compressValue(const uint8_t* data, size_t length, size_t maxEntries, std::vector<uint8_t>& packed) {
+    if (length > UINT16_MAX || maxEntries < 2 || (maxEntries - 1) * NVS_ENTRY_SIZE <= COMPRESSED_HEADER_SIZE) {
+        return false;
+    }
+    packed.resize((maxEntries - 1) * NVS_ENTRY_SIZE);
+    size_t n = LzCodec::compress(data, length, packed.data() + COMPRESSED_HEADER_SIZE,
+                                 packed.size() - COMPRESSED_HEADER_SIZE);
+    if (n == 0) {
+        return false;
+    }
+    uint32_t crc = crc32(data, length);
+    packed[0] = COMPRESSED_MAGIC[0];
+    packed[1] = COMPRESSED_MAGIC[1];
+    packed[2] = ParameterInfo::COMPRESS_LZ;
+    packed[3] = (uint8_t)(length & 0xFF);
+    packed[4] = (uint8_t)(length >> 8);
+    memcpy(&packed[5], &crc, sizeof(crc));
+    packed.resize(COMPRESSED_HEADER_SIZE + n);
+    return true;
+}
+
+// Decompress a stored value into at most capacity bytes; false if it is
+// not a compressed value
+bool decompressValue(const uint8_t* packed, size_t length, uint8_t* out, size_t capacity, size_t& outLength) {
+    if (length < COMPRESSED_HEADER_SIZE || packed[0] != COMPRESSED_MAGIC[0] ||
+        packed[1] != COMPRESSED_MAGIC[1] || packed[2] != ParameterInfo::COMPRESS_LZ) {
+        return false;
+    }
+    size_t original = packed[3] | (size_t)packed[4] << 8;
+    uint32_t crc;
+    memcpy(&crc, &packed[5], sizeof(crc));
+    if (original > capacity ||
+        !LzCodec::decompress(packed + COMPRESSED_HEADER_SIZE, length - COMPRESSED_HEADER_SIZE, out, original) ||
+        crc32(out, original) != crc) {
+        return false;
+    }
+    outLength = original;
+    return true;
+}
+
+// Streamed blobs: a manifest ".s<name hash>" and chunks ".s<name hash><set><chunk>"
+// in one of two chunk sets; the manifest names the live set
+const uint32_t STREAM_MAGIC = 0x50534231;      // "PSB1"
+
+struct StreamManifest {
+    uint32_t magic;
+    uint32_t size;
+    uint32_t crc;
+    uint16_t chunkSize;
+    uint8_t generation;     // Live chunk set, 0 or 1
+    uint8_t reserved;
+};
+
+void streamManifestKey(uint32_t hash, char* key) {
+    snprintf(key, NVS_KEY_NAME_MAX_SIZE, ".s%08lx", (unsigned long)hash);
+}
+
+void streamChunkKey(uint32_t hash, uint8_t generation, size_t chunk, char* key) {
+    snprintf(key, NVS_KEY_NAME_MAX_SIZE, ".s%08lx%u%02x", (unsigned long)hash, (unsigned)generation,
+             (unsigned)chunk);
+}
+
+size_t streamChunkCount(size_t size, size_t chunkSize) {
+    return (size + chunkSize - 1) / chunkSize;
+}
+
+bool readStreamManifest(Preferences& preferences, uint32_t hash, StreamManifest& manifest) {
+    char key[NVS_KEY_NAME_MAX_SIZE];
+    streamManifestKey(hash, key);
+    return preferences.getBytesLength(key) == sizeof(manifest) &&
+           preferences.getBytes(key, &manifest, sizeof(manifest)) == sizeof(manifest) &&
+           manifest.magic == STREAM_MAGIC && manifest.chunkSize > 0 && manifest.generation < 2;
+}
+
+// Erase chunks last to first, so an interrupted erase leaves a prefix
+// that the next cleanup still finds
+void eraseStreamChunks(Preferences& preferences, uint32_t hash, uint8_t generation, size_t count) {
+    char key[NVS_KEY_NAME_MAX_SIZE];
+    while (count > 0) {
+        streamChunkKey(hash, generation, --count, key);
+        preferences.remove(key);
+    }
+}
+
+// Whether a snapshot value of length bytes can be stored in a parameter
+bool snapshotValueFits(const ParameterInfo& param, size_t length) {
+    switch (param.type) {
+        case ParameterInfo::TYPE_STRING: return length < param.size;
+        case ParameterInfo::TYPE_BLOB:   return length > 0 && length <= param.size;
+        case ParameterInfo::TYPE_STRUCT: return length >= 4;   // Decoded field by field
+        default:                         return length == param.size;
+    }
+}
+
+// Base64 (RFC 4648, padded) carries blob values in JSON and MQTT
+const char BASE64_ALPHABET[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+size_t base64Length(size_t bytes) {
+    return (bytes + 2) / 3 * 4;
+}
+
+// Encode into base64Length(length) characters at out, without terminator
+void base64Encode(const uint8_t* data, size_t length, char* out) {
+    for (size_t i = 0; i < length; i += 3) {
+        uint32_t n = (uint32_t)data[i] << 16;
+        if (i + 1 < length) {
+            n |= (uint32_t)data[i + 1] << 8;
+        }
+        if (i + 2 < length) {
+            n |= data[i + 2];
+        }
+        *out++ = BASE64_ALPHABET[(n >> 18) & 63];
+        *out++ = BASE64_ALPHABET[(n >> 12) & 63];
+        *out++ = (i + 1 < length) ? BASE64_ALPHABET[(n >> 6) & 63] : '=';
+        *out++ = (i + 2 < length) ? BASE64_ALPHABET[n & 63] : '=';
+    }
+}
+
+int base64Value(char c) {
+    if (c >= 'A' && c <= 'Z') return c - 'A';
+    if (c >= 'a' && c <= 'z') return c - 'a' + 26;
+    if (c >= '0' && c <= '9') return c - '0' + 52;
+    if (c == '+') return 62;
+    if (c == '/') return 63;
+    return -1;
+}
+
+size_t base64Padding(const char* text, size_t length) {
+    size_t padding = 0;
+    while (padding < 2 && padding < length && text[length - 1 - padding] == '=') {
+        padding++;
+    }
+    return padding;
+}
+
+// Decoded size of base64 text, SIZE_MAX if its length is not a multiple of 4
+size_t base64DecodedLength(const char* text, size_t length) {
+    if (length % 4 != 0) {
+        return SIZE_MAX;
+    }
+    return length / 4 * 3 - base64Padding(text, length);
+}
+
+// Decode into out, which holds base64DecodedLength() bytes; false if malformed
+bool base64Decode(const char* text, size_t length, uint8_t* out) {
+    size_t decoded = base64DecodedLength(text, length);
+    if (decoded == SIZE_MAX) {
+        return false;
+    }
+    size_t dataChars = length - base64Padding(text, length);
+    size_t pos = 0;
+    for (size_t i = 0; i < length; i += 4) {
+        uint32_t n = 0;
+        for (size_t j = 0; j < 4; j++) {
+            int value = (i + j < dataChars) ? base64Value(text[i + j]) : 0;
+            if (value < 0) {
+                return false;
+            }
+            n = (n << 6) | (uint32_t)value;
+        }
+        for (size_t j = 0; j < 3 && pos < decoded; j++) {
+            out[pos++] = (uint8_t)(n >> (16 - 8 * j));
+        }
+    }
+    return true;
+}
+
+// Bytes [offset, offset + count) of a blob as base64 in "value", read without tearing
+void blobSliceToJson(const ParameterInfo& param, JsonObject root, size_t offset, size_t count) {
+    offset = std::min(offset, param.size);
+    count = std::min(count, param.size - offset);
+    std::string text(base64Length(count), '\0');
+    uint32_t start;
+    do {
+        start = ValueAccess::readBegin(param.sequence);
+        base64Encode((const uint8_t*)param.dataPtr + offset, count, &text[0]);
+    } while (ValueAccess::readRetry(param.sequence, start));
+    root["offset"] = offset;
+    root["value"] = text;
+}
+
+// Index of an enum name, -1 if the table does not contain it
+int enumIndexOf(const ParameterInfo& param, const char* name) {
+    for (uint16_t i = 0; i < param.constraints.enumeration.count; i++) {
+        if (strcmp(param.constraints.enumeration.names[i], name) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// Arrays are stored in chunks of ARRAY_CHUNK_SIZE bytes under
+// "h<name hash>#<chunk>", so that an element update rewrites one chunk
+const size_t ARRAY_CHUNK_SIZE = 64;
+const size_t ARRAY_MAX_CHUNKS = 256;
+
+size_t elementSize(ParameterInfo::Type type) {
+    switch (type) {
+        case ParameterInfo::TYPE_BOOL:  return sizeof(bool);
+        case ParameterInfo::TYPE_INT:   return sizeof(int32_t);
+        case ParameterInfo::TYPE_FLOAT: return sizeof(float);
+        default:                        return 0;
+    }
+}
+
+size_t arrayChunkCount(const ParameterInfo& param) {
+    return (param.size + ARRAY_CHUNK_SIZE - 1) / ARRAY_CHUNK_SIZE;
+}
+
+void arrayChunkKey(const char* name, size_t chunk, char* key) {
+    snprintf(key, NVS_KEY_NAME_MAX_SIZE, "h%08lx#%02x", (unsigned long)nvsKeyHash(name), (unsigned)chunk);
+}
+
+// Chunk number of an array chunk key, -1 if it is none
+long arrayChunkOf(const char* key) {
+    const char* hash = strchr(key, '#');
+    return (key[0] == 'h' && hash) ? strtol(hash + 1, nullptr, 16) : -1;
+}
+
+// Convert a JSON number or bool to an array element
+bool elementFromJson(ParameterInfo::Type type, JsonVariantConst json, void* out) {
+    if (!json.is<float>() && !json.is<bool>()) {
+        return false;
+    }
+    switch (type) {
+        case ParameterInfo::TYPE_BOOL:  *(bool*)out = json.as<bool>(); return true;
+        case ParameterInfo::TYPE_INT:   *(int32_t*)out = json.as<int32_t>(); return true;
+        case ParameterInfo::TYPE_FLOAT: *(float*)out = json.as<float>(); return true;
+        default:                        return false;
+    }
+}
+
+void elementToJson(ParameterInfo::Type type, const uint8_t* element, JsonArray array) {
+    switch (type) {
+        case ParameterInfo::TYPE_BOOL:
+            array.add(*(const bool*)element);
+            break;
+        case ParameterInfo::TYPE_INT: {
+            int32_t value;
+            memcpy(&value, element, sizeof(value));
+            array.add(value);
+            break;
+        }
+        case ParameterInfo::TYPE_FLOAT: {
+            float value;
+            memcpy(&value, element, sizeof(value));
+            array.add(value);
+            break;
+        }
+        default:
+            break;
+    }
+}
+
+// Struct blobs: 16-bit layout version and field count, then per field its
+// 16-bit name tag, type, length and value (strings without terminator)
+const StructField* findStructField(const StructLayout& layout, const char* name) {
+    for (size_t i = 0; i < layout.count; i++) {
+        if (strcmp(layout.fields[i].name, name) == 0) {
+            return &layout.fields[i];
+        }
+    }
+    return nullptr;
+}
+
+void encodeStruct(const ParameterInfo& param, std::vector<uint8_t>& out) {
+    const StructLayout& layout = *param.constraints.structure.layout;
+    std::vector<uint8_t> copy(param.size);
+    PersistentStorage::readConsistent(param, copy.data(), copy.size());
+    
+    out.clear();
+    out.push_back((uint8_t)(layout.version & 0xFF));
+    out.push_back((uint8_t)(layout.version >> 8));
+    out.push_back((uint8_t)(layout.count & 0xFF));
+    out.push_back((uint8_t)(layout.count >> 8));
+    for (size_t i = 0; i < layout.count; i++) {
+        const StructField& field = layout.fields[i];
+        const uint8_t* value = &copy[field.offset];
+        size_t length = (field.type == ParameterInfo::TYPE_STRING)
+                      ? strnlen((const char*)value, field.size - 1) : field.size;
+        uint16_t tag = structFieldTag(field.name);
+        out.push_back((uint8_t)(tag & 0xFF));
+        out.push_back((uint8_t)(tag >> 8));
+        out.push_back((uint8_t)field.type);
+        out.push_back((uint8_t)length);
+        out.insert(out.end(), value, value + length);
+    }
+}
+
+// Convert a JSON value into a field of the struct at base
+bool fieldFromJson(const StructField& field, JsonVariantConst json, uint8_t* base) {
+    uint8_t* out = base + field.offset;
+    switch (field.type) {
+        case ParameterInfo::TYPE_BOOL:
+        case ParameterInfo::TYPE_INT:
+        case ParameterInfo::TYPE_FLOAT:
+            return elementFromJson(field.type, json, out);
+        case ParameterInfo::TYPE_STRING: {
+            const char* text = json.as<const char*>();
+            if (!text || strlen(text) >= field.size) {
+                return false;
+            }
+            memcpy(out, text, strlen(text) + 1);
+            return true;
+        }
+        default:
+            return false;
+    }
+}
+
+void fieldValueToJson(const StructField& field, const uint8_t* base, JsonObject object, const char* key) {
+    const uint8_t* value = base + field.offset;
+    switch (field.type) {
+        case ParameterInfo::TYPE_BOOL:
+            object[key] = *(const bool*)value;
+            break;
+        case ParameterInfo::TYPE_INT: {
+            int32_t number;
+            memcpy(&number, value, sizeof(number));
+            object[key] = number;
+            break;
+        }
+        case ParameterInfo::TYPE_FLOAT: {
+            float number;
+            memcpy(&number, value, sizeof(number));
+            object[key] = number;
+            break;
+        }
+        case ParameterInfo::TYPE_STRING:
+            object[key] = std::string((const char*)value, strnlen((const char*)value, field.size));
+            break;
+        default:
+            break;
+    }
+}
+
+} // namespace
+
 // Constructor
 PersistentStorage::PersistentStorage(const char* namespaceName, const char* mqttPrefix) 
     : namespaceName_(namespaceName)
     , mqttPrefix_(mqttPrefix)
     , initialized_(false)
+    , loadStrategy_(LoadStrategy::ITERATE)
+    , saveMode_(SaveMode::PER_KEY)
+    , snapshotMutex_(nullptr)
+    , snapshotSlot_(-1)
+    , snapshotSequence_(0)
+    , blobMutex_(nullptr)
+    , counterMutex_(nullptr)
+    , schemaVersion_(0)
+    , migrations_(nullptr)
+    , migrationCount_(0)
+    , registrationDepth_(0)
     , mqttManager_(nullptr)
     , commandQueue_(nullptr)
     , isPublishing_(false)
     , nextParamIndex_(0)
     , totalParams_(0)
-    , publishMutex_(nullptr) {
+    , publishMutex_(nullptr)
+    , serviceTask_(nullptr)
+    , serviceExited_(nullptr)
+    , serviceRunning_(false)
+    , nextGcMs_(0)
+    , deferredMutex_(nullptr)
+    , flushDeadlineMs_(0)
+    , notifyMutex_(nullptr)
+    , nextSubscriptionId_(1)
+    , nextBatchId_(1)
+    , batchDepth_(0)
+    , changeQueue_(nullptr)
+    , dispatcherTask_(nullptr)
+    , dispatcherExited_(nullptr)
+    , dispatcherRunning_(false)
+    , pendingCommands_(0)
+    , maxPacketSize_(DEFAULT_MAX_PACKET_SIZE)
+    , outputBuffers_()
+    , outputBuffersBusy_(0) {
+    
+#ifndef PSTORAGE_DISABLE_STATS
+    portMUX_INITIALIZE(&statsMux_);
+    memset(&stats_, 0, sizeof(stats_));
+#endif
     
     // Create command queue
     commandQueue_ = xQueueCreate(COMMAND_QUEUE_SIZE, sizeof(ParameterCommand));
@@ -28,10 +798,38 @@ PersistentStorage::PersistentStorage(const char* namespaceName, const char* mqtt
     if (!publishMutex_) {
         PSTOR_LOG_E( "Failed to create publish mutex");
     }
+    
+    deferredMutex_ = xSemaphoreCreateMutex();
+    if (!deferredMutex_) {
+        PSTOR_LOG_E( "Failed to create deferred save mutex");
+    }
+    
+    notifyMutex_ = xSemaphoreCreateMutex();
+    if (!notifyMutex_) {
+        PSTOR_LOG_E( "Failed to create notification mutex");
+    }
+    
+    snapshotMutex_ = xSemaphoreCreateMutex();
+    if (!snapshotMutex_) {
+        PSTOR_LOG_E( "Failed to create snapshot mutex");
+    }
+    
+    counterMutex_ = xSemaphoreCreateMutex();
+    if (!counterMutex_) {
+        PSTOR_LOG_E( "Failed to create counter mutex");
+    }
+    
+    blobMutex_ = xSemaphoreCreateMutex();
+    if (!blobMutex_) {
+        PSTOR_LOG_E( "Failed to create blob transfer mutex");
+    }
 }
 
 // Destructor
 PersistentStorage::~PersistentStorage() {
+    stopServiceTask();
+    stopDispatcher();
+    
     if (initialized_) {
         end();
     }
@@ -42,11 +840,41 @@ PersistentStorage::~PersistentStorage() {
         commandQueue_ = nullptr;
     }
     
-    // Delete mutex
+    // Delete mutexes
     if (publishMutex_) {
         vSemaphoreDelete(publishMutex_);
         publishMutex_ = nullptr;
     }
+    if (deferredMutex_) {
+        vSemaphoreDelete(deferredMutex_);
+        deferredMutex_ = nullptr;
+    }
+    if (notifyMutex_) {
+        vSemaphoreDelete(notifyMutex_);
+        notifyMutex_ = nullptr;
+    }
+    if (snapshotMutex_) {
+        vSemaphoreDelete(snapshotMutex_);
+        snapshotMutex_ = nullptr;
+    }
+    if (counterMutex_) {
+        vSemaphoreDelete(counterMutex_);
+        counterMutex_ = nullptr;
+    }
+    if (blobMutex_) {
+        vSemaphoreDelete(blobMutex_);
+        blobMutex_ = nullptr;
+    }
+    if (dispatcherExited_) {
+        vSemaphoreDelete(dispatcherExited_);
+        dispatcherExited_ = nullptr;
+    }
+    
+    // Free output buffer pool
+    for (size_t i = 0; i < OUTPUT_BUFFER_COUNT; i++) {
+        free(outputBuffers_[i]);
+        outputBuffers_[i] = nullptr;
+    }
 }
 
 // Initialize the storage system
@@ -67,6 +895,9 @@ bool PersistentStorage::begin() {
     PSTOR_LOG_I( "Initialized with namespace: %s", 
                              namespaceName_.c_str());
     
+    // Bring stored data up to the declared schema before reading it
+    runMigrations();
+    
     // Load all registered parameters
     loadAll();
     
@@ -79,7 +910,11 @@ void PersistentStorage::end() {
         return;
     }
     
-    // Save all parameters before closing
+    // Save all parameters before closing - this covers pending deferred saves
+    if (deferredMutex_ && xSemaphoreTake(deferredMutex_, portMAX_DELAY) == pdTRUE) {
+        deferredSaves_.clear();
+        xSemaphoreGive(deferredMutex_);
+    }
     saveAll();
     
     preferences_.end();
@@ -91,7 +926,7 @@ void PersistentStorage::end() {
 // Register a boolean parameter
 PersistentStorage::Result PersistentStorage::registerBool(
     const std::string& name, bool* dataPtr, 
-    const std::string& description,
+    const char* description,
     ParameterInfo::Access access) {
     
     if (!validateParameterName(name)) {
@@ -99,22 +934,19 @@ PersistentStorage::Result PersistentStorage::registerBool(
     }
     
     ParameterInfo info;
-    info.name = name;
     info.description = description;
     info.type = ParameterInfo::TYPE_BOOL;
     info.access = access;
     info.dataPtr = dataPtr;
     info.size = sizeof(bool);
     
-    parameters_[name] = info;
+    Result res = insertParameter(name, info);
+    if (res != Result::SUCCESS) {
+        return res;
+    }
     
     PSTOR_LOG_D( "Registered bool parameter: %s", name.c_str());
     
-    // Load value if storage is already initialized
-    if (initialized_) {
-        load(name);
-    }
-    
     return Result::SUCCESS;
 }
 
@@ -122,7 +954,7 @@ PersistentStorage::Result PersistentStorage::registerBool(
 PersistentStorage::Result PersistentStorage::registerInt(
     const std::string& name, int32_t* dataPtr,
     int32_t minVal, int32_t maxVal,
-    const std::string& description,
+    const char* description,
     ParameterInfo::Access access) {
     
     if (!validateParameterName(name)) {
@@ -130,7 +962,6 @@ PersistentStorage::Result PersistentStorage::registerInt(
     }
     
     ParameterInfo info;
-    info.name = name;
     info.description = description;
     info.type = ParameterInfo::TYPE_INT;
     info.access = access;
@@ -139,15 +970,14 @@ PersistentStorage::Result PersistentStorage::registerInt(
     info.constraints.intRange.min = minVal;
     info.constraints.intRange.max = maxVal;
     
-    parameters_[name] = info;
+    Result res = insertParameter(name, info);
+    if (res != Result::SUCCESS) {
+        return res;
+    }
     
     PSTOR_LOG_D( "Registered int parameter: %s [%d-%d]", 
                              name.c_str(), minVal, maxVal);
     
-    if (initialized_) {
-        load(name);
-    }
-    
     return Result::SUCCESS;
 }
 
@@ -155,7 +985,7 @@ PersistentStorage::Result PersistentStorage::registerInt(
 PersistentStorage::Result PersistentStorage::registerFloat(
     const std::string& name, float* dataPtr,
     float minVal, float maxVal,
-    const std::string& description,
+    const char* description,
     ParameterInfo::Access access) {
     
     if (!validateParameterName(name)) {
@@ -163,7 +993,6 @@ PersistentStorage::Result PersistentStorage::registerFloat(
     }
     
     ParameterInfo info;
-    info.name = name;
     info.description = description;
     info.type = ParameterInfo::TYPE_FLOAT;
     info.access = access;
@@ -172,22 +1001,173 @@ PersistentStorage::Result PersistentStorage::registerFloat(
     info.constraints.floatRange.min = minVal;
     info.constraints.floatRange.max = maxVal;
     
-    parameters_[name] = info;
+    Result res = insertParameter(name, info);
+    if (res != Result::SUCCESS) {
+        return res;
+    }
     
     PSTOR_LOG_D( "Registered float parameter: %s [%.2f-%.2f]", 
                              name.c_str(), minVal, maxVal);
     
-    if (initialized_) {
-        load(name);
+    return Result::SUCCESS;
+}
+
+// Register a 64-bit integer parameter
+PersistentStorage::Result PersistentStorage::registerInt64(
+    const std::string& name, int64_t* dataPtr,
+    int64_t minVal, int64_t maxVal,
+    const char* description,
+    ParameterInfo::Access access) {
+    
+    if (!validateParameterName(name)) {
+        return Result::ERROR_INVALID_NAME;
+    }
+    
+    WideRange range;
+    range.int64Range.min = minVal;
+    range.int64Range.max = maxVal;
+    
+    ParameterInfo info;
+    info.description = description;
+    info.type = ParameterInfo::TYPE_INT64;
+    info.access = access;
+    info.dataPtr = dataPtr;
+    info.size = sizeof(int64_t);
+    info.constraints.wide.range = addWideRange(name, range);
+    
+    Result res = insertParameter(name, info);
+    if (res != Result::SUCCESS) {
+        return res;
+    }
+    
+    PSTOR_LOG_D( "Registered int64 parameter: %s [%lld-%lld]",
+                             name.c_str(), (long long)minVal, (long long)maxVal);
+    
+    return Result::SUCCESS;
+}
+
+// Register an unsigned 32-bit parameter
+PersistentStorage::Result PersistentStorage::registerUInt32(
+    const std::string& name, uint32_t* dataPtr,
+    uint32_t minVal, uint32_t maxVal,
+    const char* description,
+    ParameterInfo::Access access) {
+    
+    if (!validateParameterName(name)) {
+        return Result::ERROR_INVALID_NAME;
+    }
+    
+    ParameterInfo info;
+    info.description = description;
+    info.type = ParameterInfo::TYPE_UINT32;
+    info.access = access;
+    info.dataPtr = dataPtr;
+    info.size = sizeof(uint32_t);
+    info.constraints.uintRange.min = minVal;
+    info.constraints.uintRange.max = maxVal;
+    
+    Result res = insertParameter(name, info);
+    if (res != Result::SUCCESS) {
+        return res;
+    }
+    
+    PSTOR_LOG_D( "Registered uint32 parameter: %s [%lu-%lu]",
+                             name.c_str(), (unsigned long)minVal, (unsigned long)maxVal);
+    
+    return Result::SUCCESS;
+}
+
+// Register a double parameter
+PersistentStorage::Result PersistentStorage::registerDouble(
+    const std::string& name, double* dataPtr,
+    double minVal, double maxVal,
+    const char* description,
+    ParameterInfo::Access access) {
+    
+    if (!validateParameterName(name)) {
+        return Result::ERROR_INVALID_NAME;
+    }
+    
+    WideRange range;
+    range.doubleRange.min = minVal;
+    range.doubleRange.max = maxVal;
+    
+    ParameterInfo info;
+    info.description = description;
+    info.type = ParameterInfo::TYPE_DOUBLE;
+    info.access = access;
+    info.dataPtr = dataPtr;
+    info.size = sizeof(double);
+    info.constraints.wide.range = addWideRange(name, range);
+    
+    Result res = insertParameter(name, info);
+    if (res != Result::SUCCESS) {
+        return res;
+    }
+    
+    PSTOR_LOG_D( "Registered double parameter: %s [%g-%g]",
+                             name.c_str(), minVal, maxVal);
+    
+    return Result::SUCCESS;
+}
+
+// Register an enum stored as its index
+PersistentStorage::Result PersistentStorage::registerEnum(
+    const std::string& name, uint8_t* dataPtr,
+    const char* const* names, size_t count,
+    const char* description,
+    ParameterInfo::Access access) {
+    
+    if (!validateParameterName(name)) {
+        return Result::ERROR_INVALID_NAME;
+    }
+    if (!names || count == 0 || count > 256) {
+        return Result::ERROR_VALIDATION_FAILED;
+    }
+    
+    ParameterInfo info;
+    info.description = description;
+    info.type = ParameterInfo::TYPE_ENUM;
+    info.access = access;
+    info.dataPtr = dataPtr;
+    info.size = sizeof(uint8_t);
+    info.constraints.enumeration.names = names;
+    info.constraints.enumeration.count = (uint16_t)count;
+    
+    Result res = insertParameter(name, info);
+    if (res != Result::SUCCESS) {
+        return res;
     }
     
+    PSTOR_LOG_D( "Registered enum parameter: %s (%d names)",
+                             name.c_str(), count);
+    
     return Result::SUCCESS;
 }
 
+// Keep int64/double bounds in a stable slot referenced by the entry. A
+// re-registered int64/double parameter gets its slot overwritten.
+const WideRange* PersistentStorage::addWideRange(const std::string& name, const WideRange& range) {
+    RegistryLock::WriteGuard guard(registryLock_);
+    if (!guard.owns()) {
+        return nullptr;                 // insertParameter() reports it
+    }
+    const ParameterInfo* entry = findParameter(name);
+    if (entry && (entry->type == ParameterInfo::TYPE_INT64 || entry->type == ParameterInfo::TYPE_DOUBLE) &&
+        entry->constraints.wide.range) {
+        // Slots live in wideRanges_; readers hold the registry lock
+        WideRange* slot = const_cast<WideRange*>(entry->constraints.wide.range);
+        *slot = range;
+        return slot;
+    }
+    wideRanges_.push_back(range);
+    return &wideRanges_.back();
+}
+
 // Register a string parameter
 PersistentStorage::Result PersistentStorage::registerString(
     const std::string& name, char* dataPtr, size_t maxLen,
-    const std::string& description,
+    const char* description,
     ParameterInfo::Access access) {
     
     if (!validateParameterName(name)) {
@@ -195,7 +1175,6 @@ PersistentStorage::Result PersistentStorage::registerString(
     }
     
     ParameterInfo info;
-    info.name = name;
     info.description = description;
     info.type = ParameterInfo::TYPE_STRING;
     info.access = access;
@@ -203,22 +1182,21 @@ PersistentStorage::Result PersistentStorage::registerString(
     info.size = maxLen;
     info.constraints.stringMax.maxLen = maxLen;
     
-    parameters_[name] = info;
+    Result res = insertParameter(name, info);
+    if (res != Result::SUCCESS) {
+        return res;
+    }
     
     PSTOR_LOG_D( "Registered string parameter: %s (max %d)", 
                              name.c_str(), maxLen);
     
-    if (initialized_) {
-        load(name);
-    }
-    
     return Result::SUCCESS;
 }
 
 // Register a binary blob parameter
 PersistentStorage::Result PersistentStorage::registerBlob(
     const std::string& name, void* dataPtr, size_t size,
-    const std::string& description,
+    const char* description,
     ParameterInfo::Access access) {
     
     if (!validateParameterName(name)) {
@@ -226,571 +1204,3852 @@ PersistentStorage::Result PersistentStorage::registerBlob(
     }
     
     ParameterInfo info;
-    info.name = name;
     info.description = description;
     info.type = ParameterInfo::TYPE_BLOB;
     info.access = access;
     info.dataPtr = dataPtr;
     info.size = size;
     
-    parameters_[name] = info;
+    Result res = insertParameter(name, info);
+    if (res != Result::SUCCESS) {
+        return res;
+    }
     
     PSTOR_LOG_D( "Registered blob parameter: %s (size %d)", 
                              name.c_str(), size);
     
-    if (initialized_) {
-        load(name);
-    }
-    
     return Result::SUCCESS;
 }
 
-// Set change callback for a parameter
-PersistentStorage::Result PersistentStorage::setOnChange(const std::string& name, 
-                      std::function<void(const std::string&, const void*)> callback) {
-    auto it = parameters_.find(name);
-    if (it == parameters_.end()) {
-        return Result::ERROR_NOT_FOUND;
-    }
+// Register a 64-bit counter
+PersistentStorage::Result PersistentStorage::registerCounter(
+    const std::string& name, uint64_t* dataPtr,
+    const CounterConfig& config,
+    const char* description,
+    ParameterInfo::Access access) {
     
-    it->second.onChange = callback;
-    return Result::SUCCESS;
-}
-
-// Set validator callback for a parameter
-PersistentStorage::Result PersistentStorage::setValidator(const std::string& name,
-                       std::function<bool(const void*)> validator) {
-    auto it = parameters_.find(name);
-    if (it == parameters_.end()) {
-        return Result::ERROR_NOT_FOUND;
+    if (!validateParameterName(name)) {
+        return Result::ERROR_INVALID_NAME;
     }
     
-    it->second.validator = validator;
-    return Result::SUCCESS;
-}
-
-// Get parameter info
-const ParameterInfo* PersistentStorage::getInfo(const std::string& name) const {
-    auto it = parameters_.find(name);
-    if (it == parameters_.end()) {
-        return nullptr;
+    RegistryLock::WriteGuard guard(registryLock_);
+    if (!guard.owns()) {
+        return Result::ERROR_REENTRANT;
     }
-    return &it->second;
-}
-
-// List parameters by prefix
-std::vector<std::string> PersistentStorage::listByPrefix(const std::string& prefix) const {
-    std::vector<std::string> result;
-    for (const auto& pair : parameters_) {
-        if (pair.first.find(prefix) == 0) {
-            result.push_back(pair.first);
+    if (!counterMutex_ || xSemaphoreTake(counterMutex_, portMAX_DELAY) != pdTRUE) {
+        return Result::ERROR_NVS_FAIL;
+    }
+    
+    // Flush state lives in a stable slot referenced by the entry. A counter
+    // registered again keeps its slot; otherwise a slot detached from a
+    // former counter is reused before a new one is added.
+    ParameterInfo* existing = findParameter(name);
+    CounterState* state = (existing && existing->type == ParameterInfo::TYPE_COUNTER)
+                        ? existing->constraints.counter.state : nullptr;
+    bool added = false;
+    if (!state) {
+        for (CounterState& slot : counters_) {
+            if (!slot.param) {
+                state = &slot;
+                break;
+            }
         }
+        if (!state) {
+            counters_.emplace_back();
+            state = &counters_.back();
+            added = true;
+        }
+        *state = CounterState();
     }
-    return result;
-}
-
-// Reset a parameter to default value
-PersistentStorage::Result PersistentStorage::reset(const std::string& name) {
-    auto it = parameters_.find(name);
-    if (it == parameters_.end()) {
-        return Result::ERROR_NOT_FOUND;
+    state->config = config;
+    state->config.flushThreshold = std::max<uint64_t>(config.flushThreshold, 1);
+    xSemaphoreGive(counterMutex_);
+    
+    ParameterInfo info;
+    info.description = description;
+    info.type = ParameterInfo::TYPE_COUNTER;
+    info.access = access;
+    info.dataPtr = dataPtr;
+    info.size = sizeof(uint64_t);
+    info.constraints.counter.state = state;
+    
+    Result res = insertLocked(name.c_str(), info, true);
+    xSemaphoreTake(counterMutex_, portMAX_DELAY);
+    if (res == Result::SUCCESS) {
+        state->param = findParameter(name);
+    } else if (added) {
+        counters_.pop_back();   // Added under the write lock, so still the last slot
+    }
+    xSemaphoreGive(counterMutex_);
+    if (res != Result::SUCCESS) {
+        return res;
     }
     
-    // Remove from NVS
-    std::string key = sanitizeNvsKey(name);
-    preferences_.remove(key.c_str());
+    PSTOR_LOG_D( "Registered counter parameter: %s (flush every %llu or %u ms)",
+                             name.c_str(), (unsigned long long)state->config.flushThreshold,
+                             state->config.flushIntervalMs);
     
     return Result::SUCCESS;
 }
 
-// Reset all parameters to defaults
-PersistentStorage::Result PersistentStorage::resetAll() {
-    preferences_.clear();
-    return Result::SUCCESS;
+// Register an int array
+PersistentStorage::Result PersistentStorage::registerIntArray(
+    const std::string& name, int32_t* dataPtr, size_t count,
+    int32_t minVal, int32_t maxVal,
+    const char* description,
+    ParameterInfo::Access access) {
+    
+    ParameterInfo info;
+    info.description = description;
+    info.elementType = ParameterInfo::TYPE_INT;
+    info.access = access;
+    info.dataPtr = dataPtr;
+    info.constraints.intRange.min = minVal;
+    info.constraints.intRange.max = maxVal;
+    return registerArray(name, info, count);
 }
 
-// Erase the entire NVS namespace
-bool PersistentStorage::eraseNamespace() {
-    // Close current handle if open
-    if (initialized_) {
-        preferences_.end();
-        initialized_ = false;
-    }
-
-    // Open in read-write mode and clear
-    if (!preferences_.begin(namespaceName_.c_str(), false)) {
-        PSTOR_LOG_E("Failed to open NVS for erase: %s", namespaceName_.c_str());
-        return false;
-    }
-
-    // Clear all keys in namespace
-    bool success = preferences_.clear();
-
-    if (success) {
-        PSTOR_LOG_W("NVS namespace '%s' erased", namespaceName_.c_str());
-    } else {
-        PSTOR_LOG_E("Failed to erase NVS namespace: %s", namespaceName_.c_str());
-    }
-
-    // Close after erase - caller should call begin() to reinitialize
-    preferences_.end();
+// Register a float array
+PersistentStorage::Result PersistentStorage::registerFloatArray(
+    const std::string& name, float* dataPtr, size_t count,
+    float minVal, float maxVal,
+    const char* description,
+    ParameterInfo::Access access) {
+    
+    ParameterInfo info;
+    info.description = description;
+    info.elementType = ParameterInfo::TYPE_FLOAT;
+    info.access = access;
+    info.dataPtr = dataPtr;
+    info.constraints.floatRange.min = minVal;
+    info.constraints.floatRange.max = maxVal;
+    return registerArray(name, info, count);
+}
 
-    return success;
+// Register a bool array
+PersistentStorage::Result PersistentStorage::registerBoolArray(
+    const std::string& name, bool* dataPtr, size_t count,
+    const char* description,
+    ParameterInfo::Access access) {
+    
+    ParameterInfo info;
+    info.description = description;
+    info.elementType = ParameterInfo::TYPE_BOOL;
+    info.access = access;
+    info.dataPtr = dataPtr;
+    return registerArray(name, info, count);
 }
 
-// Save a single parameter to NVS
-PersistentStorage::Result PersistentStorage::save(const std::string& name) {
-    if (!initialized_) {
-        PSTOR_LOG_E( "Not initialized");
-        return Result::ERROR_NVS_FAIL;
+// Common part of the array registrations; info carries the element type and range
+PersistentStorage::Result PersistentStorage::registerArray(const std::string& name,
+                                                           ParameterInfo& info, size_t count) {
+    if (!validateParameterName(name)) {
+        return Result::ERROR_INVALID_NAME;
+    }
+    if (count == 0) {
+        return Result::ERROR_VALIDATION_FAILED;
+    }
+    if (count > ARRAY_CHUNK_SIZE * ARRAY_MAX_CHUNKS / elementSize(info.elementType)) {
+        return Result::ERROR_TOO_LARGE;
     }
     
-    auto it = parameters_.find(name);
-    if (it == parameters_.end()) {
-        return Result::ERROR_NOT_FOUND;
+    info.type = ParameterInfo::TYPE_ARRAY;
+    info.size = count * elementSize(info.elementType);
+    
+    Result res = insertParameter(name, info);
+    if (res != Result::SUCCESS) {
+        return res;
     }
     
-    return saveParameter(it->second);
+    PSTOR_LOG_D( "Registered %s array parameter: %s (%d elements)",
+                             typeToString(info.elementType), name.c_str(), count);
+    
+    return Result::SUCCESS;
 }
 
-// Save all parameters to NVS
-PersistentStorage::Result PersistentStorage::saveAll() {
-    if (!initialized_) {
-        return Result::ERROR_NVS_FAIL;
+// Register a struct stored as one tagged blob
+PersistentStorage::Result PersistentStorage::registerStruct(
+    const std::string& name, void* dataPtr, const StructLayout& layout,
+    const char* description,
+    ParameterInfo::Access access) {
+    
+    if (!validateParameterName(name)) {
+        return Result::ERROR_INVALID_NAME;
+    }
+    // Field paths ("<name>.<field>") are bound by the same length limit
+    for (size_t i = 0; i < layout.count; i++) {
+        if (name.length() + 1 + strlen(layout.fields[i].name) > 64) {
+            return Result::ERROR_INVALID_NAME;
+        }
+    }
+    // Stored field lengths are one byte; PSTORAGE_STRUCT_LAYOUT() checks
+    // this at compile time, hand-written layouts only here
+    for (size_t i = 0; i < layout.count; i++) {
+        const StructField& field = layout.fields[i];
+        if (field.size > 255 || (field.type == ParameterInfo::TYPE_STRING && field.size < 2) ||
+            field.offset + field.size > layout.size) {
+            PSTOR_LOG_E( "Struct %s: field %s has an invalid size", name.c_str(), field.name);
+            return Result::ERROR_TOO_LARGE;
+        }
     }
     
-    Result lastResult = Result::SUCCESS;
-    size_t savedCount = 0;
+    ParameterInfo info;
+    info.description = description;
+    info.type = ParameterInfo::TYPE_STRUCT;
+    info.access = access;
+    info.dataPtr = dataPtr;
+    info.size = layout.size;
+    info.constraints.structure.layout = &layout;
     
-    for (auto& pair : parameters_) {
-        Result res = saveParameter(pair.second);
-        if (res == Result::SUCCESS) {
-            savedCount++;
-        } else {
-            lastResult = res;
-        }
+    Result res = insertParameter(name, info);
+    if (res != Result::SUCCESS) {
+        return res;
     }
     
-    PSTOR_LOG_I( "Saved %d/%d parameters", 
-                             savedCount, parameters_.size());
+    PSTOR_LOG_D( "Registered struct parameter: %s (%d fields, layout v%u)",
+                             name.c_str(), layout.count, layout.version);
     
-    return lastResult;
+    return Result::SUCCESS;
 }
 
-// Load a single parameter from NVS
-PersistentStorage::Result PersistentStorage::load(const std::string& name) {
-    if (!initialized_) {
-        return Result::ERROR_NVS_FAIL;
+// Register a compile-time schema table
+PersistentStorage::Result PersistentStorage::registerSchema(const SchemaEntry* entries, size_t count,
+                                                           void* base) {
+    RegistryLock::WriteGuard guard(registryLock_);
+    if (!guard.owns()) {
+        return Result::ERROR_REENTRANT;
     }
     
-    auto it = parameters_.find(name);
-    if (it == parameters_.end()) {
-        return Result::ERROR_NOT_FOUND;
+    // The table is one batch: a single index merge and load pass at the end
+    registrationDepth_++;
+    Result result = Result::SUCCESS;
+    for (size_t i = 0; i < count; i++) {
+        const SchemaEntry& entry = entries[i];
+        
+        ParameterInfo info;
+        info.name = entry.name;
+        info.description = entry.description;
+        info.type = entry.type;
+        info.access = (entry.cls == SchemaEntry::STATUS) ? ParameterInfo::ACCESS_READ_ONLY
+                                                         : ParameterInfo::ACCESS_READ_WRITE;
+        info.persistence = (entry.cls == SchemaEntry::PERSISTENT) ? ParameterInfo::PERSIST_NVS
+                                                                  : ParameterInfo::PERSIST_NONE;
+        info.dataPtr = static_cast<uint8_t*>(base) + entry.offset;
+        info.size = entry.size;
+        
+        switch (entry.type) {
+            case ParameterInfo::TYPE_INT:
+                info.constraints.intRange.min = (int32_t)entry.min;
+                info.constraints.intRange.max = (int32_t)entry.max;
+                break;
+            case ParameterInfo::TYPE_FLOAT:
+                info.constraints.floatRange.min = (float)entry.min;
+                info.constraints.floatRange.max = (float)entry.max;
+                break;
+            case ParameterInfo::TYPE_STRING:
+                info.constraints.stringMax.maxLen = entry.size;
+                break;
+            default:
+                break;
+        }
+        
+        result = insertLocked(entry.name, info, false);
+        if (result != Result::SUCCESS) {
+            break;
+        }
     }
     
-    return loadParameter(it->second);
+    PSTOR_LOG_D( "Registered schema with %d parameters", count);
+    if (--registrationDepth_ == 0) {
+        Result loaded = commitRegistrationLocked();
+        if (result == Result::SUCCESS) {
+            result = loaded;
+        }
+    }
+    return result;
 }
 
-// Load all parameters from NVS
-PersistentStorage::Result PersistentStorage::loadAll(bool autoSaveDefaults) {
-    if (!initialized_) {
-        return Result::ERROR_NVS_FAIL;
+// Add or replace a registry entry
+PersistentStorage::Result PersistentStorage::insertParameter(const std::string& name, ParameterInfo& info) {
+    RegistryLock::WriteGuard guard(registryLock_);
+    if (!guard.owns()) {
+        return Result::ERROR_REENTRANT;
     }
+    return insertLocked(name.c_str(), info, true);
+}
 
-    Result lastResult = Result::SUCCESS;
-    size_t loadedCount = 0;
-
-    for (auto& pair : parameters_) {
-        Result res = loadParameter(pair.second);
-        if (res == Result::SUCCESS) {
-            loadedCount++;
+// Add or replace a registry entry with the write lock held. Names that are
+// not interned must outlive the registry (schema literals).
+PersistentStorage::Result PersistentStorage::insertLocked(const char* name, ParameterInfo& info, bool internName) {
+#ifdef PSTORAGE_NO_DESCRIPTIONS
+    info.description = nullptr;
+#endif
+    
+    ParameterInfo* entry = findParameter(name);
+    if (entry) {
+        // A counter replaced by another type must no longer be flushed
+        if (entry->type == ParameterInfo::TYPE_COUNTER &&
+            (info.type != ParameterInfo::TYPE_COUNTER ||
+             info.constraints.counter.state != entry->constraints.counter.state)) {
+            detachCounter(*entry->constraints.counter.state);
+        }
+        
+        // Re-registration replaces the entry in place, keeping its name
+        info.name = entry->name;
+        *entry = info;
+    } else {
+        info.name = internName ? names_.intern(name, strlen(name)) : name;
+        if (!info.name) {
+            PSTOR_LOG_E( "Out of memory registering %s", name);
+            return Result::ERROR_TOO_LARGE;
+        }
+        
+        slots_.push_back(info);
+        entry = &slots_.back();
+        if (registrationDepth_ > 0) {
+            registrationBatch_.push_back(entry);
         } else {
-            lastResult = res;
+            parameters_.insert(lowerBound(name), entry);
         }
     }
+    
+    // Load the stored value, or leave it for the batch's load pass. In
+    // snapshot mode the value lives in the image, not under its own key.
+    if (registrationDepth_ > 0) {
+        pendingLoads_.push_back(entry);
+    } else if (initialized_ && saveMode_ == SaveMode::SNAPSHOT) {
+        LoadReport report;
+        loadParameters(std::vector<ParameterInfo*>(1, entry), report, false);
+    } else if (initialized_) {
+        loadParameter(*entry);
+    }
+    return Result::SUCCESS;
+}
 
-    PSTOR_LOG_I("Loaded %d/%d parameters", loadedCount, parameters_.size());
-
-    // Auto-save defaults on first boot (when no parameters exist in NVS)
-    if (autoSaveDefaults && loadedCount == 0 && !parameters_.empty()) {
-        PSTOR_LOG_I("First boot detected - saving default parameters to NVS...");
-        saveAll();
-        return Result::SUCCESS;  // Defaults saved successfully
+// Start a bulk registration
+void PersistentStorage::beginRegistration() {
+    RegistryLock::WriteGuard guard(registryLock_);
+    if (!guard.owns()) {
+        PSTOR_LOG_E( "beginRegistration(): %s", resultToString(Result::ERROR_REENTRANT));
+        return;
     }
+    registrationDepth_++;
+}
 
-    return lastResult;
+// Finish a bulk registration
+PersistentStorage::Result PersistentStorage::endRegistration() {
+    RegistryLock::WriteGuard guard(registryLock_);
+    if (!guard.owns()) {
+        return Result::ERROR_REENTRANT;
+    }
+    if (registrationDepth_ == 0) {
+        PSTOR_LOG_W( "endRegistration() without beginRegistration()");
+        return Result::SUCCESS;
+    }
+    if (--registrationDepth_ > 0) {
+        return Result::SUCCESS;
+    }
+    return commitRegistrationLocked();
 }
 
-// Get parameter value as JSON
-PersistentStorage::Result PersistentStorage::getJson(const std::string& name, JsonDocument& doc) {
-    auto it = parameters_.find(name);
-    if (it == parameters_.end()) {
-        return Result::ERROR_NOT_FOUND;
+// Merge the registration batch into the index and load its parameters
+PersistentStorage::Result PersistentStorage::commitRegistrationLocked() {
+    auto byName = [](const ParameterInfo* a, const ParameterInfo* b) {
+        return strcmp(a->name, b->name) < 0;
+    };
+    
+    if (!registrationBatch_.empty()) {
+        size_t sorted = parameters_.size();
+        std::sort(registrationBatch_.begin(), registrationBatch_.end(), byName);
+        parameters_.insert(parameters_.end(), registrationBatch_.begin(), registrationBatch_.end());
+        std::inplace_merge(parameters_.begin(), parameters_.begin() + sorted, parameters_.end(), byName);
+        registrationBatch_.clear();
+        registrationBatch_.shrink_to_fit();
     }
     
-    parameterToJson(it->second, doc);
-    return Result::SUCCESS;
+    // A parameter registered twice in the batch is loaded once
+    std::sort(pendingLoads_.begin(), pendingLoads_.end());
+    pendingLoads_.erase(std::unique(pendingLoads_.begin(), pendingLoads_.end()), pendingLoads_.end());
+    
+    Result result = Result::SUCCESS;
+    if (initialized_) {
+        LoadReport report;
+        result = loadParameters(pendingLoads_, report, false);
+    }
+    pendingLoads_.clear();
+    pendingLoads_.shrink_to_fit();
+    return result;
 }
 
-// Set parameter value from JSON
-PersistentStorage::Result PersistentStorage::setJson(const std::string& name, const JsonDocument& doc) {
-    auto it = parameters_.find(name);
-    if (it == parameters_.end()) {
-        return Result::ERROR_NOT_FOUND;
-    }
+// Load a set of parameters with the configured strategy
+PersistentStorage::Result PersistentStorage::loadParameters(const std::vector<ParameterInfo*>& params,
+                                                            LoadReport& result, bool detailed) {
+    const int64_t startUs = esp_timer_get_time();
+    result = LoadReport();
     
-    if (it->second.access == ParameterInfo::ACCESS_READ_ONLY) {
-        return Result::ERROR_ACCESS_DENIED;
+    Result lastResult = Result::SUCCESS;
+    bool loaded = (saveMode_ == SaveMode::SNAPSHOT) &&
+                  loadSnapshot(params, result, detailed, lastResult);
+    if (!loaded) {
+        loaded = (loadStrategy_ == LoadStrategy::ITERATE) &&
+                 loadByIteration(params, result, detailed, lastResult);
     }
     
-    Result res = jsonToParameter(it->second, doc);
-    if (res == Result::SUCCESS) {
-        // Save to NVS
-        saveParameter(it->second);
-        
-        // Notify change
-        notifyChange(name, it->second.dataPtr);
-        
-        // Publish via MQTT if available
-        if (mqttManager_) {
-            publishUpdate(name);
+    if (!loaded) {
+        // Per-key lookups, also the fallback if the namespace cannot be iterated
+        result = LoadReport();
+        lastResult = Result::SUCCESS;
+        for (ParameterInfo* param : params) {
+            if (param->persistence == ParameterInfo::PERSIST_NONE) {
+                continue;
+            }
+            result.registered++;
+            Result res = loadParameter(*param);
+            if (res == Result::SUCCESS) {
+                result.loaded++;
+            } else {
+                lastResult = res;
+            }
         }
     }
     
-    return res;
+    result.durationUs = esp_timer_get_time() - startUs;
+    PSTOR_LOG_D( "Loaded %d/%d parameters in %lld us", result.loaded, result.registered,
+                 (long long)result.durationUs);
+    return lastResult;
 }
 
-// Get all parameters as JSON
-void PersistentStorage::getAllJson(JsonDocument& doc) {
-    doc.clear();
-    JsonObject root = doc.to<JsonObject>();
+// Walk the NVS namespace once and load every stored key that belongs to a
+// parameter. Returns false if the namespace could not be iterated.
+bool PersistentStorage::loadByIteration(const std::vector<ParameterInfo*>& params,
+                                        LoadReport& report, bool detailed, Result& lastResult) {
+    NvsKeyIndex index(params.size());
+    std::vector<bool> seen(params.size(), false);
+    for (size_t i = 0; i < params.size(); i++) {
+        if (params[i]->persistence == ParameterInfo::PERSIST_NONE) {
+            continue;
+        }
+        report.registered++;
+        char key[NVS_KEY_NAME_MAX_SIZE];
+        if (params[i]->type == ParameterInfo::TYPE_ARRAY) {
+            for (size_t chunk = 0; chunk < arrayChunkCount(*params[i]); chunk++) {
+                arrayChunkKey(params[i]->name, chunk, key);
+                index.add(i, key);
+            }
+        } else {
+            nvsKeyFor(params[i]->name, key);
+            index.add(i, key);
+        }
+    }
     
-    // Add a summary instead of all parameters to avoid stack overflow
-    root["parameterCount"] = parameters_.size();
-    root["message"] = "Use individual parameter queries to avoid memory issues";
-    root["timestamp"] = millis();
+    bool iterated = forEachNvsEntry(namespaceName_.c_str(), [&](const nvs_entry_info_t& entry) {
+        bool matched = index.forEach(entry.key, [&](size_t i) {
+            ParameterInfo& param = *params[i];
+            if (param.type == ParameterInfo::TYPE_ARRAY) {
+                // One entry per chunk; the array counts as loaded with its first
+                Result res = (entry.type == NVS_TYPE_BLOB)
+                           ? loadArrayChunk(param, arrayChunkOf(entry.key), true)
+                           : Result::ERROR_TYPE_MISMATCH;
+                if (res != Result::SUCCESS) {
+                    lastResult = res;
+                    if (detailed && (report.mismatched.empty() || report.mismatched.back() != param.name)) {
+                        report.mismatched.push_back(param.name);
+                    }
+                } else if (!seen[i]) {
+                    report.loaded++;
+                }
+                seen[i] = true;
+                return;
+            }
+            if (seen[i]) {
+                return;
+            }
+            seen[i] = true;
+            
+            // The iterator's item type is the stored type tag: no extra lookup.
+            // Compressed strings are blobs.
+            bool sameType = (entry.type == nvsTypeOf(param.type)) ||
+                            (param.type == ParameterInfo::TYPE_STRING && entry.type == NVS_TYPE_BLOB &&
+                             param.compression != ParameterInfo::COMPRESS_NONE);
+            Result res = sameType ? loadParameter(param, true) : convertStored(param, entry.type);
+            if (res == Result::SUCCESS) {
+                report.loaded++;
+                report.converted += sameType ? 0 : 1;
+            } else {
+                lastResult = res;
+                if (res == Result::ERROR_TYPE_MISMATCH && detailed) {
+                    report.mismatched.push_back(param.name);
+                }
+            }
+        });
+        if (!matched && detailed && entry.key[0] != '.') {
+            report.unregistered.push_back(entry.key);
+        }
+    });
+    if (!iterated) {
+        PSTOR_LOG_W( "Cannot iterate namespace, loading per key");
+        return false;
+    }
     
-    // Add just parameter names as an array
-    JsonArray names = root["parameters"].to<JsonArray>();
-    for (const auto& pair : parameters_) {
-        names.add(pair.first);
+    // Parameters without a stored value keep their defaults
+    if (detailed) {
+        for (size_t i = 0; i < params.size(); i++) {
+            if (!seen[i] && params[i]->persistence != ParameterInfo::PERSIST_NONE) {
+                report.missing.push_back(params[i]->name);
+            }
+        }
     }
+    return true;
 }
 
-// List all parameter names
-std::vector<std::string> PersistentStorage::listParameters() const {
-    std::vector<std::string> names;
-    names.reserve(parameters_.size());
+// Binary search in the name-sorted index
+std::vector<ParameterInfo*>::const_iterator PersistentStorage::lowerBound(const std::string& name) const {
+    return std::lower_bound(parameters_.begin(), parameters_.end(), name,
+                            [](const ParameterInfo* param, const std::string& key) {
+                                return key.compare(param->name) > 0;
+                            });
+}
+
+ParameterInfo* PersistentStorage::findParameter(const std::string& name) const {
+    auto it = lowerBound(name);
+    if (it != parameters_.end() && name == (*it)->name) {
+        return *it;
+    }
     
-    for (const auto& pair : parameters_) {
-        names.push_back(pair.first);
+    // Not yet indexed during a bulk registration
+    for (ParameterInfo* param : registrationBatch_) {
+        if (name == param->name) {
+            return param;
+        }
+    }
+    return nullptr;
+}
+
+// Set change callback for a parameter
+PersistentStorage::Result PersistentStorage::setOnChange(const std::string& name,
+                                                        ParameterInfo::ChangeCallback callback) {
+    RegistryLock::WriteGuard guard(registryLock_);
+    if (!guard.owns()) {
+        return Result::ERROR_REENTRANT;
+    }
+    ParameterInfo* param = findParameter(name);
+    if (!param) {
+        return Result::ERROR_NOT_FOUND;
     }
     
-    return names;
+    param->onChange = callback;
+    return Result::SUCCESS;
 }
 
-// Set MQTT manager for remote access
-void PersistentStorage::setMqttManager(MQTTManager* mqtt) {
-    mqttManager_ = mqtt;
+// Set validator callback for a parameter
+PersistentStorage::Result PersistentStorage::setValidator(const std::string& name,
+                                                         ParameterInfo::Validator validator) {
+    RegistryLock::WriteGuard guard(registryLock_);
+    if (!guard.owns()) {
+        return Result::ERROR_REENTRANT;
+    }
+    ParameterInfo* param = findParameter(name);
+    if (!param) {
+        return Result::ERROR_NOT_FOUND;
+    }
     
-    if (mqtt) {
-        PSTOR_LOG_I( "MQTT manager set, remote access enabled");
-        
-        // Subscribe to parameter topics
-        // This would be done in the main application to avoid circular dependencies
+    param->validator = validator;
+    return Result::SUCCESS;
+}
+
+PersistentStorage::Result PersistentStorage::setCompression(const std::string& name,
+                                                           ParameterInfo::Compression codec) {
+    RegistryLock::WriteGuard guard(registryLock_);
+    if (!guard.owns()) {
+        return Result::ERROR_REENTRANT;
+    }
+    ParameterInfo* param = findParameter(name);
+    if (!param) {
+        return Result::ERROR_NOT_FOUND;
+    }
+    if (param->type != ParameterInfo::TYPE_STRING && param->type != ParameterInfo::TYPE_BLOB) {
+        return Result::ERROR_TYPE_MISMATCH;
     }
+    
+    param->compression = codec;
+    return Result::SUCCESS;
 }
 
-// Set MQTT publish callback for thread-safe publishing
-void PersistentStorage::setMqttPublishCallback(std::function<bool(const char*, const char*, int, bool)> callback) {
-    mqttPublishCallback_ = callback;
-    PSTOR_LOG_I( "MQTT publish callback set");
+// Get parameter info
+const ParameterInfo* PersistentStorage::getInfo(const std::string& name) const {
+    RegistryLock::ReadGuard guard(registryLock_);
+    ParameterInfo* param = findParameter(name);
+    if (!param) {
+        return nullptr;
+    }
+    return param;
 }
 
-// Handle MQTT command
-bool PersistentStorage::handleMqttCommand(const std::string& topic, const std::string& payload) {
-    PSTOR_LOG_I( "handleMqttCommand called - topic: %s, payload: %s", 
-                             topic.c_str(), payload.c_str());
-    
-    // Queue command for async processing to avoid blocking MQTT task
-    if (!commandQueue_) {
-        PSTOR_LOG_E( "Command queue not initialized");
-        return false;
+// List parameters by prefix
+std::vector<std::string> PersistentStorage::listByPrefix(const std::string& prefix) const {
+    RegistryLock::ReadGuard guard(registryLock_);
+    std::vector<std::string> result;
+    for (const ParameterInfo* param : parameters_) {
+        if (strncmp(param->name, prefix.c_str(), prefix.length()) == 0) {
+            result.push_back(param->name);
+        }
     }
+    return result;
+}
+
+// List one page of parameters by prefix, starting after the cursor
+std::string PersistentStorage::listPage(const std::string& prefix, const std::string& cursor,
+                                        size_t limit, std::vector<std::string>& names) const {
+    RegistryLock::ReadGuard guard(registryLock_);
+    names.clear();
     
-    // Extract command from topic
-    if (topic.find(mqttPrefix_) != 0) {
-        PSTOR_LOG_W( "Topic doesn't match prefix. Topic: %s, Prefix: %s", 
-                                 topic.c_str(), mqttPrefix_.c_str());
-        return false;  // Not our topic
+    // The registry is sorted by name, so the cursor is simply the last name returned
+    auto it = (cursor.empty() || cursor < prefix) ? lowerBound(prefix) : lowerBound(cursor);
+    if (it != parameters_.end() && cursor == (*it)->name) {
+        ++it;
+    }
+    for (; it != parameters_.end() && strncmp((*it)->name, prefix.c_str(), prefix.length()) == 0; ++it) {
+        if (names.size() >= limit) {
+            return names.empty() ? std::string() : names.back();
+        }
+        names.push_back((*it)->name);
+    }
+    return std::string();
+}
+
+// Reset a parameter to default value
+PersistentStorage::Result PersistentStorage::reset(const std::string& name) {
+    RegistryLock::ReadGuard guard(registryLock_);
+    ParameterInfo* param = findParameter(name);
+    if (!param) {
+        return Result::ERROR_NOT_FOUND;
     }
     
-    std::string subTopic = topic.substr(mqttPrefix_.length() + 1);  // Skip prefix and '/'
-    
-    ParameterCommand cmd;
-    memset(&cmd, 0, sizeof(cmd));
-    
-    if (subTopic.find("set/") == 0) {
-        cmd.type = ParameterCommand::SET;
-        std::string paramName = subTopic.substr(4);  // Skip "set/"
-        strncpy(cmd.paramName, paramName.c_str(), sizeof(cmd.paramName) - 1);
-        strncpy(cmd.payload, payload.c_str(), sizeof(cmd.payload) - 1);
-    } else if (subTopic == "get/all") {
-        cmd.type = ParameterCommand::GET_ALL;
-        strcpy(cmd.paramName, "all");
-    } else if (subTopic.find("get/") == 0) {
-        cmd.type = ParameterCommand::GET;
-        std::string paramName = subTopic.substr(4);  // Skip "get/"
-        strncpy(cmd.paramName, paramName.c_str(), sizeof(cmd.paramName) - 1);
-    } else if (subTopic == "list") {
-        cmd.type = ParameterCommand::LIST;
-    } else if (subTopic == "save") {
-        cmd.type = ParameterCommand::SAVE;
-    } else {
-        return false;  // Unknown command
+    // Remove from NVS
+    if (saveMode_ == SaveMode::SNAPSHOT) {
+        return saveSnapshot(param);
     }
+    removeStored(*param);
     
-    // Queue the command - don't wait if queue is full
-    if (xQueueSend(commandQueue_, &cmd, 0) != pdTRUE) {
-        PSTOR_LOG_W( "Command queue full, dropping command");
-        return true;  // Still return true as we handled the topic
+    return Result::SUCCESS;
+}
+
+// Reset all parameters to defaults. Only the parameters' own keys are
+// removed: streamed blobs and the schema version share the namespace.
+PersistentStorage::Result PersistentStorage::resetAll() {
+    RegistryLock::ReadGuard guard(registryLock_);
+    if (!initialized_) {
+        return Result::ERROR_NVS_FAIL;
     }
     
-    PSTOR_LOG_D( "Queued command type %d for %s", 
-                             cmd.type, cmd.paramName);
-    return true;
+    // An image without parameters replaces the snapshot in one step
+    Result result = Result::SUCCESS;
+    if (saveMode_ == SaveMode::SNAPSHOT) {
+        result = saveSnapshot(nullptr, true);
+    }
+    for (const ParameterInfo* param : parameters_) {
+        if (param->persistence == ParameterInfo::PERSIST_NVS) {
+            removeStored(*param);
+        }
+    }
+    return result;
 }
 
-// Private helper methods
+// Remove the NVS item(s) of a parameter
+void PersistentStorage::removeStored(const ParameterInfo& param) {
+    char key[NVS_KEY_NAME_MAX_SIZE];
+    if (param.type == ParameterInfo::TYPE_ARRAY) {
+        for (size_t chunk = 0; chunk < arrayChunkCount(param); chunk++) {
+            arrayChunkKey(param.name, chunk, key);
+            preferences_.remove(key);
+        }
+        return;
+    }
+    nvsKeyFor(param.name, key);
+    preferences_.remove(key);
+}
 
-bool PersistentStorage::validateParameterName(const std::string& name) const {
-    if (name.empty() || name.length() > 64) {
+// Erase the entire NVS namespace
+bool PersistentStorage::eraseNamespace() {
+    // Close current handle if open
+    if (initialized_) {
+        preferences_.end();
+        initialized_ = false;
+    }
+
+    // Open in read-write mode and clear
+    if (!preferences_.begin(namespaceName_.c_str(), false)) {
+        PSTOR_LOG_E("Failed to open NVS for erase: %s", namespaceName_.c_str());
         return false;
     }
-    
-    // Check for valid characters (alphanumeric, underscore, slash)
-    for (char c : name) {
-        if (!isalnum(c) && c != '_' && c != '/') {
-            return false;
-        }
+
+    // Clear all keys in namespace
+    bool success = preferences_.clear();
+
+    if (success) {
+        PSTOR_LOG_W("NVS namespace '%s' erased", namespaceName_.c_str());
+    } else {
+        PSTOR_LOG_E("Failed to erase NVS namespace: %s", namespaceName_.c_str());
     }
-    
-    return true;
+
+    // Close after erase - caller should call begin() to reinitialize
+    preferences_.end();
+
+    return success;
 }
 
-std::string PersistentStorage::sanitizeNvsKey(const std::string& name) const {
-    // NVS keys have max 15 chars, so we need to hash longer names
-    if (name.length() <= 15) {
-        return name;
+// Declare the schema version and its migrations
+void PersistentStorage::setSchema(uint32_t version, const Migration* migrations, size_t count) {
+    schemaVersion_ = version;
+    migrations_ = migrations;
+    migrationCount_ = migrations ? count : 0;
+}
+
+// Apply the declared migrations once and record the new schema version
+PersistentStorage::Result PersistentStorage::runMigrations() {
+    migrationReport_ = MigrationReport();
+    if (schemaVersion_ == 0) {
+        return Result::SUCCESS;
     }
     
-    // Simple hash for demo - in production use proper hashing
-    uint32_t hash = 0;
-    for (char c : name) {
-        hash = hash * 31 + c;
+    // Up to date: a single lookup on every later boot
+    uint32_t version = preferences_.getUInt(SCHEMA_VERSION_KEY, 0);
+    migrationReport_.fromVersion = version;
+    migrationReport_.toVersion = version;
+    if (version == schemaVersion_) {
+        return Result::SUCCESS;
+    }
+    if (version > schemaVersion_) {
+        PSTOR_LOG_W( "Stored schema v%lu is newer than v%lu, not migrating",
+                     (unsigned long)version, (unsigned long)schemaVersion_);
+        return Result::SUCCESS;
     }
     
-    char buf[16];
-    snprintf(buf, sizeof(buf), "p%lu", (unsigned long)hash);
-    return std::string(buf);
-}
-
-PersistentStorage::Result PersistentStorage::loadParameter(ParameterInfo& param) {
-    std::string key = sanitizeNvsKey(param.name);
+    nvs_handle_t handle;
+    if (nvs_open(namespaceName_.c_str(), NVS_READWRITE, &handle) != ESP_OK) {
+        PSTOR_LOG_E( "Cannot open namespace for migration");
+        return Result::ERROR_NVS_FAIL;
+    }
     
-    switch (param.type) {
-        case ParameterInfo::TYPE_BOOL: {
-            bool defaultVal = *(bool*)param.dataPtr;
-            *(bool*)param.dataPtr = preferences_.getBool(key.c_str(), defaultVal);
-            break;
-        }
-        
-        case ParameterInfo::TYPE_INT: {
-            int32_t defaultVal = *(int32_t*)param.dataPtr;
-            *(int32_t*)param.dataPtr = preferences_.getInt(key.c_str(), defaultVal);
-            break;
+    // Stored key types, kept current as steps move and convert values
+    std::map<std::string, nvs_type_t> types;
+    forEachNvsEntry(namespaceName_.c_str(), [&](const nvs_entry_info_t& entry) {
+        types[entry.key] = entry.type;
+    });
+    
+    // Complete a retype that a power cut interrupted
+    Result result = Result::SUCCESS;
+    if ((types.count(MIGRATION_VALUE_KEY) || types.count(MIGRATION_TARGET_KEY)) &&
+        finishRetype(handle, types) != ESP_OK) {
+        PSTOR_LOG_E( "Cannot finish the interrupted retype");
+        result = Result::ERROR_NVS_FAIL;
+    }
+    
+    bool writeFailed = (result != Result::SUCCESS);
+    while (!writeFailed && version < schemaVersion_) {
+        // Next version that has steps, or the target
+        uint32_t next = schemaVersion_;
+        for (size_t i = 0; i < migrationCount_; i++) {
+            if (migrations_[i].version > version && migrations_[i].version < next) {
+                next = migrations_[i].version;
+            }
         }
         
-        case ParameterInfo::TYPE_FLOAT: {
-            float defaultVal = *(float*)param.dataPtr;
-            *(float*)param.dataPtr = preferences_.getFloat(key.c_str(), defaultVal);
-            break;
-        }
+        for (size_t i = 0; i < migrationCount_ && !writeFailed; i++) {
+            const Migration& step = migrations_[i];
+            if (step.version != next) {
+                continue;
+            }
+            
+            char key[NVS_KEY_NAME_MAX_SIZE];
+            nvsKeyFor(step.name, key);
+            auto stored = types.find(key);
+            bool applied = false;
+            bool failed = false;
+            
+            if (stored == types.end()) {
+                // Nothing stored, or a rename that already happened
+            } else if (step.kind == Migration::RENAME) {
+                char newKey[NVS_KEY_NAME_MAX_SIZE];
+                nvsKeyFor(step.newName, newKey);
+                // A value already under the new key wins (interrupted earlier run)
+                if (types.count(newKey) || copyNvsItem(handle, key, newKey, stored->second) == ESP_OK) {
+                    types[newKey] = stored->second;
+                    nvs_erase_key(handle, key);
+                    types.erase(stored);
+                    applied = true;
+                } else {
+                    failed = true;
+                }
+            } else if (step.kind == Migration::RETYPE) {
+                nvs_type_t fromType = nvsTypeOf(step.fromType);
+                nvs_type_t toType = nvsTypeOf(step.toType);
+                if (stored->second == fromType && fromType != toType) {
+                    double number = 0;
+                    std::string text;
+                    esp_err_t err = readNvsScalar(handle, key, step.fromType, number, text)
+                                  ? ESP_OK : ESP_ERR_NOT_SUPPORTED;
+                    // Convert into a temporary key first: the value survives a
+                    // power cut or a failed write between erasing and rewriting it
+                    if (err == ESP_OK) {
+                        err = nvs_set_str(handle, MIGRATION_TARGET_KEY, key);
+                    }
+                    if (err == ESP_OK) {
+                        err = writeNvsScalar(handle, MIGRATION_VALUE_KEY, step.toType, number, text);
+                    }
+                    if (err == ESP_OK) {
+                        err = nvs_commit(handle);
+                    }
+                    if (err == ESP_OK) {
+                        types[MIGRATION_TARGET_KEY] = NVS_TYPE_STR;
+                        types[MIGRATION_VALUE_KEY] = toType;
+                        err = nvs_erase_key(handle, key);
+                    }
+                    if (err == ESP_OK) {
+                        types.erase(stored);
+                        err = finishRetype(handle, types);
+                        applied = (err == ESP_OK);
+                    }
+                    if (err == ESP_ERR_NOT_SUPPORTED) {
+                        // Unconvertible values are dropped so that the default applies
+                        nvs_erase_key(handle, key);
+                        nvs_erase_key(handle, MIGRATION_TARGET_KEY);
+                        types.erase(stored);
+                        types.erase(MIGRATION_TARGET_KEY);
+                        failed = true;
+                    } else if (err != ESP_OK) {
+                        writeFailed = true;
+                    }
+                } else if (fromType == toType) {
+                    PSTOR_LOG_W( "Migration of %s: %s to %s shares the stored type, use upgradeBlob()",
+                                 step.name, typeToString(step.fromType), typeToString(step.toType));
+                    failed = true;
+                }
+            } else if (step.kind == Migration::UPGRADE_BLOB && stored->second == NVS_TYPE_BLOB) {
+                std::vector<uint8_t> data;
+                std::vector<uint8_t> upgraded(step.newSize);
+                size_t length = 0;
+                if (readNvsBytes(handle, key, NVS_TYPE_BLOB, data) && step.upgrade) {
+                    length = step.upgrade(data.data(), data.size(), upgraded.data(), upgraded.size());
+                }
+                if (length == 0 || length > upgraded.size()) {
+                    nvs_erase_key(handle, key);
+                    types.erase(stored);
+                    failed = true;
+                } else if (nvs_set_blob(handle, key, upgraded.data(), length) == ESP_OK) {
+                    applied = true;
+                } else {
+                    writeFailed = true;     // The old layout is still stored
+                }
+            }
+            
+            if (writeFailed) {
+                // Nothing lost: the version runs again at the next begin()
+                PSTOR_LOG_E( "Migration to v%lu: cannot write %s", (unsigned long)next, step.name);
+                result = Result::ERROR_NVS_FAIL;
+            } else if (failed) {
+                PSTOR_LOG_W( "Migration to v%lu: %s dropped", (unsigned long)next, step.name);
+                migrationReport_.failed++;
+            } else if (applied) {
+                migrationReport_.applied++;
+            } else {
+                migrationReport_.skipped++;
+            }
+        }
+        
+        // Commit the version's data, then record it as done
+        if (writeFailed) {
+            break;
+        }
+        if (nvs_commit(handle) != ESP_OK ||
+            nvs_set_u32(handle, SCHEMA_VERSION_KEY, next) != ESP_OK ||
+            nvs_commit(handle) != ESP_OK) {
+            PSTOR_LOG_E( "Failed to commit schema v%lu", (unsigned long)next);
+            result = Result::ERROR_NVS_FAIL;
+            break;
+        }
+        version = next;
+    }
+    
+    nvs_close(handle);
+    migrationReport_.toVersion = version;
+    PSTOR_LOG_I( "Schema v%lu -> v%lu: %d applied, %d skipped, %d failed",
+                 (unsigned long)migrationReport_.fromVersion, (unsigned long)version,
+                 migrationReport_.applied, migrationReport_.skipped, migrationReport_.failed);
+    return result;
+}
+
+// Erase NVS keys that no registered parameter owns
+PersistentStorage::Result PersistentStorage::gcOrphans(GcReport* report, size_t maxRemovals) {
+    RegistryLock::ReadGuard guard(registryLock_);
+    GcReport local;
+    GcReport& result = report ? *report : local;
+    result = GcReport();
+    
+    if (!initialized_) {
+        return Result::ERROR_NVS_FAIL;
+    }
+    if (registrationDepth_ > 0) {
+        PSTOR_LOG_W( "gcOrphans() refused during bulk registration");
+        return Result::ERROR_ACCESS_DENIED;
+    }
+    
+    NvsKeyIndex index(parameters_.size());
+    for (size_t i = 0; i < parameters_.size(); i++) {
+        const ParameterInfo& param = *parameters_[i];
+        if (param.persistence != ParameterInfo::PERSIST_NVS) {
+            continue;
+        }
+        char key[NVS_KEY_NAME_MAX_SIZE];
+        if (param.type == ParameterInfo::TYPE_ARRAY) {
+            // Chunks beyond the current size (a shrunk array) are orphans
+            for (size_t chunk = 0; chunk < arrayChunkCount(param); chunk++) {
+                arrayChunkKey(param.name, chunk, key);
+                index.add(i, key);
+            }
+        } else {
+            nvsKeyFor(param.name, key);
+            index.add(i, key);
+        }
+    }
+    
+    // Collect first: an NVS iterator does not survive erasing entries
+    std::vector<std::string> orphans;
+    bool iterated = forEachNvsEntry(namespaceName_.c_str(), [&](const nvs_entry_info_t& entry) {
+        result.scanned++;
+        if (entry.key[0] == '.' || index.contains(entry.key)) {
+            return;
+        }
+        if (maxRemovals == 0 || orphans.size() < maxRemovals) {
+            orphans.push_back(entry.key);
+        } else {
+            result.pending++;
+        }
+    });
+    if (!iterated) {
+        return Result::ERROR_NVS_FAIL;
+    }
+    
+    Result lastResult = Result::SUCCESS;
+    for (const std::string& key : orphans) {
+        if (preferences_.remove(key.c_str())) {
+            result.removed++;
+        } else {
+            result.pending++;
+            lastResult = Result::ERROR_NVS_FAIL;
+        }
+    }
+    
+    if (result.removed > 0) {
+        PSTOR_LOG_I( "Removed %d orphaned keys (%d scanned, %d pending)",
+                     result.removed, result.scanned, result.pending);
+    }
+    return lastResult;
+}
+
+// Save a single parameter to NVS
+PersistentStorage::Result PersistentStorage::save(const std::string& name) {
+    RegistryLock::ReadGuard guard(registryLock_);
+    if (!initialized_) {
+        PSTOR_LOG_E( "Not initialized");
+        return Result::ERROR_NVS_FAIL;
+    }
+    
+    ParameterInfo* param = findParameter(name);
+    if (!param) {
+        return Result::ERROR_NOT_FOUND;
+    }
+    
+    return persistParameter(*param);
+}
+
+// Save all parameters to NVS
+PersistentStorage::Result PersistentStorage::saveAll() {
+    RegistryLock::ReadGuard guard(registryLock_);
+    if (!initialized_) {
+        return Result::ERROR_NVS_FAIL;
+    }
+    
+    if (saveMode_ == SaveMode::SNAPSHOT) {
+        Result res = saveSnapshot();
+        if (res == Result::SUCCESS) {
+            PSTOR_LOG_I( "Saved snapshot of %d parameters", parameters_.size());
+        }
+        return res;
+    }
+    
+    Result lastResult = Result::SUCCESS;
+    size_t savedCount = 0;
+    
+    for (ParameterInfo* param : parameters_) {
+        Result res = saveParameter(*param);
+        if (res == Result::SUCCESS) {
+            savedCount++;
+        } else {
+            lastResult = res;
+        }
+    }
+    
+    PSTOR_LOG_I( "Saved %d/%d parameters", 
+                             savedCount, parameters_.size());
+    
+    return lastResult;
+}
+
+// Load a single parameter from NVS
+PersistentStorage::Result PersistentStorage::load(const std::string& name) {
+    RegistryLock::ReadGuard guard(registryLock_);
+    if (!initialized_) {
+        return Result::ERROR_NVS_FAIL;
+    }
+    
+    ParameterInfo* param = findParameter(name);
+    if (!param) {
+        return Result::ERROR_NOT_FOUND;
+    }
+    
+    if (saveMode_ == SaveMode::SNAPSHOT) {
+        LoadReport report;
+        return loadParameters(std::vector<ParameterInfo*>(1, param), report, false);
+    }
+    return loadParameter(*param);
+}
+
+// Load all parameters from NVS
+PersistentStorage::Result PersistentStorage::loadAll(bool autoSaveDefaults, LoadReport* report) {
+    RegistryLock::ReadGuard guard(registryLock_);
+    if (!initialized_) {
+        return Result::ERROR_NVS_FAIL;
+    }
+
+    LoadReport local;
+    LoadReport& result = report ? *report : local;
+    // Name lists are only collected when the caller asked for a report
+    Result lastResult = loadParameters(parameters_, result, report != nullptr);
+    PSTOR_LOG_I("Loaded %d/%d parameters", result.loaded, result.registered);
+    
+    // Carry per-key values over into the first snapshot
+    if (saveMode_ == SaveMode::SNAPSHOT && snapshotSlot_ < 0 && result.loaded > 0) {
+        PSTOR_LOG_I("No snapshot yet - writing one from per-key values");
+        saveSnapshot();
+    }
+
+    // Auto-save defaults on first boot (when no parameters exist in NVS)
+    if (autoSaveDefaults && result.loaded == 0 && result.registered > 0) {
+        PSTOR_LOG_I("First boot detected - saving default parameters to NVS...");
+        saveAll();
+        return Result::SUCCESS;  // Defaults saved successfully
+    }
+
+    return lastResult;
+}
+
+// Get parameter value as JSON
+PersistentStorage::Result PersistentStorage::getJson(const std::string& name, JsonDocument& doc) {
+    RegistryLock::ReadGuard guard(registryLock_);
+    ParameterInfo* param = findParameter(name);
+    const StructField* field = nullptr;
+    if (!param && !(param = findField(name, field))) {
+        return Result::ERROR_NOT_FOUND;
+    }
+    
+    if (field) {
+        fieldToJson(*param, *field, doc);
+    } else {
+        parameterToJson(*param, doc);
+    }
+    return Result::SUCCESS;
+}
+
+// Get a slice of an array parameter as JSON
+PersistentStorage::Result PersistentStorage::getJson(const std::string& name, JsonDocument& doc,
+                                                     size_t offset, size_t count) {
+    RegistryLock::ReadGuard guard(registryLock_);
+    ParameterInfo* param = findParameter(name);
+    if (!param) {
+        return Result::ERROR_NOT_FOUND;
+    }
+    if (param->type == ParameterInfo::TYPE_BLOB) {
+        parameterToJson(*param, doc);
+        blobSliceToJson(*param, doc.as<JsonObject>(), offset, count);
+        return Result::SUCCESS;
+    }
+    if (param->type != ParameterInfo::TYPE_ARRAY) {
+        return Result::ERROR_TYPE_MISMATCH;
+    }
+    
+    parameterToJson(*param, doc, offset, count);
+    return Result::SUCCESS;
+}
+
+// Copy a parameter value without tearing
+PersistentStorage::Result PersistentStorage::readConsistent(const std::string& name, void* out,
+                                                            size_t size, size_t* length) const {
+    RegistryLock::ReadGuard guard(registryLock_);
+    ParameterInfo* param = findParameter(name);
+    if (!param) {
+        return Result::ERROR_NOT_FOUND;
+    }
+    
+    size_t len = readConsistent(*param, out, size);
+    if (length) {
+        *length = len;
+    }
+    
+    bool complete = (param->type == ParameterInfo::TYPE_STRING) ? len < size : len <= size;
+    return complete ? Result::SUCCESS : Result::ERROR_TOO_LARGE;
+}
+
+// Validate and store a new value
+PersistentStorage::Result PersistentStorage::write(const std::string& name, const void* value, size_t size) {
+    RegistryLock::ReadGuard guard(registryLock_);
+    ParameterInfo* param = findParameter(name);
+    if (!param) {
+        return Result::ERROR_NOT_FOUND;
+    }
+    
+    Result res = validateValue(*param, value, size);
+    if (res != Result::SUCCESS) {
+        return res;
+    }
+    
+    storeValue(*param, value, size);
+    notifyChange(name, param->dataPtr);
+    return Result::SUCCESS;
+}
+
+// Validate and store one array element
+PersistentStorage::Result PersistentStorage::writeElement(const std::string& name, size_t index,
+                                                          const void* value, size_t size) {
+    RegistryLock::ReadGuard guard(registryLock_);
+    ParameterInfo* param = findParameter(name);
+    if (!param) {
+        return Result::ERROR_NOT_FOUND;
+    }
+    
+    Result res = storeElement(*param, index, value, size);
+    if (res == Result::SUCCESS) {
+        notifyChange(name, param->dataPtr);
+    }
+    return res;
+}
+
+// Copy part of a blob without tearing
+PersistentStorage::Result PersistentStorage::readBlob(const std::string& name, size_t offset, void* out,
+                                                      size_t length, size_t* copied) const {
+    RegistryLock::ReadGuard guard(registryLock_);
+    ParameterInfo* param = findParameter(name);
+    if (!param) {
+        return Result::ERROR_NOT_FOUND;
+    }
+    if (param->type != ParameterInfo::TYPE_BLOB) {
+        return Result::ERROR_TYPE_MISMATCH;
+    }
+    if (offset > param->size) {
+        return Result::ERROR_VALIDATION_FAILED;
+    }
+    
+    size_t n = std::min(length, param->size - offset);
+    uint32_t start;
+    do {
+        start = ValueAccess::readBegin(param->sequence);
+        memcpy(out, (const uint8_t*)param->dataPtr + offset, n);
+    } while (ValueAccess::readRetry(param->sequence, start));
+    if (copied) {
+        *copied = n;
+    }
+    return Result::SUCCESS;
+}
+
+// Stage part of a blob; the transfer is stored once complete
+PersistentStorage::Result PersistentStorage::writeBlob(const std::string& name, size_t offset,
+                                                       const void* data, size_t length, bool final) {
+    RegistryLock::ReadGuard guard(registryLock_);
+    ParameterInfo* param = findParameter(name);
+    if (!param) {
+        return Result::ERROR_NOT_FOUND;
+    }
+    if (param->type != ParameterInfo::TYPE_BLOB) {
+        return Result::ERROR_TYPE_MISMATCH;
+    }
+    
+    bool complete = false;
+    Result res = stageBlob(*param, offset, (const char*)data, length, false, final, complete);
+    if (res == Result::SUCCESS && complete) {
+        res = commitBlob(*param, false);
+    }
+    return res;
+}
+
+// Copy a chunk into the staged blob, raw or decoded from base64. A chunk
+// that does not continue the transfer in progress starts a new one.
+PersistentStorage::Result PersistentStorage::stageBlob(ParameterInfo& param, size_t offset, const char* data,
+                                                       size_t length, bool base64, bool final, bool& complete) {
+    size_t bytes = base64 ? base64DecodedLength(data, length) : length;
+    if (bytes == SIZE_MAX) {
+        return Result::ERROR_VALIDATION_FAILED;
+    }
+    if (offset > param.size || bytes > param.size - offset) {
+        return Result::ERROR_TOO_LARGE;
+    }
+    if (!blobMutex_ || xSemaphoreTake(blobMutex_, portMAX_DELAY) != pdTRUE) {
+        return Result::ERROR_NVS_FAIL;
+    }
+    
+    BlobUpload& upload = blobUpload_;
+    if (upload.param != &param || upload.complete || offset != upload.next ||
+        upload.data.size() != param.size) {
+        if (upload.param && (upload.next > 0 || upload.complete)) {
+            PSTOR_LOG_W( "Blob transfer of %s replaced", upload.param->name);
+        }
+        upload.param = &param;
+        upload.data.resize(param.size);
+        readConsistent(param, upload.data.data(), upload.data.size());
+    }
+    
+    uint8_t* out = upload.data.data() + offset;
+    bool decoded = base64 ? base64Decode(data, length, out) : (memcpy(out, data, bytes), true);
+    if (!decoded) {
+        upload = BlobUpload();
+        xSemaphoreGive(blobMutex_);
+        return Result::ERROR_VALIDATION_FAILED;
+    }
+    upload.next = offset + bytes;
+    upload.complete = final || upload.next == param.size;
+    complete = upload.complete;
+    xSemaphoreGive(blobMutex_);
+    return Result::SUCCESS;
+}
+
+// Validate and store a complete staged blob, then release the staging buffer
+PersistentStorage::Result PersistentStorage::commitBlob(ParameterInfo& param, bool persist) {
+    if (!blobMutex_ || xSemaphoreTake(blobMutex_, portMAX_DELAY) != pdTRUE) {
+        return Result::ERROR_NVS_FAIL;
+    }
+    
+    Result res = Result::ERROR_NOT_FOUND;   // Replaced by a newer transfer meanwhile
+    if (blobUpload_.param == &param && blobUpload_.complete) {
+        res = validateValue(param, blobUpload_.data.data(), blobUpload_.data.size());
+        if (res == Result::SUCCESS) {
+            storeValue(param, blobUpload_.data.data(), blobUpload_.data.size());
+        }
+        blobUpload_ = BlobUpload();
+    }
+    xSemaphoreGive(blobMutex_);
+    
+    if (res == Result::SUCCESS) {
+        if (persist) {
+            persistParameter(param);
+        }
+        notifyChange(param.name, param.dataPtr);
+        if (persist && mqttManager_) {
+            publishUpdate(param.name);
+        }
+    }
+    return res;
+}
+
+// Start a streamed blob in the chunk set that is not live
+PersistentStorage::Result PersistentStorage::openBlobWriter(const std::string& name, size_t size,
+                                                            BlobWriter& writer) {
+    writer.abort();
+    if (!initialized_) {
+        return Result::ERROR_NVS_FAIL;
+    }
+    if (!validateParameterName(name)) {
+        return Result::ERROR_INVALID_NAME;
+    }
+    if (size > STREAM_MAX_SIZE) {
+        return Result::ERROR_TOO_LARGE;
+    }
+    
+    uint32_t hash = nvsKeyHash(name.c_str());
+    if (!blobMutex_ || xSemaphoreTake(blobMutex_, portMAX_DELAY) != pdTRUE) {
+        return Result::ERROR_NVS_FAIL;
+    }
+    bool busy = std::find(streamWriters_.begin(), streamWriters_.end(), hash) != streamWriters_.end();
+    if (!busy) {
+        streamWriters_.push_back(hash);
+    }
+    xSemaphoreGive(blobMutex_);
+    if (busy) {
+        return Result::ERROR_ACCESS_DENIED;
+    }
+    
+    StreamManifest manifest;
+    uint8_t generation = readStreamManifest(preferences_, hash, manifest) ? (manifest.generation ^ 1) : 0;
+    
+    // Left over from an interrupted write or erase, a prefix of the set
+    char key[NVS_KEY_NAME_MAX_SIZE];
+    for (size_t chunk = 0; chunk < STREAM_MAX_SIZE / STREAM_CHUNK_SIZE; chunk++) {
+        streamChunkKey(hash, generation, chunk, key);
+        if (!preferences_.remove(key)) {
+            break;
+        }
+    }
+    
+    writer.storage_ = this;
+    writer.hash_ = hash;
+    writer.size_ = size;
+    writer.written_ = 0;
+    writer.crc_ = 0xFFFFFFFF;
+    writer.chunks_ = 0;
+    writer.generation_ = generation;
+    writer.window_.clear();
+    writer.window_.reserve(std::min(size, STREAM_CHUNK_SIZE));
+    return Result::SUCCESS;
+}
+
+PersistentStorage::BlobWriter& PersistentStorage::BlobWriter::operator=(BlobWriter&& other) noexcept {
+    if (this != &other) {
+        abort();
+        storage_ = other.storage_;
+        hash_ = other.hash_;
+        size_ = other.size_;
+        written_ = other.written_;
+        crc_ = other.crc_;
+        chunks_ = other.chunks_;
+        generation_ = other.generation_;
+        window_ = std::move(other.window_);
+        other.storage_ = nullptr;
+    }
+    return *this;
+}
+
+PersistentStorage::Result PersistentStorage::BlobWriter::write(const void* data, size_t length) {
+    if (!storage_) {
+        return Result::ERROR_NVS_FAIL;
+    }
+    if (length > size_ - written_) {
+        return Result::ERROR_TOO_LARGE;
+    }
+    
+    const uint8_t* bytes = (const uint8_t*)data;
+    while (length > 0) {
+        size_t n = std::min(length, STREAM_CHUNK_SIZE - window_.size());
+        window_.insert(window_.end(), bytes, bytes + n);
+        crc_ = crc32Update(crc_, bytes, n);
+        written_ += n;
+        bytes += n;
+        length -= n;
+        if (window_.size() == STREAM_CHUNK_SIZE) {
+            Result res = storage_->writeStreamChunk(*this);
+            if (res != Result::SUCCESS) {
+                abort();
+                return res;
+            }
+        }
+    }
+    return Result::SUCCESS;
+}
+
+PersistentStorage::Result PersistentStorage::BlobWriter::commit() {
+    if (!storage_) {
+        return Result::ERROR_NVS_FAIL;
+    }
+    if (written_ != size_) {
+        return Result::ERROR_VALIDATION_FAILED;
+    }
+    Result res = storage_->commitStream(*this);
+    storage_->closeStream(*this);
+    return res;
+}
+
+void PersistentStorage::BlobWriter::abort() {
+    if (storage_) {
+        // The partial chunk set is erased by the next writer
+        storage_->closeStream(*this);
+    }
+}
+
+// Write the window as the next chunk
+PersistentStorage::Result PersistentStorage::writeStreamChunk(BlobWriter& writer) {
+    PSTOR_STATS_TIMER(startUs);
+    char key[NVS_KEY_NAME_MAX_SIZE];
+    streamChunkKey(writer.hash_, writer.generation_, writer.chunks_, key);
+    if (preferences_.putBytes(key, writer.window_.data(), writer.window_.size()) != writer.window_.size()) {
+        PSTOR_LOG_E( "Failed to write stream chunk %s", key);
+        return Result::ERROR_NVS_FAIL;
+    }
+    PSTOR_STATS_INC(nvsCommits);
+    PSTOR_STATS_ADD(nvsBytesWritten, writer.window_.size());
+    PSTOR_STATS_LATENCY(OP_SAVE, startUs);
+    writer.chunks_++;
+    writer.window_.clear();
+    return Result::SUCCESS;
+}
+
+// Write the last chunk, switch the manifest to the new set and erase the old one
+PersistentStorage::Result PersistentStorage::commitStream(BlobWriter& writer) {
+    if (!writer.window_.empty()) {
+        Result res = writeStreamChunk(writer);
+        if (res != Result::SUCCESS) {
+            return res;
+        }
+    }
+    
+    StreamManifest old;
+    bool hadOld = readStreamManifest(preferences_, writer.hash_, old);
+    
+    StreamManifest manifest;
+    memset(&manifest, 0, sizeof(manifest));
+    manifest.magic = STREAM_MAGIC;
+    manifest.size = writer.size_;
+    manifest.crc = ~writer.crc_;
+    manifest.chunkSize = STREAM_CHUNK_SIZE;
+    manifest.generation = writer.generation_;
+    char key[NVS_KEY_NAME_MAX_SIZE];
+    streamManifestKey(writer.hash_, key);
+    if (preferences_.putBytes(key, &manifest, sizeof(manifest)) != sizeof(manifest)) {
+        PSTOR_LOG_E( "Failed to write stream manifest %s", key);
+        return Result::ERROR_NVS_FAIL;
+    }
+    PSTOR_STATS_INC(nvsCommits);
+    PSTOR_STATS_ADD(nvsBytesWritten, sizeof(manifest));
+    
+    if (hadOld && old.generation != writer.generation_) {
+        eraseStreamChunks(preferences_, writer.hash_, old.generation, streamChunkCount(old.size, old.chunkSize));
+    }
+    PSTOR_LOG_D( "Committed stream %s: %d bytes in %d chunks", key, writer.size_, writer.chunks_);
+    return Result::SUCCESS;
+}
+
+void PersistentStorage::closeStream(BlobWriter& writer) {
+    if (blobMutex_ && xSemaphoreTake(blobMutex_, portMAX_DELAY) == pdTRUE) {
+        auto it = std::find(streamWriters_.begin(), streamWriters_.end(), writer.hash_);
+        if (it != streamWriters_.end()) {
+            streamWriters_.erase(it);
+        }
+        xSemaphoreGive(blobMutex_);
+    }
+    writer.storage_ = nullptr;
+    std::vector<uint8_t>().swap(writer.window_);
+}
+
+PersistentStorage::Result PersistentStorage::openBlobReader(const std::string& name, BlobReader& reader) {
+    reader = BlobReader();
+    if (!initialized_) {
+        return Result::ERROR_NVS_FAIL;
+    }
+    
+    uint32_t hash = nvsKeyHash(name.c_str());
+    StreamManifest manifest;
+    if (!readStreamManifest(preferences_, hash, manifest)) {
+        return Result::ERROR_NOT_FOUND;
+    }
+    if (manifest.chunkSize != STREAM_CHUNK_SIZE) {
+        PSTOR_LOG_E( "Stream %s has chunks of %u bytes", name.c_str(), manifest.chunkSize);
+        return Result::ERROR_TYPE_MISMATCH;
+    }
+    
+    reader.storage_ = this;
+    reader.hash_ = hash;
+    reader.size_ = manifest.size;
+    reader.crc_ = manifest.crc;
+    reader.generation_ = manifest.generation;
+    reader.runningCrc_ = 0xFFFFFFFF;
+    reader.checking_ = true;
+    return Result::SUCCESS;
+}
+
+PersistentStorage::Result PersistentStorage::BlobReader::read(void* out, size_t length, size_t* got) {
+    if (got) {
+        *got = 0;
+    }
+    if (!storage_) {
+        return Result::ERROR_NVS_FAIL;
+    }
+    
+    uint8_t* bytes = (uint8_t*)out;
+    size_t copied = 0;
+    length = std::min(length, (size_t)(size_ - position_));
+    while (copied < length) {
+        size_t chunk = position_ / STREAM_CHUNK_SIZE;
+        if (windowChunk_ != (int32_t)chunk) {
+            Result res = storage_->loadStreamChunk(*this, chunk);
+            if (res != Result::SUCCESS) {
+                return res;
+            }
+        }
+        size_t at = position_ % STREAM_CHUNK_SIZE;
+        size_t n = std::min(length - copied, window_.size() - at);
+        memcpy(bytes + copied, window_.data() + at, n);
+        if (checking_) {
+            runningCrc_ = crc32Update(runningCrc_, window_.data() + at, n);
+        }
+        copied += n;
+        position_ += n;
+        if (got) {
+            *got = copied;
+        }
+    }
+    
+    if (checking_ && position_ == size_) {
+        checking_ = false;
+        if (~runningCrc_ != crc_) {
+            PSTOR_LOG_E( "Stream CRC mismatch");
+            return Result::ERROR_VALIDATION_FAILED;
+        }
+    }
+    return Result::SUCCESS;
+}
+
+PersistentStorage::Result PersistentStorage::BlobReader::seek(size_t offset) {
+    if (!storage_) {
+        return Result::ERROR_NVS_FAIL;
+    }
+    if (offset > size_) {
+        return Result::ERROR_VALIDATION_FAILED;
+    }
+    position_ = offset;
+    checking_ = (offset == 0);
+    runningCrc_ = 0xFFFFFFFF;
+    return Result::SUCCESS;
+}
+
+// Load a chunk into the reader's window, checking its length
+PersistentStorage::Result PersistentStorage::loadStreamChunk(BlobReader& reader, size_t chunk) {
+    size_t expected = std::min(STREAM_CHUNK_SIZE, (size_t)reader.size_ - chunk * STREAM_CHUNK_SIZE);
+    char key[NVS_KEY_NAME_MAX_SIZE];
+    streamChunkKey(reader.hash_, reader.generation_, chunk, key);
+    reader.window_.resize(expected);
+    reader.windowChunk_ = -1;
+    if (preferences_.getBytesLength(key) != expected ||
+        preferences_.getBytes(key, reader.window_.data(), expected) != expected) {
+        // Replaced by a newer version, or lost
+        PSTOR_LOG_E( "Stream chunk %s is missing or damaged", key);
+        return Result::ERROR_NVS_FAIL;
+    }
+    reader.windowChunk_ = (int32_t)chunk;
+    return Result::SUCCESS;
+}
+
+PersistentStorage::Result PersistentStorage::removeBlobStream(const std::string& name) {
+    if (!initialized_) {
+        return Result::ERROR_NVS_FAIL;
+    }
+    uint32_t hash = nvsKeyHash(name.c_str());
+    if (!blobMutex_ || xSemaphoreTake(blobMutex_, portMAX_DELAY) != pdTRUE) {
+        return Result::ERROR_NVS_FAIL;
+    }
+    bool busy = std::find(streamWriters_.begin(), streamWriters_.end(), hash) != streamWriters_.end();
+    xSemaphoreGive(blobMutex_);
+    if (busy) {
+        return Result::ERROR_ACCESS_DENIED;
+    }
+    
+    StreamManifest manifest;
+    if (!readStreamManifest(preferences_, hash, manifest)) {
+        return Result::ERROR_NOT_FOUND;
+    }
+    // Manifest first: without it the chunks are never read
+    char key[NVS_KEY_NAME_MAX_SIZE];
+    streamManifestKey(hash, key);
+    if (!preferences_.remove(key)) {
+        return Result::ERROR_NVS_FAIL;
+    }
+    eraseStreamChunks(preferences_, hash, manifest.generation, streamChunkCount(manifest.size, manifest.chunkSize));
+    return Result::SUCCESS;
+}
+
+// Increment a counter, saving it once the flush threshold is reached
+PersistentStorage::Result PersistentStorage::add(const std::string& name, uint64_t delta) {
+    RegistryLock::ReadGuard guard(registryLock_);
+    ParameterInfo* param = findParameter(name);
+    if (!param) {
+        return Result::ERROR_NOT_FOUND;
+    }
+    if (param->type != ParameterInfo::TYPE_COUNTER) {
+        return Result::ERROR_TYPE_MISMATCH;
+    }
+    if (delta == 0) {
+        return Result::SUCCESS;
+    }
+    
+    uint64_t value = ValueAccess::add<uint64_t>(param->dataPtr, delta);
+    CounterState& state = *param->constraints.counter.state;
+    bool due = false;
+    bool first = false;
+    if (xSemaphoreTake(counterMutex_, portMAX_DELAY) == pdTRUE) {
+        due = (value - state.flushed >= state.config.flushThreshold);
+        if (!state.dirty) {
+            state.dirty = true;
+            state.dirtySinceMs = millis();
+            first = true;
+        }
+        xSemaphoreGive(counterMutex_);
+    }
+    
+    Result res = Result::SUCCESS;
+    if (due && initialized_) {
+        res = persistParameter(*param);
+    } else if (first) {
+        wakeServiceTask();  // Re-arm the timeout for the flush interval
+    }
+    notifyChange(name, param->dataPtr);
+    return res;
+}
+
+// Save counters with unsaved increments
+size_t PersistentStorage::flushCounters(bool all) {
+    RegistryLock::ReadGuard guard(registryLock_);
+    if (!initialized_) {
+        return 0;
+    }
+    return flushDueCounters(all, nullptr);
+}
+
+// Save dirty counters past their interval (all: every dirty counter); waitMs
+// receives the time until the next one is due. The caller holds the registry lock.
+size_t PersistentStorage::flushDueCounters(bool all, uint32_t* waitMs) {
+    std::vector<ParameterInfo*> due;
+    uint32_t wait = serviceConfig_.idleTimeoutMs;
+    if (xSemaphoreTake(counterMutex_, portMAX_DELAY) != pdTRUE) {
+        return 0;
+    }
+    uint32_t now = millis();
+    for (CounterState& state : counters_) {
+        if (!state.dirty || !state.param) {
+            continue;
+        }
+        uint32_t elapsed = now - state.dirtySinceMs;
+        if (all || elapsed >= state.config.flushIntervalMs) {
+            due.push_back(state.param);
+        } else {
+            wait = std::min(wait, state.config.flushIntervalMs - elapsed);
+        }
+    }
+    xSemaphoreGive(counterMutex_);
+    
+    size_t saved = 0;
+    if (saveMode_ == SaveMode::SNAPSHOT && !due.empty()) {
+        // One image covers all counters
+        saved = (saveSnapshot() == Result::SUCCESS) ? due.size() : 0;
+    } else {
+        for (ParameterInfo* param : due) {
+            if (saveParameter(*param) == Result::SUCCESS) {
+                saved++;
+            }
+        }
+    }
+    
+    if (waitMs) {
+        *waitMs = wait;
+    }
+    if (saved > 0) {
+        PSTOR_LOG_D( "Flushed %d counters", saved);
+    }
+    return saved;
+}
+
+// Release the flush state of a counter that left the registry; the slot is
+// reused by the next registerCounter()
+void PersistentStorage::detachCounter(CounterState& state) {
+    if (xSemaphoreTake(counterMutex_, portMAX_DELAY) != pdTRUE) {
+        return;
+    }
+    state.param = nullptr;
+    state.dirty = false;
+    xSemaphoreGive(counterMutex_);
+}
+
+// Record a saved counter value; increments made since stay dirty
+void PersistentStorage::markCounterFlushed(const ParameterInfo& param, uint64_t value) {
+    CounterState* state = param.constraints.counter.state;
+    if (!state || xSemaphoreTake(counterMutex_, portMAX_DELAY) != pdTRUE) {
+        return;
+    }
+    state->flushed = std::max(state->flushed, value);
+    bool dirty = ValueAccess::load<uint64_t>(param.dataPtr) != state->flushed;
+    if (dirty && !state->dirty) {
+        state->dirtySinceMs = millis();
+    }
+    state->dirty = dirty;
+    xSemaphoreGive(counterMutex_);
+}
+
+// Set parameter value from JSON
+PersistentStorage::Result PersistentStorage::setJson(const std::string& name, const JsonDocument& doc) {
+    RegistryLock::ReadGuard guard(registryLock_);
+    ParameterInfo* param = findParameter(name);
+    const StructField* field = nullptr;
+    if (!param && !(param = findField(name, field))) {
+        return Result::ERROR_NOT_FOUND;
+    }
+    
+    if (param->access == ParameterInfo::ACCESS_READ_ONLY) {
+        return Result::ERROR_ACCESS_DENIED;
+    }
+    
+    PSTOR_STATS_TIMER(startUs);
+    Result res = field ? jsonToField(*param, *field, doc) : jsonToParameter(*param, doc);
+    if (res == Result::SUCCESS) {
+        // Save to NVS (a struct field rewrites its struct's blob)
+        persistParameter(*param);
+        
+        // Notify change
+        notifyChange(param->name, param->dataPtr);
+        
+        // Publish via MQTT if available
+        if (mqttManager_) {
+            publishUpdate(name);
+        }
+    }
+    
+    PSTOR_STATS_LATENCY(OP_SET_JSON, startUs);
+    return res;
+}
+
+// Set one array element from JSON and save only its chunk
+PersistentStorage::Result PersistentStorage::setElementJson(const std::string& name, size_t index,
+                                                            const JsonDocument& doc) {
+    RegistryLock::ReadGuard guard(registryLock_);
+    ParameterInfo* param = findParameter(name);
+    if (!param) {
+        return Result::ERROR_NOT_FOUND;
+    }
+    if (param->type != ParameterInfo::TYPE_ARRAY) {
+        return Result::ERROR_TYPE_MISMATCH;
+    }
+    if (param->access == ParameterInfo::ACCESS_READ_ONLY) {
+        return Result::ERROR_ACCESS_DENIED;
+    }
+    
+    PSTOR_STATS_TIMER(startUs);
+    uint8_t element[sizeof(int32_t)];
+    Result res = elementFromJson(param->elementType, doc["value"], element)
+               ? storeElement(*param, index, element, elementSize(param->elementType))
+               : Result::ERROR_VALIDATION_FAILED;
+    if (res == Result::SUCCESS) {
+        if (param->persistence == ParameterInfo::PERSIST_NVS) {
+            if (saveMode_ == SaveMode::SNAPSHOT) {
+                saveSnapshot();
+            } else {
+                saveArrayChunk(*param, index * elementSize(param->elementType) / ARRAY_CHUNK_SIZE);
+            }
+        }
+        
+        notifyChange(name, param->dataPtr);
+        
+        if (mqttManager_) {
+            publishParameter(*param, index, 1);
+        }
+    }
+    
+    PSTOR_STATS_LATENCY(OP_SET_JSON, startUs);
+    return res;
+}
+
+// Get all parameters as JSON
+void PersistentStorage::getAllJson(JsonDocument& doc) {
+    RegistryLock::ReadGuard guard(registryLock_);
+    doc.clear();
+    JsonObject root = doc.to<JsonObject>();
+    
+    // Add a summary instead of all parameters to avoid stack overflow
+    root["parameterCount"] = parameters_.size();
+    root["message"] = "Use individual parameter queries to avoid memory issues";
+    root["timestamp"] = millis();
+    
+    // Add just parameter names as an array
+    JsonArray names = root["parameters"].to<JsonArray>();
+    for (const ParameterInfo* param : parameters_) {
+        names.add(param->name);
+    }
+}
+
+// Get one page of parameter names as JSON
+void PersistentStorage::getAllJson(JsonDocument& doc, const std::string& prefix,
+                                   const std::string& cursor, size_t limit, bool withMeta) {
+    RegistryLock::ReadGuard guard(registryLock_);
+    doc.clear();
+    JsonObject root = doc.to<JsonObject>();
+    root["prefix"] = prefix;
+    
+    std::vector<std::string> names;
+    names.reserve(limit);
+    std::string next = listPage(prefix, cursor, limit, names);
+    
+    JsonArray items = root["items"].to<JsonArray>();
+    for (const auto& name : names) {
+        if (!withMeta) {
+            items.add(name);
+            continue;
+        }
+        const ParameterInfo& param = *findParameter(name);
+        JsonObject item = items.add<JsonObject>();
+        item["name"] = name;
+        item["type"] = typeToString(param.type);
+        item["access"] = (param.access == ParameterInfo::ACCESS_READ_ONLY) ? "ro" : "rw";
+    }
+    root["count"] = names.size();
+    
+    if (!next.empty()) {
+        root["next"] = next;
+    }
+}
+
+// List all parameter names
+std::vector<std::string> PersistentStorage::listParameters() const {
+    RegistryLock::ReadGuard guard(registryLock_);
+    std::vector<std::string> names;
+    names.reserve(parameters_.size());
+    
+    for (const ParameterInfo* param : parameters_) {
+        names.push_back(param->name);
+    }
+    
+    return names;
+}
+
+// Set MQTT manager for remote access
+void PersistentStorage::setMqttManager(MQTTManager* mqtt) {
+    mqttManager_ = mqtt;
+    
+    if (mqtt) {
+        PSTOR_LOG_I( "MQTT manager set, remote access enabled");
+        
+        // Subscribe to parameter topics
+        // This would be done in the main application to avoid circular dependencies
+    }
+}
+
+// Set MQTT publish callback for thread-safe publishing
+void PersistentStorage::setMqttPublishCallback(std::function<bool(const char*, const char*, int, bool)> callback) {
+    mqttPublishCallback_ = callback;
+    PSTOR_LOG_I( "MQTT publish callback set");
+}
+
+// Handle MQTT command
+bool PersistentStorage::handleMqttCommand(const std::string& topic, const std::string& payload) {
+    PSTOR_LOG_I( "handleMqttCommand called - topic: %s, payload: %s", 
+                             topic.c_str(), payload.c_str());
+    
+    // Queue command for async processing to avoid blocking MQTT task
+    if (!commandQueue_) {
+        PSTOR_LOG_E( "Command queue not initialized");
+        return false;
+    }
+    
+    // Extract command from topic
+    if (topic.find(mqttPrefix_) != 0) {
+        PSTOR_LOG_W( "Topic doesn't match prefix. Topic: %s, Prefix: %s", 
+                                 topic.c_str(), mqttPrefix_.c_str());
+        return false;  // Not our topic
+    }
+    
+    std::string subTopic = topic.substr(mqttPrefix_.length() + 1);  // Skip prefix and '/'
+    
+    ParameterCommand cmd;
+    memset(&cmd, 0, sizeof(cmd));
+    
+    if (subTopic.find("set/") == 0) {
+        // set/<name>, set/<blob>?offset=<n>&final=1
+        size_t queryPos = subTopic.find('?');
+        std::string paramName = subTopic.substr(4, queryPos == std::string::npos ? std::string::npos : queryPos - 4);
+        std::string query = (queryPos == std::string::npos) ? "" : subTopic.substr(queryPos + 1);
+        if (handleBlobSet(paramName, query, payload)) {
+            return true;
+        }
+        
+        cmd.type = ParameterCommand::SET;
+        strncpy(cmd.paramName, paramName.c_str(), sizeof(cmd.paramName) - 1);
+        strncpy(cmd.payload, payload.c_str(), sizeof(cmd.payload) - 1);
+    } else if (subTopic == "get/all") {
+        cmd.type = ParameterCommand::GET_ALL;
+        strcpy(cmd.paramName, "all");
+    } else if (subTopic.find("get/") == 0) {
+        // get/<name>, get/<array>/<index> or get/<array>?offset=<i>&count=<n>
+        cmd.type = ParameterCommand::GET;
+        size_t queryPos = subTopic.find('?');
+        std::string paramName = subTopic.substr(4, queryPos == std::string::npos ? std::string::npos : queryPos - 4);
+        strncpy(cmd.paramName, paramName.c_str(), sizeof(cmd.paramName) - 1);
+        
+        while (queryPos != std::string::npos) {
+            size_t start = queryPos + 1;
+            queryPos = subTopic.find('&', start);
+            std::string arg = subTopic.substr(start, queryPos == std::string::npos ? std::string::npos : queryPos - start);
+            
+            if (arg.find("offset=") == 0) {
+                cmd.offset = (uint16_t)std::min<unsigned long>(strtoul(arg.c_str() + 7, nullptr, 10), UINT16_MAX);
+            } else if (arg.find("count=") == 0) {
+                cmd.limit = (uint16_t)std::min<unsigned long>(strtoul(arg.c_str() + 6, nullptr, 10), UINT16_MAX);
+            }
+        }
+    } else if (subTopic == "list") {
+        cmd.type = ParameterCommand::LIST;
+    } else if (subTopic.find("list/") == 0 || subTopic.find("list?") == 0) {
+        // list/<prefix>?cursor=<name>&limit=<n>&meta=1 - every part optional
+        cmd.type = ParameterCommand::LIST_PAGE;
+        cmd.limit = LIST_PAGE_DEFAULT;
+        
+        size_t queryPos = subTopic.find('?');
+        std::string prefix = subTopic.substr(4, queryPos == std::string::npos ? std::string::npos : queryPos - 4);
+        if (!prefix.empty()) {
+            prefix.erase(0, 1);  // Skip '/'
+        }
+        strncpy(cmd.paramName, prefix.c_str(), sizeof(cmd.paramName) - 1);
+        
+        while (queryPos != std::string::npos) {
+            size_t start = queryPos + 1;
+            queryPos = subTopic.find('&', start);
+            std::string arg = subTopic.substr(start, queryPos == std::string::npos ? std::string::npos : queryPos - start);
+            
+            if (arg.find("cursor=") == 0) {
+                strncpy(cmd.payload, arg.c_str() + 7, sizeof(cmd.payload) - 1);
+            } else if (arg.find("limit=") == 0) {
+                long limit = strtol(arg.c_str() + 6, nullptr, 10);
+                cmd.limit = (uint16_t)std::min<long>(std::max<long>(limit, 1), LIST_PAGE_MAX);
+            } else if (arg == "meta=1" || arg == "meta=true") {
+                cmd.withMeta = true;
+            }
+        }
+    } else if (subTopic == "save") {
+        cmd.type = ParameterCommand::SAVE;
+    } else if (subTopic == "stats") {
+        cmd.type = ParameterCommand::STATS;
+    } else {
+        return false;  // Unknown command
+    }
+    
+    // Commands without arguments produce the same result however often they
+    // are queued, so merge them into the one already waiting
+    uint32_t pendingBit = 0;
+    if (cmd.type == ParameterCommand::LIST || cmd.type == ParameterCommand::SAVE ||
+        cmd.type == ParameterCommand::GET_ALL || cmd.type == ParameterCommand::STATS) {
+        pendingBit = 1UL << cmd.type;
+        if (pendingCommands_.fetch_or(pendingBit) & pendingBit) {
+            PSTOR_STATS_INC(commandsCoalesced);
+            PSTOR_LOG_D( "Command type %d already queued, coalesced", cmd.type);
+            return true;
+        }
+    }
+    
+    // Queue the command - don't wait if queue is full
+    if (xQueueSend(commandQueue_, &cmd, 0) != pdTRUE) {
+        pendingCommands_.fetch_and(~pendingBit);
+        PSTOR_STATS_INC(commandsDropped);
+        PSTOR_LOG_W( "Command queue full, dropping command");
+        return true;  // Still return true as we handled the topic
+    }
+    
+#ifndef PSTORAGE_DISABLE_STATS
+    uint32_t depth = uxQueueMessagesWaiting(commandQueue_);
+    portENTER_CRITICAL(&statsMux_);
+    if (depth > stats_.queueHighWater) {
+        stats_.queueHighWater = depth;
+    }
+    portEXIT_CRITICAL(&statsMux_);
+#endif
+    
+    PSTOR_LOG_D( "Queued command type %d for %s", 
+                             cmd.type, cmd.paramName);
+    wakeServiceTask();
+    return true;
+}
+
+// Blob payloads do not fit a queued command: chunks are decoded into the
+// staging buffer right away and only the commit is queued. Returns false
+// if name is not a blob.
+bool PersistentStorage::handleBlobSet(const std::string& name, const std::string& query,
+                                      const std::string& payload) {
+    RegistryLock::ReadGuard guard(registryLock_);
+    ParameterInfo* param = findParameter(name);
+    if (!param || param->type != ParameterInfo::TYPE_BLOB) {
+        return false;
+    }
+    if (param->access == ParameterInfo::ACCESS_READ_ONLY) {
+        PSTOR_LOG_E("Set %s: %s", name.c_str(), resultToString(Result::ERROR_ACCESS_DENIED));
+        return true;
+    }
+    
+    // Without a query the payload is the whole blob
+    size_t offset = 0;
+    bool final = query.empty();
+    size_t pos = 0;
+    while (pos < query.size()) {
+        size_t end = query.find('&', pos);
+        std::string arg = query.substr(pos, end == std::string::npos ? std::string::npos : end - pos);
+        if (arg.find("offset=") == 0) {
+            offset = strtoul(arg.c_str() + 7, nullptr, 10);
+        } else if (arg == "final=1" || arg == "final=true") {
+            final = true;
+        }
+        pos = (end == std::string::npos) ? query.size() : end + 1;
+    }
+    
+    // Raw base64 or {"value": "<base64>"}
+    const char* text = payload.c_str();
+    size_t length = payload.length();
+    JsonDocument doc;  // ArduinoJson v7
+    if (!payload.empty() && payload[0] == '{') {
+        if (deserializeJson(doc, payload) || !doc["value"].is<const char*>()) {
+            PSTOR_LOG_E("Set %s: %s", name.c_str(), resultToString(Result::ERROR_VALIDATION_FAILED));
+            return true;
+        }
+        text = doc["value"].as<const char*>();
+        length = strlen(text);
+    }
+    
+    bool complete = false;
+    Result res = stageBlob(*param, offset, text, length, true, final, complete);
+    if (res != Result::SUCCESS) {
+        PSTOR_LOG_E("Set %s: %s", name.c_str(), resultToString(res));
+        return true;
+    }
+    if (!complete) {
+        PSTOR_LOG_D("Staged %d bytes of %s at %d", base64DecodedLength(text, length), name.c_str(), offset);
+        return true;
+    }
+    
+    ParameterCommand cmd;
+    memset(&cmd, 0, sizeof(cmd));
+    cmd.type = ParameterCommand::BLOB_COMMIT;
+    strncpy(cmd.paramName, param->name, sizeof(cmd.paramName) - 1);
+    if (xQueueSend(commandQueue_, &cmd, 0) != pdTRUE) {
+        // Nothing would commit it: drop the transfer so the sender can retry
+        xSemaphoreTake(blobMutex_, portMAX_DELAY);
+        if (blobUpload_.param == param) {
+            blobUpload_ = BlobUpload();
+        }
+        xSemaphoreGive(blobMutex_);
+        PSTOR_STATS_INC(commandsDropped);
+        PSTOR_LOG_W( "Command queue full, dropping blob transfer of %s", name.c_str());
+        return true;
+    }
+    wakeServiceTask();
+    return true;
+}
+
+// Private helper methods
+
+bool PersistentStorage::validateParameterName(const std::string& name) const {
+    if (name.empty() || name.length() > 64) {
+        return false;
+    }
+    
+    // Check for valid characters (alphanumeric, underscore, slash)
+    for (char c : name) {
+        if (!isalnum(c) && c != '_' && c != '/') {
+            return false;
+        }
+    }
+    
+    return true;
+}
+
+std::string PersistentStorage::sanitizeNvsKey(const std::string& name) const {
+    char key[NVS_KEY_NAME_MAX_SIZE];
+    nvsKeyFor(name.c_str(), key);
+    return std::string(key);
+}
+
+// NVS key of a parameter name into a NVS_KEY_NAME_MAX_SIZE buffer
+void PersistentStorage::nvsKeyFor(const char* name, char* key) {
+    // NVS keys have max 15 chars, so we need to hash longer names
+    size_t len = strlen(name);
+    if (len < NVS_KEY_NAME_MAX_SIZE) {
+        memcpy(key, name, len + 1);
+        return;
+    }
+    
+    // Same hash as the compile-time key check in PersistentStorageSchema.h
+    snprintf(key, NVS_KEY_NAME_MAX_SIZE, "p%lu", (unsigned long)nvsKeyHash(name));
+}
+
+// Load a parameter. stored = the key is known to exist with the parameter's
+// NVS item type, so a value that cannot be read has the wrong size.
+PersistentStorage::Result PersistentStorage::loadParameter(ParameterInfo& param, bool stored) {
+    if (param.persistence == ParameterInfo::PERSIST_NONE) {
+        return Result::SUCCESS;
+    }
+    
+    PSTOR_STATS_TIMER(startUs);
+    std::string key = sanitizeNvsKey(param.name);
+    Result result = Result::SUCCESS;
+    
+    switch (param.type) {
+        case ParameterInfo::TYPE_BOOL: {
+            bool defaultVal = ValueAccess::load<bool>(param.dataPtr);
+            ValueAccess::store<bool>(param.dataPtr, preferences_.getBool(key.c_str(), defaultVal));
+            break;
+        }
+        
+        case ParameterInfo::TYPE_INT: {
+            int32_t defaultVal = ValueAccess::load<int32_t>(param.dataPtr);
+            ValueAccess::store<int32_t>(param.dataPtr, preferences_.getInt(key.c_str(), defaultVal));
+            break;
+        }
+        
+        case ParameterInfo::TYPE_COUNTER: {
+            uint64_t value = preferences_.getULong64(key.c_str(), ValueAccess::load<uint64_t>(param.dataPtr));
+            ValueAccess::store<uint64_t>(param.dataPtr, value);
+            markCounterFlushed(param, value);
+            break;
+        }
+        
+        case ParameterInfo::TYPE_INT64: {
+            int64_t defaultVal = ValueAccess::load<int64_t>(param.dataPtr);
+            ValueAccess::store<int64_t>(param.dataPtr, preferences_.getLong64(key.c_str(), defaultVal));
+            break;
+        }
+        
+        case ParameterInfo::TYPE_UINT32: {
+            uint32_t defaultVal = ValueAccess::load<uint32_t>(param.dataPtr);
+            ValueAccess::store<uint32_t>(param.dataPtr, preferences_.getUInt(key.c_str(), defaultVal));
+            break;
+        }
+        
+        case ParameterInfo::TYPE_ENUM: {
+            // An index beyond the table (names removed since) keeps the default
+            uint8_t defaultVal = ValueAccess::load<uint8_t>(param.dataPtr);
+            uint8_t value = preferences_.getUChar(key.c_str(), defaultVal);
+            if (value < param.constraints.enumeration.count) {
+                ValueAccess::store<uint8_t>(param.dataPtr, value);
+            } else {
+                result = Result::ERROR_TYPE_MISMATCH;
+            }
+            break;
+        }
+        
+        case ParameterInfo::TYPE_FLOAT:
+        case ParameterInfo::TYPE_DOUBLE: {
+            // Floats are 4-byte and doubles 8-byte blobs. Both share the NVS
+            // type, so a value stored as the other one is converted here.
+            // One getBytes() into a buffer that fits either, the returned length
+            // tells which. Preferences still looks up the length before reading,
+            // so this is two NVS lookups instead of three.
+            uint8_t raw[sizeof(double)];
+            size_t len = preferences_.getBytes(key.c_str(), raw, sizeof(raw));
+            double wide = 0;
+            float narrow = 0;
+            if (len == sizeof(double)) {
+                memcpy(&wide, raw, sizeof(wide));
+                narrow = (float)wide;
+            } else if (len == sizeof(float)) {
+                memcpy(&narrow, raw, sizeof(narrow));
+                wide = narrow;
+            } else {
+                if (stored || len > 0) {
+                    result = Result::ERROR_TYPE_MISMATCH;
+                }
+                break;
+            }
+            const void* value = (param.type == ParameterInfo::TYPE_FLOAT) ? (const void*)&narrow : &wide;
+            if (len != param.size && validateValue(param, value, param.size) != Result::SUCCESS) {
+                result = Result::ERROR_TYPE_MISMATCH;
+                break;
+            }
+            storeValue(param, value, param.size);
+            if (len != param.size) {
+                PSTOR_LOG_I( "Converted stored %s to %s", param.name, typeToString(param.type));
+                saveParameter(param);
+            }
+            break;
+        }
+        
+        case ParameterInfo::TYPE_STRING: {
+            // Flash is read into a copy, so that readers never wait for it
+            std::vector<char> text(param.size);
+            size_t len = preferences_.getString(key.c_str(), text.data(), param.size);
+            if (len > 0) {
+                storeValue(param, text.data(), strnlen(text.data(), param.size - 1));
+                param.storedAsBlob = false;
+                break;
+            }
+            // Compressed strings are stored as blobs. Only probed for with
+            // compression on; without, the iterating load finds them by type
+            // (convertStored()).
+            result = (param.compression != ParameterInfo::COMPRESS_NONE)
+                   ? loadCompressed(param, key.c_str()) : Result::ERROR_NOT_FOUND;
+            if (result == Result::ERROR_NOT_FOUND) {
+                result = stored ? Result::ERROR_TYPE_MISMATCH : Result::SUCCESS;   // Longer than the buffer
+            }
+            break;
+        }
+        
+        case ParameterInfo::TYPE_BLOB: {
+            size_t len = preferences_.getBytesLength(key.c_str());
+            if (len > 0 && len <= param.size) {
+                // Read and decompressed into a copy, published in one step
+                std::vector<uint8_t> data(len);
+                preferences_.getBytes(key.c_str(), data.data(), len);
+                if (len >= COMPRESSED_HEADER_SIZE && memcmp(data.data(), COMPRESSED_MAGIC, 2) == 0) {
+                    // Probably compressed; a plain blob that only starts alike is kept
+                    std::vector<uint8_t> value(param.size);
+                    size_t original;
+                    if (decompressValue(data.data(), len, value.data(), param.size, original)) {
+                        value.resize(original);
+                        data.swap(value);
+                    }
+                }
+                storeValue(param, data.data(), data.size());
+            } else if (stored || len > 0) {
+                result = Result::ERROR_TYPE_MISMATCH;
+            }
+            break;
+        }
+        
+        case ParameterInfo::TYPE_ARRAY:
+            for (size_t chunk = 0; chunk < arrayChunkCount(param); chunk++) {
+                Result res = loadArrayChunk(param, chunk, false);
+                if (res != Result::SUCCESS) {
+                    result = res;
+                }
+            }
+            break;
+        
+        case ParameterInfo::TYPE_STRUCT: {
+            size_t len = preferences_.getBytesLength(key.c_str());
+            if (len == 0) {
+                result = stored ? Result::ERROR_TYPE_MISMATCH : Result::SUCCESS;
+                break;
+            }
+            std::vector<uint8_t> data(len);
+            preferences_.getBytes(key.c_str(), data.data(), len);
+            bool upgraded = false;
+            result = decodeStruct(param, data.data(), len, upgraded);
+            if (result == Result::SUCCESS && upgraded) {
+                // Rewrite in the current layout so later loads match directly
+                PSTOR_LOG_I( "Upgraded %s to layout v%u", param.name,
+                             param.constraints.structure.layout->version);
+                saveParameter(param);
+            }
+            break;
+        }
+    }
+    
+    if (result != Result::SUCCESS) {
+        PSTOR_LOG_W( "Stored %s has the wrong size, keeping default", param.name);
+    }
+    PSTOR_STATS_LATENCY(OP_LOAD, startUs);
+    return result;
+}
+
+// Load a value stored with a different NVS type than the parameter's, e.g.
+// after int -> float without a migration. Converts what can be represented
+// and re-saves it with the right type, erasing the old item. Otherwise the
+// default is kept and the old item stays untouched, so that a migration or
+// a firmware that still knows the old type can read it.
+PersistentStorage::Result PersistentStorage::convertStored(ParameterInfo& param, uint8_t storedType) {
+    char key[NVS_KEY_NAME_MAX_SIZE];
+    nvsKeyFor(param.name, key);
+    
+    if (param.type == ParameterInfo::TYPE_STRING && storedType == NVS_TYPE_BLOB &&
+        loadCompressed(param, key) == Result::SUCCESS) {
+        // Compressed, but the parameter no longer is
+        preferences_.remove(key);
+        PSTOR_LOG_I( "Converted stored %s to %s", param.name, typeToString(param.type));
+        return saveParameter(param);
+    }
+    
+    double number = NAN;
+    std::string text;
+    switch (storedType) {
+        case NVS_TYPE_U8:   number = preferences_.getUChar(key); break;
+        case NVS_TYPE_I32:  number = preferences_.getInt(key); break;
+        case NVS_TYPE_U32:  number = preferences_.getUInt(key); break;
+        case NVS_TYPE_I64:  number = (double)preferences_.getLong64(key); break;
+        case NVS_TYPE_U64:  number = (double)preferences_.getULong64(key); break;
+        case NVS_TYPE_BLOB: {
+            // Float or double
+            size_t length = preferences_.getBytesLength(key);
+            if (length == sizeof(float)) {
+                float value;
+                preferences_.getBytes(key, &value, sizeof(value));
+                number = value;
+            } else if (length == sizeof(double)) {
+                double value;
+                preferences_.getBytes(key, &value, sizeof(value));
+                number = value;
+            }
+            break;
+        }
+        case NVS_TYPE_STR: {
+            // Sized from the stored item: it may be longer than any buffer at hand
+            nvs_handle_t handle;
+            if (nvs_open(namespaceName_.c_str(), NVS_READONLY, &handle) == ESP_OK) {
+                std::vector<uint8_t> data;
+                if (readNvsBytes(handle, key, NVS_TYPE_STR, data) && !data.empty()) {
+                    text.assign((const char*)data.data(), strnlen((const char*)data.data(), data.size()));
+                }
+                nvs_close(handle);
+            }
+            if (!text.empty()) {
+                char* end = nullptr;
+                double parsed = strtod(text.c_str(), &end);
+                if (text == "true" || text == "false") {
+                    number = (text[0] == 't') ? 1 : 0;
+                } else if (end != text.c_str() && *end == '\0') {
+                    number = parsed;
+                }
+            }
+            break;
+        }
+        default:
+            break;
+    }
+    if (text.empty() && !std::isnan(number)) {
+        char formatted[32];
+        snprintf(formatted, sizeof(formatted), "%.9g", number);
+        text = formatted;
+    }
+    
+    // Candidate in the parameter's type, checked like an MQTT write
+    Result result = Result::ERROR_TYPE_MISMATCH;
+    bool boolValue = false;
+    int32_t intValue = 0;
+    float floatValue = 0.0f;
+    uint64_t counterValue = 0;
+    int64_t int64Value = 0;
+    uint32_t uint32Value = 0;
+    double doubleValue = 0.0;
+    uint8_t enumValue = 0;
+    const void* value = nullptr;
+    size_t size = 0;
+    switch (param.type) {
+        case ParameterInfo::TYPE_BOOL:
+            boolValue = (number != 0);
+            value = &boolValue;
+            size = sizeof(boolValue);
+            break;
+        case ParameterInfo::TYPE_INT:
+            if (number >= INT32_MIN && number <= INT32_MAX) {
+                intValue = (int32_t)std::lround(number);
+                value = &intValue;
+                size = sizeof(intValue);
+            }
+            break;
+        case ParameterInfo::TYPE_FLOAT:
+            floatValue = (float)number;
+            value = &floatValue;
+            size = sizeof(floatValue);
+            break;
+        case ParameterInfo::TYPE_COUNTER:
+            if (number >= 0 && number < 1.8e19) {
+                counterValue = (uint64_t)std::llround(number);
+                value = &counterValue;
+                size = sizeof(counterValue);
+            }
+            break;
+        case ParameterInfo::TYPE_INT64:
+            if (std::fabs(number) < 9.2e18) {
+                int64Value = std::llround(number);
+                value = &int64Value;
+                size = sizeof(int64Value);
+            }
+            break;
+        case ParameterInfo::TYPE_UINT32:
+            if (number >= 0 && number <= UINT32_MAX) {
+                uint32Value = (uint32_t)std::llround(number);
+                value = &uint32Value;
+                size = sizeof(uint32Value);
+            }
+            break;
+        case ParameterInfo::TYPE_DOUBLE:
+            doubleValue = number;
+            value = &doubleValue;
+            size = sizeof(doubleValue);
+            break;
+        case ParameterInfo::TYPE_ENUM: {
+            // A string enum becomes its index; numbers are taken as the index
+            int index = (storedType == NVS_TYPE_STR) ? enumIndexOf(param, text.c_str()) : -1;
+            if (index >= 0) {
+                number = index;
+            }
+            if (number >= 0 && number <= UINT8_MAX) {
+                enumValue = (uint8_t)std::lround(number);
+                value = &enumValue;
+                size = sizeof(enumValue);
+            }
+            break;
+        }
+        case ParameterInfo::TYPE_STRING:
+            value = text.c_str();
+            size = text.size();
+            break;
+        default:
+            break;
+    }
+    if (value && (param.type == ParameterInfo::TYPE_STRING ? size > 0 : !std::isnan(number))) {
+        result = validateValue(param, value, size);
+        if (result == Result::ERROR_VALIDATION_FAILED) {
+            result = Result::ERROR_TYPE_MISMATCH;
+        }
+    }
+    
+    if (result != Result::SUCCESS) {
+        PSTOR_LOG_W( "Stored %s has an incompatible type, keeping default", param.name);
+        return result;
+    }
+    
+    preferences_.remove(key);
+    storeValue(param, value, size);
+    PSTOR_LOG_I( "Converted stored %s to %s", param.name, typeToString(param.type));
+    return saveParameter(param);
+}
+
+PersistentStorage::Result PersistentStorage::saveParameter(const ParameterInfo& param) {
+    if (param.persistence == ParameterInfo::PERSIST_NONE) {
+        return Result::SUCCESS;
+    }
+    
+    PSTOR_STATS_TIMER(startUs);
+    std::string key = sanitizeNvsKey(param.name);
+    size_t written = 0;
+    
+    switch (param.type) {
+        case ParameterInfo::TYPE_BOOL:
+            written = preferences_.putBool(key.c_str(), ValueAccess::load<bool>(param.dataPtr));
+            break;
+            
+        case ParameterInfo::TYPE_INT:
+            written = preferences_.putInt(key.c_str(), ValueAccess::load<int32_t>(param.dataPtr));
+            break;
+            
+        case ParameterInfo::TYPE_FLOAT:
+            written = preferences_.putFloat(key.c_str(), ValueAccess::load<float>(param.dataPtr));
+            break;
+            
+        case ParameterInfo::TYPE_INT64:
+            written = preferences_.putLong64(key.c_str(), ValueAccess::load<int64_t>(param.dataPtr));
+            break;
+            
+        case ParameterInfo::TYPE_UINT32:
+            written = preferences_.putUInt(key.c_str(), ValueAccess::load<uint32_t>(param.dataPtr));
+            break;
+            
+        case ParameterInfo::TYPE_DOUBLE:
+            written = preferences_.putDouble(key.c_str(), ValueAccess::load<double>(param.dataPtr));
+            break;
+            
+        case ParameterInfo::TYPE_ENUM:
+            written = preferences_.putUChar(key.c_str(), ValueAccess::load<uint8_t>(param.dataPtr));
+            break;
+            
+        case ParameterInfo::TYPE_COUNTER: {
+            uint64_t value = ValueAccess::load<uint64_t>(param.dataPtr);
+            written = preferences_.putULong64(key.c_str(), value);
+            if (written > 0) {
+                markCounterFlushed(param, value);
+            }
+            break;
+        }
+            
+        case ParameterInfo::TYPE_STRING:
+        case ParameterInfo::TYPE_BLOB: {
+            if (param.compression != ParameterInfo::COMPRESS_NONE) {
+                written = saveCompressed(param, key.c_str());
+                break;
+            }
+            // A string last saved compressed is a blob; NVS would keep both items
+            if (param.type == ParameterInfo::TYPE_STRING && param.storedAsBlob) {
+                preferences_.remove(key.c_str());
+            }
+            // Write straight from the variable and rewrite if it changed meanwhile,
+            // so that NVS never keeps a torn value and no copy is needed
+            uint32_t start;
+            do {
+                start = ValueAccess::readBegin(param.sequence);
+                if (param.type == ParameterInfo::TYPE_STRING) {
+                    written = preferences_.putString(key.c_str(), (const char*)param.dataPtr);
+                } else {
+                    written = preferences_.putBytes(key.c_str(), param.dataPtr, param.size);
+                }
+            } while (written > 0 && ValueAccess::readRetry(param.sequence, start));
+            if (written > 0) {
+                param.storedAsBlob = false;
+            }
+            break;
+        }
+        
+        case ParameterInfo::TYPE_STRUCT: {
+            std::vector<uint8_t> blob;
+            encodeStruct(param, blob);
+            written = preferences_.putBytes(key.c_str(), blob.data(), blob.size());
+            break;
+        }
+        
+        case ParameterInfo::TYPE_ARRAY: {
+            // NVS skips chunks whose content did not change
+            Result result = Result::SUCCESS;
+            for (size_t chunk = 0; chunk < arrayChunkCount(param); chunk++) {
+                Result res = saveArrayChunk(param, chunk);
+                if (res != Result::SUCCESS) {
+                    result = res;
+                }
+            }
+            PSTOR_STATS_LATENCY(OP_SAVE, startUs);
+            return result;
+        }
+    }
+    
+    PSTOR_STATS_LATENCY(OP_SAVE, startUs);
+    if (written == 0) {
+        return Result::ERROR_NVS_FAIL;
+    }
+    
+    PSTOR_STATS_INC(nvsCommits);
+    PSTOR_STATS_ADD(nvsBytesWritten, written);
+    return Result::SUCCESS;
+}
+
+// Save a string or blob compressed if that takes fewer NVS entries. A
+// string is a string or a blob item depending on that, so when the form
+// changes the old item is erased first: NVS could keep both under one key.
+// The stored form is known from the last load or save, no lookup needed.
+size_t PersistentStorage::saveCompressed(const ParameterInfo& param, const char* key) {
+    std::vector<uint8_t> value(param.size);
+    size_t length = std::min(readConsistent(param, value.data(), value.size()), value.size());
+    bool isString = (param.type == ParameterInfo::TYPE_STRING);
+    
+    // A blob item has one more entry than a string item (the chunk index)
+    size_t maxEntries = isString ? nvsDataEntries(length + 1) - 1 : nvsDataEntries(length);
+    std::vector<uint8_t> packed;
+    bool compressed = compressValue(value.data(), length, maxEntries, packed);
+    if (isString && param.storedAsBlob != compressed) {
+        preferences_.remove(key);
+    }
+    
+    size_t written;
+    if (compressed) {
+        written = preferences_.putBytes(key, packed.data(), packed.size());
+    } else if (isString) {
+        written = preferences_.putString(key, (const char*)value.data());
+    } else {
+        written = preferences_.putBytes(key, value.data(), value.size());
+    }
+    if (isString && written > 0) {
+        param.storedAsBlob = compressed;
+    }
+    return written;
+}
+
+// Load a string stored compressed. ERROR_NOT_FOUND if there is no blob
+// under key, ERROR_TYPE_MISMATCH if it is not a compressed string that fits.
+PersistentStorage::Result PersistentStorage::loadCompressed(ParameterInfo& param, const char* key) {
+    size_t len = preferences_.getBytesLength(key);
+    if (len == 0) {
+        return Result::ERROR_NOT_FOUND;
+    }
+    std::vector<uint8_t> packed(len);
+    preferences_.getBytes(key, packed.data(), len);
+    std::vector<uint8_t> value(param.size);
+    size_t length = 0;
+    if (!decompressValue(packed.data(), len, value.data(), param.size - 1, length) ||
+        memchr(value.data(), '\0', length)) {
+        return Result::ERROR_TYPE_MISMATCH;
+    }
+    storeValue(param, value.data(), length);
+    param.storedAsBlob = true;
+    return Result::SUCCESS;
+}
+
+// Load one chunk of an array. A chunk of another size keeps its defaults;
+// a missing one too, which is only an error if it is known to be stored.
+PersistentStorage::Result PersistentStorage::loadArrayChunk(ParameterInfo& param, size_t chunk, bool stored) {
+    if (chunk >= arrayChunkCount(param)) {
+        return Result::ERROR_TYPE_MISMATCH;
+    }
+    
+    char key[NVS_KEY_NAME_MAX_SIZE];
+    arrayChunkKey(param.name, chunk, key);
+    size_t offset = chunk * ARRAY_CHUNK_SIZE;
+    size_t length = std::min(ARRAY_CHUNK_SIZE, param.size - offset);
+    size_t len = preferences_.getBytesLength(key);
+    if (len != length) {
+        return (stored || len > 0) ? Result::ERROR_TYPE_MISMATCH : Result::SUCCESS;
+    }
+    
+    // Read outside the sequence lock, which only covers the copy
+    uint8_t data[ARRAY_CHUNK_SIZE];
+    preferences_.getBytes(key, data, length);
+    ValueAccess::writeBegin(param.sequence);
+    memcpy((uint8_t*)param.dataPtr + offset, data, length);
+    ValueAccess::writeEnd(param.sequence);
+    return Result::SUCCESS;
+}
+
+// Write one chunk of an array, retried like strings if it changed meanwhile
+PersistentStorage::Result PersistentStorage::saveArrayChunk(const ParameterInfo& param, size_t chunk) {
+    char key[NVS_KEY_NAME_MAX_SIZE];
+    arrayChunkKey(param.name, chunk, key);
+    size_t offset = chunk * ARRAY_CHUNK_SIZE;
+    size_t length = std::min(ARRAY_CHUNK_SIZE, param.size - offset);
+    
+    size_t written;
+    uint32_t start;
+    do {
+        start = ValueAccess::readBegin(param.sequence);
+        written = preferences_.putBytes(key, (const uint8_t*)param.dataPtr + offset, length);
+    } while (written > 0 && ValueAccess::readRetry(param.sequence, start));
+    
+    if (written == 0) {
+        return Result::ERROR_NVS_FAIL;
+    }
+    PSTOR_STATS_INC(nvsCommits);
+    PSTOR_STATS_ADD(nvsBytesWritten, written);
+    return Result::SUCCESS;
+}
+
+// Check one array element and write it into the array. A validator gets
+// the whole array as it would be afterwards.
+PersistentStorage::Result PersistentStorage::storeElement(ParameterInfo& param, size_t index,
+                                                          const void* value, size_t size) {
+    if (param.type != ParameterInfo::TYPE_ARRAY) {
+        return Result::ERROR_TYPE_MISMATCH;
+    }
+    size_t elemSize = elementSize(param.elementType);
+    if (size != elemSize) {
+        return Result::ERROR_TYPE_MISMATCH;
+    }
+    if (index >= param.size / elemSize) {
+        return Result::ERROR_NOT_FOUND;
+    }
+    
+    if (param.elementType == ParameterInfo::TYPE_INT) {
+        int32_t newVal;
+        memcpy(&newVal, value, sizeof(newVal));
+        if (newVal < param.constraints.intRange.min || newVal > param.constraints.intRange.max) {
+            return Result::ERROR_VALIDATION_FAILED;
+        }
+    } else if (param.elementType == ParameterInfo::TYPE_FLOAT) {
+        float newVal;
+        memcpy(&newVal, value, sizeof(newVal));
+        if (newVal < param.constraints.floatRange.min || newVal > param.constraints.floatRange.max) {
+            return Result::ERROR_VALIDATION_FAILED;
+        }
+    }
+    if (param.validator) {
+        std::vector<uint8_t> candidate(param.size);
+        readConsistent(param, candidate.data(), candidate.size());
+        memcpy(&candidate[index * elemSize], value, elemSize);
+        if (!param.validator(candidate.data())) {
+            return Result::ERROR_VALIDATION_FAILED;
+        }
+    }
+    
+    ValueAccess::writeBegin(param.sequence);
+    memcpy((uint8_t*)param.dataPtr + index * elemSize, value, elemSize);
+    ValueAccess::writeEnd(param.sequence);
+    return Result::SUCCESS;
+}
+
+// Resolve "<array>/<index>" to the array parameter and the element index
+ParameterInfo* PersistentStorage::findElement(const std::string& path, size_t& index) const {
+    size_t slash = path.rfind('/');
+    if (slash == std::string::npos || slash + 1 == path.size() ||
+        path.find_first_not_of("0123456789", slash + 1) != std::string::npos) {
+        return nullptr;
+    }
+    ParameterInfo* param = findParameter(path.substr(0, slash));
+    if (!param || param->type != ParameterInfo::TYPE_ARRAY) {
+        return nullptr;
+    }
+    index = strtoul(path.c_str() + slash + 1, nullptr, 10);
+    return param;
+}
+
+// Resolve "<struct>.<field>" to the struct parameter and the field
+ParameterInfo* PersistentStorage::findField(const std::string& path, const StructField*& field) const {
+    size_t dot = path.rfind('.');
+    if (dot == std::string::npos) {
+        return nullptr;
+    }
+    ParameterInfo* param = findParameter(path.substr(0, dot));
+    if (!param || param->type != ParameterInfo::TYPE_STRUCT) {
+        return nullptr;
+    }
+    field = findStructField(*param->constraints.structure.layout, path.c_str() + dot + 1);
+    return field ? param : nullptr;
+}
+
+// Read a stored struct blob into the variable. Fields are matched by tag
+// and type; unknown ones are skipped and missing ones keep their value.
+// upgraded is set if the blob has another layout version.
+PersistentStorage::Result PersistentStorage::decodeStruct(ParameterInfo& param, const uint8_t* data,
+                                                          size_t length, bool& upgraded) {
+    if (length < 4) {
+        return Result::ERROR_TYPE_MISMATCH;
+    }
+    const StructLayout& layout = *param.constraints.structure.layout;
+    uint16_t version = data[0] | (data[1] << 8);
+    
+    std::vector<uint8_t> candidate(param.size);
+    readConsistent(param, candidate.data(), candidate.size());
+    for (size_t pos = 4; pos < length;) {
+        if (pos + 4 > length || pos + 4 + data[pos + 3] > length) {
+            return Result::ERROR_TYPE_MISMATCH;     // Truncated, nothing applied
+        }
+        uint16_t tag = data[pos] | (data[pos + 1] << 8);
+        uint8_t type = data[pos + 2];
+        size_t fieldLength = data[pos + 3];
+        const uint8_t* value = data + pos + 4;
+        pos += 4 + fieldLength;
+        
+        const StructField* field = nullptr;
+        for (size_t i = 0; i < layout.count && !field; i++) {
+            if (structFieldTag(layout.fields[i].name) == tag) {
+                field = &layout.fields[i];
+            }
+        }
+        if (!field || field->type != type) {
+            continue;   // Removed or retyped field
+        }
+        if (type == ParameterInfo::TYPE_STRING ? fieldLength < field->size : fieldLength == field->size) {
+            memcpy(&candidate[field->offset], value, fieldLength);
+            if (type == ParameterInfo::TYPE_STRING) {
+                candidate[field->offset + fieldLength] = '\0';
+            }
+        }
+    }
+    
+    storeValue(param, candidate.data(), candidate.size());
+    upgraded = (version != layout.version);
+    return Result::SUCCESS;
+}
+
+// Write a changed parameter: the whole image in snapshot mode
+PersistentStorage::Result PersistentStorage::persistParameter(const ParameterInfo& param) {
+    if (param.persistence == ParameterInfo::PERSIST_NONE) {
+        return Result::SUCCESS;
+    }
+    return (saveMode_ == SaveMode::SNAPSHOT) ? saveSnapshot() : saveParameter(param);
+}
+
+// Write all persistent parameters into the inactive slot, then make it the
+// active one. Until the flip the previous image stays in effect, so a power
+// cut never exposes a mix of old and new values. exclude is left out of the
+// image (reset()), empty leaves out every parameter (resetAll()). The caller
+// holds the registry lock.
+PersistentStorage::Result PersistentStorage::saveSnapshot(const ParameterInfo* exclude, bool empty) {
+    if (!snapshotMutex_ || xSemaphoreTake(snapshotMutex_, portMAX_DELAY) != pdTRUE) {
+        return Result::ERROR_NVS_FAIL;
+    }
+    
+    PSTOR_STATS_TIMER(startUs);
+    std::vector<uint8_t> image(sizeof(SnapshotHeader));
+    std::vector<uint8_t> value;
+    std::vector<std::pair<const ParameterInfo*, uint64_t>> counters;
+    SnapshotHeader header = {SNAPSHOT_MAGIC, snapshotSequence_ + 1, 0, 0};
+    Result result = Result::SUCCESS;
+    
+    for (const ParameterInfo* param : parameters_) {
+        if (empty || param->persistence == ParameterInfo::PERSIST_NONE || param == exclude) {
+            continue;
+        }
+        size_t length;
+        if (param->type == ParameterInfo::TYPE_STRUCT) {
+            encodeStruct(*param, value);
+            length = value.size();
+        } else {
+            value.resize(param->size);
+            length = std::min(readConsistent(*param, value.data(), value.size()), value.size());
+        }
+        if (length > UINT16_MAX) {
+            PSTOR_LOG_E( "%s is too large for a snapshot", param->name);
+            result = Result::ERROR_TOO_LARGE;
+            break;
+        }
+        
+        char key[NVS_KEY_NAME_MAX_SIZE];
+        nvsKeyFor(param->name, key);
+        image.insert(image.end(), key, key + strlen(key) + 1);
+        image.push_back((uint8_t)param->type);
+        image.push_back((uint8_t)(length & 0xFF));
+        image.push_back((uint8_t)(length >> 8));
+        image.insert(image.end(), value.begin(), value.begin() + length);
+        header.count++;
+        
+        if (param->type == ParameterInfo::TYPE_COUNTER) {
+            uint64_t count;
+            memcpy(&count, value.data(), sizeof(count));
+            counters.emplace_back(param, count);
+        }
+    }
+    
+    if (result == Result::SUCCESS) {
+        memcpy(image.data(), &header, sizeof(header));
+        uint32_t crc = crc32(image.data(), image.size());
+        const uint8_t* crcBytes = (const uint8_t*)&crc;
+        image.insert(image.end(), crcBytes, crcBytes + sizeof(crc));
+        
+        uint8_t slot = (snapshotSlot_ == 0) ? 1 : 0;
+        if (preferences_.putBytes(SNAPSHOT_SLOT_KEYS[slot], image.data(), image.size()) != image.size() ||
+            preferences_.putUChar(SNAPSHOT_ACTIVE_KEY, slot) == 0) {
+            PSTOR_LOG_E( "Failed to write snapshot %u", header.sequence);
+            result = Result::ERROR_NVS_FAIL;
+        } else {
+            snapshotSlot_ = slot;
+            snapshotSequence_ = header.sequence;
+            for (const auto& counter : counters) {
+                markCounterFlushed(*counter.first, counter.second);
+            }
+            PSTOR_STATS_ADD(nvsCommits, 2);
+            PSTOR_STATS_ADD(nvsBytesWritten, image.size() + 1);
+        }
+    }
+    
+    PSTOR_STATS_LATENCY(OP_SAVE, startUs);
+    xSemaphoreGive(snapshotMutex_);
+    return result;
+}
+
+// Read a slot and check its CRC; image is returned without the CRC
+bool PersistentStorage::readSnapshot(uint8_t slot, std::vector<uint8_t>& image, uint32_t& sequence) {
+    const char* key = SNAPSHOT_SLOT_KEYS[slot];
+    if (!preferences_.isKey(key)) {
+        return false;
+    }
+    size_t length = preferences_.getBytesLength(key);
+    if (length < sizeof(SnapshotHeader) + sizeof(uint32_t)) {
+        PSTOR_LOG_W( "Snapshot %s is truncated", key);
+        return false;
+    }
+    
+    image.resize(length);
+    if (preferences_.getBytes(key, image.data(), length) != length) {
+        return false;
+    }
+    
+    SnapshotHeader header;
+    uint32_t crc;
+    memcpy(&header, image.data(), sizeof(header));
+    memcpy(&crc, image.data() + length - sizeof(crc), sizeof(crc));
+    if (header.magic != SNAPSHOT_MAGIC || crc32(image.data(), length - sizeof(crc)) != crc) {
+        PSTOR_LOG_W( "Snapshot %s is corrupt", key);
+        return false;
+    }
+    
+    image.resize(length - sizeof(crc));
+    sequence = header.sequence;
+    return true;
+}
+
+// Load parameters from the active snapshot, or from the other slot if the
+// active one is corrupt. Returns false if neither holds a valid image.
+bool PersistentStorage::loadSnapshot(const std::vector<ParameterInfo*>& params,
+                                     LoadReport& report, bool detailed, Result& lastResult) {
+    if (!snapshotMutex_ || xSemaphoreTake(snapshotMutex_, portMAX_DELAY) != pdTRUE) {
+        return false;
+    }
+    
+    std::vector<uint8_t> images[2];
+    uint32_t sequences[2] = {0, 0};
+    bool valid[2] = {false, false};
+    uint8_t active = preferences_.getUChar(SNAPSHOT_ACTIVE_KEY, 0xFF);
+    int slot = -1;
+    
+    if (active < 2 && (valid[active] = readSnapshot(active, images[active], sequences[active]))) {
+        slot = active;
+    } else {
+        // Pointer lost or its image damaged: take the newest valid slot
+        for (uint8_t i = 0; i < 2; i++) {
+            if (i != active) {
+                valid[i] = readSnapshot(i, images[i], sequences[i]);
+            }
+        }
+        if (valid[0] || valid[1]) {
+            slot = (valid[0] && (!valid[1] || sequences[0] > sequences[1])) ? 0 : 1;
+            PSTOR_LOG_W( "Using snapshot %s (sequence %u)", SNAPSHOT_SLOT_KEYS[slot], sequences[slot]);
+        }
+    }
+    
+    snapshotSlot_ = (int8_t)slot;
+    snapshotSequence_ = std::max(snapshotSequence_, std::max(sequences[0], sequences[1]));
+    xSemaphoreGive(snapshotMutex_);
+    if (slot < 0) {
+        return false;
+    }
+    
+    NvsKeyIndex index(params.size());
+    std::vector<bool> seen(params.size(), false);
+    for (size_t i = 0; i < params.size(); i++) {
+        if (params[i]->persistence == ParameterInfo::PERSIST_NONE) {
+            continue;
+        }
+        report.registered++;
+        char key[NVS_KEY_NAME_MAX_SIZE];
+        nvsKeyFor(params[i]->name, key);
+        index.add(i, key);
+    }
+    
+    const std::vector<uint8_t>& image = images[slot];
+    size_t pos = sizeof(SnapshotHeader);
+    while (pos < image.size()) {
+        const char* key = (const char*)&image[pos];
+        size_t keyLength = strnlen(key, std::min(image.size() - pos, (size_t)NVS_KEY_NAME_MAX_SIZE));
+        if (pos + keyLength + 4 > image.size() || key[keyLength] != '\0') {
+            break;
+        }
+        ParameterInfo::Type type = (ParameterInfo::Type)image[pos + keyLength + 1];
+        size_t length = image[pos + keyLength + 2] | (image[pos + keyLength + 3] << 8);
+        const uint8_t* value = &image[pos + keyLength + 4];
+        if (pos + keyLength + 4 + length > image.size()) {
+            break;
+        }
+        
+        bool matched = index.forEach(key, [&](size_t i) {
+            if (seen[i]) {
+                return;
+            }
+            seen[i] = true;
+            
+            ParameterInfo& param = *params[i];
+            bool fits = (type == param.type && snapshotValueFits(param, length));
+            if (fits && param.type == ParameterInfo::TYPE_STRUCT) {
+                bool upgraded = false;  // Written in the current layout by the next snapshot
+                fits = (decodeStruct(param, value, length, upgraded) == Result::SUCCESS);
+            } else if (fits) {
+                storeValue(param, value, length);
+            }
+            if (fits) {
+                report.loaded++;
+            } else {
+                lastResult = Result::ERROR_TYPE_MISMATCH;
+                if (detailed) {
+                    report.mismatched.push_back(param.name);
+                }
+            }
+        });
+        if (!matched && detailed) {
+            report.unregistered.push_back(key);
+        }
+        pos += keyLength + 4 + length;
+    }
+    
+    if (detailed) {
+        for (size_t i = 0; i < params.size(); i++) {
+            if (!seen[i] && params[i]->persistence != ParameterInfo::PERSIST_NONE) {
+                report.missing.push_back(params[i]->name);
+            }
+        }
+    }
+    return true;
+}
+
+// offset and count select a slice of an array; other types ignore them
+void PersistentStorage::parameterToJson(const ParameterInfo& param, JsonDocument& doc,
+                                        size_t offset, size_t count) {
+    doc.clear();
+    JsonObject root = doc.to<JsonObject>();
+    
+    root["name"] = param.name;
+    if (param.description) {
+        root["description"] = param.description;
+    }
+    root["access"] = (param.access == ParameterInfo::ACCESS_READ_ONLY) ? "ro" : "rw";
+    root["type"] = typeToString(param.type);
+    
+    switch (param.type) {
+        case ParameterInfo::TYPE_BOOL:
+            root["value"] = ValueAccess::load<bool>(param.dataPtr);
+            break;
+            
+        case ParameterInfo::TYPE_INT:
+            root["value"] = ValueAccess::load<int32_t>(param.dataPtr);
+            root["min"] = param.constraints.intRange.min;
+            root["max"] = param.constraints.intRange.max;
+            break;
+            
+        case ParameterInfo::TYPE_FLOAT:
+            root["value"] = ValueAccess::load<float>(param.dataPtr);
+            root["min"] = param.constraints.floatRange.min;
+            root["max"] = param.constraints.floatRange.max;
+            break;
+            
+        case ParameterInfo::TYPE_COUNTER:
+            root["value"] = ValueAccess::load<uint64_t>(param.dataPtr);
+            break;
+            
+        case ParameterInfo::TYPE_INT64:
+            root["value"] = ValueAccess::load<int64_t>(param.dataPtr);
+            root["min"] = param.constraints.wide.range->int64Range.min;
+            root["max"] = param.constraints.wide.range->int64Range.max;
+            break;
+            
+        case ParameterInfo::TYPE_UINT32:
+            root["value"] = ValueAccess::load<uint32_t>(param.dataPtr);
+            root["min"] = param.constraints.uintRange.min;
+            root["max"] = param.constraints.uintRange.max;
+            break;
+            
+        case ParameterInfo::TYPE_DOUBLE:
+            root["value"] = ValueAccess::load<double>(param.dataPtr);
+            root["min"] = param.constraints.wide.range->doubleRange.min;
+            root["max"] = param.constraints.wide.range->doubleRange.max;
+            break;
+            
+        case ParameterInfo::TYPE_ENUM: {
+            // The names are literals: the document stores pointers, no copies
+            uint8_t index = ValueAccess::load<uint8_t>(param.dataPtr);
+            if (index < param.constraints.enumeration.count) {
+                root["value"] = param.constraints.enumeration.names[index];
+            } else {
+                root["value"] = index;
+            }
+            JsonArray options = root["options"].to<JsonArray>();
+            for (uint16_t i = 0; i < param.constraints.enumeration.count; i++) {
+                options.add(param.constraints.enumeration.names[i]);
+            }
+            break;
+        }
+            
+        case ParameterInfo::TYPE_STRING: {
+            // The document copies the string; repeat if a writer interfered
+            uint32_t start;
+            do {
+                start = ValueAccess::readBegin(param.sequence);
+                root["value"] = (const char*)param.dataPtr;
+            } while (ValueAccess::readRetry(param.sequence, start));
+            root["maxLen"] = param.constraints.stringMax.maxLen;
+            break;
+        }
+            
+        case ParameterInfo::TYPE_BLOB:
+            root["size"] = param.size;
+            // Don't include blob data in JSON
+            break;
+            
+        case ParameterInfo::TYPE_ARRAY: {
+            size_t elemSize = elementSize(param.elementType);
+            size_t total = param.size / elemSize;
+            offset = std::min(offset, total);
+            count = std::min(count, total - offset);
+            
+            // Copy the slice first so that the document never sees a torn array
+            std::vector<uint8_t> slice(count * elemSize);
+            uint32_t start;
+            do {
+                start = ValueAccess::readBegin(param.sequence);
+                memcpy(slice.data(), (const uint8_t*)param.dataPtr + offset * elemSize, slice.size());
+            } while (ValueAccess::readRetry(param.sequence, start));
+            
+            root["elementType"] = typeToString(param.elementType);
+            root["count"] = total;
+            if (offset > 0 || count < total) {
+                root["offset"] = offset;
+            }
+            JsonArray values = root["value"].to<JsonArray>();
+            for (size_t i = 0; i < count; i++) {
+                elementToJson(param.elementType, &slice[i * elemSize], values);
+            }
+            if (param.elementType == ParameterInfo::TYPE_INT) {
+                root["min"] = param.constraints.intRange.min;
+                root["max"] = param.constraints.intRange.max;
+            } else if (param.elementType == ParameterInfo::TYPE_FLOAT) {
+                root["min"] = param.constraints.floatRange.min;
+                root["max"] = param.constraints.floatRange.max;
+            }
+            break;
+        }
+        
+        case ParameterInfo::TYPE_STRUCT: {
+            const StructLayout& layout = *param.constraints.structure.layout;
+            std::vector<uint8_t> copy(param.size);
+            readConsistent(param, copy.data(), copy.size());
+            root["version"] = layout.version;
+            JsonObject values = root["value"].to<JsonObject>();
+            for (size_t i = 0; i < layout.count; i++) {
+                fieldValueToJson(layout.fields[i], copy.data(), values, layout.fields[i].name);
+            }
+            break;
+        }
+    }
+}
+
+// One struct field as a parameter of its own ("<name>.<field>")
+void PersistentStorage::fieldToJson(const ParameterInfo& param, const StructField& field, JsonDocument& doc) {
+    doc.clear();
+    JsonObject root = doc.to<JsonObject>();
+    
+    root["name"] = std::string(param.name) + "." + field.name;
+    root["access"] = (param.access == ParameterInfo::ACCESS_READ_ONLY) ? "ro" : "rw";
+    root["type"] = typeToString(field.type);
+    
+    std::vector<uint8_t> copy(param.size);
+    readConsistent(param, copy.data(), copy.size());
+    fieldValueToJson(field, copy.data(), root, "value");
+    if (field.type == ParameterInfo::TYPE_INT) {
+        root["min"] = (int32_t)field.min;
+        root["max"] = (int32_t)field.max;
+    } else if (field.type == ParameterInfo::TYPE_FLOAT) {
+        root["min"] = (float)field.min;
+        root["max"] = (float)field.max;
+    } else if (field.type == ParameterInfo::TYPE_STRING) {
+        root["maxLen"] = field.size;
+    }
+}
+
+// Set one struct field; only the field is written to the variable, so
+// concurrent updates of other fields are kept
+PersistentStorage::Result PersistentStorage::jsonToField(ParameterInfo& param, const StructField& field,
+                                                         const JsonDocument& doc) {
+    std::vector<uint8_t> candidate(param.size);
+    readConsistent(param, candidate.data(), candidate.size());
+    if (!fieldFromJson(field, doc["value"], candidate.data())) {
+        return Result::ERROR_VALIDATION_FAILED;
+    }
+    
+    Result res = validateValue(param, candidate.data(), candidate.size());
+    if (res == Result::SUCCESS) {
+        ValueAccess::writeBegin(param.sequence);
+        memcpy((uint8_t*)param.dataPtr + field.offset, &candidate[field.offset], field.size);
+        ValueAccess::writeEnd(param.sequence);
+    }
+    return res;
+}
+
+PersistentStorage::Result PersistentStorage::jsonToParameter(ParameterInfo& param, const JsonDocument& doc) {
+    // Use isNull() instead of containsKey() for ArduinoJson v7
+    if (doc["value"].isNull()) {
+        return Result::ERROR_VALIDATION_FAILED;
+    }
+    
+    // Build the candidate value; it is validated before the variable is touched
+    union {
+        bool b;
+        int32_t i;
+        float f;
+        uint64_t u;
+        int64_t i64;
+        uint32_t u32;
+        double d;
+        uint8_t e;
+    } scalar;
+    const void* value = &scalar;
+    size_t size = 0;
+    
+    switch (param.type) {
+        case ParameterInfo::TYPE_BOOL:
+            scalar.b = doc["value"].as<bool>();
+            size = sizeof(bool);
+            break;
+        
+        case ParameterInfo::TYPE_INT:
+            scalar.i = doc["value"].as<int32_t>();
+            size = sizeof(int32_t);
+            break;
+        
+        case ParameterInfo::TYPE_FLOAT:
+            scalar.f = doc["value"].as<float>();
+            size = sizeof(float);
+            break;
+        
+        case ParameterInfo::TYPE_COUNTER:
+            if (!doc["value"].is<uint64_t>()) {
+                return Result::ERROR_VALIDATION_FAILED;
+            }
+            scalar.u = doc["value"].as<uint64_t>();
+            size = sizeof(uint64_t);
+            break;
+        
+        case ParameterInfo::TYPE_INT64:
+            if (!doc["value"].is<int64_t>()) {
+                return Result::ERROR_VALIDATION_FAILED;
+            }
+            scalar.i64 = doc["value"].as<int64_t>();
+            size = sizeof(int64_t);
+            break;
+        
+        case ParameterInfo::TYPE_UINT32: {
+            // Out of range values must not wrap into range
+            if (!doc["value"].is<int64_t>() || doc["value"].as<int64_t>() < 0 ||
+                doc["value"].as<int64_t>() > UINT32_MAX) {
+                return Result::ERROR_VALIDATION_FAILED;
+            }
+            scalar.u32 = (uint32_t)doc["value"].as<int64_t>();
+            size = sizeof(uint32_t);
+            break;
+        }
+        
+        case ParameterInfo::TYPE_DOUBLE:
+            if (!doc["value"].is<double>()) {
+                return Result::ERROR_VALIDATION_FAILED;
+            }
+            scalar.d = doc["value"].as<double>();
+            size = sizeof(double);
+            break;
+        
+        case ParameterInfo::TYPE_ENUM: {
+            // A name, or the index as a number
+            int index = -1;
+            if (const char* name = doc["value"].as<const char*>()) {
+                index = enumIndexOf(param, name);
+            } else if (doc["value"].is<int32_t>()) {
+                index = std::min<int32_t>(doc["value"].as<int32_t>(), param.constraints.enumeration.count);
+            }
+            if (index < 0 || index >= param.constraints.enumeration.count) {
+                return Result::ERROR_VALIDATION_FAILED;
+            }
+            scalar.e = (uint8_t)index;
+            size = sizeof(uint8_t);
+            break;
+        }
         
         case ParameterInfo::TYPE_STRING: {
-            preferences_.getString(key.c_str(), (char*)param.dataPtr, param.size);
+            const char* newVal = doc["value"].as<const char*>();
+            if (!newVal) {
+                return Result::ERROR_VALIDATION_FAILED;
+            }
+            value = newVal;
+            size = strlen(newVal);
             break;
         }
         
+        case ParameterInfo::TYPE_ARRAY: {
+            // One value per element, converted into a candidate array
+            JsonArrayConst values = doc["value"].as<JsonArrayConst>();
+            size_t elemSize = elementSize(param.elementType);
+            if (values.isNull() || values.size() != param.size / elemSize) {
+                return Result::ERROR_VALIDATION_FAILED;
+            }
+            std::vector<uint8_t> candidate(param.size);
+            for (size_t i = 0; i < values.size(); i++) {
+                if (!elementFromJson(param.elementType, values[i], &candidate[i * elemSize])) {
+                    return Result::ERROR_VALIDATION_FAILED;
+                }
+            }
+            Result res = validateValue(param, candidate.data(), candidate.size());
+            if (res == Result::SUCCESS) {
+                storeValue(param, candidate.data(), candidate.size());
+            }
+            return res;
+        }
+        
         case ParameterInfo::TYPE_BLOB: {
-            size_t len = preferences_.getBytesLength(key.c_str());
-            if (len > 0 && len <= param.size) {
-                preferences_.getBytes(key.c_str(), param.dataPtr, param.size);
+            // The whole blob as base64
+            const char* text = doc["value"].as<const char*>();
+            size_t length = text ? strlen(text) : 0;
+            if (!text || base64DecodedLength(text, length) != param.size) {
+                return Result::ERROR_VALIDATION_FAILED;
+            }
+            std::vector<uint8_t> candidate(param.size);
+            if (!base64Decode(text, length, candidate.data())) {
+                return Result::ERROR_VALIDATION_FAILED;
+            }
+            Result res = validateValue(param, candidate.data(), candidate.size());
+            if (res == Result::SUCCESS) {
+                storeValue(param, candidate.data(), candidate.size());
+            }
+            return res;
+        }
+        
+        case ParameterInfo::TYPE_STRUCT: {
+            // The fields present are changed, the others kept
+            JsonObjectConst values = doc["value"].as<JsonObjectConst>();
+            if (values.isNull()) {
+                return Result::ERROR_VALIDATION_FAILED;
+            }
+            const StructLayout& layout = *param.constraints.structure.layout;
+            std::vector<uint8_t> candidate(param.size);
+            readConsistent(param, candidate.data(), candidate.size());
+            for (JsonPairConst member : values) {
+                const StructField* field = findStructField(layout, member.key().c_str());
+                if (!field || !fieldFromJson(*field, member.value(), candidate.data())) {
+                    return Result::ERROR_VALIDATION_FAILED;
+                }
+            }
+            Result res = validateValue(param, candidate.data(), candidate.size());
+            if (res == Result::SUCCESS) {
+                storeValue(param, candidate.data(), candidate.size());
+            }
+            return res;
+        }
+        
+        default:
+            return Result::ERROR_TYPE_MISMATCH;
+    }
+    
+    Result res = validateValue(param, value, size);
+    if (res == Result::SUCCESS) {
+        storeValue(param, value, size);
+    }
+    return res;
+}
+
+// Range, length and custom validator checks on a candidate value
+PersistentStorage::Result PersistentStorage::validateValue(const ParameterInfo& param,
+                                                           const void* value, size_t size) const {
+    switch (param.type) {
+        case ParameterInfo::TYPE_BOOL:
+            if (size != sizeof(bool)) {
+                return Result::ERROR_TYPE_MISMATCH;
+            }
+            break;
+            
+        case ParameterInfo::TYPE_INT: {
+            if (size != sizeof(int32_t)) {
+                return Result::ERROR_TYPE_MISMATCH;
+            }
+            int32_t newVal = *(const int32_t*)value;
+            if (newVal < param.constraints.intRange.min || newVal > param.constraints.intRange.max) {
+                return Result::ERROR_VALIDATION_FAILED;
+            }
+            break;
+        }
+            
+        case ParameterInfo::TYPE_FLOAT: {
+            if (size != sizeof(float)) {
+                return Result::ERROR_TYPE_MISMATCH;
+            }
+            float newVal = *(const float*)value;
+            if (newVal < param.constraints.floatRange.min || newVal > param.constraints.floatRange.max) {
+                return Result::ERROR_VALIDATION_FAILED;
+            }
+            break;
+        }
+            
+        case ParameterInfo::TYPE_INT64: {
+            if (size != sizeof(int64_t)) {
+                return Result::ERROR_TYPE_MISMATCH;
+            }
+            int64_t newVal;
+            memcpy(&newVal, value, sizeof(newVal));
+            const WideRange& range = *param.constraints.wide.range;
+            if (newVal < range.int64Range.min || newVal > range.int64Range.max) {
+                return Result::ERROR_VALIDATION_FAILED;
+            }
+            break;
+        }
+            
+        case ParameterInfo::TYPE_UINT32: {
+            if (size != sizeof(uint32_t)) {
+                return Result::ERROR_TYPE_MISMATCH;
+            }
+            uint32_t newVal;
+            memcpy(&newVal, value, sizeof(newVal));
+            if (newVal < param.constraints.uintRange.min || newVal > param.constraints.uintRange.max) {
+                return Result::ERROR_VALIDATION_FAILED;
+            }
+            break;
+        }
+            
+        case ParameterInfo::TYPE_DOUBLE: {
+            if (size != sizeof(double)) {
+                return Result::ERROR_TYPE_MISMATCH;
+            }
+            double newVal;
+            memcpy(&newVal, value, sizeof(newVal));
+            const WideRange& range = *param.constraints.wide.range;
+            if (!(newVal >= range.doubleRange.min && newVal <= range.doubleRange.max)) {
+                return Result::ERROR_VALIDATION_FAILED;
+            }
+            break;
+        }
+            
+        case ParameterInfo::TYPE_ENUM:
+            if (size != sizeof(uint8_t)) {
+                return Result::ERROR_TYPE_MISMATCH;
+            }
+            if (*(const uint8_t*)value >= param.constraints.enumeration.count) {
+                return Result::ERROR_VALIDATION_FAILED;
+            }
+            break;
+            
+        case ParameterInfo::TYPE_STRING:
+            if (size >= param.constraints.stringMax.maxLen ||
+                memchr(value, '\0', size) != nullptr) {
+                return Result::ERROR_VALIDATION_FAILED;
+            }
+            break;
+            
+        case ParameterInfo::TYPE_BLOB:
+            if (size != param.size) {
+                return Result::ERROR_TYPE_MISMATCH;
+            }
+            break;
+            
+        case ParameterInfo::TYPE_COUNTER: {
+            if (size != sizeof(uint64_t)) {
+                return Result::ERROR_TYPE_MISMATCH;
+            }
+            // Counters only move forward
+            uint64_t newVal;
+            memcpy(&newVal, value, sizeof(newVal));
+            if (newVal < ValueAccess::load<uint64_t>(param.dataPtr)) {
+                return Result::ERROR_VALIDATION_FAILED;
+            }
+            break;
+        }
+        
+        case ParameterInfo::TYPE_ARRAY: {
+            if (size != param.size) {
+                return Result::ERROR_TYPE_MISMATCH;
+            }
+            // Every element within the range
+            const uint8_t* element = (const uint8_t*)value;
+            size_t elemSize = elementSize(param.elementType);
+            for (size_t i = 0; i < size; i += elemSize) {
+                if (param.elementType == ParameterInfo::TYPE_INT) {
+                    int32_t newVal;
+                    memcpy(&newVal, element + i, sizeof(newVal));
+                    if (newVal < param.constraints.intRange.min || newVal > param.constraints.intRange.max) {
+                        return Result::ERROR_VALIDATION_FAILED;
+                    }
+                } else if (param.elementType == ParameterInfo::TYPE_FLOAT) {
+                    float newVal;
+                    memcpy(&newVal, element + i, sizeof(newVal));
+                    if (newVal < param.constraints.floatRange.min || newVal > param.constraints.floatRange.max) {
+                        return Result::ERROR_VALIDATION_FAILED;
+                    }
+                }
+            }
+            break;
+        }
+        
+        case ParameterInfo::TYPE_STRUCT: {
+            if (size != param.size) {
+                return Result::ERROR_TYPE_MISMATCH;
+            }
+            const StructLayout& layout = *param.constraints.structure.layout;
+            const uint8_t* base = (const uint8_t*)value;
+            for (size_t i = 0; i < layout.count; i++) {
+                const StructField& field = layout.fields[i];
+                if (field.type == ParameterInfo::TYPE_INT) {
+                    int32_t newVal;
+                    memcpy(&newVal, base + field.offset, sizeof(newVal));
+                    if (newVal < field.min || newVal > field.max) {
+                        return Result::ERROR_VALIDATION_FAILED;
+                    }
+                } else if (field.type == ParameterInfo::TYPE_FLOAT) {
+                    float newVal;
+                    memcpy(&newVal, base + field.offset, sizeof(newVal));
+                    if (newVal < field.min || newVal > field.max) {
+                        return Result::ERROR_VALIDATION_FAILED;
+                    }
+                } else if (field.type == ParameterInfo::TYPE_STRING &&
+                           memchr(base + field.offset, '\0', field.size) == nullptr) {
+                    return Result::ERROR_VALIDATION_FAILED;
+                }
             }
             break;
         }
     }
-    
+    
+    // Validators of string parameters expect a terminated string; the
+    // caller's buffer ends at size, so always validate a terminated copy
+    if (param.validator) {
+        if (param.type == ParameterInfo::TYPE_STRING) {
+            std::string terminated((const char*)value, size);
+            return param.validator(terminated.c_str()) ? Result::SUCCESS : Result::ERROR_VALIDATION_FAILED;
+        }
+        if (!param.validator(value)) {
+            return Result::ERROR_VALIDATION_FAILED;
+        }
+    }
     return Result::SUCCESS;
 }
 
-PersistentStorage::Result PersistentStorage::saveParameter(const ParameterInfo& param) {
-    std::string key = sanitizeNvsKey(param.name);
-    bool success = false;
-    
+// Publish a validated value to the variable without tearing
+void PersistentStorage::storeValue(ParameterInfo& param, const void* value, size_t size) {
     switch (param.type) {
         case ParameterInfo::TYPE_BOOL:
-            success = preferences_.putBool(key.c_str(), *(bool*)param.dataPtr);
+            ValueAccess::store<bool>(param.dataPtr, *(const bool*)value);
             break;
             
         case ParameterInfo::TYPE_INT:
-            success = preferences_.putInt(key.c_str(), *(int32_t*)param.dataPtr);
+            ValueAccess::store<int32_t>(param.dataPtr, *(const int32_t*)value);
             break;
             
         case ParameterInfo::TYPE_FLOAT:
-            success = preferences_.putFloat(key.c_str(), *(float*)param.dataPtr);
+            ValueAccess::store<float>(param.dataPtr, *(const float*)value);
+            break;
+            
+        case ParameterInfo::TYPE_COUNTER: {
+            uint64_t newVal;
+            memcpy(&newVal, value, sizeof(newVal));
+            ValueAccess::store<uint64_t>(param.dataPtr, newVal);
+            break;
+        }
+            
+        case ParameterInfo::TYPE_INT64: {
+            int64_t newVal;
+            memcpy(&newVal, value, sizeof(newVal));
+            ValueAccess::store<int64_t>(param.dataPtr, newVal);
+            break;
+        }
+            
+        case ParameterInfo::TYPE_UINT32: {
+            uint32_t newVal;
+            memcpy(&newVal, value, sizeof(newVal));
+            ValueAccess::store<uint32_t>(param.dataPtr, newVal);
+            break;
+        }
+            
+        case ParameterInfo::TYPE_DOUBLE: {
+            double newVal;
+            memcpy(&newVal, value, sizeof(newVal));
+            ValueAccess::store<double>(param.dataPtr, newVal);
+            break;
+        }
+            
+        case ParameterInfo::TYPE_ENUM:
+            ValueAccess::store<uint8_t>(param.dataPtr, *(const uint8_t*)value);
             break;
             
         case ParameterInfo::TYPE_STRING:
-            success = preferences_.putString(key.c_str(), (const char*)param.dataPtr);
+            ValueAccess::writeBegin(param.sequence);
+            memcpy(param.dataPtr, value, size);
+            ((char*)param.dataPtr)[size] = '\0';
+            ValueAccess::writeEnd(param.sequence);
             break;
             
         case ParameterInfo::TYPE_BLOB:
-            success = preferences_.putBytes(key.c_str(), param.dataPtr, param.size);
+        case ParameterInfo::TYPE_ARRAY:
+        case ParameterInfo::TYPE_STRUCT:
+            ValueAccess::writeBegin(param.sequence);
+            memcpy(param.dataPtr, value, size);
+            ValueAccess::writeEnd(param.sequence);
             break;
     }
-    
-    return success ? Result::SUCCESS : Result::ERROR_NVS_FAIL;
 }
 
-void PersistentStorage::parameterToJson(const ParameterInfo& param, JsonDocument& doc) {
-    doc.clear();
-    JsonObject root = doc.to<JsonObject>();
-    
-    root["name"] = param.name;
-    root["description"] = param.description;
-    root["access"] = (param.access == ParameterInfo::ACCESS_READ_ONLY) ? "ro" : "rw";
-    
+// Copy a value without tearing
+size_t PersistentStorage::readConsistent(const ParameterInfo& param, void* out, size_t size) {
     switch (param.type) {
         case ParameterInfo::TYPE_BOOL:
-            root["type"] = "bool";
-            root["value"] = *(bool*)param.dataPtr;
-            break;
+            if (size >= sizeof(bool)) {
+                *(bool*)out = ValueAccess::load<bool>(param.dataPtr);
+            }
+            return sizeof(bool);
             
         case ParameterInfo::TYPE_INT:
-            root["type"] = "int";
-            root["value"] = *(int32_t*)param.dataPtr;
-            root["min"] = param.constraints.intRange.min;
-            root["max"] = param.constraints.intRange.max;
-            break;
+            if (size >= sizeof(int32_t)) {
+                int32_t val = ValueAccess::load<int32_t>(param.dataPtr);
+                memcpy(out, &val, sizeof(val));
+            }
+            return sizeof(int32_t);
             
         case ParameterInfo::TYPE_FLOAT:
-            root["type"] = "float";
-            root["value"] = *(float*)param.dataPtr;
-            root["min"] = param.constraints.floatRange.min;
-            root["max"] = param.constraints.floatRange.max;
-            break;
+            if (size >= sizeof(float)) {
+                float val = ValueAccess::load<float>(param.dataPtr);
+                memcpy(out, &val, sizeof(val));
+            }
+            return sizeof(float);
             
-        case ParameterInfo::TYPE_STRING:
-            root["type"] = "string";
-            root["value"] = (const char*)param.dataPtr;
-            root["maxLen"] = param.constraints.stringMax.maxLen;
-            break;
+        case ParameterInfo::TYPE_COUNTER:
+            if (size >= sizeof(uint64_t)) {
+                uint64_t val = ValueAccess::load<uint64_t>(param.dataPtr);
+                memcpy(out, &val, sizeof(val));
+            }
+            return sizeof(uint64_t);
+            
+        case ParameterInfo::TYPE_INT64:
+            if (size >= sizeof(int64_t)) {
+                int64_t val = ValueAccess::load<int64_t>(param.dataPtr);
+                memcpy(out, &val, sizeof(val));
+            }
+            return sizeof(int64_t);
+            
+        case ParameterInfo::TYPE_UINT32:
+            if (size >= sizeof(uint32_t)) {
+                uint32_t val = ValueAccess::load<uint32_t>(param.dataPtr);
+                memcpy(out, &val, sizeof(val));
+            }
+            return sizeof(uint32_t);
+            
+        case ParameterInfo::TYPE_DOUBLE:
+            if (size >= sizeof(double)) {
+                double val = ValueAccess::load<double>(param.dataPtr);
+                memcpy(out, &val, sizeof(val));
+            }
+            return sizeof(double);
+            
+        case ParameterInfo::TYPE_ENUM:
+            if (size >= sizeof(uint8_t)) {
+                *(uint8_t*)out = ValueAccess::load<uint8_t>(param.dataPtr);
+            }
+            return sizeof(uint8_t);
+            
+        case ParameterInfo::TYPE_STRING: {
+            if (size == 0) {
+                return strnlen((const char*)param.dataPtr, param.size);
+            }
+            size_t len;
+            uint32_t start;
+            do {
+                start = ValueAccess::readBegin(param.sequence);
+                len = strnlen((const char*)param.dataPtr, param.size - 1);
+                size_t copy = std::min(len, size - 1);
+                memcpy(out, param.dataPtr, copy);
+                ((char*)out)[copy] = '\0';
+            } while (ValueAccess::readRetry(param.sequence, start));
+            return len;
+        }
             
         case ParameterInfo::TYPE_BLOB:
-            root["type"] = "blob";
-            root["size"] = param.size;
-            // Don't include blob data in JSON
-            break;
+        case ParameterInfo::TYPE_ARRAY:
+        case ParameterInfo::TYPE_STRUCT: {
+            uint32_t start;
+            do {
+                start = ValueAccess::readBegin(param.sequence);
+                memcpy(out, param.dataPtr, std::min(size, param.size));
+            } while (ValueAccess::readRetry(param.sequence, start));
+            return param.size;
+        }
     }
+    return 0;
 }
 
-PersistentStorage::Result PersistentStorage::jsonToParameter(ParameterInfo& param, const JsonDocument& doc) {
-    // Use isNull() instead of containsKey() for ArduinoJson v7
-    if (doc["value"].isNull()) {
-        return Result::ERROR_VALIDATION_FAILED;
+void PersistentStorage::notifyChange(const std::string& name, const void* newValue) {
+    ParameterInfo* param = findParameter(name);
+    if (param && param->onChange) {
+        param->onChange(name, newValue);
     }
     
-    // Store old value for validation
-    void* oldValue = nullptr;
-    switch (param.type) {
-        case ParameterInfo::TYPE_BOOL: {
-            bool newVal = doc["value"].as<bool>();
-            oldValue = malloc(sizeof(bool));
-            *(bool*)oldValue = *(bool*)param.dataPtr;
-            *(bool*)param.dataPtr = newVal;
-            break;
+    if (!notifyMutex_ || xSemaphoreTake(notifyMutex_, portMAX_DELAY) != pdTRUE) {
+        return;
+    }
+    if (subscriptions_.empty()) {
+        xSemaphoreGive(notifyMutex_);
+        return;
+    }
+    if (batchDepth_ > 0) {
+        if (std::find(batchNames_.begin(), batchNames_.end(), name) == batchNames_.end()) {
+            batchNames_.push_back(name);
         }
-        
-        case ParameterInfo::TYPE_INT: {
-            int32_t newVal = doc["value"].as<int32_t>();
-            if (newVal < param.constraints.intRange.min || newVal > param.constraints.intRange.max) {
-                return Result::ERROR_VALIDATION_FAILED;
+        xSemaphoreGive(notifyMutex_);
+        return;
+    }
+    xSemaphoreGive(notifyMutex_);
+    
+    deliverChanges(std::vector<std::string>(1, name));
+}
+
+// Subscribe to changes of a parameter or group
+uint32_t PersistentStorage::subscribe(const std::string& pattern, ChangeHandler handler) {
+    if (pattern.empty() || !handler) {
+        return 0;
+    }
+    if (xSemaphoreTake(notifyMutex_, portMAX_DELAY) != pdTRUE) {
+        return 0;
+    }
+    
+    Subscription sub;
+    sub.id = nextSubscriptionId_++;
+    sub.pattern = pattern;
+    sub.handler = handler;
+    subscriptions_.push_back(sub);
+    xSemaphoreGive(notifyMutex_);
+    
+    PSTOR_LOG_D( "Subscription %u for %s", sub.id, pattern.c_str());
+    return sub.id;
+}
+
+// Remove a subscription
+bool PersistentStorage::unsubscribe(uint32_t id) {
+    if (xSemaphoreTake(notifyMutex_, portMAX_DELAY) != pdTRUE) {
+        return false;
+    }
+    
+    auto it = std::find_if(subscriptions_.begin(), subscriptions_.end(),
+                           [id](const Subscription& sub) { return sub.id == id; });
+    bool found = it != subscriptions_.end();
+    if (found) {
+        subscriptions_.erase(it);
+    }
+    xSemaphoreGive(notifyMutex_);
+    return found;
+}
+
+void PersistentStorage::beginChangeBatch() {
+    if (xSemaphoreTake(notifyMutex_, portMAX_DELAY) == pdTRUE) {
+        batchDepth_++;
+        xSemaphoreGive(notifyMutex_);
+    }
+}
+
+void PersistentStorage::endChangeBatch() {
+    std::vector<std::string> names;
+    if (xSemaphoreTake(notifyMutex_, portMAX_DELAY) != pdTRUE) {
+        return;
+    }
+    if (batchDepth_ > 0 && --batchDepth_ == 0) {
+        names.swap(batchNames_);
+    }
+    xSemaphoreGive(notifyMutex_);
+    
+    if (!names.empty()) {
+        deliverChanges(names);
+    }
+}
+
+// "name", "prefix*" or "*"
+bool PersistentStorage::patternMatches(const std::string& pattern, const std::string& name) {
+    if (!pattern.empty() && pattern.back() == '*') {
+        return name.compare(0, pattern.length() - 1, pattern, 0, pattern.length() - 1) == 0;
+    }
+    return pattern == name;
+}
+
+// Call every subscriber once with the names it is interested in
+void PersistentStorage::dispatchChanges(const std::vector<std::string>& names) {
+    // Collect calls under the mutex, run them outside so handlers may (un)subscribe
+    std::vector<std::pair<ChangeHandler, std::vector<std::string>>> calls;
+    if (xSemaphoreTake(notifyMutex_, portMAX_DELAY) != pdTRUE) {
+        return;
+    }
+    for (const auto& sub : subscriptions_) {
+        std::vector<std::string> matched;
+        for (const auto& name : names) {
+            if (patternMatches(sub.pattern, name)) {
+                matched.push_back(name);
             }
-            oldValue = malloc(sizeof(int32_t));
-            *(int32_t*)oldValue = *(int32_t*)param.dataPtr;
-            *(int32_t*)param.dataPtr = newVal;
-            break;
         }
-        
-        case ParameterInfo::TYPE_FLOAT: {
-            float newVal = doc["value"].as<float>();
-            if (newVal < param.constraints.floatRange.min || newVal > param.constraints.floatRange.max) {
-                return Result::ERROR_VALIDATION_FAILED;
-            }
-            oldValue = malloc(sizeof(float));
-            *(float*)oldValue = *(float*)param.dataPtr;
-            *(float*)param.dataPtr = newVal;
-            break;
+        if (!matched.empty()) {
+            calls.emplace_back(sub.handler, std::move(matched));
         }
+    }
+    xSemaphoreGive(notifyMutex_);
+    
+    for (const auto& call : calls) {
+        call.first(call.second);
+    }
+}
+
+// Hand a batch to the dispatcher task without blocking, or call the
+// subscribers directly if no dispatcher runs
+void PersistentStorage::deliverChanges(const std::vector<std::string>& names) {
+    if (!notifyMutex_ || xSemaphoreTake(notifyMutex_, portMAX_DELAY) != pdTRUE) {
+        return;
+    }
+    if (!dispatcherRunning_ || !changeQueue_) {
+        xSemaphoreGive(notifyMutex_);
+        dispatchChanges(names);
+        return;
+    }
+    
+    // Sent under the mutex, so that stopDispatcher() cannot delete the queue meanwhile
+    ChangeEvent event;
+    event.batch = nextBatchId_++;
+    for (size_t i = 0; i < names.size(); i++) {
+        strncpy(event.name, names[i].c_str(), sizeof(event.name) - 1);
+        event.name[sizeof(event.name) - 1] = '\0';
+        event.last = (i + 1 == names.size());
         
-        case ParameterInfo::TYPE_STRING: {
-            const char* newVal = doc["value"].as<const char*>();
-            if (!newVal || strlen(newVal) >= param.constraints.stringMax.maxLen) {
-                return Result::ERROR_VALIDATION_FAILED;
-            }
-            oldValue = malloc(param.size);
-            strcpy((char*)oldValue, (char*)param.dataPtr);
-            strcpy((char*)param.dataPtr, newVal);
-            break;
+        if (xQueueSend(changeQueue_, &event, 0) == pdTRUE) {
+            PSTOR_STATS_INC(notificationsQueued);
+        } else {
+            PSTOR_STATS_INC(notificationsDropped);
+            PSTOR_LOG_W( "Change queue full, dropped notification for %s", event.name);
         }
-        
-        default:
-            return Result::ERROR_TYPE_MISMATCH;
+    }
+    xSemaphoreGive(notifyMutex_);
+}
+
+// Start the change notification dispatcher
+bool PersistentStorage::startDispatcher(const DispatcherConfig& config) {
+    if (dispatcherTask_) {
+        PSTOR_LOG_W( "Dispatcher already running");
+        return true;
     }
     
-    // Run custom validator if set
-    if (param.validator && !param.validator(param.dataPtr)) {
-        // Restore old value
-        switch (param.type) {
-            case ParameterInfo::TYPE_BOOL:
-                *(bool*)param.dataPtr = *(bool*)oldValue;
-                break;
-            case ParameterInfo::TYPE_INT:
-                *(int32_t*)param.dataPtr = *(int32_t*)oldValue;
-                break;
-            case ParameterInfo::TYPE_FLOAT:
-                *(float*)param.dataPtr = *(float*)oldValue;
-                break;
-            case ParameterInfo::TYPE_STRING:
-                strcpy((char*)param.dataPtr, (char*)oldValue);
-                break;
-            case ParameterInfo::TYPE_BLOB:
-                // BLOB types cannot be changed via JSON
-                break;
-        }
-        free(oldValue);
-        return Result::ERROR_VALIDATION_FAILED;
+    if (!changeQueue_) {
+        changeQueue_ = xQueueCreate(config.queueLength, sizeof(ChangeEvent));
+    }
+    if (!dispatcherExited_) {
+        dispatcherExited_ = xSemaphoreCreateBinary();
+    }
+    if (!changeQueue_ || !dispatcherExited_) {
+        PSTOR_LOG_E( "Failed to create dispatcher queue");
+        return false;
     }
     
-    free(oldValue);
-    return Result::SUCCESS;
+    TaskHandle_t task = nullptr;
+    dispatcherRunning_ = true;
+    BaseType_t created = xTaskCreatePinnedToCore(dispatcherTaskEntry, "pstor_notify",
+                                                 config.stackSize, this, config.priority,
+                                                 &task, config.core);
+    if (created != pdPASS) {
+        PSTOR_LOG_E( "Failed to create dispatcher task");
+        task = nullptr;
+    }
+    
+    xSemaphoreTake(notifyMutex_, portMAX_DELAY);
+    dispatcherTask_ = task;
+    dispatcherRunning_ = (task != nullptr);
+    xSemaphoreGive(notifyMutex_);
+    if (!task) {
+        return false;
+    }
+    
+    PSTOR_LOG_I( "Dispatcher started (queue %d)", config.queueLength);
+    return true;
 }
 
-void PersistentStorage::notifyChange(const std::string& name, const void* newValue) {
-    auto it = parameters_.find(name);
-    if (it != parameters_.end() && it->second.onChange) {
-        it->second.onChange(name, newValue);
+// Stop the dispatcher after it has drained the queue
+void PersistentStorage::stopDispatcher() {
+    // Later changes are dispatched directly; the task drains what is queued
+    if (!notifyMutex_ || xSemaphoreTake(notifyMutex_, portMAX_DELAY) != pdTRUE) {
+        return;
+    }
+    TaskHandle_t task = dispatcherRunning_ ? dispatcherTask_ : nullptr;
+    dispatcherRunning_ = false;
+    xSemaphoreGive(notifyMutex_);
+    if (!task) {
+        return;
+    }
+    
+    ChangeEvent wake = {};
+    xQueueSend(changeQueue_, &wake, portMAX_DELAY);
+    
+    if (xSemaphoreTake(dispatcherExited_, pdMS_TO_TICKS(5000)) != pdTRUE) {
+        PSTOR_LOG_E( "Dispatcher did not stop, deleting it");
+        vTaskDelete(task);
+    }
+    
+    // No sender uses the queue once it is cleared under the mutex
+    xSemaphoreTake(notifyMutex_, portMAX_DELAY);
+    QueueHandle_t queue = changeQueue_;
+    changeQueue_ = nullptr;
+    dispatcherTask_ = nullptr;
+    xSemaphoreGive(notifyMutex_);
+    vQueueDelete(queue);
+    
+    PSTOR_LOG_I( "Dispatcher stopped");
+}
+
+void PersistentStorage::dispatcherTaskEntry(void* arg) {
+    PersistentStorage* self = static_cast<PersistentStorage*>(arg);
+    self->dispatcherLoop();
+    
+    xSemaphoreGive(self->dispatcherExited_);
+    vTaskDelete(nullptr);
+}
+
+void PersistentStorage::dispatcherLoop() {
+    std::vector<std::string> pending;
+    uint32_t pendingBatch = 0;
+    ChangeEvent event;
+    
+    while (dispatcherRunning_ || uxQueueMessagesWaiting(changeQueue_) > 0) {
+        TickType_t wait = pending.empty() ? portMAX_DELAY : pdMS_TO_TICKS(BATCH_TIMEOUT_MS);
+        if (xQueueReceive(changeQueue_, &event, wait) != pdTRUE) {
+            // The end of this batch was dropped - deliver what arrived
+            dispatchChanges(pending);
+            pending.clear();
+            continue;
+        }
+        
+        if (!pending.empty() && event.batch != pendingBatch) {
+            dispatchChanges(pending);
+            pending.clear();
+        }
+        if (event.name[0] == '\0') {
+            continue;
+        }
+        
+        pendingBatch = event.batch;
+        pending.push_back(event.name);
+        if (event.last) {
+            dispatchChanges(pending);
+            pending.clear();
+        }
+    }
+    
+    if (!pending.empty()) {
+        dispatchChanges(pending);
     }
 }
 
@@ -804,11 +5063,238 @@ const char* PersistentStorage::resultToString(Result result) {
         case Result::ERROR_NVS_FAIL: return "NVS operation failed";
         case Result::ERROR_INVALID_NAME: return "Invalid parameter name";
         case Result::ERROR_TOO_LARGE: return "Value too large";
+        case Result::ERROR_REENTRANT: return "Registry in use by the caller";
         default: return "Unknown error";
     }
 }
 
+// Publish a message via callback if set, otherwise via the MQTT manager
+bool PersistentStorage::publishMessage(const char* topic, const char* payload) {
+    PSTOR_STATS_TIMER(startUs);
+    bool success = false;
+    
+    if (mqttPublishCallback_) {
+        success = mqttPublishCallback_(topic, payload, 0, false);
+    } else if (mqttManager_) {
+        auto result = mqttManager_->publish(topic, payload, 0, false);
+        success = result.isOk();
+        if (!success) {
+            PSTOR_LOG_D( "Publish to %s failed: %s", topic,
+                         result.error() == MQTTError::CONNECTION_FAILED ? "Not connected" : "Publish failed");
+        }
+    }
+    
+    PSTOR_STATS_LATENCY(OP_PUBLISH, startUs);
+    if (!success) {
+        PSTOR_STATS_INC(publishFailures);
+    }
+    return success;
+}
+
+// Take a buffer from the output pool, falling back to the heap when all are in use
+char* PersistentStorage::acquireOutputBuffer(size_t size, int& slot) {
+    slot = -1;
+    if (size <= maxPacketSize_) {
+        for (size_t i = 0; i < OUTPUT_BUFFER_COUNT; i++) {
+            uint32_t bit = 1UL << i;
+            if (outputBuffersBusy_.fetch_or(bit) & bit) {
+                continue;  // Taken by another task
+            }
+            if (!outputBuffers_[i]) {
+                outputBuffers_[i] = (char*)malloc(maxPacketSize_);
+                if (!outputBuffers_[i]) {
+                    outputBuffersBusy_.fetch_and(~bit);
+                    break;
+                }
+            }
+            slot = i;
+            return outputBuffers_[i];
+        }
+    }
+    return (char*)malloc(size);
+}
+
+void PersistentStorage::releaseOutputBuffer(char* buffer, int slot) {
+    if (slot < 0) {
+        free(buffer);
+    } else {
+        outputBuffersBusy_.fetch_and(~(1UL << slot));
+    }
+}
+
+// Largest payload that fits one MQTT packet together with the given topic
+size_t PersistentStorage::payloadLimit(size_t topicLen) const {
+    size_t overhead = topicLen + MQTT_PACKET_OVERHEAD;
+    return maxPacketSize_ > overhead + 1 ? maxPacketSize_ - overhead - 1 : 1;
+}
+
+/**
+ * ArduinoJson writer that cuts the output into numbered parts and publishes
+ * each one as soon as it is full, so the document is never held in RAM as a
+ * whole.
+ */
+class PersistentStorage::MultipartWriter {
+public:
+    MultipartWriter(PersistentStorage& owner, const char* topic, char* buffer,
+                    size_t partSize, size_t partCount)
+        : owner_(owner), topic_(topic), buffer_(buffer), partSize_(partSize)
+        , partCount_(partCount), used_(0), partIndex_(0), failed_(false) {}
+    
+    size_t write(uint8_t c) {
+        return write(&c, 1);
+    }
+    
+    size_t write(const uint8_t* data, size_t len) {
+        size_t done = 0;
+        while (done < len) {
+            size_t n = std::min(len - done, partSize_ - used_);
+            memcpy(buffer_ + used_, data + done, n);
+            used_ += n;
+            done += n;
+            if (used_ == partSize_) {
+                flush();
+            }
+        }
+        return len;
+    }
+    
+    void flush() {
+        if (used_ == 0) {
+            return;
+        }
+        buffer_[used_] = '\0';
+        partIndex_++;
+        
+        // Any prefix length: a cut-off "/part/<i>/<n>" could not be reassembled
+        char suffix[32];
+        snprintf(suffix, sizeof(suffix), "/part/%u/%u",
+                 (unsigned)partIndex_, (unsigned)partCount_);
+        std::string partTopic = std::string(topic_) + suffix;
+        if (!owner_.publishMessage(partTopic.c_str(), buffer_)) {
+            failed_ = true;
+        }
+        used_ = 0;
+    }
+    
+    bool complete() const { return !failed_ && partIndex_ == partCount_; }
+
+private:
+    PersistentStorage& owner_;
+    const char* topic_;
+    char* buffer_;
+    size_t partSize_;
+    size_t partCount_;
+    size_t used_;
+    size_t partIndex_;
+    bool failed_;
+};
+
+// Serialize with measured sizing and publish, split into parts if too large
+bool PersistentStorage::publishJson(const char* topic, const JsonDocument& doc) {
+    size_t len = measureJson(doc);
+    size_t topicLen = strlen(topic);
+    
+    if (len <= payloadLimit(topicLen)) {
+        int slot;
+        char* buffer = acquireOutputBuffer(len + 1, slot);
+        if (!buffer) {
+            PSTOR_STATS_INC(jsonTruncations);
+            PSTOR_LOG_E( "No memory for %d byte payload on %s", len, topic);
+            return false;
+        }
+        serializeJson(doc, buffer, len + 1);
+        bool success = publishMessage(topic, buffer);
+        releaseOutputBuffer(buffer, slot);
+        return success;
+    }
+    
+    // Too large for one packet: ".../part/<i>/<n>" adds at most 16 characters
+    size_t partSize = payloadLimit(topicLen + 16);
+    size_t partCount = (len + partSize - 1) / partSize;
+    int slot;
+    char* buffer = acquireOutputBuffer(partSize + 1, slot);
+    if (!buffer) {
+        PSTOR_STATS_INC(jsonTruncations);
+        PSTOR_LOG_E( "No memory for multi-part payload on %s", topic);
+        return false;
+    }
+    
+    PSTOR_LOG_D( "Splitting %d byte payload on %s into %d parts", len, topic, partCount);
+    MultipartWriter writer(*this, topic, buffer, partSize, partCount);
+    serializeJson(doc, writer);
+    writer.flush();
+    releaseOutputBuffer(buffer, slot);
+    
+    PSTOR_STATS_INC(multipartMessages);
+    if (!writer.complete()) {
+        // Consumers cannot reassemble a document with missing parts
+        PSTOR_STATS_INC(jsonTruncations);
+        PSTOR_LOG_W( "Multi-part publish on %s incomplete", topic);
+        return false;
+    }
+    return true;
+}
+
+// Set the largest MQTT packet the broker/client accepts
+void PersistentStorage::setMaxPacketSize(size_t bytes) {
+    if (bytes < MIN_PACKET_SIZE) {
+        bytes = MIN_PACKET_SIZE;
+    }
+    
+    // Pool buffers are sized for the old limit - drop the idle ones
+    for (size_t i = 0; i < OUTPUT_BUFFER_COUNT; i++) {
+        uint32_t bit = 1UL << i;
+        if (outputBuffersBusy_.fetch_or(bit) & bit) {
+            outputBuffersBusy_.fetch_and(~(bit - 1));
+            PSTOR_LOG_W( "Output buffer %d in use, max packet size not changed", i);
+            return;
+        }
+        free(outputBuffers_[i]);
+        outputBuffers_[i] = nullptr;
+    }
+    maxPacketSize_ = bytes;
+    outputBuffersBusy_.store(0);
+}
+
+const char* PersistentStorage::typeToString(ParameterInfo::Type type) {
+    switch (type) {
+        case ParameterInfo::TYPE_BOOL: return "bool";
+        case ParameterInfo::TYPE_INT: return "int";
+        case ParameterInfo::TYPE_FLOAT: return "float";
+        case ParameterInfo::TYPE_STRING: return "string";
+        case ParameterInfo::TYPE_BLOB: return "blob";
+        case ParameterInfo::TYPE_COUNTER: return "counter";
+        case ParameterInfo::TYPE_ARRAY: return "array";
+        case ParameterInfo::TYPE_STRUCT: return "struct";
+        case ParameterInfo::TYPE_INT64: return "int64";
+        case ParameterInfo::TYPE_UINT32: return "uint32";
+        case ParameterInfo::TYPE_DOUBLE: return "double";
+        case ParameterInfo::TYPE_ENUM: return "enum";
+        default: return "unknown";
+    }
+}
+
 void PersistentStorage::publishUpdate(const std::string& name) {
+    RegistryLock::ReadGuard guard(registryLock_);
+    ParameterInfo* param = findParameter(name);
+    const StructField* field = nullptr;
+    if (param) {
+        publishParameter(*param);
+    } else if ((param = findField(name, field)) != nullptr) {
+        if (!mqttPublishCallback_ && (!mqttManager_ || !mqttManager_->isConnected())) {
+            return;
+        }
+        JsonDocument doc;  // ArduinoJson v7
+        fieldToJson(*param, *field, doc);
+        std::string topic = mqttPrefix_ + "/status/" + name;
+        if (!publishJson(topic.c_str(), doc)) {
+            PSTOR_LOG_W( "Failed to publish parameter %s", name.c_str());
+        }
+    }
+}
+
+// Publish a parameter, or a slice of an array, to {prefix}/status/<name>
+void PersistentStorage::publishParameter(const ParameterInfo& param, size_t offset, size_t count) {
     // Only check connection if not using callback
     if (!mqttPublishCallback_) {
         if (!mqttManager_) return;
@@ -816,34 +5302,69 @@ void PersistentStorage::publishUpdate(const std::string& name) {
         // Check connection before publishing
         if (!mqttManager_->isConnected()) {
             PSTOR_LOG_D( "MQTT not connected, skipping publish of %s",
-                                     name.c_str());
+                                     param.name);
             return;
         }
     }
+
+    JsonDocument doc;  // ArduinoJson v7
+    parameterToJson(param, doc, offset, count);
+    
+    std::string topic = mqttPrefix_ + "/status/" + param.name;
+    if (!publishJson(topic.c_str(), doc)) {
+        PSTOR_LOG_W( "Failed to publish parameter %s", param.name);
+    }
+}
+
+// Publish a blob slice to {prefix}/status/<name> as base64 chunks of one
+// packet each, encoded straight from the variable into the output buffer
+void PersistentStorage::publishBlob(const ParameterInfo& param, size_t offset, size_t count) {
+    if (!mqttPublishCallback_ && (!mqttManager_ || !mqttManager_->isConnected())) {
+        return;
+    }
     
-    auto it = parameters_.find(name);
-    if (it == parameters_.end()) return;
-
-    JsonDocument doc;  // ArduinoJson v7
-    parameterToJson(it->second, doc);
+    std::string topic = mqttPrefix_ + "/status/" + param.name;
+    size_t limit = payloadLimit(topic.length());
+    size_t envelope = strlen(param.name) + 80;  // Keys, quotes and two numbers
+    if (limit < envelope + 4) {
+        PSTOR_LOG_E( "Packet too small for blob chunks of %s", param.name);
+        return;
+    }
+    size_t chunkBytes = (limit - envelope) / 4 * 3;
     
-    std::string topic = mqttPrefix_ + "/status/" + name;
-    char buffer[256];
-    serializeJson(doc, buffer, sizeof(buffer));
+    int slot;
+    char* buffer = acquireOutputBuffer(limit + 1, slot);
+    if (!buffer) {
+        PSTOR_LOG_E( "No memory for blob chunks of %s", param.name);
+        return;
+    }
     
-    // Use callback if available, otherwise direct publish
-    if (mqttPublishCallback_) {
-        if (!mqttPublishCallback_(topic.c_str(), buffer, 0, false)) {
-            PSTOR_LOG_W( "Failed to publish parameter %s via callback", name.c_str());
-        }
-    } else {
-        auto result = mqttManager_->publish(topic.c_str(), buffer, 0, false);
-        if (!result.isOk()) {
-            PSTOR_LOG_W( "Failed to publish parameter %s: %s", 
-                                     name.c_str(), 
-                                     result.error() == MQTTError::CONNECTION_FAILED ? "Not connected" : "Publish failed");
+    offset = std::min(offset, param.size);
+    size_t end = offset + std::min(count, param.size - offset);
+    size_t chunks = 0;
+    do {
+        size_t n = std::min(chunkBytes, end - offset);
+        int len = snprintf(buffer, limit + 1,
+                           "{\"name\":\"%s\",\"type\":\"blob\",\"size\":%u,\"offset\":%u,\"value\":\"",
+                           param.name, (unsigned)param.size, (unsigned)offset);
+        char* value = buffer + len;
+        uint32_t start;
+        do {
+            start = ValueAccess::readBegin(param.sequence);
+            base64Encode((const uint8_t*)param.dataPtr + offset, n, value);
+        } while (ValueAccess::readRetry(param.sequence, start));
+        memcpy(value + base64Length(n), "\"}", 3);
+        
+        if (!publishMessage(topic.c_str(), buffer)) {
+            PSTOR_LOG_W( "Failed to publish blob %s at %d", param.name, offset);
+            break;
         }
-    }
+        offset += n;
+        chunks++;
+    } while (offset < end);
+    releaseOutputBuffer(buffer, slot);
+    
+    PSTOR_LOG_D( "Published %s in %d chunks", param.name, chunks);
 }
 
 void PersistentStorage::publishAll() {
@@ -852,6 +5373,11 @@ void PersistentStorage::publishAll() {
 }
 
 void PersistentStorage::publishAllGrouped() {
+    publishAllGrouped(GROUP_PUBLISH_DELAY_MS);
+}
+
+void PersistentStorage::publishAllGrouped(uint32_t groupDelayMs) {
+    RegistryLock::ReadGuard guard(registryLock_);
     PSTOR_LOG_I( "publishAllGrouped called");
 
     // Only check connection if not using callback
@@ -870,10 +5396,10 @@ void PersistentStorage::publishAllGrouped() {
 
     // Auto-discover all unique group prefixes from registered parameters
     std::vector<std::string> groups;
-    for (const auto& pair : parameters_) {
-        size_t slashPos = pair.first.find('/');
-        if (slashPos != std::string::npos) {
-            std::string group = pair.first.substr(0, slashPos);
+    for (const ParameterInfo* param : parameters_) {
+        const char* slash = strchr(param->name, '/');
+        if (slash) {
+            std::string group(param->name, slash - param->name);
             // Check if group already in list
             bool found = false;
             for (const auto& g : groups) {
@@ -890,7 +5416,9 @@ void PersistentStorage::publishAllGrouped() {
 
     // Process each discovered group
     for (const auto& group : groups) {
-        publishGroupedCategory(group);
+        if (publishGroupedCategory(group) && groupDelayMs > 0) {
+            vTaskDelay(pdMS_TO_TICKS(groupDelayMs));
+        }
     }
 
     // Send completion message
@@ -899,20 +5427,14 @@ void PersistentStorage::publishAllGrouped() {
     completeDoc["timestamp"] = millis();
     completeDoc["groupsPublished"] = groups.size();
     
-    char buffer[256];
-    serializeJson(completeDoc, buffer, sizeof(buffer));
     std::string completeTopic = mqttPrefix_ + "/status/complete";
-    
-    if (mqttPublishCallback_) {
-        mqttPublishCallback_(completeTopic.c_str(), buffer, 0, false);
-    } else {
-        (void)mqttManager_->publish(completeTopic.c_str(), buffer, 0, false);
-    }
+    publishJson(completeTopic.c_str(), completeDoc);
     
     PSTOR_LOG_I( "Grouped publishing complete");
 }
 
-void PersistentStorage::publishGroupedCategory(const std::string& category) {
+bool PersistentStorage::publishGroupedCategory(const std::string& category) {
+    RegistryLock::ReadGuard guard(registryLock_);
     // Use JSON doc (ArduinoJson v7)
     JsonDocument doc;
     JsonObject rootObj = doc.to<JsonObject>();
@@ -925,9 +5447,8 @@ void PersistentStorage::publishGroupedCategory(const std::string& category) {
     }
 
     // Iterate through all parameters for this category
-    for (const auto& pair : parameters_) {
-        const std::string& fullName = pair.first;
-        const ParameterInfo& param = pair.second;
+    for (const ParameterInfo* entry : parameters_) {
+        const ParameterInfo& param = *entry;
 
         // Skip read-only parameters in get/all
         if (param.access == ParameterInfo::ACCESS_READ_ONLY) {
@@ -935,18 +5456,18 @@ void PersistentStorage::publishGroupedCategory(const std::string& category) {
         }
 
         // Find the first '/' to determine the group
-        size_t slashPos = fullName.find('/');
-        if (slashPos == std::string::npos) {
+        const char* slash = strchr(param.name, '/');
+        if (!slash) {
             continue;  // Skip parameters without a group
         }
 
         // Compare group without allocating string
-        if (fullName.compare(0, slashPos, category) != 0) {
+        if (category.compare(0, std::string::npos, param.name, slash - param.name) != 0) {
             continue;  // Not our category
         }
 
         // Get parameter name (after first slash)
-        const char* nameStart = fullName.c_str() + slashPos + 1;
+        const char* nameStart = slash + 1;
         JsonObject targetObj = rootObj;
 
         // Handle PID parameters specially - find second slash
@@ -969,17 +5490,39 @@ void PersistentStorage::publishGroupedCategory(const std::string& category) {
         if (!targetObj.isNull()) {
             switch (param.type) {
                 case ParameterInfo::TYPE_BOOL:
-                    targetObj[nameStart] = *(bool*)param.dataPtr;
+                    targetObj[nameStart] = ValueAccess::load<bool>(param.dataPtr);
                     break;
                 case ParameterInfo::TYPE_INT:
-                    targetObj[nameStart] = *(int32_t*)param.dataPtr;
+                    targetObj[nameStart] = ValueAccess::load<int32_t>(param.dataPtr);
                     break;
                 case ParameterInfo::TYPE_FLOAT:
-                    targetObj[nameStart] = *(float*)param.dataPtr;
+                    targetObj[nameStart] = ValueAccess::load<float>(param.dataPtr);
+                    break;
+                case ParameterInfo::TYPE_COUNTER:
+                    targetObj[nameStart] = ValueAccess::load<uint64_t>(param.dataPtr);
                     break;
-                case ParameterInfo::TYPE_STRING:
-                    targetObj[nameStart] = (const char*)param.dataPtr;
+                case ParameterInfo::TYPE_INT64:
+                    targetObj[nameStart] = ValueAccess::load<int64_t>(param.dataPtr);
                     break;
+                case ParameterInfo::TYPE_UINT32:
+                    targetObj[nameStart] = ValueAccess::load<uint32_t>(param.dataPtr);
+                    break;
+                case ParameterInfo::TYPE_DOUBLE:
+                    targetObj[nameStart] = ValueAccess::load<double>(param.dataPtr);
+                    break;
+                case ParameterInfo::TYPE_ENUM: {
+                    uint8_t index = ValueAccess::load<uint8_t>(param.dataPtr);
+                    if (index < param.constraints.enumeration.count) {
+                        targetObj[nameStart] = param.constraints.enumeration.names[index];
+                    }
+                    break;
+                }
+                case ParameterInfo::TYPE_STRING: {
+                    std::vector<char> text(param.size);
+                    readConsistent(param, text.data(), text.size());
+                    targetObj[nameStart] = text.data();    // Copied by the document
+                    break;
+                }
                 default:
                     break;
             }
@@ -988,31 +5531,21 @@ void PersistentStorage::publishGroupedCategory(const std::string& category) {
 
     // Only publish if we have content
     if (doc.size() > 0) {
-        // Use static buffer to avoid stack allocation each call
-        static char buffer[256];
         char topicBuf[64];
         snprintf(topicBuf, sizeof(topicBuf), "%s/status/%s", mqttPrefix_.c_str(), category.c_str());
-        serializeJson(doc, buffer, sizeof(buffer));
-
-        bool success = false;
-        if (mqttPublishCallback_) {
-            success = mqttPublishCallback_(topicBuf, buffer, 0, false);
-        } else {
-            auto result = mqttManager_->publish(topicBuf, buffer, 0, false);
-            success = result.isOk();
-        }
 
-        if (success) {
+        if (publishJson(topicBuf, doc)) {
             PSTOR_LOG_I( "Published %s group", category.c_str());
         } else {
             PSTOR_LOG_E( "Failed to publish %s group", category.c_str());
         }
-
-        vTaskDelay(pdMS_TO_TICKS(50));
+        return true;
     }
+    return false;
 }
 
 void PersistentStorage::publishAllAsync() {
+    RegistryLock::ReadGuard guard(registryLock_);
     PSTOR_LOG_I( "publishAllAsync called");
 
     // Only check connection if not using callback
@@ -1062,19 +5595,9 @@ void PersistentStorage::publishAllAsync() {
     summaryDoc["message"] = "Publishing parameters asynchronously";
     
     std::string summaryTopic = mqttPrefix_ + "/status/summary";
-    char summaryBuffer[256];
-    serializeJson(summaryDoc, summaryBuffer, sizeof(summaryBuffer));
     
     // Publish summary with error handling
-    bool publishSuccess = false;
-    if (mqttPublishCallback_) {
-        publishSuccess = mqttPublishCallback_(summaryTopic.c_str(), summaryBuffer, 0, false);
-    } else {
-        auto summaryResult = mqttManager_->publish(summaryTopic.c_str(), summaryBuffer, 0, false);
-        publishSuccess = summaryResult.isOk();
-    }
-    
-    if (!publishSuccess) {
+    if (!publishJson(summaryTopic.c_str(), summaryDoc)) {
         PSTOR_LOG_W( "Failed to publish summary");
         isPublishing_ = false;
         nextParamIndex_ = 0;
@@ -1089,24 +5612,27 @@ void PersistentStorage::publishAllAsync() {
     
     // Release mutex
     xSemaphoreGive(publishMutex_);
+    wakeServiceTask();
 }
 
-void PersistentStorage::continueAsyncPublish() {
+// Claim the next registry position of the running async publish
+bool PersistentStorage::claimNextPublishIndex(size_t& index) {
+    RegistryLock::ReadGuard guard(registryLock_);
     // Take mutex to check state
     if (!publishMutex_ || xSemaphoreTake(publishMutex_, pdMS_TO_TICKS(100)) != pdTRUE) {
-        return;
+        return false;
     }
     
     if (!isPublishing_) {
         xSemaphoreGive(publishMutex_);
-        return;
+        return false;
     }
 
     // Only check connection if not using callback
     if (!mqttPublishCallback_) {
         if (!mqttManager_) {
             xSemaphoreGive(publishMutex_);
-            return;
+            return false;
         }
 
         // Verify MQTT is still connected
@@ -1116,94 +5642,78 @@ void PersistentStorage::continueAsyncPublish() {
             nextParamIndex_ = 0;
             totalParams_ = 0;
             xSemaphoreGive(publishMutex_);
-            return;
+            return false;
         }
     }
     
     // Check if we're done
-    if (nextParamIndex_ >= totalParams_) {
+    if (nextParamIndex_ >= totalParams_ || nextParamIndex_ >= parameters_.size()) {
         PSTOR_LOG_I( "Finished publishing all %d parameters", totalParams_);
         isPublishing_ = false;
         nextParamIndex_ = 0;
         totalParams_ = 0;
         xSemaphoreGive(publishMutex_);
-        return;
+        return false;
     }
     
-    // Calculate how many to publish in this chunk
-    size_t toPublish = std::min(PARAMS_PER_CHUNK, totalParams_ - nextParamIndex_);
-    size_t startIndex = nextParamIndex_;
-    
-    // Update index for next iteration
-    nextParamIndex_ += toPublish;
+    index = nextParamIndex_;
+    nextParamIndex_ = index + 1;
     
     // Release mutex before publishing
     xSemaphoreGive(publishMutex_);
+    return true;
+}
 
-    // Note: Removed esp_task_wdt_reset() - caller task may not be registered
+// Publish the parameter at a registry position as part of an async publish
+void PersistentStorage::publishParameterAt(size_t index) {
+    RegistryLock::ReadGuard guard(registryLock_);
+    if (index >= parameters_.size()) {
+        return;
+    }
+    const ParameterInfo& param = *parameters_[index];
     
-    // Publish parameters by iterating through the map
-    size_t currentIndex = 0;
-    size_t published = 0;
+    JsonDocument paramDoc;  // ArduinoJson v7
+    parameterToJson(param, paramDoc);
     
-    for (const auto& pair : parameters_) {
-        // Skip to the start index
-        if (currentIndex < startIndex) {
-            currentIndex++;
-            continue;
-        }
-        
-        // Check if we've published enough
-        if (published >= toPublish) {
-            break;
-        }
-        
-        // Publish this parameter
-        JsonDocument paramDoc;  // ArduinoJson v7
-        parameterToJson(pair.second, paramDoc);
-        
-        // Use static buffers to avoid dynamic allocation
-        char topicBuffer[128];
-        snprintf(topicBuffer, sizeof(topicBuffer), "%s/status/%s", 
-                 mqttPrefix_.c_str(), pair.first.c_str());
-        
-        char paramBuffer[512];
-        serializeJson(paramDoc, paramBuffer, sizeof(paramBuffer));
-        
-        bool success = false;
-        if (mqttPublishCallback_) {
-            success = mqttPublishCallback_(topicBuffer, paramBuffer, 0, false);
-        } else {
-            auto result = mqttManager_->publish(topicBuffer, paramBuffer, 0, false);
-            success = result.isOk();
-            if (!success && result.error() == MQTTError::CONNECTION_FAILED) {
-                PSTOR_LOG_W( "MQTT connection lost, stopping publish");
-                // Reset publishing state
-                if (xSemaphoreTake(publishMutex_, pdMS_TO_TICKS(100)) == pdTRUE) {
-                    isPublishing_ = false;
-                    nextParamIndex_ = 0;
-                    totalParams_ = 0;
-                    xSemaphoreGive(publishMutex_);
-                }
-                return;
-            }
-        }
-        
-        if (!success) {
-            PSTOR_LOG_W( "Failed to publish parameter: %s", pair.first.c_str());
+    char topicBuffer[128];
+    snprintf(topicBuffer, sizeof(topicBuffer), "%s/status/%s", 
+             mqttPrefix_.c_str(), param.name);
+    
+    if (publishJson(topicBuffer, paramDoc)) {
+        return;
+    }
+    
+    if (!mqttPublishCallback_ && !mqttManager_->isConnected()) {
+        PSTOR_LOG_W( "MQTT connection lost, stopping publish");
+        // Reset publishing state
+        if (xSemaphoreTake(publishMutex_, pdMS_TO_TICKS(100)) == pdTRUE) {
+            isPublishing_ = false;
+            nextParamIndex_ = 0;
+            totalParams_ = 0;
+            xSemaphoreGive(publishMutex_);
         }
-        
+        return;
+    }
+    PSTOR_LOG_W( "Failed to publish parameter: %s", param.name);
+}
+
+void PersistentStorage::continueAsyncPublish() {
+    // Note: Removed esp_task_wdt_reset() - caller task may not be registered
+    size_t published = 0;
+    size_t index;
+    
+    while (published < PARAMS_PER_CHUNK && claimNextPublishIndex(index)) {
+        publishParameterAt(index);
         published++;
-        currentIndex++;
         
         // Small delay between parameters
         vTaskDelay(pdMS_TO_TICKS(50));
-
-        // Note: Removed esp_task_wdt_reset() - caller task may not be registered
     }
     
-    PSTOR_LOG_D( "Published %d parameters, %d remaining", 
-                             published, totalParams_ - nextParamIndex_);
+    if (published > 0) {
+        PSTOR_LOG_D( "Published %d parameters, %d remaining", 
+                                 published, totalParams_ - nextParamIndex_);
+    }
 }
 
 void PersistentStorage::processCommandQueue() {
@@ -1218,99 +5728,383 @@ void PersistentStorage::processCommandQueue() {
             break;  // No more commands
         }
         
-        // Minimal logging to save stack space
-        PSTOR_LOG_D( "Cmd type: %d", cmd.type);
+        executeCommand(cmd, true);
+        
+        // Small delay between commands
+        vTaskDelay(pdMS_TO_TICKS(10));
+    }
+}
 
-        // Note: Removed esp_task_wdt_reset() - caller task may not be registered
-        // with ESP-IDF task watchdog, causing crash. Caller should handle WDT if needed.
+size_t PersistentStorage::processCommandQueue(uint32_t budgetUs) {
+    if (!commandQueue_) {
+        return 0;
+    }
+    
+    const int64_t startUs = esp_timer_get_time();
+    ParameterCommand cmd;
+    bool didWork;
+    
+    // Alternate between one command and one async publish step until both
+    // are drained or the budget is used up - never sleeps
+    do {
+        didWork = false;
         
-        switch (cmd.type) {
-            case ParameterCommand::SET: {
-                JsonDocument doc;  // ArduinoJson v7
-                DeserializationError error = deserializeJson(doc, cmd.payload);
+        if (xQueueReceive(commandQueue_, &cmd, 0) == pdTRUE) {
+            executeCommand(cmd, false);
+            didWork = true;
+        }
+        
+        size_t index;
+        if (isPublishing_ && claimNextPublishIndex(index)) {
+            publishParameterAt(index);
+            didWork = true;
+        }
+    } while (didWork && esp_timer_get_time() - startUs < (int64_t)budgetUs);
+    
+    return uxQueueMessagesWaiting(commandQueue_);
+}
 
-                // If JSON parsing failed or no "value" key, wrap plain value
-                if (error || doc["value"].isNull()) {
-                    doc.clear();
-                    // Try to detect type and set appropriately
-                    char* endptr;
-                    double numVal = strtod(cmd.payload, &endptr);
-                    if (*endptr == '\0' && endptr != cmd.payload) {
-                        // It's a number
-                        doc["value"] = numVal;
-                    } else if (strcmp(cmd.payload, "true") == 0) {
-                        doc["value"] = true;
-                    } else if (strcmp(cmd.payload, "false") == 0) {
-                        doc["value"] = false;
-                    } else {
-                        // Treat as string
-                        doc["value"] = cmd.payload;
-                    }
-                    PSTOR_LOG_D("Wrapped plain value: %s", cmd.payload);
-                }
+void PersistentStorage::executeCommand(const ParameterCommand& cmd, bool paced) {
+    RegistryLock::ReadGuard guard(registryLock_);
+    // Identical commands arriving from now on need a new queue slot
+    if (cmd.type != ParameterCommand::LIST_PAGE) {
+        pendingCommands_.fetch_and(~(1UL << cmd.type));
+    }
+    
+    // Minimal logging to save stack space
+    PSTOR_LOG_D( "Cmd type: %d", cmd.type);
+
+    // Note: Removed esp_task_wdt_reset() - caller task may not be registered
+    // with ESP-IDF task watchdog, causing crash. Caller should handle WDT if needed.
+    
+    switch (cmd.type) {
+        case ParameterCommand::SET: {
+            JsonDocument doc;  // ArduinoJson v7
+            DeserializationError error = deserializeJson(doc, cmd.payload);
 
-                Result res = setJson(cmd.paramName, doc);
-                if (res == Result::SUCCESS) {
-                    PSTOR_LOG_I("Set %s: %s", cmd.paramName, resultToString(res));
+            if (!error && doc.is<JsonArray>()) {
+                // Plain array for an array parameter
+                JsonDocument wrapped;
+                wrapped["value"] = doc.as<JsonArray>();
+                doc = wrapped;
+            } else if (!error && doc.is<int64_t>()) {
+                // Plain integer: kept exact, a double would round int64 values
+                int64_t intVal = doc.as<int64_t>();
+                doc.clear();
+                doc["value"] = intVal;
+            } else if (error || doc["value"].isNull()) {
+                // If JSON parsing failed or no "value" key, wrap plain value
+                doc.clear();
+                // Try to detect type and set appropriately
+                char* endptr;
+                double numVal = strtod(cmd.payload, &endptr);
+                if (*endptr == '\0' && endptr != cmd.payload) {
+                    // It's a number
+                    doc["value"] = numVal;
+                } else if (strcmp(cmd.payload, "true") == 0) {
+                    doc["value"] = true;
+                } else if (strcmp(cmd.payload, "false") == 0) {
+                    doc["value"] = false;
                 } else {
-                    PSTOR_LOG_E("Set %s: %s", cmd.paramName, resultToString(res));
+                    // Treat as string
+                    doc["value"] = cmd.payload;
                 }
-                break;
+                PSTOR_LOG_D("Wrapped plain value: %s", cmd.payload);
             }
 
-            case ParameterCommand::GET: {
-                // Check if this is a category/group query (no slash = group name)
-                std::string paramName(cmd.paramName);
-                if (paramName.find('/') == std::string::npos) {
-                    // No slash - might be a group name like "heating", "wheater", "pid", "sensor", "system"
-                    if (paramName == "heating" || paramName == "wheater" ||
-                        paramName == "pid" || paramName == "sensor" || paramName == "system") {
-                        PSTOR_LOG_I("GET group: %s", paramName.c_str());
-                        publishGroupedCategory(paramName);
-                    } else {
-                        // Unknown group, try as exact parameter name
-                        publishUpdate(paramName);
-                    }
+            // set/<array>/<index> updates a single element
+            size_t index = 0;
+            ParameterInfo* array = findParameter(cmd.paramName) ? nullptr : findElement(cmd.paramName, index);
+            Result res = array ? setElementJson(array->name, index, doc) : setJson(cmd.paramName, doc);
+            if (res == Result::SUCCESS) {
+                PSTOR_LOG_I("Set %s: %s", cmd.paramName, resultToString(res));
+            } else {
+                PSTOR_LOG_E("Set %s: %s", cmd.paramName, resultToString(res));
+            }
+            break;
+        }
+
+        case ParameterCommand::GET: {
+            // Check if this is a category/group query (no slash = group name)
+            std::string paramName(cmd.paramName);
+            size_t index = 0;
+            ParameterInfo* array = nullptr;
+            if (paramName.find('/') == std::string::npos &&
+                (paramName == "heating" || paramName == "wheater" ||
+                 paramName == "pid" || paramName == "sensor" || paramName == "system")) {
+                PSTOR_LOG_I("GET group: %s", paramName.c_str());
+                publishGroupedCategory(paramName);
+            } else if (ParameterInfo* param = findParameter(paramName)) {
+                // Exact parameter name like "heating/targetTemp"; arrays and blobs may ask for a slice
+                if (param->type == ParameterInfo::TYPE_BLOB) {
+                    publishBlob(*param, cmd.offset, cmd.limit ? cmd.limit : SIZE_MAX);
                 } else {
-                    // Has slash - exact parameter name like "heating/targetTemp"
-                    publishUpdate(paramName);
+                    publishParameter(*param, cmd.offset, cmd.limit ? cmd.limit : SIZE_MAX);
                 }
-                break;
+            } else if ((array = findElement(paramName, index)) != nullptr) {
+                // One element: "heating/curve/3"
+                publishParameter(*array, index, 1);
+            } else {
+                // Struct field: "pid/spaceHeating.kp"
+                publishUpdate(paramName);
             }
+            break;
+        }
 
-            case ParameterCommand::GET_ALL:
-                publishAllGrouped();
-                break;
+        case ParameterCommand::GET_ALL:
+            publishAllGrouped(paced ? GROUP_PUBLISH_DELAY_MS : 0);
+            break;
 
-            case ParameterCommand::LIST: {
-                // Use JSON doc (ArduinoJson v7)
-                JsonDocument doc;
-                JsonArray array = doc.to<JsonArray>();
+        case ParameterCommand::LIST: {
+            // Use JSON doc (ArduinoJson v7)
+            JsonDocument doc;
+            JsonArray array = doc.to<JsonArray>();
 
-                for (const auto& name : listParameters()) {
-                    array.add(name);
-                }
-                
-                std::string listTopic = mqttPrefix_ + "/list/response";
-                char listBuffer[1024];
-                serializeJson(doc, listBuffer, sizeof(listBuffer));
-                if (mqttPublishCallback_) {
-                    mqttPublishCallback_(listTopic.c_str(), listBuffer, 0, false);
-                } else {
-                    (void)mqttManager_->publish(listTopic.c_str(), listBuffer, 0, false);
-                }
-                break;
+            for (const ParameterInfo* param : parameters_) {
+                array.add(param->name);
             }
             
-            case ParameterCommand::SAVE:
-                saveAll();
-                PSTOR_LOG_I( "Parameters saved to NVS");
-                break;
+            std::string listTopic = mqttPrefix_ + "/list/response";
+            publishJson(listTopic.c_str(), doc);
+            break;
         }
         
-        // Small delay between commands
-        vTaskDelay(pdMS_TO_TICKS(10));
+        case ParameterCommand::LIST_PAGE: {
+            JsonDocument doc;  // ArduinoJson v7
+            getAllJson(doc, cmd.paramName, cmd.payload, cmd.limit, cmd.withMeta);
+            
+            std::string listTopic = mqttPrefix_ + "/list/response";
+            publishJson(listTopic.c_str(), doc);
+            break;
+        }
+        
+        case ParameterCommand::SAVE:
+            saveAll();
+            PSTOR_LOG_I( "Parameters saved to NVS");
+            break;
+            
+        case ParameterCommand::STATS:
+            publishStats();
+            break;
+            
+        case ParameterCommand::BLOB_COMMIT: {
+            ParameterInfo* param = findParameter(cmd.paramName);
+            Result res = param ? commitBlob(*param, true) : Result::ERROR_NOT_FOUND;
+            if (res == Result::SUCCESS) {
+                PSTOR_LOG_I("Set %s: %s", cmd.paramName, resultToString(res));
+            } else {
+                PSTOR_LOG_E("Set %s: %s", cmd.paramName, resultToString(res));
+            }
+            break;
+        }
+    }
+}
+
+// Start the built-in service task
+bool PersistentStorage::startServiceTask(const StorageTaskConfig& config) {
+    if (serviceTask_) {
+        PSTOR_LOG_W( "Service task already running");
+        return true;
+    }
+    
+    if (!serviceExited_) {
+        serviceExited_ = xSemaphoreCreateBinary();
+        if (!serviceExited_) {
+            PSTOR_LOG_E( "Failed to create service task semaphore");
+            return false;
+        }
+    }
+    
+    serviceConfig_ = config;
+    // First collection after one interval, once registration has settled
+    nextGcMs_ = millis() + config.gcIntervalMs;
+    serviceRunning_ = true;
+    
+    BaseType_t created = xTaskCreatePinnedToCore(serviceTaskEntry, "pstor_svc",
+                                                 config.stackSize, this, config.priority,
+                                                 &serviceTask_, config.core);
+    if (created != pdPASS) {
+        PSTOR_LOG_E( "Failed to create service task");
+        serviceRunning_ = false;
+        serviceTask_ = nullptr;
+        return false;
+    }
+    
+    PSTOR_LOG_I( "Service task started (prio %d, core %d)", config.priority, config.core);
+    return true;
+}
+
+// Stop the built-in service task
+void PersistentStorage::stopServiceTask() {
+    if (!serviceTask_) {
+        return;
+    }
+    
+    serviceRunning_ = false;
+    wakeServiceTask();
+    
+    // The task signals once it has left its loop and deletes itself
+    if (xSemaphoreTake(serviceExited_, pdMS_TO_TICKS(5000)) != pdTRUE) {
+        PSTOR_LOG_E( "Service task did not stop, deleting it");
+        vTaskDelete(serviceTask_);
+    }
+    serviceTask_ = nullptr;
+    
+    PSTOR_LOG_I( "Service task stopped");
+}
+
+void PersistentStorage::serviceTaskEntry(void* arg) {
+    PersistentStorage* self = static_cast<PersistentStorage*>(arg);
+    self->serviceLoop();
+    
+    xSemaphoreGive(self->serviceExited_);
+    vTaskDelete(nullptr);
+}
+
+void PersistentStorage::serviceLoop() {
+    while (serviceRunning_) {
+        size_t remaining = processCommandQueue(serviceConfig_.budgetUs);
+        
+        uint32_t waitMs = msUntilDeferredFlush();
+        if (waitMs == 0) {
+            flushDeferred();
+            waitMs = msUntilDeferredFlush();
+        }
+        
+        // Counters past their flush interval
+        {
+            RegistryLock::ReadGuard guard(registryLock_);
+            uint32_t untilCounters;
+            if (initialized_) {
+                flushDueCounters(false, &untilCounters);
+                waitMs = std::min(waitMs, untilCounters);
+            }
+        }
+        
+        // Background orphan collection: a few keys per idle round until clean
+        if (serviceConfig_.gcIntervalMs > 0) {
+            if (remaining == 0 && !isPublishing_ && (int32_t)(millis() - nextGcMs_) >= 0) {
+                GcReport gc;
+                gcOrphans(&gc, serviceConfig_.gcBatch);
+                nextGcMs_ = millis() + (gc.pending > 0 ? 0 : serviceConfig_.gcIntervalMs);
+            }
+            int32_t untilGc = (int32_t)(nextGcMs_ - millis());
+            waitMs = std::min<uint32_t>(waitMs, untilGc > 0 ? untilGc : 0);
+        }
+        
+        // More work pending: give lower priority tasks a tick, then continue
+        if (remaining > 0 || isPublishing_) {
+            waitMs = 1;
+        }
+        
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(std::max<uint32_t>(waitMs, 1)));
+    }
+}
+
+void PersistentStorage::wakeServiceTask() {
+    TaskHandle_t task = serviceTask_;
+    if (task) {
+        xTaskNotifyGive(task);
+    }
+}
+
+// Time until pending deferred saves are due, idle timeout when none are pending
+uint32_t PersistentStorage::msUntilDeferredFlush() {
+    uint32_t waitMs = serviceConfig_.idleTimeoutMs;
+    
+    if (xSemaphoreTake(deferredMutex_, portMAX_DELAY) == pdTRUE) {
+        if (!deferredSaves_.empty()) {
+            int32_t remaining = (int32_t)(flushDeadlineMs_ - millis());
+            waitMs = remaining > 0 ? std::min<uint32_t>(remaining, waitMs) : 0;
+        }
+        xSemaphoreGive(deferredMutex_);
+    }
+    return waitMs;
+}
+
+// Mark a parameter for saving after the flush delay
+PersistentStorage::Result PersistentStorage::saveDeferred(const std::string& name) {
+    RegistryLock::ReadGuard guard(registryLock_);
+    if (!findParameter(name)) {
+        return Result::ERROR_NOT_FOUND;
+    }
+    
+    if (xSemaphoreTake(deferredMutex_, portMAX_DELAY) != pdTRUE) {
+        return Result::ERROR_NVS_FAIL;
+    }
+    
+    bool first = deferredSaves_.empty();
+    if (std::find(deferredSaves_.begin(), deferredSaves_.end(), name) == deferredSaves_.end()) {
+        deferredSaves_.push_back(name);
+    }
+    if (first) {
+        flushDeadlineMs_ = millis() + serviceConfig_.flushDelayMs;
+    }
+    xSemaphoreGive(deferredMutex_);
+    
+    // Let the service task re-arm its timeout for the new deadline
+    if (first) {
+        wakeServiceTask();
+    }
+    return Result::SUCCESS;
+}
+
+// Write all pending deferred saves now
+size_t PersistentStorage::flushDeferred() {
+    std::vector<std::string> pending;
+    if (xSemaphoreTake(deferredMutex_, portMAX_DELAY) != pdTRUE) {
+        return 0;
+    }
+    pending.swap(deferredSaves_);
+    xSemaphoreGive(deferredMutex_);
+    
+    size_t saved = 0;
+    if (saveMode_ == SaveMode::SNAPSHOT && !pending.empty()) {
+        // One image covers all pending parameters
+        RegistryLock::ReadGuard guard(registryLock_);
+        if (initialized_ && saveSnapshot() == Result::SUCCESS) {
+            saved = pending.size();
+        }
+    } else {
+        for (const auto& name : pending) {
+            if (save(name) == Result::SUCCESS) {
+                saved++;
+            }
+        }
+    }
+    
+    if (!pending.empty()) {
+        PSTOR_LOG_D( "Flushed %d/%d deferred saves", saved, pending.size());
     }
+    return saved;
+}
+
+// Registry RAM usage by field
+MemoryFootprint PersistentStorage::getMemoryFootprint() const {
+    RegistryLock::ReadGuard guard(registryLock_);
+    MemoryFootprint fp = {};
+    size_t count = parameters_.size();
+    
+    fp.parameters = count;
+    fp.names = names_.bytesAllocated() + count * sizeof(ParameterInfo::name);
+    fp.descriptions = count * sizeof(ParameterInfo::description);
+    fp.callbacks = count * (sizeof(ParameterInfo::onChange) + sizeof(ParameterInfo::validator));
+    fp.constraints = count * sizeof(ParameterInfo::constraints) + wideRanges_.size() * sizeof(WideRange);
+    fp.values = count * sizeof(ParameterInfo) - fp.descriptions - fp.callbacks
+              - count * sizeof(ParameterInfo::constraints) - count * sizeof(ParameterInfo::name);
+    
+    // Slots are allocated in deque chunks of 512 bytes (libstdc++, at least
+    // one slot, one chunk beyond the full ones) referenced from a chunk map.
+    // The slots in use are counted above; add the rest of the chunks, the
+    // map and the sorted index.
+    const size_t slotsPerChunk = sizeof(ParameterInfo) < 512 ? 512 / sizeof(ParameterInfo) : 1;
+    size_t chunks = slots_.size() / slotsPerChunk + 1;
+    fp.index = (chunks * slotsPerChunk - count) * sizeof(ParameterInfo)
+             + std::max<size_t>(8, chunks + 2) * sizeof(ParameterInfo*)
+             + parameters_.capacity() * sizeof(ParameterInfo*);
+    
+    fp.total = fp.names + fp.descriptions + fp.callbacks + fp.constraints + fp.values + fp.index;
+    return fp;
 }
 
 void PersistentStorage::getNvsStats(size_t& usedEntries, size_t& freeEntries, size_t& totalEntries) {
@@ -1329,4 +6123,102 @@ void PersistentStorage::getNvsStats(size_t& usedEntries, size_t& freeEntries, si
         totalEntries = 0;
         PSTOR_LOG_W("Failed to get NVS stats: %s", esp_err_to_name(err));
     }
-}
\ No newline at end of file
+}
+
+#ifndef PSTORAGE_DISABLE_STATS
+void PersistentStorage::statsAdd(uint32_t StorageStats::* field, uint32_t n) {
+    portENTER_CRITICAL(&statsMux_);
+    stats_.*field += n;
+    portEXIT_CRITICAL(&statsMux_);
+}
+
+void PersistentStorage::statsRecordLatency(StorageStats::Operation op, int64_t us) {
+    uint32_t sample = us > 0 ? (uint32_t)std::min<int64_t>(us, UINT32_MAX) : 0;
+    size_t bucket = LatencyHistogram::bucketFor(sample);
+    
+    portENTER_CRITICAL(&statsMux_);
+    LatencyHistogram& hist = stats_.latency[op];
+    hist.count++;
+    hist.totalUs += sample;
+    hist.buckets[bucket]++;
+    if (sample > hist.maxUs) {
+        hist.maxUs = sample;
+    }
+    portEXIT_CRITICAL(&statsMux_);
+}
+#endif
+
+StorageStats PersistentStorage::getStats() const {
+    StorageStats snapshot;
+#ifndef PSTORAGE_DISABLE_STATS
+    portENTER_CRITICAL(&statsMux_);
+    snapshot = stats_;
+    portEXIT_CRITICAL(&statsMux_);
+    snapshot.queueDepth = commandQueue_ ? uxQueueMessagesWaiting(commandQueue_) : 0;
+#else
+    memset(&snapshot, 0, sizeof(snapshot));
+#endif
+    return snapshot;
+}
+
+void PersistentStorage::resetStats() {
+#ifndef PSTORAGE_DISABLE_STATS
+    portENTER_CRITICAL(&statsMux_);
+    memset(&stats_, 0, sizeof(stats_));
+    portEXIT_CRITICAL(&statsMux_);
+#endif
+}
+
+void PersistentStorage::statsToJson(const StorageStats& stats, JsonDocument& doc) const {
+    doc.clear();
+    JsonObject root = doc.to<JsonObject>();
+    root["timestamp"] = millis();
+    
+    JsonObject ops = root["ops"].to<JsonObject>();
+    for (size_t op = 0; op < StorageStats::OP_COUNT; op++) {
+        const LatencyHistogram& hist = stats.latency[op];
+        JsonObject entry = ops[StorageStats::operationName((StorageStats::Operation)op)].to<JsonObject>();
+        entry["count"] = hist.count;
+        entry["avgUs"] = hist.count ? (uint32_t)(hist.totalUs / hist.count) : 0;
+        entry["maxUs"] = hist.maxUs;
+        JsonArray buckets = entry["hist"].to<JsonArray>();
+        for (size_t b = 0; b < LatencyHistogram::BUCKET_COUNT; b++) {
+            buckets.add(hist.buckets[b]);
+        }
+    }
+    
+    JsonObject nvs = root["nvs"].to<JsonObject>();
+    nvs["bytesWritten"] = stats.nvsBytesWritten;
+    nvs["commits"] = stats.nvsCommits;
+    
+    JsonObject queue = root["queue"].to<JsonObject>();
+    queue["depth"] = stats.queueDepth;
+    queue["highWater"] = stats.queueHighWater;
+    queue["dropped"] = stats.commandsDropped;
+    queue["coalesced"] = stats.commandsCoalesced;
+    
+    root["publishFailures"] = stats.publishFailures;
+    root["multipartMessages"] = stats.multipartMessages;
+    root["jsonTruncations"] = stats.jsonTruncations;
+    
+    JsonObject notify = root["notify"].to<JsonObject>();
+    notify["queued"] = stats.notificationsQueued;
+    notify["dropped"] = stats.notificationsDropped;
+}
+
+void PersistentStorage::publishStats() {
+    if (!mqttPublishCallback_ && (!mqttManager_ || !mqttManager_->isConnected())) {
+        PSTOR_LOG_D( "MQTT not available, skipping stats publish");
+        return;
+    }
+    
+    JsonDocument doc;  // ArduinoJson v7
+    statsToJson(getStats(), doc);
+    
+    char topicBuf[64];
+    snprintf(topicBuf, sizeof(topicBuf), "%s/status/stats", mqttPrefix_.c_str());
+    
+    if (!publishJson(topicBuf, doc)) {
+        PSTOR_LOG_W( "Failed to publish stats");
+    }
+}
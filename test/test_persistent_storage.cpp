@@ -8,7 +8,11 @@
 
 #include <unity.h>
 #include <PersistentStorage.h>
+#include <PersistentStorageSchema.h>
+#include <PersistentStorageMigration.h>
+#include <PersistentStorageStruct.h>
 #include <ArduinoJson.h>
+#include <Preferences.h>
 #include <string.h>
 
 // Test fixtures
@@ -333,6 +337,38 @@ void test_list_parameters() {
     TEST_ASSERT_TRUE(foundFloat);
 }
 
+void test_list_pagination() {
+    static int32_t values[10];
+    for (int i = 0; i < 10; i++) {
+        char name[32];
+        snprintf(name, sizeof(name), "%s/p%d", (i % 2) ? "odd" : "even", i);
+        storage->registerInt(name, &values[i], 0, 100);
+    }
+    
+    // Walk "odd/" two at a time
+    std::vector<std::string> page;
+    std::vector<std::string> seen;
+    std::string cursor;
+    int pages = 0;
+    do {
+        cursor = storage->listPage("odd/", cursor, 2, page);
+        TEST_ASSERT_TRUE(page.size() <= 2);
+        seen.insert(seen.end(), page.begin(), page.end());
+        pages++;
+    } while (!cursor.empty());
+    
+    TEST_ASSERT_EQUAL(3, pages);
+    TEST_ASSERT_EQUAL(5, seen.size());
+    TEST_ASSERT_EQUAL_STRING("odd/p1", seen.front().c_str());
+    
+    // JSON variant with metadata
+    JsonDocument doc;
+    storage->getAllJson(doc, "even/", "", 3, true);
+    TEST_ASSERT_EQUAL(3, doc["count"].as<int>());
+    TEST_ASSERT_EQUAL_STRING("int", doc["items"][0]["type"].as<const char*>());
+    TEST_ASSERT_EQUAL_STRING("even/p4", doc["next"].as<const char*>());
+}
+
 void test_hierarchical_names() {
     // Test hierarchical parameter organization
     bool heatingEnabled = false;
@@ -376,6 +412,987 @@ void test_invalid_operations() {
     TEST_ASSERT_NOT_EQUAL(PersistentStorage::Result::SUCCESS, result);
 }
 
+void test_runtime_stats() {
+    storage->resetStats();
+    storage->registerInt("stats/int", &testInt, -100, 100);
+    
+    testInt = 7;
+    TEST_ASSERT_EQUAL(PersistentStorage::Result::SUCCESS, storage->save("stats/int"));
+    TEST_ASSERT_EQUAL(PersistentStorage::Result::SUCCESS, storage->load("stats/int"));
+    
+    StorageStats stats = storage->getStats();
+#ifndef PSTORAGE_DISABLE_STATS
+    TEST_ASSERT_EQUAL(1, stats.latency[StorageStats::OP_SAVE].count);
+    TEST_ASSERT_EQUAL(1, stats.latency[StorageStats::OP_LOAD].count);
+    TEST_ASSERT_EQUAL(1, stats.nvsCommits);
+    TEST_ASSERT_EQUAL(sizeof(int32_t), stats.nvsBytesWritten);
+#else
+    TEST_ASSERT_EQUAL(0, stats.nvsCommits);
+#endif
+    
+    // Reset clears everything
+    storage->resetStats();
+    stats = storage->getStats();
+    TEST_ASSERT_EQUAL(0, stats.latency[StorageStats::OP_SAVE].count);
+    TEST_ASSERT_EQUAL(0, stats.nvsBytesWritten);
+}
+
+void test_value_access() {
+    storage->registerFloat("value/float", &testFloat, 0.0f, 10.0f);
+    storage->registerString("value/string", testString, sizeof(testString));
+    storage->registerBlob("value/blob", testBlob, sizeof(testBlob));
+    storage->setOnChange("value/float", testCallback);
+    
+    // Scalars: validated, stored and notified
+    float f = 2.5f;
+    TEST_ASSERT_EQUAL(PersistentStorage::Result::SUCCESS, storage->write("value/float", &f, sizeof(f)));
+    TEST_ASSERT_EQUAL_FLOAT(2.5f, testFloat);
+    TEST_ASSERT_EQUAL(1, callbackCount);
+    f = 20.0f;
+    TEST_ASSERT_EQUAL(PersistentStorage::Result::ERROR_VALIDATION_FAILED, storage->write("value/float", &f, sizeof(f)));
+    TEST_ASSERT_EQUAL(PersistentStorage::Result::ERROR_TYPE_MISMATCH, storage->write("value/float", &f, 2));
+    
+    // Strings: length without terminator, copies are terminated
+    TEST_ASSERT_EQUAL(PersistentStorage::Result::SUCCESS, storage->write("value/string", "hello", 5));
+    char buf[16];
+    size_t len = 0;
+    TEST_ASSERT_EQUAL(PersistentStorage::Result::SUCCESS, storage->readConsistent("value/string", buf, sizeof(buf), &len));
+    TEST_ASSERT_EQUAL_STRING("hello", buf);
+    TEST_ASSERT_EQUAL(5, len);
+    char small[4];
+    TEST_ASSERT_EQUAL(PersistentStorage::Result::ERROR_TOO_LARGE, storage->readConsistent("value/string", small, sizeof(small)));
+    TEST_ASSERT_EQUAL_STRING("hel", small);
+    
+    // Blobs: exact size only
+    uint8_t blob[sizeof(testBlob)];
+    memset(blob, 0x5A, sizeof(blob));
+    TEST_ASSERT_EQUAL(PersistentStorage::Result::SUCCESS, storage->write("value/blob", blob, sizeof(blob)));
+    TEST_ASSERT_EQUAL(PersistentStorage::Result::ERROR_TYPE_MISMATCH, storage->write("value/blob", blob, 4));
+    uint8_t copy[sizeof(testBlob)] = {0};
+    const ParameterInfo* info = storage->getInfo("value/blob");
+    TEST_ASSERT_EQUAL(sizeof(testBlob), PersistentStorage::readConsistent(*info, copy, sizeof(copy)));
+    TEST_ASSERT_EQUAL_UINT8_ARRAY(blob, copy, sizeof(copy));
+}
+
+void test_inline_delegates() {
+    // A capturing lambda is stored inline - no heap, two pointers per delegate
+    TEST_ASSERT_EQUAL(2 * sizeof(void*), sizeof(ParameterInfo::ChangeCallback));
+    TEST_ASSERT_EQUAL(2 * sizeof(void*), sizeof(ParameterInfo::Validator));
+    
+    static int32_t limit;
+    limit = 50;
+    int32_t* limitPtr = &limit;
+    storage->registerInt("delegate/int", &testInt, 0, 100);
+    storage->setValidator("delegate/int", [limitPtr](const void* value) {
+        return *(const int32_t*)value <= *limitPtr;
+    });
+    storage->setOnChange("delegate/int", testCallback);
+    
+    int32_t val = 60;
+    TEST_ASSERT_EQUAL(PersistentStorage::Result::ERROR_VALIDATION_FAILED, storage->write("delegate/int", &val, sizeof(val)));
+    val = 40;
+    TEST_ASSERT_EQUAL(PersistentStorage::Result::SUCCESS, storage->write("delegate/int", &val, sizeof(val)));
+    TEST_ASSERT_EQUAL(1, callbackCount);
+    
+    // Per-parameter saving against two std::function members
+    size_t saved = 500 * 2 * (sizeof(std::function<bool(const void*)>) - sizeof(ParameterInfo::Validator));
+    char msg[64];
+    snprintf(msg, sizeof(msg), "Callback RAM saved for 500 parameters: %u bytes", (unsigned)saved);
+    TEST_MESSAGE(msg);
+}
+
+void test_change_subscriptions() {
+    storage->registerInt("sub/a", &testInt, 0, 100);
+    storage->registerFloat("sub/b", &testFloat, 0.0f, 10.0f);
+    storage->registerBool("other/c", &testBool);
+    
+    static int groupCalls;
+    static size_t groupNames;
+    groupCalls = 0;
+    groupNames = 0;
+    uint32_t id = storage->subscribe("sub/*", [](const std::vector<std::string>& names) {
+        groupCalls++;
+        groupNames += names.size();
+    });
+    TEST_ASSERT_NOT_EQUAL(0, id);
+    
+    // Without dispatcher: delivered synchronously, non-matching names ignored
+    bool on = true;
+    storage->write("other/c", &on, sizeof(on));
+    TEST_ASSERT_EQUAL(0, groupCalls);
+    int32_t val = 5;
+    storage->write("sub/a", &val, sizeof(val));
+    TEST_ASSERT_EQUAL(1, groupCalls);
+    
+    // With dispatcher: one call for the whole batch
+    TEST_ASSERT_TRUE(storage->startDispatcher());
+    float f = 1.5f;
+    storage->beginChangeBatch();
+    storage->write("sub/a", &val, sizeof(val));
+    storage->write("sub/b", &f, sizeof(f));
+    storage->endChangeBatch();
+    storage->stopDispatcher();
+    TEST_ASSERT_EQUAL(2, groupCalls);
+    TEST_ASSERT_EQUAL(3, groupNames);
+    
+    TEST_ASSERT_TRUE(storage->unsubscribe(id));
+    TEST_ASSERT_FALSE(storage->unsubscribe(id));
+}
+
+void test_memory_footprint() {
+    MemoryFootprint empty = storage->getMemoryFootprint();
+    TEST_ASSERT_EQUAL(0, empty.parameters);
+    
+    storage->registerInt("mem/a", &testInt, 0, 10, "First");
+    storage->registerFloat("mem/b", &testFloat, 0.0f, 1.0f, "Second");
+    storage->registerInt("mem/a", &testInt, 0, 20, "Replaced");
+    
+    MemoryFootprint fp = storage->getMemoryFootprint();
+    TEST_ASSERT_EQUAL(2, fp.parameters);
+    // Per-field shares add up to the entries themselves (name pointers included)
+    TEST_ASSERT_EQUAL(2 * sizeof(ParameterInfo),
+                      2 * sizeof(const char*) + fp.descriptions + fp.callbacks + fp.constraints + fp.values);
+    TEST_ASSERT_TRUE(fp.names > empty.names);
+    TEST_ASSERT_EQUAL(fp.names + fp.descriptions + fp.callbacks + fp.constraints + fp.values + fp.index,
+                      fp.total);
+    
+    // Re-registration keeps the interned name and replaces the rest
+    const ParameterInfo* info = storage->getInfo("mem/a");
+    TEST_ASSERT_EQUAL_STRING("mem/a", info->name);
+    TEST_ASSERT_EQUAL(20, info->constraints.intRange.max);
+#ifndef PSTORAGE_NO_DESCRIPTIONS
+    TEST_ASSERT_EQUAL_STRING("Replaced", info->description);
+#else
+    TEST_ASSERT_NULL(info->description);
+#endif
+}
+
+// Compile-time schema: struct, ids and table generated from one list
+#define TEST_SCHEMA(X) \
+    X(FLOAT,  target,  "schema/target",  21.5f,  5, 30, PERSISTENT, "Target temperature") \
+    X(INT,    mode,    "schema/mode",    1,      0, 3,  RUNTIME,    "Operating mode") \
+    X(STRING, label,   "schema/a_long_parameter_label", "hall", 0, 15, PERSISTENT, "Label") \
+    X(BOOL,   running, "schema/running", false,  0, 1,  STATUS,     "Burner running")
+PSTORAGE_SCHEMA(TestSettings, TEST_SCHEMA);
+
+void test_compile_time_schema() {
+    TestSettings settings;
+    TEST_ASSERT_EQUAL_FLOAT(21.5f, settings.target);
+    TEST_ASSERT_EQUAL_STRING("hall", settings.label);
+    TEST_ASSERT_EQUAL(4, TestSettings::Param::COUNT);
+    TEST_ASSERT_EQUAL_STRING("schema/mode", schemaName<TestSettings>(TestSettings::Param::mode));
+    
+    TEST_ASSERT_EQUAL(PersistentStorage::Result::SUCCESS, registerSchema(*storage, settings));
+    
+    // Names point at the table in flash instead of the name arena
+    const ParameterInfo* info = storage->getInfo("schema/target");
+    TEST_ASSERT_NOT_NULL(info);
+    TEST_ASSERT_EQUAL_PTR(schemaName<TestSettings>(TestSettings::Param::target), info->name);
+    TEST_ASSERT_EQUAL_PTR(&settings.target, info->dataPtr);
+    TEST_ASSERT_EQUAL_FLOAT(30.0f, info->constraints.floatRange.max);
+    
+    // Classes map to access and persistence
+    info = storage->getInfo("schema/mode");
+    TEST_ASSERT_EQUAL(ParameterInfo::ACCESS_READ_WRITE, info->access);
+    TEST_ASSERT_EQUAL(ParameterInfo::PERSIST_NONE, info->persistence);
+    info = storage->getInfo("schema/running");
+    TEST_ASSERT_EQUAL(ParameterInfo::ACCESS_READ_ONLY, info->access);
+    TEST_ASSERT_EQUAL(ParameterInfo::PERSIST_NONE, info->persistence);
+    info = storage->getInfo("schema/a_long_parameter_label");
+    TEST_ASSERT_EQUAL(sizeof(settings.label), info->constraints.stringMax.maxLen);
+    
+    // Only persistent fields survive a reload
+    settings.target = 25.0f;
+    settings.mode = 3;
+    TEST_ASSERT_EQUAL(PersistentStorage::Result::SUCCESS, storage->saveAll());
+    settings.target = 0.0f;
+    settings.mode = 1;
+    storage->loadAll();
+    TEST_ASSERT_EQUAL_FLOAT(25.0f, settings.target);
+    TEST_ASSERT_EQUAL(1, settings.mode);
+}
+
+// Bulk registration defers index insertion and NVS loads to endRegistration()
+void test_bulk_registration() {
+    static int32_t values[3] = {0, 0, 0};
+    storage->registerInt("bulk/b", &values[1], 0, 100);
+    values[1] = 42;
+    TEST_ASSERT_EQUAL(PersistentStorage::Result::SUCCESS, storage->save("bulk/b"));
+    values[1] = 0;
+    
+    storage->beginRegistration();
+    storage->registerInt("bulk/c", &values[2], 0, 100);
+    storage->registerInt("bulk/b", &values[1], 0, 100);
+    storage->registerInt("bulk/a", &values[0], 0, 100);
+    
+    // Visible by name, but not listed or loaded yet
+    TEST_ASSERT_NOT_NULL(storage->getInfo("bulk/a"));
+    TEST_ASSERT_EQUAL(PersistentStorage::Result::SUCCESS,
+                      storage->setOnChange("bulk/a", [](const std::string&, const void*) {}));
+    TEST_ASSERT_EQUAL(1, storage->listByPrefix("bulk/").size());
+    TEST_ASSERT_EQUAL(0, values[1]);
+    
+    TEST_ASSERT_EQUAL(PersistentStorage::Result::SUCCESS, storage->endRegistration());
+    TEST_ASSERT_EQUAL(42, values[1]);
+    
+    std::vector<std::string> names = storage->listByPrefix("bulk/");
+    TEST_ASSERT_EQUAL(3, names.size());
+    TEST_ASSERT_EQUAL_STRING("bulk/a", names[0].c_str());
+    TEST_ASSERT_EQUAL_STRING("bulk/c", names[2].c_str());
+}
+
+// loadAll() strategies: one pass over the namespace vs. one lookup per key
+static int32_t benchValues[1000];
+
+void test_load_strategies() {
+    const size_t sizes[] = {100, 500, 1000};
+    size_t usedEntries, freeEntries, totalEntries;
+    storage->getNvsStats(usedEntries, freeEntries, totalEntries);
+    
+    for (size_t n : sizes) {
+        char msg[96];
+        // Half of the parameters are stored, as after an update that added new ones
+        if (n / 2 >= freeEntries) {
+            snprintf(msg, sizeof(msg), "%u keys: skipped, only %u free NVS entries",
+                     (unsigned)n, (unsigned)freeEntries);
+            TEST_MESSAGE(msg);
+            continue;
+        }
+        
+        PersistentStorage bench("test_bench", TEST_MQTT_PREFIX);
+        bench.eraseNamespace();
+        TEST_ASSERT_TRUE(bench.begin());
+        char name[32];
+        bench.beginRegistration();
+        for (size_t i = 0; i < n; i++) {
+            snprintf(name, sizeof(name), "bench/value_%04u", (unsigned)i);
+            benchValues[i] = i;
+            bench.registerInt(name, &benchValues[i], -1, 1000);
+        }
+        bench.endRegistration();
+        for (size_t i = 0; i < n; i += 2) {
+            snprintf(name, sizeof(name), "bench/value_%04u", (unsigned)i);
+            TEST_ASSERT_EQUAL(PersistentStorage::Result::SUCCESS, bench.save(name));
+        }
+        
+        int64_t durationUs[2];
+        const PersistentStorage::LoadStrategy strategies[] = {
+            PersistentStorage::LoadStrategy::PER_KEY, PersistentStorage::LoadStrategy::ITERATE
+        };
+        for (int s = 0; s < 2; s++) {
+            for (size_t i = 0; i < n; i++) {
+                benchValues[i] = -1;
+            }
+            bench.setLoadStrategy(strategies[s]);
+            LoadReport report;
+            TEST_ASSERT_EQUAL(PersistentStorage::Result::SUCCESS, bench.loadAll(false, &report));
+            durationUs[s] = report.durationUs;
+            for (size_t i = 0; i < n; i++) {
+                TEST_ASSERT_EQUAL((i % 2) ? -1 : (int32_t)i, benchValues[i]);
+            }
+            if (strategies[s] == PersistentStorage::LoadStrategy::ITERATE) {
+                TEST_ASSERT_EQUAL(n / 2, report.loaded);
+                TEST_ASSERT_EQUAL(n / 2, report.missing.size());
+                TEST_ASSERT_EQUAL(0, report.unregistered.size());
+            }
+        }
+        
+        snprintf(msg, sizeof(msg), "%u keys: per-key %lld us, iterate %lld us",
+                 (unsigned)n, (long long)durationUs[0], (long long)durationUs[1]);
+        TEST_MESSAGE(msg);
+        bench.eraseNamespace();
+    }
+}
+
+// gcOrphans() erases keys of parameters that are no longer registered
+void test_gc_orphans() {
+    {
+        // A previous firmware with a parameter that has since been removed
+        static int32_t removed = 7;
+        PersistentStorage old(TEST_NAMESPACE, TEST_MQTT_PREFIX);
+        TEST_ASSERT_TRUE(old.begin());
+        old.registerInt("gc/a_parameter_that_was_removed", &removed, 0, 10);
+        TEST_ASSERT_EQUAL(PersistentStorage::Result::SUCCESS, old.saveAll());
+    }
+    
+    storage->registerInt("gc/keep", &testInt, 0, 100);
+    testInt = 55;
+    TEST_ASSERT_EQUAL(PersistentStorage::Result::SUCCESS, storage->save("gc/keep"));
+    
+    // Bounded rounds until nothing is pending
+    GcReport report;
+    size_t removed = 0;
+    do {
+        TEST_ASSERT_EQUAL(PersistentStorage::Result::SUCCESS, storage->gcOrphans(&report, 1));
+        TEST_ASSERT_TRUE(report.removed <= 1);
+        removed += report.removed;
+    } while (report.pending > 0);
+    TEST_ASSERT_TRUE(removed >= 1);
+    
+    TEST_ASSERT_EQUAL(PersistentStorage::Result::SUCCESS, storage->gcOrphans(&report));
+    TEST_ASSERT_EQUAL(0, report.removed);
+    TEST_ASSERT_EQUAL(1, report.scanned);
+    
+    testInt = 0;
+    storage->load("gc/keep");
+    TEST_ASSERT_EQUAL(55, testInt);
+    
+    // Refused while registration is incomplete
+    storage->beginRegistration();
+    TEST_ASSERT_EQUAL(PersistentStorage::Result::ERROR_ACCESS_DENIED, storage->gcOrphans());
+    storage->endRegistration();
+}
+
+// Migrations run once at begin() and are skipped once the version is stored
+static size_t widenBlob(const uint8_t* data, size_t oldLength, uint8_t* out, size_t capacity) {
+    if (oldLength != 4 || capacity < 8) {
+        return 0;
+    }
+    memcpy(out, data, 4);
+    memset(out + 4, 0, 4);
+    return 8;
+}
+
+void test_type_mismatch_on_load() {
+    storage->eraseNamespace();
+    {
+        static int32_t level = 12;
+        static char mode[16] = "auto";
+        static uint8_t table[8] = {1, 2, 3, 4, 5, 6, 7, 8};
+        static char offset[96];
+        memset(offset, '0', 80);                // 80 characters, still the number 42
+        strcpy(offset + 78, "42");
+        PersistentStorage before(TEST_NAMESPACE, TEST_MQTT_PREFIX);
+        TEST_ASSERT_TRUE(before.begin());
+        before.registerInt("tm/level", &level, 0, 100);
+        before.registerString("tm/mode", mode, sizeof(mode));
+        before.registerBlob("tm/table", table, sizeof(table));
+        before.registerString("tm/offset", offset, sizeof(offset));
+        TEST_ASSERT_EQUAL(PersistentStorage::Result::SUCCESS, before.saveAll());
+    }
+    
+    {
+        // Types changed without a migration
+        float level = 1.0f;
+        int32_t mode = 5;
+        uint8_t table[4] = {9, 9, 9, 9};
+        int32_t offset = 0;
+        PersistentStorage after(TEST_NAMESPACE, TEST_MQTT_PREFIX);
+        after.registerFloat("tm/level", &level, 0.0f, 100.0f);
+        after.registerInt("tm/mode", &mode, 0, 100);
+        after.registerBlob("tm/table", table, sizeof(table));
+        after.registerInt("tm/offset", &offset, 0, 100);
+        TEST_ASSERT_TRUE(after.begin());
+        
+        // Representable values are converted, the rest keep their defaults
+        TEST_ASSERT_EQUAL_FLOAT(12.0f, level);
+        TEST_ASSERT_EQUAL(5, mode);
+        TEST_ASSERT_EQUAL(9, table[0]);
+        TEST_ASSERT_EQUAL(42, offset);
+        
+        // Unusable items are left in place and reported again on each load
+        LoadReport report;
+        after.loadAll(false, &report);
+        TEST_ASSERT_EQUAL(2, report.mismatched.size());
+        TEST_ASSERT_EQUAL(0, report.converted);
+        TEST_ASSERT_EQUAL_FLOAT(12.0f, level);
+        
+        char storedMode[16] = "";
+        Preferences prefs;
+        TEST_ASSERT_TRUE(prefs.begin(TEST_NAMESPACE, true));
+        prefs.getString("tm/mode", storedMode, sizeof(storedMode));
+        prefs.end();
+        TEST_ASSERT_EQUAL_STRING("auto", storedMode);
+    }
+    storage->eraseNamespace();
+}
+
+void test_snapshot_power_loss() {
+    storage->eraseNamespace();
+    {
+        float gains[3];
+        PersistentStorage snap(TEST_NAMESPACE, TEST_MQTT_PREFIX);
+        snap.setSaveMode(PersistentStorage::SaveMode::SNAPSHOT);
+        snap.registerFloat("pid/kp", &gains[0], 0.0f, 100.0f);
+        snap.registerFloat("pid/ki", &gains[1], 0.0f, 100.0f);
+        snap.registerFloat("pid/kd", &gains[2], 0.0f, 100.0f);
+        TEST_ASSERT_TRUE(snap.begin());
+        
+        gains[0] = 1.0f; gains[1] = 2.0f; gains[2] = 3.0f;
+        TEST_ASSERT_EQUAL(PersistentStorage::Result::SUCCESS, snap.saveAll());
+        gains[0] = 10.0f; gains[1] = 20.0f; gains[2] = 30.0f;
+        TEST_ASSERT_EQUAL(PersistentStorage::Result::SUCCESS, snap.saveAll());
+        
+        // Keep the newest image, then cut its write short at every byte offset
+        // (the active slot pointer already flipped: the worst case)
+        Preferences prefs;
+        TEST_ASSERT_TRUE(prefs.begin(TEST_NAMESPACE, false));
+        const char* slot = prefs.getUChar(".snap", 0) ? ".snapB" : ".snapA";
+        size_t length = prefs.getBytesLength(slot);
+        std::vector<uint8_t> image(length);
+        TEST_ASSERT_EQUAL(length, prefs.getBytes(slot, image.data(), length));
+        
+        for (size_t cut = 0; cut < length; cut++) {
+            if (cut == 0) {
+                prefs.remove(slot);
+            } else {
+                prefs.putBytes(slot, image.data(), cut);
+            }
+            gains[0] = gains[1] = gains[2] = 0.0f;
+            snap.loadAll();
+            // All three values come from the previous image, never a mix
+            TEST_ASSERT_EQUAL_FLOAT(1.0f, gains[0]);
+            TEST_ASSERT_EQUAL_FLOAT(2.0f, gains[1]);
+            TEST_ASSERT_EQUAL_FLOAT(3.0f, gains[2]);
+        }
+        
+        // The complete image is used again
+        prefs.putBytes(slot, image.data(), length);
+        prefs.end();
+        snap.loadAll();
+        TEST_ASSERT_EQUAL_FLOAT(10.0f, gains[0]);
+        TEST_ASSERT_EQUAL_FLOAT(30.0f, gains[2]);
+    }
+    storage->eraseNamespace();
+}
+
+void test_snapshot_late_registration() {
+    storage->eraseNamespace();
+    {
+        float gains[2] = {1.0f, 2.0f};
+        PersistentStorage snap(TEST_NAMESPACE, TEST_MQTT_PREFIX);
+        snap.setSaveMode(PersistentStorage::SaveMode::SNAPSHOT);
+        snap.registerFloat("pid/kp", &gains[0], 0.0f, 100.0f);
+        snap.registerFloat("pid/ki", &gains[1], 0.0f, 100.0f);
+        TEST_ASSERT_TRUE(snap.begin());
+        TEST_ASSERT_EQUAL(PersistentStorage::Result::SUCCESS, snap.saveAll());
+    }
+    {
+        // Stale per-key item from before the switch to snapshot mode
+        Preferences prefs;
+        TEST_ASSERT_TRUE(prefs.begin(TEST_NAMESPACE, false));
+        prefs.putFloat("pid/ki", 50.0f);
+        prefs.end();
+    }
+    {
+        // Registered after begin(), outside a batch, then another value is saved
+        float gains[2] = {0.0f, 0.0f};
+        PersistentStorage snap(TEST_NAMESPACE, TEST_MQTT_PREFIX);
+        snap.setSaveMode(PersistentStorage::SaveMode::SNAPSHOT);
+        snap.registerFloat("pid/kp", &gains[0], 0.0f, 100.0f);
+        TEST_ASSERT_TRUE(snap.begin());
+        snap.registerFloat("pid/ki", &gains[1], 0.0f, 100.0f);
+        TEST_ASSERT_EQUAL_FLOAT(2.0f, gains[1]);
+        
+        gains[0] = 5.0f;
+        TEST_ASSERT_EQUAL(PersistentStorage::Result::SUCCESS, snap.save("pid/kp"));
+    }
+    {
+        float gains[2] = {0.0f, 0.0f};
+        PersistentStorage snap(TEST_NAMESPACE, TEST_MQTT_PREFIX);
+        snap.setSaveMode(PersistentStorage::SaveMode::SNAPSHOT);
+        snap.registerFloat("pid/kp", &gains[0], 0.0f, 100.0f);
+        snap.registerFloat("pid/ki", &gains[1], 0.0f, 100.0f);
+        TEST_ASSERT_TRUE(snap.begin());
+        TEST_ASSERT_EQUAL_FLOAT(5.0f, gains[0]);
+        TEST_ASSERT_EQUAL_FLOAT(2.0f, gains[1]);
+    }
+    storage->eraseNamespace();
+}
+
+void test_counter_batched_flush() {
+    storage->eraseNamespace();
+    uint64_t starts = 0;
+    {
+        PersistentStorage counting(TEST_NAMESPACE, TEST_MQTT_PREFIX);
+        CounterConfig config;
+        config.flushThreshold = 10;
+        config.flushIntervalMs = 3600000;
+        TEST_ASSERT_EQUAL(PersistentStorage::Result::SUCCESS,
+                          counting.registerCounter("cnt/starts", &starts, config));
+        TEST_ASSERT_TRUE(counting.begin());
+        
+        for (int i = 0; i < 25; i++) {
+            TEST_ASSERT_EQUAL(PersistentStorage::Result::SUCCESS, counting.add("cnt/starts"));
+        }
+        TEST_ASSERT_EQUAL(25, starts);
+        TEST_ASSERT_EQUAL(0, counting.flushCounters());   // Interval not reached
+        
+        // Counters never go backwards
+        JsonDocument doc;
+        doc["value"] = 3;
+        TEST_ASSERT_EQUAL(PersistentStorage::Result::ERROR_VALIDATION_FAILED,
+                          counting.setJson("cnt/starts", doc));
+    }
+    
+    // The last threshold flush was at 20; end() saved the rest
+    {
+        uint64_t restored = 0;
+        PersistentStorage reader(TEST_NAMESPACE, TEST_MQTT_PREFIX);
+        reader.registerCounter("cnt/starts", &restored);
+        TEST_ASSERT_TRUE(reader.begin());
+        TEST_ASSERT_EQUAL(25, restored);
+    }
+    storage->eraseNamespace();
+}
+
+void test_array_element_updates() {
+    storage->eraseNamespace();
+    int32_t curve[40];
+    {
+        for (int i = 0; i < 40; i++) {
+            curve[i] = i;
+        }
+        PersistentStorage writer(TEST_NAMESPACE, TEST_MQTT_PREFIX);
+        TEST_ASSERT_EQUAL(PersistentStorage::Result::SUCCESS,
+                          writer.registerIntArray("arr/curve", curve, 40, -50, 100));
+        TEST_ASSERT_TRUE(writer.begin());
+        TEST_ASSERT_EQUAL(PersistentStorage::Result::SUCCESS, writer.saveAll());
+        
+        JsonDocument doc;
+        doc["value"] = 77;
+        TEST_ASSERT_EQUAL(PersistentStorage::Result::SUCCESS, writer.setElementJson("arr/curve", 20, doc));
+        TEST_ASSERT_EQUAL(PersistentStorage::Result::ERROR_NOT_FOUND, writer.setElementJson("arr/curve", 40, doc));
+        doc["value"] = 200;
+        TEST_ASSERT_EQUAL(PersistentStorage::Result::ERROR_VALIDATION_FAILED,
+                          writer.setElementJson("arr/curve", 21, doc));
+        TEST_ASSERT_EQUAL(21, curve[21]);
+        
+        doc.clear();
+        TEST_ASSERT_EQUAL(PersistentStorage::Result::SUCCESS, writer.getJson("arr/curve", doc, 19, 3));
+        TEST_ASSERT_EQUAL(40, doc["count"].as<int>());
+        TEST_ASSERT_EQUAL(19, doc["offset"].as<int>());
+        TEST_ASSERT_EQUAL(3, doc["value"].size());
+        TEST_ASSERT_EQUAL(77, doc["value"][1].as<int>());
+    }
+    
+    // The element and the untouched chunks survive a restart
+    {
+        int32_t restored[40] = {0};
+        PersistentStorage reader(TEST_NAMESPACE, TEST_MQTT_PREFIX);
+        reader.registerIntArray("arr/curve", restored, 40, -50, 100);
+        TEST_ASSERT_TRUE(reader.begin());
+        TEST_ASSERT_EQUAL(77, restored[20]);
+        TEST_ASSERT_EQUAL(39, restored[39]);
+        TEST_ASSERT_EQUAL(0, restored[0]);
+    }
+    storage->eraseNamespace();
+}
+
+struct TestPidV1 { float kp; float ki; int32_t windup; };
+#define TEST_PID_V1(X) X(kp, 0, 100) X(ki, 0, 10) X(windup, 0, 1000)
+PSTORAGE_STRUCT_LAYOUT(TestPidV1, 1, TEST_PID_V1);
+
+// Version 2 reorders the fields, drops windup and adds enabled
+struct TestPidV2 { bool enabled; float ki; float kp; };
+#define TEST_PID_V2(X) X(enabled, 0, 1) X(ki, 0, 10) X(kp, 0, 100)
+PSTORAGE_STRUCT_LAYOUT(TestPidV2, 2, TEST_PID_V2);
+
+void test_struct_field_access() {
+    storage->eraseNamespace();
+    {
+        TestPidV1 pid = {1.5f, 0.2f, 300};
+        PersistentStorage writer(TEST_NAMESPACE, TEST_MQTT_PREFIX);
+        TEST_ASSERT_EQUAL(PersistentStorage::Result::SUCCESS, registerStruct(writer, "pid/space", pid));
+        TEST_ASSERT_TRUE(writer.begin());
+        
+        JsonDocument doc;
+        doc["value"] = 12.5f;
+        TEST_ASSERT_EQUAL(PersistentStorage::Result::SUCCESS, writer.setJson("pid/space.kp", doc));
+        TEST_ASSERT_EQUAL_FLOAT(12.5f, pid.kp);
+        doc["value"] = 50;
+        TEST_ASSERT_EQUAL(PersistentStorage::Result::ERROR_VALIDATION_FAILED, writer.setJson("pid/space.ki", doc));
+        TEST_ASSERT_EQUAL(PersistentStorage::Result::ERROR_NOT_FOUND, writer.setJson("pid/space.kd", doc));
+        
+        doc.clear();
+        TEST_ASSERT_EQUAL(PersistentStorage::Result::SUCCESS, writer.getJson("pid/space.ki", doc));
+        TEST_ASSERT_EQUAL_STRING("float", doc["type"].as<const char*>());
+        TEST_ASSERT_EQUAL_FLOAT(0.2f, doc["value"].as<float>());
+    }
+    
+    // Fields are matched by name across layout versions
+    {
+        TestPidV2 pid = {true, 0.0f, 0.0f};
+        PersistentStorage reader(TEST_NAMESPACE, TEST_MQTT_PREFIX);
+        registerStruct(reader, "pid/space", pid);
+        TEST_ASSERT_TRUE(reader.begin());
+        TEST_ASSERT_EQUAL_FLOAT(12.5f, pid.kp);
+        TEST_ASSERT_EQUAL_FLOAT(0.2f, pid.ki);
+        TEST_ASSERT_TRUE(pid.enabled);
+    }
+    storage->eraseNamespace();
+}
+
+void test_schema_migrations() {
+    storage->eraseNamespace();
+    {
+        // Version 1 firmware
+        static int32_t gain = 12;
+        static bool legacy = true;
+        static uint8_t layout[4] = {1, 2, 3, 4};
+        PersistentStorage v1(TEST_NAMESPACE, TEST_MQTT_PREFIX);
+        TEST_ASSERT_TRUE(v1.begin());
+        v1.registerInt("mig/gain", &gain, 0, 100);
+        v1.registerBool("mig/legacy", &legacy);
+        v1.registerBlob("mig/layout", layout, sizeof(layout));
+        TEST_ASSERT_EQUAL(PersistentStorage::Result::SUCCESS, v1.saveAll());
+    }
+    
+    static const Migration steps[] = {
+        Migration::rename(2, "mig/legacy", "mig/enabled"),
+        Migration::retype(2, "mig/gain", ParameterInfo::TYPE_INT, ParameterInfo::TYPE_FLOAT),
+        Migration::upgradeBlob(3, "mig/layout", 8, widenBlob),
+    };
+    
+    for (int boot = 0; boot < 2; boot++) {
+        float gain = 0.0f;
+        bool enabled = false;
+        uint8_t layout[8] = {0};
+        PersistentStorage v3(TEST_NAMESPACE, TEST_MQTT_PREFIX);
+        v3.registerFloat("mig/gain", &gain, 0.0f, 100.0f);
+        v3.registerBool("mig/enabled", &enabled);
+        v3.registerBlob("mig/layout", layout, sizeof(layout));
+        v3.setSchema(3, steps, sizeof(steps) / sizeof(steps[0]));
+        TEST_ASSERT_TRUE(v3.begin());
+        
+        const MigrationReport& report = v3.getMigrationReport();
+        TEST_ASSERT_EQUAL(3, report.toVersion);
+        if (boot == 0) {
+            TEST_ASSERT_EQUAL(0, report.fromVersion);
+            TEST_ASSERT_EQUAL(3, report.applied);
+            TEST_ASSERT_EQUAL(0, report.failed);
+        } else {
+            // Later boots only read the stored version
+            TEST_ASSERT_EQUAL(3, report.fromVersion);
+            TEST_ASSERT_EQUAL(0, report.applied);
+        }
+        
+        TEST_ASSERT_EQUAL_FLOAT(12.0f, gain);
+        TEST_ASSERT_TRUE(enabled);
+        TEST_ASSERT_EQUAL(4, layout[3]);
+        TEST_ASSERT_EQUAL(0, layout[7]);
+    }
+    storage->eraseNamespace();
+}
+
+void test_migration_interrupted_retype() {
+    storage->eraseNamespace();
+    {
+        // Power cut during an int -> float retype, after the old item was erased
+        float converted = 12.0f;
+        Preferences prefs;
+        TEST_ASSERT_TRUE(prefs.begin(TEST_NAMESPACE, false));
+        prefs.putUInt(".schema", 1);
+        prefs.putString(".migkey", "mig/gain");
+        prefs.putBytes(".migval", &converted, sizeof(converted));
+        prefs.end();
+    }
+    
+    static const Migration steps[] = {
+        Migration::retype(2, "mig/gain", ParameterInfo::TYPE_INT, ParameterInfo::TYPE_FLOAT),
+    };
+    {
+        float gain = 0.0f;
+        PersistentStorage v2(TEST_NAMESPACE, TEST_MQTT_PREFIX);
+        v2.registerFloat("mig/gain", &gain, 0.0f, 100.0f);
+        v2.setSchema(2, steps, sizeof(steps) / sizeof(steps[0]));
+        TEST_ASSERT_TRUE(v2.begin());
+        
+        const MigrationReport& report = v2.getMigrationReport();
+        TEST_ASSERT_EQUAL(2, report.toVersion);
+        TEST_ASSERT_EQUAL(0, report.failed);
+        TEST_ASSERT_EQUAL_FLOAT(12.0f, gain);
+        
+        Preferences prefs;
+        TEST_ASSERT_TRUE(prefs.begin(TEST_NAMESPACE, true));
+        TEST_ASSERT_FALSE(prefs.isKey(".migkey"));
+        TEST_ASSERT_FALSE(prefs.isKey(".migval"));
+        prefs.end();
+    }
+    storage->eraseNamespace();
+}
+
+enum class TestMode : uint8_t { OFF, ECO, COMFORT };
+static const char* const TEST_MODE_NAMES[] = {"off", "eco", "comfort"};
+
+void test_wide_and_enum_types() {
+    storage->eraseNamespace();
+    {
+        // Written by an older firmware as string, int and float
+        char mode[16] = "comfort";
+        int32_t energy = 7;
+        float ratio = 2.5f;
+        PersistentStorage writer(TEST_NAMESPACE, TEST_MQTT_PREFIX);
+        writer.registerString("wide/mode", mode, sizeof(mode));
+        writer.registerInt("wide/energy", &energy, 0, 100);
+        writer.registerFloat("wide/ratio", &ratio, 0.0f, 10.0f);
+        TEST_ASSERT_TRUE(writer.begin());
+        TEST_ASSERT_EQUAL(PersistentStorage::Result::SUCCESS, writer.saveAll());
+    }
+    
+    for (int boot = 0; boot < 2; boot++) {
+        TestMode mode = TestMode::OFF;
+        int64_t energy = 0;
+        uint32_t since = 0;
+        double ratio = 0.0;
+        PersistentStorage reader(TEST_NAMESPACE, TEST_MQTT_PREFIX);
+        TEST_ASSERT_EQUAL(PersistentStorage::Result::SUCCESS,
+                          reader.registerEnum("wide/mode", &mode, TEST_MODE_NAMES));
+        reader.registerInt64("wide/energy", &energy, 0, INT64_MAX);
+        reader.registerUInt32("wide/since", &since, 0, UINT32_MAX);
+        reader.registerDouble("wide/ratio", &ratio, 0.0, 10.0);
+        TEST_ASSERT_TRUE(reader.begin());
+        
+        if (boot == 0) {
+            // The old values are converted to the new types
+            TEST_ASSERT_EQUAL(TestMode::COMFORT, mode);
+            TEST_ASSERT_EQUAL(7, energy);
+            TEST_ASSERT_TRUE(ratio == 2.5);
+            
+            JsonDocument doc;
+            doc["value"] = "eco";
+            TEST_ASSERT_EQUAL(PersistentStorage::Result::SUCCESS, reader.setJson("wide/mode", doc));
+            doc["value"] = "turbo";
+            TEST_ASSERT_EQUAL(PersistentStorage::Result::ERROR_VALIDATION_FAILED, reader.setJson("wide/mode", doc));
+            doc["value"] = 3;
+            TEST_ASSERT_EQUAL(PersistentStorage::Result::ERROR_VALIDATION_FAILED, reader.setJson("wide/mode", doc));
+            doc["value"] = (int64_t)9000000000123LL;
+            TEST_ASSERT_EQUAL(PersistentStorage::Result::SUCCESS, reader.setJson("wide/energy", doc));
+            doc["value"] = (int64_t)5000000000LL;
+            TEST_ASSERT_EQUAL(PersistentStorage::Result::ERROR_VALIDATION_FAILED, reader.setJson("wide/since", doc));
+            doc["value"] = 4000000000UL;
+            TEST_ASSERT_EQUAL(PersistentStorage::Result::SUCCESS, reader.setJson("wide/since", doc));
+            doc["value"] = 12.5;
+            TEST_ASSERT_EQUAL(PersistentStorage::Result::ERROR_VALIDATION_FAILED, reader.setJson("wide/ratio", doc));
+            
+            doc.clear();
+            TEST_ASSERT_EQUAL(PersistentStorage::Result::SUCCESS, reader.getJson("wide/mode", doc));
+            TEST_ASSERT_EQUAL_STRING("enum", doc["type"].as<const char*>());
+            TEST_ASSERT_EQUAL_STRING("eco", doc["value"].as<const char*>());
+            TEST_ASSERT_EQUAL(3, doc["options"].size());
+        } else {
+            TEST_ASSERT_EQUAL(TestMode::ECO, mode);
+            TEST_ASSERT_TRUE(energy == 9000000000123LL);
+            TEST_ASSERT_EQUAL_UINT32(4000000000UL, since);
+            TEST_ASSERT_TRUE(ratio == 2.5);
+        }
+    }
+    storage->eraseNamespace();
+}
+
+// Blobs staged in chunks and exchanged as base64
+void test_blob_base64_transfer() {
+    uint8_t blob[8] = {0, 1, 2, 3, 4, 5, 6, 7};
+    TEST_ASSERT_EQUAL(PersistentStorage::Result::SUCCESS, storage->registerBlob("blob/cal", blob, sizeof(blob)));
+    
+    // Not stored until the last chunk
+    const uint8_t head[4] = {0xAA, 0xAA, 0xAA, 0xAA};
+    const uint8_t tail[4] = {0xBB, 0xBB, 0xBB, 0xBB};
+    TEST_ASSERT_EQUAL(PersistentStorage::Result::SUCCESS, storage->writeBlob("blob/cal", 0, head, 4, false));
+    TEST_ASSERT_EQUAL(0, blob[0]);
+    TEST_ASSERT_EQUAL(PersistentStorage::Result::SUCCESS, storage->writeBlob("blob/cal", 4, tail, 4, false));
+    TEST_ASSERT_EQUAL(0xAA, blob[0]);
+    TEST_ASSERT_EQUAL(0xBB, blob[7]);
+    TEST_ASSERT_EQUAL(PersistentStorage::Result::ERROR_TOO_LARGE, storage->writeBlob("blob/cal", 6, tail, 4));
+    
+    uint8_t out[4] = {0};
+    size_t copied = 0;
+    TEST_ASSERT_EQUAL(PersistentStorage::Result::SUCCESS, storage->readBlob("blob/cal", 6, out, sizeof(out), &copied));
+    TEST_ASSERT_EQUAL(2, copied);
+    TEST_ASSERT_EQUAL(0xBB, out[0]);
+    
+    JsonDocument doc;
+    TEST_ASSERT_EQUAL(PersistentStorage::Result::SUCCESS, storage->getJson("blob/cal", doc, 3, 2));
+    TEST_ASSERT_EQUAL(3, doc["offset"].as<int>());
+    TEST_ASSERT_EQUAL_STRING("qrs=", doc["value"].as<const char*>());
+    
+    // setJson() takes the whole blob
+    doc.clear();
+    doc["value"] = "AAECAwQFBgc=";
+    TEST_ASSERT_EQUAL(PersistentStorage::Result::SUCCESS, storage->setJson("blob/cal", doc));
+    TEST_ASSERT_EQUAL(7, blob[7]);
+    doc["value"] = "AAEC";
+    TEST_ASSERT_EQUAL(PersistentStorage::Result::ERROR_VALIDATION_FAILED, storage->setJson("blob/cal", doc));
+    doc["value"] = "AAE$AwQFBgc=";
+    TEST_ASSERT_EQUAL(PersistentStorage::Result::ERROR_VALIDATION_FAILED, storage->setJson("blob/cal", doc));
+    TEST_ASSERT_EQUAL(1, blob[1]);
+}
+
+// Streamed blobs written and read through small windows
+void test_blob_stream() {
+    std::vector<uint8_t> table(3 * PersistentStorage::STREAM_CHUNK_SIZE + 100);
+    for (size_t i = 0; i < table.size(); i++) {
+        table[i] = (uint8_t)(i * 7);
+    }
+    
+    PersistentStorage::BlobWriter writer;
+    TEST_ASSERT_EQUAL(PersistentStorage::Result::SUCCESS,
+                      storage->openBlobWriter("stream/table", table.size(), writer));
+    PersistentStorage::BlobWriter second;
+    TEST_ASSERT_EQUAL(PersistentStorage::Result::ERROR_ACCESS_DENIED,
+                      storage->openBlobWriter("stream/table", 10, second));
+    for (size_t i = 0; i < table.size(); i += 100) {
+        size_t n = std::min<size_t>(100, table.size() - i);
+        TEST_ASSERT_EQUAL(PersistentStorage::Result::SUCCESS, writer.write(table.data() + i, n));
+    }
+    TEST_ASSERT_EQUAL(PersistentStorage::Result::ERROR_TOO_LARGE, writer.write(table.data(), 1));
+    TEST_ASSERT_EQUAL(PersistentStorage::Result::SUCCESS, writer.commit());
+    
+    // An abandoned rewrite keeps the committed version
+    {
+        PersistentStorage::BlobWriter partial;
+        TEST_ASSERT_EQUAL(PersistentStorage::Result::SUCCESS,
+                          storage->openBlobWriter("stream/table", table.size(), partial));
+        partial.write(table.data(), PersistentStorage::STREAM_CHUNK_SIZE + 1);
+        TEST_ASSERT_EQUAL(PersistentStorage::Result::ERROR_VALIDATION_FAILED, partial.commit());
+    }
+    
+    PersistentStorage::BlobReader reader;
+    TEST_ASSERT_EQUAL(PersistentStorage::Result::SUCCESS, storage->openBlobReader("stream/table", reader));
+    TEST_ASSERT_EQUAL(table.size(), reader.size());
+    std::vector<uint8_t> copy(table.size());
+    size_t position = 0;
+    size_t got = 0;
+    do {
+        TEST_ASSERT_EQUAL(PersistentStorage::Result::SUCCESS, reader.read(copy.data() + position, 64, &got));
+        position += got;
+    } while (got > 0);
+    TEST_ASSERT_TRUE(copy == table);
+    
+    uint8_t byte = 0;
+    TEST_ASSERT_EQUAL(PersistentStorage::Result::SUCCESS, reader.seek(2000));
+    TEST_ASSERT_EQUAL(PersistentStorage::Result::SUCCESS, reader.read(&byte, 1));
+    TEST_ASSERT_EQUAL(table[2000], byte);
+    
+    TEST_ASSERT_EQUAL(PersistentStorage::Result::SUCCESS, storage->removeBlobStream("stream/table"));
+    TEST_ASSERT_EQUAL(PersistentStorage::Result::ERROR_NOT_FOUND, storage->openBlobReader("stream/table", reader));
+}
+
+// Compressed strings and blobs load back, also once compression is off
+void test_compressed_values() {
+    storage->eraseNamespace();
+    const char* config = "{\"zones\":[{\"name\":\"living\",\"mode\":\"auto\"},"
+                         "{\"name\":\"kitchen\",\"mode\":\"auto\"},"
+                         "{\"name\":\"bedroom\",\"mode\":\"auto\"},"
+                         "{\"name\":\"office\",\"mode\":\"auto\"}]}";
+    for (int boot = 0; boot < 3; boot++) {
+        char text[256] = "";
+        uint8_t sparse[512];
+        memset(sparse, 0xFF, sizeof(sparse));
+        PersistentStorage instance(TEST_NAMESPACE, TEST_MQTT_PREFIX);
+        instance.registerString("zip/config", text, sizeof(text));
+        instance.registerBlob("zip/sparse", sparse, sizeof(sparse));
+        if (boot < 2) {
+            TEST_ASSERT_EQUAL(PersistentStorage::Result::SUCCESS,
+                              instance.setCompression("zip/config", ParameterInfo::COMPRESS_LZ));
+            TEST_ASSERT_EQUAL(PersistentStorage::Result::SUCCESS,
+                              instance.setCompression("zip/sparse", ParameterInfo::COMPRESS_LZ));
+        }
+        TEST_ASSERT_TRUE(instance.begin());
+        
+        if (boot == 0) {
+            strcpy(text, config);
+            memset(sparse, 0, sizeof(sparse));
+            sparse[100] = 42;
+            TEST_ASSERT_EQUAL(PersistentStorage::Result::SUCCESS, instance.saveAll());
+        } else {
+            // Boot 2 reads the compressed values with compression off
+            TEST_ASSERT_EQUAL_STRING(config, text);
+            TEST_ASSERT_EQUAL(0, sparse[0]);
+            TEST_ASSERT_EQUAL(42, sparse[100]);
+        }
+    }
+    
+    int32_t number = 0;
+    storage->registerInt("zip/number", &number, 0, 10);
+    TEST_ASSERT_EQUAL(PersistentStorage::Result::ERROR_TYPE_MISMATCH,
+                      storage->setCompression("zip/number", ParameterInfo::COMPRESS_LZ));
+    storage->eraseNamespace();
+}
+
+// Concurrent registration while other tasks read the registry
+static constexpr int STRESS_WRITERS = 2;
+static constexpr int STRESS_READERS = 3;
+static constexpr int STRESS_PARAMS = 40;
+static int32_t stressValues[STRESS_WRITERS][STRESS_PARAMS];
+static volatile bool stressWritersDone = false;
+static volatile int stressReaderErrors = 0;
+static SemaphoreHandle_t stressDone = nullptr;
+
+static void stressWriterTask(void* arg) {
+    int writer = (int)(intptr_t)arg;
+    for (int i = 0; i < STRESS_PARAMS; i++) {
+        char name[32];
+        snprintf(name, sizeof(name), "stress/w%d/p%02d", writer, i);
+        storage->registerInt(name, &stressValues[writer][i], 0, 1000);
+        storage->setOnChange(name, testCallback);
+        taskYIELD();
+    }
+    xSemaphoreGive(stressDone);
+    vTaskDelete(nullptr);
+}
+
+static void stressReaderTask(void*) {
+    JsonDocument doc;
+    while (!stressWritersDone) {
+        for (const auto& name : storage->listParameters()) {
+            if (storage->getJson(name, doc) != PersistentStorage::Result::SUCCESS) {
+                stressReaderErrors++;
+            }
+        }
+        storage->getAllJson(doc, "stress/", "", 10);
+        taskYIELD();
+    }
+    xSemaphoreGive(stressDone);
+    vTaskDelete(nullptr);
+}
+
+void test_concurrent_registry() {
+    stressWritersDone = false;
+    stressReaderErrors = 0;
+    stressDone = xSemaphoreCreateCounting(STRESS_WRITERS + STRESS_READERS, 0);
+    
+    for (int r = 0; r < STRESS_READERS; r++) {
+        xTaskCreate(stressReaderTask, "stress_r", 4096, nullptr, 1, nullptr);
+    }
+    for (int w = 0; w < STRESS_WRITERS; w++) {
+        xTaskCreate(stressWriterTask, "stress_w", 4096, (void*)(intptr_t)w, 1, nullptr);
+    }
+    
+    for (int w = 0; w < STRESS_WRITERS; w++) {
+        TEST_ASSERT_TRUE(xSemaphoreTake(stressDone, pdMS_TO_TICKS(10000)));
+    }
+    stressWritersDone = true;
+    for (int r = 0; r < STRESS_READERS; r++) {
+        TEST_ASSERT_TRUE(xSemaphoreTake(stressDone, pdMS_TO_TICKS(10000)));
+    }
+    vSemaphoreDelete(stressDone);
+    
+    TEST_ASSERT_EQUAL(0, stressReaderErrors);
+    TEST_ASSERT_EQUAL(STRESS_WRITERS * STRESS_PARAMS, storage->listByPrefix("stress/").size());
+}
+
+static PersistentStorage::Result reentryResult;
+
+void test_callback_registry_reentry() {
+    static int32_t late = 0;
+    reentryResult = PersistentStorage::Result::SUCCESS;
+    storage->registerInt("test/reentry", &testInt, -100, 100);
+    storage->setOnChange("test/reentry", [](const std::string&, const void*) {
+        // Would wait for the caller's own read lock
+        reentryResult = storage->registerInt("test/late", &late, 0, 10);
+    });
+    
+    int32_t value = 7;
+    TEST_ASSERT_EQUAL(PersistentStorage::Result::SUCCESS,
+                      storage->write("test/reentry", &value, sizeof(value)));
+    TEST_ASSERT_EQUAL(PersistentStorage::Result::ERROR_REENTRANT, reentryResult);
+    TEST_ASSERT_NULL(storage->getInfo("test/late"));
+    
+    // Outside the callback the registry accepts changes again
+    TEST_ASSERT_EQUAL(PersistentStorage::Result::SUCCESS, storage->registerInt("test/late", &late, 0, 10));
+}
+
 // Test runner
 void runPersistentStorageTests() {
     UNITY_BEGIN();
@@ -402,8 +1419,32 @@ void runPersistentStorageTests() {
     RUN_TEST(test_save_load);
     RUN_TEST(test_json_operations);
     RUN_TEST(test_list_parameters);
+    RUN_TEST(test_list_pagination);
     RUN_TEST(test_hierarchical_names);
     RUN_TEST(test_invalid_operations);
+    RUN_TEST(test_runtime_stats);
+    RUN_TEST(test_value_access);
+    RUN_TEST(test_inline_delegates);
+    RUN_TEST(test_change_subscriptions);
+    RUN_TEST(test_memory_footprint);
+    RUN_TEST(test_compile_time_schema);
+    RUN_TEST(test_bulk_registration);
+    RUN_TEST(test_load_strategies);
+    RUN_TEST(test_gc_orphans);
+    RUN_TEST(test_schema_migrations);
+    RUN_TEST(test_migration_interrupted_retype);
+    RUN_TEST(test_type_mismatch_on_load);
+    RUN_TEST(test_snapshot_power_loss);
+    RUN_TEST(test_snapshot_late_registration);
+    RUN_TEST(test_counter_batched_flush);
+    RUN_TEST(test_array_element_updates);
+    RUN_TEST(test_struct_field_access);
+    RUN_TEST(test_wide_and_enum_types);
+    RUN_TEST(test_blob_base64_transfer);
+    RUN_TEST(test_blob_stream);
+    RUN_TEST(test_compressed_values);
+    RUN_TEST(test_concurrent_registry);
+    RUN_TEST(test_callback_registry_reentry);
     
     UNITY_END();
 }
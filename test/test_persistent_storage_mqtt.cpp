@@ -324,6 +324,119 @@ void test_mqtt_grouped_publish() {
     TEST_ASSERT_GREATER_THAN(0, groupCount);
 }
 
+void test_mqtt_stats_topic() {
+    std::string lastTopic, lastPayload;
+    storage->setMqttPublishCallback([&](const char* topic, const char* payload, int, bool) -> bool {
+        lastTopic = topic;
+        lastPayload = payload;
+        return true;
+    });
+    
+    // Identical argument-less commands are coalesced while one is pending
+    storage->handleMqttCommand(formatTopic("save"), "");
+    storage->handleMqttCommand(formatTopic("save"), "");
+    storage->handleMqttCommand(formatTopic("stats"), "");
+    storage->processCommandQueue();
+    
+    TEST_ASSERT_EQUAL_STRING(formatTopic("status/stats").c_str(), lastTopic.c_str());
+    
+    JsonDocument doc;
+    TEST_ASSERT_FALSE(deserializeJson(doc, lastPayload));
+    TEST_ASSERT_TRUE(doc["ops"]["save"]["count"].as<uint32_t>() > 0);
+    TEST_ASSERT_EQUAL(1, doc["queue"]["coalesced"].as<uint32_t>());
+    TEST_ASSERT_EQUAL(0, doc["jsonTruncations"].as<uint32_t>());
+}
+
+void test_mqtt_multipart_list() {
+    // 120 names do not fit one small packet
+    static int32_t values[120];
+    for (int i = 0; i < 120; i++) {
+        char name[32];
+        snprintf(name, sizeof(name), "bulk/param%03d", i);
+        storage->registerInt(name, &values[i], 0, 100);
+    }
+    
+    std::vector<std::pair<std::string, std::string>> messages;
+    storage->setMqttPublishCallback([&](const char* topic, const char* payload, int, bool) -> bool {
+        messages.push_back({topic, payload});
+        return true;
+    });
+    storage->setMaxPacketSize(256);
+    
+    storage->handleMqttCommand(formatTopic("list"), "");
+    storage->processCommandQueue();
+    
+    // Concatenated parts must form the complete, valid document
+    std::string reassembled;
+    std::string partPrefix = formatTopic("list/response/part/");
+    for (const auto& msg : messages) {
+        if (msg.first.find(partPrefix) == 0) {
+            reassembled += msg.second;
+        }
+    }
+    TEST_ASSERT_TRUE(messages.size() > 1);
+    
+    JsonDocument doc;
+    TEST_ASSERT_FALSE(deserializeJson(doc, reassembled));
+    TEST_ASSERT_EQUAL(124, doc.size());  // 120 bulk + 4 from setUp
+    
+    StorageStats stats = storage->getStats();
+    TEST_ASSERT_EQUAL(0, stats.jsonTruncations);
+}
+
+void test_mqtt_budgeted_processing() {
+    size_t published = 0;
+    storage->setMqttPublishCallback([&](const char*, const char*, int, bool) -> bool {
+        published++;
+        return true;
+    });
+    
+    storage->publishAll();
+    storage->handleMqttCommand(formatTopic("set/mqtt/int"), "12");
+    storage->handleMqttCommand(formatTopic("set/mqtt/bool"), "true");
+    
+    // Generous budget: everything drains without sleeping
+    unsigned long start = millis();
+    size_t remaining = storage->processCommandQueue(50000);
+    
+    TEST_ASSERT_EQUAL(0, remaining);
+    TEST_ASSERT_FALSE(storage->isPublishing());
+    TEST_ASSERT_TRUE(millis() - start < 50);
+    TEST_ASSERT_EQUAL(12, testInt);
+    TEST_ASSERT_TRUE(testBool);
+    // Summary + 4 parameters + 2 change notifications
+    TEST_ASSERT_EQUAL(7, published);
+}
+
+void test_mqtt_service_task() {
+    StorageTaskConfig config;
+    config.flushDelayMs = 100;
+    TEST_ASSERT_TRUE(storage->startServiceTask(config));
+    TEST_ASSERT_TRUE(storage->isServiceTaskRunning());
+    
+    // Commands are applied without polling processCommandQueue()
+    storage->handleMqttCommand(formatTopic("set/mqtt/int"), "33");
+    delay(50);
+    TEST_ASSERT_EQUAL(33, testInt);
+    
+    // Deferred save is written once after the flush delay
+    TEST_ASSERT_EQUAL(PersistentStorage::Result::SUCCESS, storage->reset("mqtt/float"));
+    testFloat = 9.5f;
+    TEST_ASSERT_EQUAL(PersistentStorage::Result::SUCCESS, storage->saveDeferred("mqtt/float"));
+    TEST_ASSERT_EQUAL(PersistentStorage::Result::SUCCESS, storage->saveDeferred("mqtt/float"));
+    TEST_ASSERT_EQUAL(PersistentStorage::Result::ERROR_NOT_FOUND, storage->saveDeferred("missing"));
+    delay(300);
+    TEST_ASSERT_EQUAL(0, storage->flushDeferred());
+    
+    // The service task wrote it: reloading brings the value back
+    testFloat = 0.0f;
+    TEST_ASSERT_EQUAL(PersistentStorage::Result::SUCCESS, storage->load("mqtt/float"));
+    TEST_ASSERT_EQUAL_FLOAT(9.5f, testFloat);
+    
+    storage->stopServiceTask();
+    TEST_ASSERT_FALSE(storage->isServiceTaskRunning());
+}
+
 // Test runner for MQTT tests
 void runPersistentStorageMqttTests() {
     UNITY_BEGIN();
@@ -338,6 +451,10 @@ void runPersistentStorageMqttTests() {
     RUN_TEST(test_mqtt_callback_publish);
     RUN_TEST(test_mqtt_invalid_commands);
     RUN_TEST(test_mqtt_grouped_publish);
+    RUN_TEST(test_mqtt_stats_topic);
+    RUN_TEST(test_mqtt_multipart_list);
+    RUN_TEST(test_mqtt_budgeted_processing);
+    RUN_TEST(test_mqtt_service_task);
     
     UNITY_END();
 }
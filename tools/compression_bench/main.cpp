@@ -0,0 +1,181 @@
+/**
+ * @file main.cpp
+ * @brief Compression ratio, CPU time and NVS entries of ParameterInfo::COMPRESS_LZ
+ *
+ * Runs the library's LzCodec on representative string and blob payloads
+ * and reports what setCompression() would store: the stored size (plain
+ * when compressing saves no NVS entry), the entries of the plain and the
+ * stored item, and the time to compress and decompress.
+ *
+ *   compression_bench [--iterations N]
+ */
+
+#include "../../include/PersistentStorageCompression.h"
+#include <chrono>
+#include <string>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+namespace {
+
+// As in PersistentStorage.cpp: magic, codec, length and CRC-32
+const size_t COMPRESSED_HEADER_SIZE = 9;
+const size_t ENTRY_SIZE = 32;
+
+struct Payload {
+    std::string name;
+    bool isString;
+    std::vector<uint8_t> data;
+};
+
+size_t dataEntries(size_t bytes) {
+    return (bytes + ENTRY_SIZE - 1) / ENTRY_SIZE;
+}
+
+// NVS format v2 within one page: a string is a header entry plus its data
+// with terminator, a blob an index entry, a chunk header and the data
+size_t itemEntries(size_t bytes, bool isString) {
+    return (isString ? 1 : 2) + dataEntries(bytes);
+}
+
+Payload text(const std::string& name, const std::string& value) {
+    return {name, true, std::vector<uint8_t>(value.begin(), value.end())};
+}
+
+std::vector<Payload> payloads() {
+    std::vector<Payload> result;
+
+    result.push_back(text("string: device description",
+        "Heating controller for the ground floor: three radiator zones with "
+        "thermostatic valves, one underfloor zone in the bathroom, outdoor "
+        "temperature sensor on the north wall, boiler on the OpenTherm bus."));
+
+    std::string config = "{\"zones\":[";
+    const char* zones[] = {"living", "kitchen", "bedroom", "bath", "office", "hall"};
+    for (int i = 0; i < 6; i++) {
+        char zone[160];
+        snprintf(zone, sizeof(zone),
+                 "%s{\"name\":\"%s\",\"target\":%.1f,\"eco\":17.0,\"mode\":\"auto\",\"valve\":%d}",
+                 i ? "," : "", zones[i], 19.0 + i * 0.5, 10 + i);
+        config += zone;
+    }
+    config += "],\"boiler\":{\"maxFlow\":65,\"minFlow\":25,\"hysteresis\":2}}";
+    result.push_back(text("string: JSON config", config));
+
+    result.push_back(text("string: short name", "Living room"));
+
+    // 48 half-hour setpoints per day, comfort and eco blocks
+    Payload schedule = {"blob: weekly schedule", false, {}};
+    for (int day = 0; day < 7; day++) {
+        for (int slot = 0; slot < 48; slot++) {
+            bool comfort = (slot >= 12 && slot < 16) || (slot >= 34 && slot < 44) ||
+                           (day >= 5 && slot >= 16 && slot < 34);
+            schedule.data.push_back(comfort ? 42 : 34);
+        }
+    }
+    result.push_back(schedule);
+
+    // Mostly zero, a few calibrated points
+    Payload calibration = {"blob: sparse calibration", false, std::vector<uint8_t>(1024, 0)};
+    for (size_t i = 0; i < calibration.data.size(); i += 97) {
+        calibration.data[i] = (uint8_t)(i * 13);
+        calibration.data[i + 1] = (uint8_t)(i >> 3);
+    }
+    result.push_back(calibration);
+
+    // Heating curve: int16 flow temperature per 0.5 degree outdoor temperature
+    Payload curve = {"blob: lookup table", false, {}};
+    for (int i = 0; i < 512; i++) {
+        int16_t flow = (int16_t)(2000 + (512 - i) * 7 / 2);
+        curve.data.push_back((uint8_t)(flow & 0xFF));
+        curve.data.push_back((uint8_t)(flow >> 8));
+    }
+    result.push_back(curve);
+
+    // Incompressible: kept plain
+    Payload random = {"blob: random key material", false, std::vector<uint8_t>(256)};
+    uint32_t seed = 12345;
+    for (uint8_t& byte : random.data) {
+        seed = seed * 1103515245 + 12345;
+        byte = (uint8_t)(seed >> 16);
+    }
+    result.push_back(random);
+
+    return result;
+}
+
+template<typename F>
+double averageUs(int iterations, F fn) {
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; i++) {
+        fn();
+    }
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    return std::chrono::duration<double, std::micro>(elapsed).count() / iterations;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    int iterations = 2000;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--iterations") == 0 && i + 1 < argc) {
+            iterations = atoi(argv[++i]);
+        } else {
+            fprintf(stderr, "usage: %s [--iterations N]\n", argv[0]);
+            return 2;
+        }
+    }
+    if (iterations < 1) {
+        iterations = 1;
+    }
+
+    printf("%-28s %6s %6s %6s %8s %8s %8s %8s\n",
+           "payload", "raw", "stored", "ratio", "entries", "stored", "comp us", "dec us");
+
+    size_t totalRaw = 0;
+    size_t totalStored = 0;
+    for (const Payload& payload : payloads()) {
+        size_t rawBytes = payload.data.size() + (payload.isString ? 1 : 0);
+        std::vector<uint8_t> packed(rawBytes + LzCodec::MAX_MATCH);
+        size_t packedSize = 0;
+        double compressUs = averageUs(iterations, [&]() {
+            packedSize = LzCodec::compress(payload.data.data(), payload.data.size(),
+                                           packed.data(), packed.size());
+        });
+
+        std::vector<uint8_t> restored(payload.data.size());
+        bool ok = false;
+        double decompressUs = averageUs(iterations, [&]() {
+            ok = LzCodec::decompress(packed.data(), packedSize, restored.data(), restored.size());
+        });
+        if (packedSize > 0 && (!ok || restored != payload.data)) {
+            fprintf(stderr, "%s: round trip failed\n", payload.name.c_str());
+            return 1;
+        }
+
+        // Same rule as saveCompressed(): compressed only if the item takes fewer entries
+        size_t plainEntries = itemEntries(rawBytes, payload.isString);
+        size_t compressedBytes = COMPRESSED_HEADER_SIZE + packedSize;
+        bool compressed = packedSize > 0 && itemEntries(compressedBytes, false) < plainEntries;
+        size_t storedBytes = compressed ? compressedBytes : rawBytes;
+        size_t storedEntries = compressed ? itemEntries(compressedBytes, false) : plainEntries;
+
+        printf("%-28s %6zu %6zu %6.2f %8zu %8zu %8.2f ",
+               payload.name.c_str(), rawBytes, storedBytes, (double)rawBytes / storedBytes,
+               plainEntries, storedEntries, compressUs);
+        if (compressed) {
+            printf("%8.2f\n", decompressUs);
+        } else {
+            printf("%8s  (plain)\n", "-");
+        }
+        totalRaw += rawBytes;
+        totalStored += storedBytes;
+    }
+
+    printf("\ntotal %zu -> %zu bytes (%.2fx), host times averaged over %d runs\n",
+           totalRaw, totalStored, (double)totalRaw / totalStored, iterations);
+    return 0;
+}
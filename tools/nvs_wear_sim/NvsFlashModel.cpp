@@ -0,0 +1,197 @@
+#include "NvsFlashModel.h"
+#include <algorithm>
+
+namespace {
+const size_t NO_PAGE = (size_t)-1;
+}
+
+NvsFlashModel::NvsFlashModel(size_t pageCount)
+    : pages_(std::max<size_t>(pageCount, 2))
+    , pending_(nullptr)
+    , active_(NO_PAGE)
+    , collecting_(false) {
+    for (size_t i = 0; i < pages_.size(); i++) {
+        freePages_.push_back(i);
+    }
+}
+
+size_t NvsFlashModel::dataEntries(size_t length) {
+    return (length + ENTRY_SIZE - 1) / ENTRY_SIZE;
+}
+
+bool NvsFlashModel::write(const std::string& key, ItemKind kind, size_t length, uint64_t content) {
+    auto it = items_.find(key);
+    if (it != items_.end() && it->second.kind == kind && it->second.length == length &&
+        it->second.content == content) {
+        counters_.skippedWrites++;
+        return true;
+    }
+
+    // The new item is written before the old one is marked erased
+    Item item = {kind, length, content, {}};
+    pending_ = &item;
+    bool placed = place(item);
+    pending_ = nullptr;
+    if (!placed) {
+        release(item);
+        counters_.failedWrites++;
+        return false;
+    }
+
+    counters_.payloadBytes += length;
+    if (it != items_.end()) {
+        release(it->second);
+        it->second = item;
+    } else {
+        items_[key] = item;
+    }
+    return true;
+}
+
+void NvsFlashModel::erase(const std::string& key) {
+    auto it = items_.find(key);
+    if (it != items_.end()) {
+        release(it->second);
+        items_.erase(it);
+    }
+}
+
+const std::vector<uint32_t>& NvsFlashModel::eraseCounts() const {
+    eraseCounts_.resize(pages_.size());
+    for (size_t i = 0; i < pages_.size(); i++) {
+        eraseCounts_[i] = pages_[i].eraseCount;
+    }
+    return eraseCounts_;
+}
+
+bool NvsFlashModel::place(Item& item) {
+    Span span;
+    switch (item.kind) {
+        case SCALAR:
+            if (!allocate(1, 1, span)) {
+                return false;
+            }
+            item.spans.push_back(span);
+            return true;
+
+        case STRING: {
+            size_t entries = 1 + dataEntries(std::min(item.length, MAX_STRING_SIZE));
+            if (!allocate(entries, entries, span)) {
+                return false;
+            }
+            item.spans.push_back(span);
+            return true;
+        }
+
+        case BLOB: {
+            // Chunks fill the rest of each page, then the index entry follows
+            size_t remaining = item.length;
+            do {
+                if (!allocate(1 + dataEntries(remaining), 2, span)) {
+                    return false;
+                }
+                item.spans.push_back(span);
+                remaining -= std::min(remaining, (span.entries - 1) * ENTRY_SIZE);
+            } while (remaining > 0);
+
+            if (!allocate(1, 1, span)) {
+                return false;
+            }
+            item.spans.push_back(span);
+            return true;
+        }
+    }
+    return false;
+}
+
+// Take up to entries (at least minEntries) from the active page, opening a
+// new page or collecting garbage when it is full
+bool NvsFlashModel::allocate(size_t entries, size_t minEntries, Span& span) {
+    for (;;) {
+        if (active_ != NO_PAGE) {
+            size_t available = ENTRIES_PER_PAGE - pages_[active_].used;
+            if (available >= minEntries) {
+                span.page = active_;
+                span.entries = std::min(entries, available);
+                program(active_, span.entries);
+                return true;
+            }
+            pages_[active_].state = PAGE_FULL;
+            active_ = NO_PAGE;
+        }
+
+        // The last free page is only used to collect garbage into
+        if (freePages_.size() > 1 || (collecting_ && !freePages_.empty())) {
+            active_ = freePages_.front();
+            freePages_.pop_front();
+            pages_[active_].state = PAGE_ACTIVE;
+            counters_.bytesWritten += PAGE_HEADER_SIZE;
+            continue;
+        }
+
+        if (collecting_ || !collectGarbage()) {
+            return false;
+        }
+    }
+}
+
+// Move the live entries of the full page with the most erased entries
+// into the reserve page and erase it
+bool NvsFlashModel::collectGarbage() {
+    size_t victim = NO_PAGE;
+    for (size_t i = 0; i < pages_.size(); i++) {
+        if (pages_[i].state == PAGE_FULL && pages_[i].erased > 0 &&
+            (victim == NO_PAGE || pages_[i].erased > pages_[victim].erased)) {
+            victim = i;
+        }
+    }
+    if (victim == NO_PAGE) {
+        return false;
+    }
+
+    counters_.gcRuns++;
+    collecting_ = true;
+    for (auto& entry : items_) {
+        relocate(entry.second, victim);
+    }
+    if (pending_) {
+        relocate(*pending_, victim);
+    }
+    collecting_ = false;
+
+    Page& page = pages_[victim];
+    page.state = PAGE_EMPTY;
+    page.used = 0;
+    page.erased = 0;
+    page.eraseCount++;
+    counters_.pageErases++;
+    freePages_.push_back(victim);
+    return true;
+}
+
+void NvsFlashModel::relocate(Item& item, size_t victim) {
+    for (Span& span : item.spans) {
+        if (span.page != victim) {
+            continue;
+        }
+        Span moved;
+        if (allocate(span.entries, span.entries, moved)) {
+            counters_.entriesMoved += span.entries;
+            span = moved;
+        }
+    }
+}
+
+// Mark an item's entries erased in the state bitmap
+void NvsFlashModel::release(const Item& item) {
+    for (const Span& span : item.spans) {
+        pages_[span.page].erased += span.entries;
+        counters_.bytesWritten += span.entries * BITMAP_WRITE_SIZE;
+    }
+}
+
+void NvsFlashModel::program(size_t page, size_t entries) {
+    pages_[page].used += entries;
+    counters_.entriesWritten += entries;
+    counters_.bytesWritten += entries * (ENTRY_SIZE + BITMAP_WRITE_SIZE);
+}
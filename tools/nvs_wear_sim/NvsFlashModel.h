@@ -0,0 +1,118 @@
+#ifndef NVS_FLASH_MODEL_H
+#define NVS_FLASH_MODEL_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <deque>
+#include <map>
+#include <string>
+#include <vector>
+
+/**
+ * @brief Host-side model of the ESP-IDF NVS page layout
+ *
+ * Counts what a sequence of NVS writes costs in flash: 4 KB pages holding
+ * a 32-byte header, an entry state bitmap and 126 entries of 32 bytes.
+ * Items are appended to the active page; an update writes the new item and
+ * then marks the old entries erased. When only the reserve page is left,
+ * garbage collection moves the live entries of the page with the most
+ * erased entries and erases it. Values identical to the stored one are
+ * skipped, as nvs_set_*() does.
+ *
+ * Item sizes follow NVS format v2: scalars take one entry, strings one
+ * header entry plus their data in one page, blobs an index entry plus data
+ * chunks that span as many pages as needed.
+ */
+class NvsFlashModel {
+public:
+    static constexpr size_t PAGE_SIZE = 4096;
+    static constexpr size_t ENTRY_SIZE = 32;
+    static constexpr size_t ENTRIES_PER_PAGE = 126;
+    static constexpr size_t PAGE_HEADER_SIZE = 32;
+    static constexpr size_t BITMAP_WRITE_SIZE = 4;      // One flash word per entry state change
+    static constexpr size_t MAX_STRING_SIZE = 4000;
+
+    enum ItemKind : uint8_t {
+        SCALAR,     // u8..u64, one entry
+        STRING,     // Header entry + data, within one page
+        BLOB        // Index entry + data chunks across pages
+    };
+
+    struct Counters {
+        uint64_t bytesWritten = 0;      // Physical bytes programmed, including bitmap and headers
+        uint64_t payloadBytes = 0;      // Value bytes the caller asked to store
+        uint64_t entriesWritten = 0;
+        uint64_t pageErases = 0;
+        uint64_t gcRuns = 0;
+        uint64_t entriesMoved = 0;      // Copied by garbage collection
+        uint64_t skippedWrites = 0;     // Value unchanged, nothing written
+        uint64_t failedWrites = 0;      // Partition full
+    };
+
+    /**
+     * @param pageCount Pages in the partition (the default 0x6000 partition has 6)
+     */
+    explicit NvsFlashModel(size_t pageCount);
+
+    /**
+     * @brief Store length bytes under key; content identifies the value
+     * @return false if the partition is full
+     */
+    bool write(const std::string& key, ItemKind kind, size_t length, uint64_t content);
+
+    /**
+     * @brief Erase a stored item
+     */
+    void erase(const std::string& key);
+
+    const Counters& counters() const { return counters_; }
+    const std::vector<uint32_t>& eraseCounts() const;
+    size_t pageCount() const { return pages_.size(); }
+
+private:
+    enum PageState : uint8_t {
+        PAGE_EMPTY,
+        PAGE_ACTIVE,
+        PAGE_FULL
+    };
+
+    struct Page {
+        PageState state = PAGE_EMPTY;
+        size_t used = 0;                // Entries written since the last erase
+        size_t erased = 0;              // Of those, entries marked erased
+        uint32_t eraseCount = 0;
+    };
+
+    // Entries of one item in one page
+    struct Span {
+        size_t page;
+        size_t entries;
+    };
+
+    struct Item {
+        ItemKind kind;
+        size_t length;
+        uint64_t content;
+        std::vector<Span> spans;
+    };
+
+    static size_t dataEntries(size_t length);
+
+    bool place(Item& item);
+    bool allocate(size_t entries, size_t minEntries, Span& span);
+    bool collectGarbage();
+    void relocate(Item& item, size_t victim);
+    void release(const Item& item);
+    void program(size_t page, size_t entries);
+
+    std::vector<Page> pages_;
+    std::deque<size_t> freePages_;      // Erased pages, oldest first; the last one is the GC reserve
+    std::map<std::string, Item> items_;
+    Item* pending_;                     // Item being written, moved by GC like stored ones
+    size_t active_;
+    bool collecting_;
+    Counters counters_;
+    mutable std::vector<uint32_t> eraseCounts_;
+};
+
+#endif // NVS_FLASH_MODEL_H
@@ -0,0 +1,427 @@
+/**
+ * @file main.cpp
+ * @brief Replays a parameter trace against the NVS flash model
+ *
+ * For every persistence strategy the trace is replayed on a fresh model,
+ * reporting bytes written, write amplification, garbage collection and
+ * page erases per PersistentStorage operation, and the flash lifetime this
+ * workload projects to.
+ *
+ *   nvs_wear_sim [--pages N] [--repeat N] [--flush-ms N] [--endurance N] trace
+ */
+
+#include "NvsFlashModel.h"
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+namespace {
+
+const double MS_PER_YEAR = 365.0 * 24 * 3600 * 1000;
+
+enum ParamType { TYPE_BOOL, TYPE_INT, TYPE_FLOAT, TYPE_STRING, TYPE_BLOB };
+
+struct Param {
+    std::string name;
+    std::string key;
+    ParamType type;
+    size_t size;            // Blob size, string buffer size
+};
+
+struct Event {
+    enum Op { SET, SAVE_ALL };
+    uint64_t timeMs;
+    Op op;
+    size_t param;
+    std::string value;
+};
+
+struct Trace {
+    std::vector<Param> params;
+    std::vector<Event> events;
+    uint64_t periodMs = 0;
+};
+
+struct Options {
+    size_t pages = 6;                   // Default 0x6000 nvs partition
+    size_t repeat = 1;
+    uint32_t flushDelayMs = 2000;       // StorageTaskConfig::flushDelayMs default
+    uint32_t endurance = 100000;        // Erase cycles per sector
+};
+
+// Same mapping as PersistentStorage::sanitizeNvsKey()
+std::string nvsKey(const std::string& name) {
+    if (name.size() <= 15) {
+        return name;
+    }
+    uint32_t hash = 0;
+    for (char c : name) {
+        hash = hash * 31 + (uint32_t)c;
+    }
+    return "p" + std::to_string(hash);
+}
+
+uint64_t fnv1a(const std::string& data, uint64_t hash = 1469598103934665603ULL) {
+    for (char c : data) {
+        hash = (hash ^ (uint8_t)c) * 1099511628211ULL;
+    }
+    return hash;
+}
+
+bool parseType(const std::string& text, ParamType& type) {
+    static const char* const names[] = {"bool", "int", "float", "string", "blob"};
+    for (int i = 0; i < 5; i++) {
+        if (text == names[i]) {
+            type = (ParamType)i;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Trace lines:
+//   param <name> <bool|int|float|string|blob> [size]
+//   period <ms>                     Time the trace covers (default: last event)
+//   <ms> set <name> <value>
+//   <ms> save_all
+bool loadTrace(const char* path, Trace& trace) {
+    std::ifstream in(path);
+    if (!in) {
+        fprintf(stderr, "Cannot open %s\n", path);
+        return false;
+    }
+
+    std::string line;
+    for (int lineNo = 1; std::getline(in, line); lineNo++) {
+        std::istringstream fields(line);
+        std::string first;
+        if (!(fields >> first) || first[0] == '#') {
+            continue;
+        }
+
+        if (first == "param") {
+            Param param;
+            std::string type;
+            param.size = 0;
+            fields >> param.name >> type >> param.size;
+            if (param.name.empty() || !parseType(type, param.type)) {
+                fprintf(stderr, "%s:%d: bad parameter\n", path, lineNo);
+                return false;
+            }
+            param.key = nvsKey(param.name);
+            trace.params.push_back(param);
+        } else if (first == "period") {
+            fields >> trace.periodMs;
+        } else {
+            Event event;
+            std::string op;
+            event.timeMs = strtoull(first.c_str(), nullptr, 10);
+            fields >> op;
+            if (op == "save_all") {
+                event.op = Event::SAVE_ALL;
+                event.param = 0;
+            } else if (op == "set") {
+                std::string name;
+                fields >> name;
+                std::getline(fields >> std::ws, event.value);
+                auto it = std::find_if(trace.params.begin(), trace.params.end(),
+                                       [&](const Param& p) { return p.name == name; });
+                if (it == trace.params.end()) {
+                    fprintf(stderr, "%s:%d: unknown parameter %s\n", path, lineNo, name.c_str());
+                    return false;
+                }
+                event.op = Event::SET;
+                event.param = it - trace.params.begin();
+            } else {
+                fprintf(stderr, "%s:%d: unknown operation %s\n", path, lineNo, op.c_str());
+                return false;
+            }
+            trace.events.push_back(event);
+        }
+    }
+
+    if (trace.events.empty()) {
+        fprintf(stderr, "%s: no events\n", path);
+        return false;
+    }
+    trace.periodMs = std::max(trace.periodMs, trace.events.back().timeMs + 1);
+    return true;
+}
+
+/**
+ * @brief Replays a trace with one persistence strategy
+ *
+ * snapshot mirrors SaveMode::SNAPSHOT (whole image into alternating slots,
+ * then the slot index); flushDelayMs > 0 mirrors saveDeferred() with the
+ * service task flushing after the delay.
+ */
+class Replay {
+public:
+    enum Op { OP_SET, OP_SAVE_ALL, OP_FLUSH, OP_COUNT };
+
+    struct OpStats {
+        uint64_t count = 0;
+        uint64_t bytesWritten = 0;
+        uint64_t pageErases = 0;
+    };
+
+    Replay(const Trace& trace, const Options& options, bool snapshot, uint32_t flushDelayMs)
+        : trace_(trace)
+        , model_(options.pages)
+        , snapshot_(snapshot)
+        , flushDelayMs_(flushDelayMs)
+        , values_(trace.params.size())
+        , dirty_(trace.params.size(), false)
+        , flushDeadline_(0)
+        , pending_(false)
+        , sequence_(0)
+        , appBytes_(0) {
+        for (size_t i = 0; i < trace.params.size(); i++) {
+            values_[i] = "default";
+        }
+    }
+
+    void run(size_t repeat) {
+        for (size_t r = 0; r < repeat; r++) {
+            uint64_t base = r * trace_.periodMs;
+            for (const Event& event : trace_.events) {
+                uint64_t now = base + event.timeMs;
+                if (pending_ && now >= flushDeadline_) {
+                    flush(OP_FLUSH);
+                }
+                if (event.op == Event::SAVE_ALL) {
+                    saveAll();
+                } else {
+                    set(event.param, event.value, now);
+                }
+            }
+        }
+        if (pending_) {
+            flush(OP_FLUSH);
+        }
+    }
+
+    const NvsFlashModel& model() const { return model_; }
+    const OpStats& stats(Op op) const { return stats_[op]; }
+    uint64_t appBytes() const { return appBytes_; }
+
+private:
+    void set(size_t index, const std::string& value, uint64_t now) {
+        if (values_[index] == value) {
+            return;
+        }
+        values_[index] = value;
+        appBytes_ += valueLength(index);
+
+        if (flushDelayMs_ == 0) {
+            Measure measure(*this, OP_SET);
+            persist(index);
+            return;
+        }
+        if (!pending_) {
+            flushDeadline_ = now + flushDelayMs_;
+            pending_ = true;
+        }
+        dirty_[index] = true;
+    }
+
+    void saveAll() {
+        Measure measure(*this, OP_SAVE_ALL);
+        if (snapshot_) {
+            writeSnapshot();
+        } else {
+            for (size_t i = 0; i < trace_.params.size(); i++) {
+                writeParam(i);
+            }
+        }
+        std::fill(dirty_.begin(), dirty_.end(), false);
+        pending_ = false;
+    }
+
+    void flush(Op op) {
+        Measure measure(*this, op);
+        if (snapshot_) {
+            writeSnapshot();
+        } else {
+            for (size_t i = 0; i < dirty_.size(); i++) {
+                if (dirty_[i]) {
+                    writeParam(i);
+                }
+            }
+        }
+        std::fill(dirty_.begin(), dirty_.end(), false);
+        pending_ = false;
+    }
+
+    void persist(size_t index) {
+        if (snapshot_) {
+            writeSnapshot();
+        } else {
+            writeParam(index);
+        }
+    }
+
+    // Bytes Preferences stores for the current value
+    size_t valueLength(size_t index) const {
+        const Param& param = trace_.params[index];
+        switch (param.type) {
+            case TYPE_BOOL:   return 1;
+            case TYPE_STRING: return std::min(values_[index].size(), param.size ? param.size - 1 : SIZE_MAX) + 1;
+            case TYPE_BLOB:   return param.size;
+            default:          return 4;
+        }
+    }
+
+    void writeParam(size_t index) {
+        const Param& param = trace_.params[index];
+        NvsFlashModel::ItemKind kind = NvsFlashModel::SCALAR;
+        if (param.type == TYPE_STRING) {
+            kind = NvsFlashModel::STRING;
+        } else if (param.type == TYPE_FLOAT || param.type == TYPE_BLOB) {
+            kind = NvsFlashModel::BLOB;     // Preferences stores floats as 4-byte blobs
+        }
+        model_.write(param.key, kind, valueLength(index), fnv1a(values_[index]));
+    }
+
+    // Same layout as PersistentStorage::saveSnapshot(): header, entries, CRC
+    void writeSnapshot() {
+        size_t length = 12 + 4;
+        uint64_t content = ++sequence_;     // The sequence number changes every image
+        for (size_t i = 0; i < trace_.params.size(); i++) {
+            length += trace_.params[i].key.size() + 1 + 3 + valueLength(i) - (trace_.params[i].type == TYPE_STRING);
+            content = fnv1a(values_[i], content);
+        }
+        uint8_t slot = sequence_ & 1;
+        model_.write(slot ? ".snapB" : ".snapA", NvsFlashModel::BLOB, length, content);
+        model_.write(".snap", NvsFlashModel::SCALAR, 1, slot);
+    }
+
+    // Attributes model counter changes to an operation
+    struct Measure {
+        Measure(Replay& replay, Op op)
+            : replay_(replay)
+            , op_(op)
+            , bytes_(replay.model_.counters().bytesWritten)
+            , erases_(replay.model_.counters().pageErases) {}
+
+        ~Measure() {
+            OpStats& stats = replay_.stats_[op_];
+            stats.count++;
+            stats.bytesWritten += replay_.model_.counters().bytesWritten - bytes_;
+            stats.pageErases += replay_.model_.counters().pageErases - erases_;
+        }
+
+        Replay& replay_;
+        Op op_;
+        uint64_t bytes_;
+        uint64_t erases_;
+    };
+
+    const Trace& trace_;
+    NvsFlashModel model_;
+    bool snapshot_;
+    uint32_t flushDelayMs_;
+    std::vector<std::string> values_;
+    std::vector<bool> dirty_;
+    uint64_t flushDeadline_;
+    bool pending_;
+    uint64_t sequence_;
+    uint64_t appBytes_;
+    OpStats stats_[OP_COUNT];
+};
+
+void report(const char* name, const Replay& replay, const Trace& trace, const Options& options) {
+    const NvsFlashModel::Counters& c = replay.model().counters();
+    const std::vector<uint32_t>& erases = replay.model().eraseCounts();
+    uint32_t hottest = *std::max_element(erases.begin(), erases.end());
+    double simulatedMs = (double)trace.periodMs * options.repeat;
+    double amplification = replay.appBytes() ? (double)c.bytesWritten / replay.appBytes() : 0.0;
+
+    printf("%-18s %12llu %10.1f %8llu %8llu %9u ", name,
+           (unsigned long long)c.bytesWritten, amplification,
+           (unsigned long long)c.gcRuns, (unsigned long long)c.pageErases, hottest);
+    if (hottest == 0) {
+        printf("%12s\n", "no erases");
+    } else {
+        double erasesPerYear = hottest * MS_PER_YEAR / simulatedMs;
+        printf("%12.1f\n", options.endurance / erasesPerYear);
+    }
+    if (c.failedWrites) {
+        printf("%-18s %llu writes failed: partition full\n", "",
+               (unsigned long long)c.failedWrites);
+    }
+
+    static const char* const opNames[] = {"set", "save_all", "flush"};
+    for (int op = 0; op < Replay::OP_COUNT; op++) {
+        const Replay::OpStats& stats = replay.stats((Replay::Op)op);
+        if (stats.count) {
+            printf("  %-16s %8llu ops %10.1f bytes/op %8llu erases\n", opNames[op],
+                   (unsigned long long)stats.count, (double)stats.bytesWritten / stats.count,
+                   (unsigned long long)stats.pageErases);
+        }
+    }
+}
+
+void usage() {
+    fprintf(stderr, "usage: nvs_wear_sim [--pages N] [--repeat N] [--flush-ms N] [--endurance N] trace\n");
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    Options options;
+    const char* path = nullptr;
+    for (int i = 1; i < argc; i++) {
+        bool hasValue = (i + 1 < argc);
+        if (hasValue && strcmp(argv[i], "--pages") == 0) {
+            options.pages = strtoul(argv[++i], nullptr, 10);
+        } else if (hasValue && strcmp(argv[i], "--repeat") == 0) {
+            options.repeat = std::max(1UL, strtoul(argv[++i], nullptr, 10));
+        } else if (hasValue && strcmp(argv[i], "--flush-ms") == 0) {
+            options.flushDelayMs = strtoul(argv[++i], nullptr, 10);
+        } else if (hasValue && strcmp(argv[i], "--endurance") == 0) {
+            options.endurance = strtoul(argv[++i], nullptr, 10);
+        } else if (argv[i][0] != '-' && !path) {
+            path = argv[i];
+        } else {
+            usage();
+            return 2;
+        }
+    }
+    if (!path) {
+        usage();
+        return 2;
+    }
+
+    Trace trace;
+    if (!loadTrace(path, trace)) {
+        return 1;
+    }
+
+    printf("%zu parameters, %zu events over %.1f h, replayed %zu times on %zu pages\n\n",
+           trace.params.size(), trace.events.size(), trace.periodMs / 3600000.0,
+           options.repeat, options.pages);
+    printf("%-18s %12s %10s %8s %8s %9s %12s\n", "strategy", "bytes", "WA", "GC runs",
+           "erases", "max/page", "life (years)");
+
+    struct Strategy {
+        const char* name;
+        bool snapshot;
+        bool deferred;
+    };
+    static const Strategy strategies[] = {
+        {"per-key", false, false},          // Library default: every set is saved at once
+        {"per-key deferred", false, true},
+        {"snapshot", true, false},
+        {"snapshot deferred", true, true},
+    };
+    for (const Strategy& strategy : strategies) {
+        Replay replay(trace, options, strategy.snapshot, strategy.deferred ? options.flushDelayMs : 0);
+        replay.run(options.repeat);
+        report(strategy.name, replay, trace, options);
+    }
+    return 0;
+}